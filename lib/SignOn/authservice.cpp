@@ -58,6 +58,11 @@ void AuthService::queryIdentities(const IdentityFilter &filter)
     impl->queryIdentities(filter);
 }
 
+void AuthService::queryIdentities(const IdentityFilter &filter, int pageSize)
+{
+    impl->queryIdentities(filter, pageSize);
+}
+
 void AuthService::clear()
 {
     impl->clear();
@@ -79,13 +79,18 @@ public:
         AuthMethod = 0,
         Username,
         Realm,
-        Caption
+        Caption,
+        Type
     } IdentityFilterCriteria;
 
     /*!
      * @class IdentityRegExp
      * The class represents a regular expression.
-     * It is used for filtering identity querying.
+     * It is used for filtering identity querying: the expression must match
+     * the whole value of the filtered field (for realms and methods, any one
+     * of them). Plain literals and patterns of the form "literal.*" are
+     * evaluated by the service as exact and prefix matches respectively,
+     * which are much cheaper than generic expressions.
      * @see queryIdentities()
      * @note This is for internal use only.
      */
@@ -106,7 +111,8 @@ public:
 
         /*!
          * Returns the validity of regular expression.
-         * @return Always false, validity check not implemented.
+         * @return Whether the pattern is a valid Perl-compatible regular
+         * expression.
          */
         bool isValid() const;
 
@@ -176,12 +182,35 @@ public:
      *
      * @see AuthService::identities()
      * @see AuthService::error()
-     * @param filter Shows only identities specified in filter - filtering not implemented for the moment.
+     * @param filter Shows only identities matching all the criteria of
+     * filter; invalid expressions are ignored.
      * If default parameter is passed, all the identities are returned.
      * @credential keychain-access key-chain application can access list of identities.
      */
     void queryIdentities(const IdentityFilter &filter = IdentityFilter());
 
+    /*!
+     * Requests information on identities which are stored, delivering them
+     * a page at a time with signal identitiesPage(), rather than all at once
+     * with signal identities(). Each page is requested from the service
+     * once the previous one has been received, so that large lists don't
+     * need to be held in memory all at once.
+     * Error is reported by emitting signal error(); no more pages are
+     * delivered after an error.
+     * If filter is not valid, or pageSize is not positive, Error::type() is
+     * Error::InvalidQuery.
+     * If the application does not have keychain-access credential,
+     * Error::type() is Error::PermissionDenied.
+     *
+     * @see AuthService::identitiesPage()
+     * @see AuthService::error()
+     * @param filter Shows only identities matching all the criteria of
+     * filter; invalid expressions are ignored.
+     * @param pageSize The maximum number of identities in each page.
+     * @credential keychain-access key-chain application can access list of identities.
+     */
+    void queryIdentities(const IdentityFilter &filter, int pageSize);
+
     /*!
      * Clears credentials database. All identity entries are removed from database.
      * Signal cleared() is emitted when operation is completed.
@@ -234,6 +263,18 @@ Q_SIGNALS:
      */
     void identities(const QList<SignOn::IdentityInfo> &identityList);
 
+    /*!
+     * Delivers a page of the identities matching the query parameters.
+     * This signal is emitted in response to queryIdentities() with a page
+     * size; a page can hold fewer identities than the page size, or even
+     * none, without being the last one.
+     *
+     * @param identityList list of identities information
+     * @param isLast true if this is the last page of the query
+     */
+    void identitiesPage(const QList<SignOn::IdentityInfo> &identityList,
+                        bool isLast);
+
     /*!
      * Database is cleared and reset to initial state.
      * This signal is emitted in response to clear().
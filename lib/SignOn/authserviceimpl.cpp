@@ -25,6 +25,7 @@
 #include <QDBusMetaType>
 #include <QDBusPendingCallWatcher>
 #include <QDBusPendingReply>
+#include <QRegularExpression>
 #include <QTimer>
 
 #include "signond/signoncommon.h"
@@ -52,7 +53,7 @@ AuthService::IdentityRegExp::IdentityRegExp(const IdentityRegExp &src):
 
 bool AuthService::IdentityRegExp::isValid() const
 {
-    return false;
+    return QRegularExpression(m_pattern).isValid();
 }
 
 QString AuthService::IdentityRegExp::pattern() const
@@ -94,12 +95,8 @@ void AuthServiceImpl::queryMechanisms(const QString &method)
     m_methodsForWhichMechsWereQueried.enqueue(method);
 }
 
-void AuthServiceImpl::queryIdentities(const AuthService::IdentityFilter &filter)
+static QVariantMap filterMap(const AuthService::IdentityFilter &filter)
 {
-    if (!filter.isEmpty())
-        TRACE() << "Querying identities with filter not implemented.";
-
-    QVariantList args;
     QMap<QString, QVariant> filterMap;
     if (!filter.empty()) {
         QMapIterator<AuthService::IdentityFilterCriteria,
@@ -108,30 +105,81 @@ void AuthServiceImpl::queryIdentities(const AuthService::IdentityFilter &filter)
         while (it.hasNext()) {
             it.next();
 
-            if (!it.value().isValid())
+            if (!it.value().isValid()) {
+                TRACE() << "Skipping invalid filter pattern:" <<
+                    it.value().pattern();
                 continue;
+            }
 
-            const char *criteriaStr = 0;
+            QString criteria;
             switch ((AuthService::IdentityFilterCriteria)it.key()) {
-            case AuthService::AuthMethod: criteriaStr = "AuthMethod"; break;
-            case AuthService::Username: criteriaStr = "Username"; break;
-            case AuthService::Realm: criteriaStr = "Realm"; break;
-            case AuthService::Caption: criteriaStr = "Caption"; break;
-            default: break;
+            case AuthService::AuthMethod:
+                criteria = SIGNOND_IDENTITY_FILTER_AUTHMETHOD; break;
+            case AuthService::Username:
+                criteria = SIGNOND_IDENTITY_FILTER_USERNAME; break;
+            case AuthService::Realm:
+                criteria = SIGNOND_IDENTITY_FILTER_REALM; break;
+            case AuthService::Caption:
+                criteria = SIGNOND_IDENTITY_FILTER_CAPTION; break;
+            case AuthService::Type:
+                criteria = SIGNOND_IDENTITY_FILTER_TYPE; break;
+            default: continue;
             }
-            filterMap.insert(QLatin1String(criteriaStr),
-                             QVariant(it.value().pattern()));
+            filterMap.insert(criteria, QVariant(it.value().pattern()));
         }
 
     }
+    return filterMap;
+}
+
+static QList<IdentityInfo> identityList(const QVariant &reply)
+{
+    QDBusArgument arg = reply.value<QDBusArgument>();
+    MapList identitiesData = qdbus_cast<MapList>(arg);
+
+    QList<IdentityInfo> infoList;
+    foreach (const QVariantMap &map, identitiesData) {
+        IdentityInfo info;
+        info.impl->updateFromMap(map);
+        infoList.append(info);
+    }
+    return infoList;
+}
 
-    args << filterMap;
+void AuthServiceImpl::queryIdentities(const AuthService::IdentityFilter &filter)
+{
+    QVariantList args;
+    args << filterMap(filter);
 
     sendRequest(QLatin1String("queryIdentities"),
                 SLOT(queryIdentitiesReply(QDBusPendingCallWatcher*)),
                 args);
 }
 
+void AuthServiceImpl::queryIdentities(const AuthService::IdentityFilter &filter,
+                                      int pageSize)
+{
+    queryIdentitiesPage(filterMap(filter), pageSize, QString());
+}
+
+void AuthServiceImpl::queryIdentitiesPage(const QVariantMap &filter,
+                                          int pageSize,
+                                          const QString &cursor)
+{
+    /* A negative size is sent as an invalid one, to get the error from
+     * the service like for any invalid query */
+    QVariantList args;
+    args << filter << uint(qMax(pageSize, 0)) << cursor;
+
+    PendingCall *call =
+        m_dbusProxy.queueCall(QLatin1String("queryIdentitiesPage"), args,
+            SLOT(queryIdentitiesPageReply(QDBusPendingCallWatcher*)),
+            SLOT(queryIdentitiesPageError(const QDBusError&)));
+    IdentityQuery &query = m_identityQueries[call];
+    query.filter = filter;
+    query.pageSize = pageSize;
+}
+
 void AuthServiceImpl::clear()
 {
     sendRequest(QLatin1String("clear"),
@@ -187,17 +235,33 @@ void AuthServiceImpl::queryIdentitiesReply(QDBusPendingCallWatcher *call)
         return;
     }
 
-    QDBusArgument arg = args[0].value<QDBusArgument>();
-    MapList identitiesData = qdbus_cast<MapList>(arg);
+    emit m_parent->identities(identityList(args[0]));
+}
 
-    QList<IdentityInfo> infoList;
-    foreach (const QVariantMap &map, identitiesData) {
-        IdentityInfo info;
-        info.impl->updateFromMap(map);
-        infoList.append(info);
+void AuthServiceImpl::queryIdentitiesPageReply(QDBusPendingCallWatcher *call)
+{
+    IdentityQuery query = m_identityQueries.take(sender());
+
+    QDBusMessage msg = call->reply();
+    QList<QVariant> args = msg.arguments();
+    if (args.count() < 2) {
+        BLAME() << "Invalid reply: missing arguments";
+        return;
     }
 
-    emit m_parent->identities(infoList);
+    /* The next page is requested before this one is delivered, so that the
+     * service can prepare it while the client handles this one. */
+    QString cursor = args[1].toString();
+    if (!cursor.isEmpty())
+        queryIdentitiesPage(query.filter, query.pageSize, cursor);
+
+    emit m_parent->identitiesPage(identityList(args[0]), cursor.isEmpty());
+}
+
+void AuthServiceImpl::queryIdentitiesPageError(const QDBusError &err)
+{
+    m_identityQueries.remove(sender());
+    errorReply(err);
 }
 
 void AuthServiceImpl::clearReply()
@@ -24,6 +24,7 @@
 #define AUTHSERVICEIMPL_H
 
 #include <QObject>
+#include <QHash>
 #include <QList>
 #include <QMap>
 #include <QString>
@@ -60,6 +61,8 @@ public:
     void queryMethods();
     void queryMechanisms(const QString &method);
     void queryIdentities(const AuthService::IdentityFilter &filter);
+    void queryIdentities(const AuthService::IdentityFilter &filter,
+                         int pageSize);
     void clear();
 
 public Q_SLOTS:
@@ -67,6 +70,8 @@ public Q_SLOTS:
     void queryMechanismsReply(QDBusPendingCallWatcher *call);
     void queryMechanismsError(const QDBusError &err);
     void queryIdentitiesReply(QDBusPendingCallWatcher *call);
+    void queryIdentitiesPageReply(QDBusPendingCallWatcher *call);
+    void queryIdentitiesPageError(const QDBusError &err);
     void queryMethodsReply(QDBusPendingCallWatcher *call);
     void clearReply();
 
@@ -74,11 +79,20 @@ private:
     void sendRequest(const QString &operation,
                      const char *replySlot,
                      const QList<QVariant> &args = QList<QVariant>());
+    void queryIdentitiesPage(const QVariantMap &filter, int pageSize,
+                             const QString &cursor);
 
 private:
+    struct IdentityQuery {
+        QVariantMap filter;
+        int pageSize;
+    };
+
     AuthService *m_parent;
     SignondAsyncDBusProxy m_dbusProxy;
     QQueue<QString> m_methodsForWhichMechsWereQueried;
+    /* The paged queries, by pending page request */
+    QHash<QObject *, IdentityQuery> m_identityQueries;
 };
 
 } // namespace SignOn
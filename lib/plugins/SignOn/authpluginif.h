@@ -60,6 +60,22 @@ enum AuthPluginState {
     PLUGIN_STATE_DONE                    /**< Process is finished. Process can be terminated. */
 };
 
+/*!
+ * Property which holds the id of the request a SessionData belongs to.
+ * @see AuthPluginInterface
+ */
+#define SSO_PLUGIN_REQUEST_ID QLatin1String("PluginRequestId")
+
+/*!
+ * Property which a plugin can set in the data emitted with result(), to
+ * tell for how many seconds the result stays valid. Until then, the
+ * requests with the same parameters for the same identity are answered by
+ * the daemon with the same result, without involving the plugin; the
+ * cached results are dropped when the identity changes, is signed out or
+ * the plugin stores new data. The property is not passed to the client.
+ */
+#define SSO_PLUGIN_RESULT_EXPIRES_IN QLatin1String("PluginResultExpiresIn")
+
 /*!
  * Macro to create declarations of
  * SSO authentication plugin.
@@ -79,6 +95,19 @@ enum AuthPluginState {
 /*!
  * @class AuthPluginInterface.
  * Interface definition for authentication plugins
+ *
+ * By default, a plugin is given one request at a time. Plugins which can
+ * work on several requests at once (for instance, because they spend most
+ * of the time waiting on the network) can declare so by setting the
+ * "reentrant" property to true. Such plugins find the id of the request in
+ * the SSO_PLUGIN_REQUEST_ID property of the data passed to process(),
+ * userActionFinished() and refresh(); they must set it in the data emitted
+ * with the result(), store(), userActionRequired() and refreshed() signals,
+ * and report errors and status changes with requestError() and
+ * requestStatusChanged(). Their cancel() method is never called: to stop
+ * working on a canceled request, they can provide a cancelRequest(quint32)
+ * slot; otherwise, the request is reported as canceled right away and its
+ * results are discarded.
  */
 class AuthPluginInterface : public QObject
 {
@@ -202,6 +231,25 @@ Q_SIGNALS:
     void statusChanged(const AuthPluginState state,
                        const QString &message = QString());
 
+    /*!
+     * Emitted by reentrant plugins instead of error().
+     *
+     * @param requestId The id of the request which failed
+     * @param err The error object
+     */
+    void requestError(quint32 requestId, const SignOn::Error &err);
+
+    /*!
+     * Emitted by reentrant plugins instead of statusChanged().
+     *
+     * @param requestId The id of the request whose status changed
+     * @param state Plugin process state @see AuthPluginState
+     * @param message Optional message for client application
+     */
+    void requestStatusChanged(quint32 requestId,
+                              const AuthPluginState state,
+                              const QString &message = QString());
+
 public Q_SLOTS:
     /*!
      * User interaction completed.
@@ -28,6 +28,12 @@
 #ifndef SIGNON_PLUGINS_COMMON_IPC_H
 #define SIGNON_PLUGINS_COMMON_IPC_H
 
+/*
+ * The operations concerning a request (PLUGIN_OP_PROCESS,
+ * PLUGIN_OP_PROCESS_UI, PLUGIN_OP_REFRESH and PLUGIN_OP_CANCEL) are followed
+ * by the quint32 id of the request, and so is every response; this lets
+ * reentrant plugins work on several requests at once.
+ */
 enum PluginOperation {
     PLUGIN_OP_TYPE = 1,
     PLUGIN_OP_MECHANISMS,
@@ -36,6 +42,8 @@ enum PluginOperation {
     PLUGIN_OP_REFRESH,
     PLUGIN_OP_CANCEL,
     PLUGIN_OP_STOP,
+    PLUGIN_OP_RESET,
+    PLUGIN_OP_REENTRANT,
     PLUGIN_OP_LAST
 };
 
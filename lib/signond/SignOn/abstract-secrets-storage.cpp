@@ -85,6 +85,28 @@ bool AbstractSecretsStorage::checkPassword(const quint32 id,
     return storedUsername == username && storedPassword == password;
 }
 
+bool AbstractSecretsStorage::beginBatch()
+{
+    SecretsStorageBatchInterface *batch =
+        qobject_cast<SecretsStorageBatchInterface *>(this);
+    return batch != 0 ? batch->beginTransaction() : true;
+}
+
+bool AbstractSecretsStorage::commitBatch()
+{
+    SecretsStorageBatchInterface *batch =
+        qobject_cast<SecretsStorageBatchInterface *>(this);
+    return batch != 0 ? batch->commitTransaction() : true;
+}
+
+void AbstractSecretsStorage::rollbackBatch()
+{
+    SecretsStorageBatchInterface *batch =
+        qobject_cast<SecretsStorageBatchInterface *>(this);
+    if (batch != 0)
+        batch->rollbackTransaction();
+}
+
 CredentialsDBError AbstractSecretsStorage::lastError() const
 {
     return d_ptr->m_lastError;
@@ -28,6 +28,7 @@
 #include <SignOn/export.h>
 
 #include <QObject>
+#include <QStringList>
 #include <QVariantMap>
 
 namespace SignOn {
@@ -169,6 +170,29 @@ public:
      */
     virtual bool removeData(quint32 id, quint32 method) = 0;
 
+    /*!
+     * Starts a batch of writes: if the implementation supports it (see
+     * SecretsStorageBatchInterface), the changes made until commitBatch()
+     * is called are written in a single transaction. Otherwise, each
+     * operation is committed on its own, as usual.
+     * Batches can be nested; only the outermost one is committed to disk.
+     * @returns false if the batch could not be started.
+     */
+    bool beginBatch();
+
+    /*!
+     * Commits the changes made since beginBatch(). If the commit fails, the
+     * changes are discarded.
+     * @returns true if successful, false otherwise.
+     */
+    bool commitBatch();
+
+    /*!
+     * Discards the changes made since beginBatch(). This has no effect if the
+     * implementation doesn't support batches.
+     */
+    void rollbackBatch();
+
     /*!
      * Get the last error.
      */
@@ -188,6 +212,95 @@ private:
     Q_DECLARE_PRIVATE(AbstractSecretsStorage)
 };
 
+/*!
+ * @class SecretsStorageBatchInterface
+ * @headerfile SignOn/abstract-secrets-storage.h SignOn/AbstractSecretsStorage
+ * @brief Optional interface for secrets storages able to group several
+ * writes in one transaction.
+ *
+ * An AbstractSecretsStorage subclass implementing this interface must also
+ * list it with the Q_INTERFACES() macro, so that
+ * AbstractSecretsStorage::beginBatch() and friends can find it.
+ */
+class SIGNON_EXPORT SecretsStorageBatchInterface
+{
+public:
+    virtual ~SecretsStorageBatchInterface() {}
+
+    /*!
+     * Starts a transaction, or a nested one if a transaction is already
+     * open.
+     * @returns true if successful, false otherwise.
+     */
+    virtual bool beginTransaction() = 0;
+
+    /*!
+     * Commits the innermost open transaction.
+     * @returns true if successful, false otherwise.
+     */
+    virtual bool commitTransaction() = 0;
+
+    /*!
+     * Discards the changes made in the innermost open transaction.
+     */
+    virtual void rollbackTransaction() = 0;
+};
+
+/*!
+ * @class SecretsStorageMaintenanceInterface
+ * @headerfile SignOn/abstract-secrets-storage.h SignOn/AbstractSecretsStorage
+ * @brief Optional interface for secrets storages whose space and write-ahead
+ * log are managed by signond.
+ *
+ * Like SecretsStorageBatchInterface, it must be listed with the
+ * Q_INTERFACES() macro. Storages not implementing it are expected to manage
+ * their files by themselves.
+ */
+class SIGNON_EXPORT SecretsStorageMaintenanceInterface
+{
+public:
+    virtual ~SecretsStorageMaintenanceInterface() {}
+
+    /*!
+     * Like AbstractSecretsStorage::loadData(), but the values of the given
+     * keys are neither decoded nor returned.
+     * @param id the identity whose data are being loaded.
+     * @param method the authentication method the data is used for.
+     * @param skippedKeys the keys to leave out.
+     * @returns a dictionary with the data.
+     */
+    virtual QVariantMap loadPartialData(quint32 id, quint32 method,
+                                        const QStringList &skippedKeys) = 0;
+
+    /*!
+     * Writes the changes logged so far into the storage file.
+     * @returns true if successful, false otherwise.
+     */
+    virtual bool checkpoint() = 0;
+
+    /*!
+     * Releases up to @a maxPages free pages to the filesystem.
+     * @returns the number of free pages left, or -1 on error.
+     */
+    virtual qint64 incrementalVacuum(int maxPages) = 0;
+
+    /*!
+     * @returns the size of the storage file in bytes, or -1 on error.
+     */
+    virtual qint64 fileSize() = 0;
+
+    /*!
+     * @returns the unused space in the storage file in bytes, or -1 on
+     * error.
+     */
+    virtual qint64 freeSize() = 0;
+};
+
 } // namespace
 
+Q_DECLARE_INTERFACE(SignOn::SecretsStorageBatchInterface,
+                    "com.nokia.SingleSignOn.SecretsStorageBatchInterface/1.0")
+Q_DECLARE_INTERFACE(SignOn::SecretsStorageMaintenanceInterface,
+                    "com.nokia.SingleSignOn.SecretsStorageMaintenanceInterface/1.0")
+
 #endif // SIGNON_ABSTRACT_SECRETS_STORAGE_H
@@ -88,6 +88,15 @@
 #define SIGNOND_IDENTITY_INFO_USERNAME_IS_SECRET \
     SIGNOND_STRING("UserNameSecret")
 
+/*
+ * Identity query filter criteria
+ * */
+#define SIGNOND_IDENTITY_FILTER_AUTHMETHOD SIGNOND_STRING("AuthMethod")
+#define SIGNOND_IDENTITY_FILTER_USERNAME SIGNOND_STRING("Username")
+#define SIGNOND_IDENTITY_FILTER_REALM SIGNOND_STRING("Realm")
+#define SIGNOND_IDENTITY_FILTER_CAPTION SIGNOND_STRING("Caption")
+#define SIGNOND_IDENTITY_FILTER_TYPE SIGNOND_STRING("Type")
+
 /*
  * Common server/client sides error names and messages
  * */
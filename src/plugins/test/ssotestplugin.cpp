@@ -33,6 +33,17 @@ using namespace SignOn;
 
 namespace SsoTestPluginNS {
 
+/* The number of requests this process has computed a result for */
+static int processedCount = 0;
+
+static void addProperty(SignOn::SessionData &data,
+                        const QString &key, const QVariant &value)
+{
+    QVariantMap map;
+    map.insert(key, value);
+    data += SignOn::SessionData(map);
+}
+
 SsoTestPlugin::SsoTestPlugin(QObject *parent):
     AuthPluginInterface(parent)
 {
@@ -47,6 +58,18 @@ SsoTestPlugin::SsoTestPlugin(QObject *parent):
     qRegisterMetaType<SignOn::SessionData>("SignOn::SessionData");
 
     QObject::connect(&m_timer, SIGNAL(timeout()), this, SLOT(execProcess()));
+
+    /* Lets the tests simulate a plugin which is slow to load */
+    int startDelay = qgetenv("SSOTEST_START_DELAY").toInt();
+    if (startDelay > 0)
+        usleep(startDelay * 1000);
+
+    /* Lets the tests run several requests at once */
+    m_reentrant = qgetenv("SSOTEST_REENTRANT").toInt() > 0;
+    setProperty("reentrant", m_reentrant);
+
+    m_timer.setInterval(100);
+    m_timer.setSingleShot(false);
 }
 
 SsoTestPlugin::~SsoTestPlugin()
@@ -56,9 +79,36 @@ SsoTestPlugin::~SsoTestPlugin()
 void SsoTestPlugin::cancel()
 {
     TRACE() << "Operation is canceled";
+    m_timer.stop();
+    m_requests.clear();
     emit error(Error(Error::SessionCanceled,
                      QLatin1String("The operation is canceled")));
-    m_timer.stop();
+}
+
+void SsoTestPlugin::cancelRequest(quint32 requestId)
+{
+    TRACE() << "Request" << requestId << "is canceled";
+    m_requests.remove(requestId);
+    if (m_requests.isEmpty())
+        m_timer.stop();
+    emitError(requestId, Error(Error::SessionCanceled,
+                               QLatin1String("The operation is canceled")));
+}
+
+void SsoTestPlugin::emitError(quint32 requestId, const SignOn::Error &err)
+{
+    if (m_reentrant)
+        emit requestError(requestId, err);
+    else
+        emit error(err);
+}
+
+void SsoTestPlugin::emitStatus(quint32 requestId, const QString &message)
+{
+    if (m_reentrant)
+        emit requestStatusChanged(requestId, PLUGIN_STATE_WAITING, message);
+    else
+        emit statusChanged(PLUGIN_STATE_WAITING, message);
 }
 
 /*
@@ -67,35 +117,54 @@ void SsoTestPlugin::cancel()
 void SsoTestPlugin::process(const SignOn::SessionData &inData,
                             const QString &mechanism)
 {
+    quint32 requestId = inData.getProperty(SSO_PLUGIN_REQUEST_ID).toUInt();
+
     if (!mechanisms().contains(mechanism)) {
         QString message = QLatin1String("The given mechanism is unavailable");
         TRACE() << message;
-        emit error(Error(Error::MechanismNotAvailable, message));
+        emitError(requestId, Error(Error::MechanismNotAvailable, message));
         return;
     }
 
-    m_data = inData;
-    m_mechanism = mechanism;
-    m_statusCounter = 0;
+    Request request;
+    request.data = inData;
+    request.mechanism = mechanism;
+    request.statusCounter = 0;
+    m_requests.insert(requestId, request);
 
-    m_timer.setInterval(100);
-    m_timer.setSingleShot(false);
-    m_timer.start();
+    if (!m_timer.isActive())
+        m_timer.start();
 }
 
 void SsoTestPlugin::execProcess()
 {
-    m_statusCounter++;
-    emit statusChanged(PLUGIN_STATE_WAITING,
-                       QLatin1String("hello from the test plugin"));
-    if (m_statusCounter < 10) return;
+    QMap<quint32, Request> finished;
+    QMutableMapIterator<quint32, Request> it(m_requests);
+    while (it.hasNext()) {
+        it.next();
+        emitStatus(it.key(), QLatin1String("hello from the test plugin"));
+        if (++it.value().statusCounter < 10) continue;
+
+        finished.insert(it.key(), it.value());
+        it.remove();
+    }
 
-    m_timer.stop();
+    if (m_requests.isEmpty())
+        m_timer.stop();
 
-    SignOn::SessionData outData(m_data);
+    QMapIterator<quint32, Request> done(finished);
+    while (done.hasNext()) {
+        done.next();
+        finishRequest(done.key(), done.value());
+    }
+}
+
+void SsoTestPlugin::finishRequest(quint32 requestId, const Request &request)
+{
+    SignOn::SessionData outData(request.data);
     outData.setRealm("testRealm_after_test");
 
-    if (m_mechanism == QLatin1String("BLOB")) {
+    if (request.mechanism == QLatin1String("BLOB")) {
         emit result(outData);
         return;
     }
@@ -103,14 +172,25 @@ void SsoTestPlugin::execProcess()
     foreach(QString key, outData.propertyNames())
         TRACE() << key << ": " << outData.getProperty(key);
 
-    if (m_mechanism == QLatin1String("mech1")) {
+    if (request.mechanism == QLatin1String("mech1")) {
+        /* Lets the tests have the result cached by the daemon */
+        QVariant cacheFor = outData.getProperty(QLatin1String("CacheFor"));
+        if (cacheFor.isValid())
+            addProperty(outData, SSO_PLUGIN_RESULT_EXPIRES_IN, cacheFor);
+        /* Lets the tests tell which requests reached the plugin */
+        processedCount++;
+        if (outData.getProperty(QLatin1String("CountProcessed")).toBool())
+            addProperty(outData, QLatin1String("ProcessedCount"),
+                        processedCount);
         emit result(outData);
         return;
     }
 
-    if (m_mechanism == QLatin1String("mech2")) {
+    if (request.mechanism == QLatin1String("mech2")) {
         SignOn::UiSessionData data;
         data.setQueryPassword(true);
+        if (m_reentrant)
+            addProperty(data, SSO_PLUGIN_REQUEST_ID, requestId);
         emit userActionRequired(data);
         return;
     }
@@ -121,22 +201,25 @@ void SsoTestPlugin::execProcess()
 void SsoTestPlugin::userActionFinished(const SignOn::UiSessionData &data)
 {
     TRACE();
+    quint32 requestId = data.getProperty(SSO_PLUGIN_REQUEST_ID).toUInt();
 
     if (data.QueryErrorCode() == QUERY_ERROR_NONE) {
         SignOn::SessionData response;
         response.setUserName(data.UserName());
         response.setSecret(data.Secret());
+        if (m_reentrant)
+            addProperty(response, SSO_PLUGIN_REQUEST_ID, requestId);
         emit result(response);
         return;
     }
 
     if (data.QueryErrorCode() == QUERY_ERROR_FORBIDDEN)
-        emit error(Error(Error::NotAuthorized,
-                   QLatin1String("userActionFinished forbidden ")));
+        emitError(requestId, Error(Error::NotAuthorized,
+                  QLatin1String("userActionFinished forbidden ")));
     else
-        emit error(Error(Error::UserInteraction,
-                   QLatin1String("userActionFinished error: ")
-                   + QString::number(data.QueryErrorCode())));
+        emitError(requestId, Error(Error::UserInteraction,
+                  QLatin1String("userActionFinished error: ")
+                  + QString::number(data.QueryErrorCode())));
 
     return;
 }
@@ -47,14 +47,26 @@ public Q_SLOTS:
     void process(const SignOn::SessionData &inData,
                  const QString &mechanism = 0);
     void userActionFinished(const SignOn::UiSessionData &data);
+    void cancelRequest(quint32 requestId);
 
 private:
+    struct Request {
+        SignOn::SessionData data;
+        QString mechanism;
+        int statusCounter;
+    };
+
+    void emitError(quint32 requestId, const SignOn::Error &err);
+    void emitStatus(quint32 requestId, const QString &message);
+    void finishRequest(quint32 requestId, const Request &request);
+
     QString m_type;
     QStringList m_mechanisms;
-    SignOn::SessionData m_data;
-    QString m_mechanism;
+    bool m_reentrant;
+    /* The requests being processed, by request ID (always 0 unless the
+     * plugin runs in reentrant mode) */
+    QMap<quint32, Request> m_requests;
     QTimer m_timer;
-    int m_statusCounter;
 
 private Q_SLOTS:
     void execProcess();
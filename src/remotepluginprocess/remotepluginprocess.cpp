@@ -45,7 +45,9 @@ namespace RemotePluginProcessNS {
 
 RemotePluginProcess::RemotePluginProcess(QObject *parent):
     QObject(parent),
-    m_currentOperation(PLUGIN_OP_STOP)
+    m_currentOperation(PLUGIN_OP_STOP),
+    m_currentRequestId(0),
+    m_reentrant(false)
 {
     m_plugin = NULL;
     m_readnotifier = NULL;
@@ -132,12 +134,39 @@ bool RemotePluginProcess::loadPlugin(QString &type)
             SIGNAL(statusChanged(const AuthPluginState, const QString&)),
             this, SLOT(statusChanged(const AuthPluginState, const QString&)));
 
+    connect(m_plugin, SIGNAL(requestError(quint32, const SignOn::Error &)),
+            this, SLOT(requestError(quint32, const SignOn::Error &)));
+
+    connect(m_plugin,
+            SIGNAL(requestStatusChanged(quint32, const AuthPluginState,
+                                        const QString&)),
+            this,
+            SLOT(requestStatusChanged(quint32, const AuthPluginState,
+                                      const QString&)));
+
     m_plugin->setParent(this);
+    m_reentrant = m_plugin->property("reentrant").toBool();
+    TRACE() << "plugin is reentrant:" << m_reentrant;
 
     TRACE() << "plugin is fully initialized";
     return true;
 }
 
+void RemotePluginProcess::reset()
+{
+    TRACE();
+
+    /* The process is going to serve another session. Plugins are singletons
+     * which get all their input with each request, so there is no instance
+     * to replace: just make sure that nothing of the previous session is
+     * still running. */
+    m_plugin->abort();
+    m_currentMechanism.clear();
+    m_currentOperation = PLUGIN_OP_STOP;
+    m_currentRequestId = 0;
+    m_activeRequests.clear();
+}
+
 bool RemotePluginProcess::setupDataStreams()
 {
     TRACE();
@@ -192,6 +221,27 @@ void RemotePluginProcess::blobIOError()
         QLatin1String("Failed to I/O session data to/from the signon daemon.")));
 }
 
+quint32 RemotePluginProcess::currentRequestId() const
+{
+    if (!m_reentrant)
+        return m_currentRequestId;
+
+    /* The plugin didn't tell: that's fine only if there is no ambiguity */
+    if (m_activeRequests.count() != 1) {
+        BLAME() << "Cannot tell which request the plugin is replying to";
+        return 0;
+    }
+    return *m_activeRequests.constBegin();
+}
+
+quint32 RemotePluginProcess::takeRequestId(QVariantMap &map) const
+{
+    QVariant requestId = map.take(SSO_PLUGIN_REQUEST_ID);
+    if (m_reentrant && requestId.isValid())
+        return requestId.toUInt();
+    return currentRequestId();
+}
+
 void RemotePluginProcess::result(const SignOn::SessionData &data)
 {
     QDataStream out(&m_outFile);
@@ -200,7 +250,11 @@ void RemotePluginProcess::result(const SignOn::SessionData &data)
     foreach(QString key, data.propertyNames())
         resultDataMap[key] = data.getProperty(key);
 
+    quint32 requestId = takeRequestId(resultDataMap);
+    m_activeRequests.remove(requestId);
+
     out << (quint32)PLUGIN_RESPONSE_RESULT;
+    out << requestId;
 
     m_blobIOHandler->sendData(resultDataMap);
 
@@ -216,6 +270,7 @@ void RemotePluginProcess::store(const SignOn::SessionData &data)
         storeDataMap[key] = data.getProperty(key);
 
     out << (quint32)PLUGIN_RESPONSE_STORE;
+    out << takeRequestId(storeDataMap);
 
     m_blobIOHandler->sendData(storeDataMap);
 
@@ -223,15 +278,25 @@ void RemotePluginProcess::store(const SignOn::SessionData &data)
 }
 
 void RemotePluginProcess::error(const SignOn::Error &err)
+{
+    requestError(currentRequestId(), err);
+}
+
+void RemotePluginProcess::requestError(quint32 requestId,
+                                       const SignOn::Error &err)
 {
     QDataStream out(&m_outFile);
 
+    m_activeRequests.remove(requestId);
+
     out << (quint32)PLUGIN_RESPONSE_ERROR;
+    out << requestId;
     out << (quint32)err.type();
     out << err.message();
     m_outFile.flush();
 
-    TRACE() << "error is sent" << err.type() << " " << err.message();
+    TRACE() << "error is sent" << requestId << err.type() << " " <<
+        err.message();
 }
 
 void RemotePluginProcess::userActionRequired(const SignOn::UiSessionData &data)
@@ -245,6 +310,7 @@ void RemotePluginProcess::userActionRequired(const SignOn::UiSessionData &data)
         resultDataMap[key] = data.getProperty(key);
 
     out << (quint32)PLUGIN_RESPONSE_UI;
+    out << takeRequestId(resultDataMap);
     m_blobIOHandler->sendData(resultDataMap);
     m_outFile.flush();
 }
@@ -260,6 +326,7 @@ void RemotePluginProcess::refreshed(const SignOn::UiSessionData &data)
         resultDataMap[key] = data.getProperty(key);
 
     out << (quint32)PLUGIN_RESPONSE_REFRESHED;
+    out << takeRequestId(resultDataMap);
 
     m_blobIOHandler->sendData(resultDataMap);
 
@@ -268,11 +335,19 @@ void RemotePluginProcess::refreshed(const SignOn::UiSessionData &data)
 
 void RemotePluginProcess::statusChanged(const AuthPluginState state,
                                         const QString &message)
+{
+    requestStatusChanged(currentRequestId(), state, message);
+}
+
+void RemotePluginProcess::requestStatusChanged(quint32 requestId,
+                                               const AuthPluginState state,
+                                               const QString &message)
 {
     TRACE();
     QDataStream out(&m_outFile);
 
     out << (quint32)PLUGIN_RESPONSE_SIGNAL;
+    out << requestId;
     out << (quint32)state;
     out << message;
 
@@ -307,10 +382,17 @@ void RemotePluginProcess::mechanisms()
     out << mechsVar;
 }
 
+void RemotePluginProcess::reentrant()
+{
+    QDataStream out(&m_outFile);
+    out << m_reentrant;
+}
+
 void RemotePluginProcess::process()
 {
     QDataStream in(&m_inFile);
 
+    in >> m_currentRequestId;
     in >> m_currentMechanism;
 
     int processBlobSize = -1;
@@ -323,6 +405,7 @@ void RemotePluginProcess::process()
 void RemotePluginProcess::userActionFinished()
 {
     QDataStream in(&m_inFile);
+    in >> m_currentRequestId;
     int processBlobSize = -1;
     in >> processBlobSize;
 
@@ -333,6 +416,7 @@ void RemotePluginProcess::userActionFinished()
 void RemotePluginProcess::refresh()
 {
     QDataStream in(&m_inFile);
+    in >> m_currentRequestId;
     int processBlobSize = -1;
     in >> processBlobSize;
 
@@ -340,10 +424,38 @@ void RemotePluginProcess::refresh()
     m_blobIOHandler->receiveData(processBlobSize);
 }
 
-void RemotePluginProcess::sessionDataReceived(const QVariantMap &sessionDataMap)
+void RemotePluginProcess::cancel()
+{
+    QDataStream in(&m_inFile);
+    in >> m_currentRequestId;
+
+    if (!m_reentrant) {
+        m_plugin->cancel();
+        return;
+    }
+
+    if (m_plugin->metaObject()->indexOfMethod("cancelRequest(quint32)") >= 0) {
+        QMetaObject::invokeMethod(m_plugin, "cancelRequest",
+                                  Q_ARG(quint32, m_currentRequestId));
+    } else if (m_activeRequests.contains(m_currentRequestId)) {
+        /* cancel() would stop the other requests too: let this one run to
+         * its end, the daemon drops its late reply */
+        requestError(m_currentRequestId,
+                     Error(Error::SessionCanceled,
+                           QLatin1String("The request was canceled.")));
+    }
+}
+
+void RemotePluginProcess::sessionDataReceived(const QVariantMap &dataMap)
 {
+    /* Reentrant plugins need to know which request the data is for */
+    QVariantMap sessionDataMap = dataMap;
+    if (m_reentrant)
+        sessionDataMap.insert(SSO_PLUGIN_REQUEST_ID, m_currentRequestId);
+
     if (m_currentOperation == PLUGIN_OP_PROCESS) {
         SessionData inData(sessionDataMap);
+        m_activeRequests.insert(m_currentRequestId);
         m_plugin->process(inData, m_currentMechanism);
         m_currentMechanism.clear();
 
@@ -366,11 +478,21 @@ void RemotePluginProcess::sessionDataReceived(const QVariantMap &sessionDataMap)
 
 void RemotePluginProcess::startTask()
 {
-    if (m_blobIOHandler->isReading()) {
-        /* A data blob is being read; there's nothing for us here */
-        return;
-    }
+    /* Several operations might have been read in at once: the notifier
+     * won't tell about those left in the buffer. */
+    do {
+        if (m_blobIOHandler->isReading()) {
+            /* A data blob is being read; there's nothing for us here */
+            return;
+        }
+
+        if (!runTask())
+            return;
+    } while (m_inFile.bytesAvailable() > 0);
+}
 
+bool RemotePluginProcess::runTask()
+{
     quint32 opcode = PLUGIN_OP_STOP;
     bool is_stopped = false;
 
@@ -383,12 +505,12 @@ void RemotePluginProcess::startTask()
             opcode;
         m_plugin->abort();
         Q_EMIT processStopped();
-        return;
+        return false;
     }
 
     switch (opcode) {
     case PLUGIN_OP_CANCEL:
-        m_plugin->cancel();
+        cancel();
         break;
     case PLUGIN_OP_TYPE:
         type();
@@ -408,6 +530,12 @@ void RemotePluginProcess::startTask()
     case PLUGIN_OP_STOP:
         is_stopped = true;
         break;
+    case PLUGIN_OP_RESET:
+        reset();
+        break;
+    case PLUGIN_OP_REENTRANT:
+        reentrant();
+        break;
     default:
         {
             qCritical() << " unknown operation code: " << opcode;
@@ -428,6 +556,7 @@ void RemotePluginProcess::startTask()
         m_plugin->abort();
         emit processStopped();
     }
+    return !is_stopped;
 }
 
 } //namespace RemotePluginProcessNS
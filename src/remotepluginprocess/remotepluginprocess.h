@@ -31,6 +31,7 @@
 #include <QByteArray>
 #include <QVariant>
 #include <QMap>
+#include <QSet>
 #include <QIODevice>
 #include <QFile>
 #include <QDir>
@@ -88,7 +89,7 @@ public:
 
 public Q_SLOTS:
     void startTask();
-    void sessionDataReceived(const QVariantMap &sessionDataMap);
+    void sessionDataReceived(const QVariantMap &dataMap);
 
 private:
     AuthPluginInterface *m_plugin;
@@ -105,15 +106,28 @@ private:
     quint32 m_currentOperation;
     QString m_currentMechanism;
 
+    /* The request the last operation was about: for plugins which are not
+     * reentrant, this is the request being served. */
+    quint32 m_currentRequestId;
+    bool m_reentrant;
+    QSet<quint32> m_activeRequests;
+
 private:
     QString getPluginName(const QString &type);
     void type();
     void mechanism();
     void mechanisms();
+    void reentrant();
 
+    bool runTask();
     void process();
     void userActionFinished();
     void refresh();
+    void cancel();
+    void reset();
+
+    quint32 currentRequestId() const;
+    quint32 takeRequestId(QVariantMap &map) const;
 
 private Q_SLOTS:
     void result(const SignOn::SessionData &data);
@@ -122,6 +136,10 @@ private Q_SLOTS:
     void userActionRequired(const SignOn::UiSessionData &data);
     void refreshed(const SignOn::UiSessionData &data);
     void statusChanged(const AuthPluginState state, const QString &message);
+    void requestError(quint32 requestId, const SignOn::Error &err);
+    void requestStatusChanged(quint32 requestId,
+                              const AuthPluginState state,
+                              const QString &message);
     void blobIOError();
 
 Q_SIGNALS :
@@ -70,12 +70,14 @@ bool AccessControlManagerHelper::isPeerAllowedToUseIdentity(
 {
     // TODO - improve this, the error handling and more precise behaviour
 
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    if (db == 0) {
-        TRACE() << "NULL db pointer, secure storage might be unavailable,";
+    /* The snapshot is read without waiting for the storage thread */
+    QStringList acl;
+    bool ok = CredentialsAccessManager::instance()->aclSnapshot()->
+        lookup(identityId, &acl, 0);
+    if (!ok) {
+        TRACE() << "No ACL snapshot, secure storage might be unavailable";
         return false;
     }
-    QStringList acl = db->accessControlList(identityId);
 
     TRACE() << QString(QLatin1String("Access control list of identity: "
                                  "%1: [%2].Tokens count: %3\t"))
@@ -83,9 +85,6 @@ bool AccessControlManagerHelper::isPeerAllowedToUseIdentity(
                                 .arg(acl.join(QLatin1String(", ")))
                                 .arg(acl.size());
 
-    if (db->errorOccurred())
-        return false;
-
     IdentityOwnership ownership =
         isPeerOwnerOfIdentity(peerConnection, peerMessage, identityId);
     if (ownership == ApplicationIsOwner)
@@ -106,15 +105,13 @@ AccessControlManagerHelper::isPeerOwnerOfIdentity(
                                        const QDBusMessage &peerMessage,
                                        const quint32 identityId)
 {
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    if (db == 0) {
-        TRACE() << "NULL db pointer, secure storage might be unavailable,";
+    QStringList ownerSecContexts;
+    bool ok = CredentialsAccessManager::instance()->aclSnapshot()->
+        lookup(identityId, 0, &ownerSecContexts);
+    if (!ok) {
+        TRACE() << "No ACL snapshot, secure storage might be unavailable";
         return ApplicationIsNotOwner;
     }
-    QStringList ownerSecContexts = db->ownerList(identityId);
-
-    if (db->errorOccurred())
-        return ApplicationIsNotOwner;
 
     if (ownerSecContexts.isEmpty())
         return IdentityDoesNotHaveOwner;
@@ -0,0 +1,91 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+#include "aclsnapshot.h"
+#include "signond-common.h"
+
+namespace SignonDaemonNS {
+
+AclSnapshot::AclSnapshot():
+    m_isValid(false)
+{
+}
+
+AclSnapshot::~AclSnapshot()
+{
+}
+
+void AclSnapshot::reset(const QHash<quint32, QStringList> &acls,
+                        const QHash<quint32, QStringList> &owners)
+{
+    QWriteLocker locker(&m_lock);
+    m_acls = acls;
+    m_owners = owners;
+    m_isValid = true;
+    TRACE() << "ACL snapshot of" << m_acls.count() << "identities";
+}
+
+void AclSnapshot::update(quint32 id, const QStringList &acl,
+                         const QStringList &owners)
+{
+    QWriteLocker locker(&m_lock);
+    if (acl.isEmpty()) {
+        m_acls.remove(id);
+    } else {
+        m_acls.insert(id, acl);
+    }
+    if (owners.isEmpty()) {
+        m_owners.remove(id);
+    } else {
+        m_owners.insert(id, owners);
+    }
+}
+
+void AclSnapshot::remove(quint32 id)
+{
+    QWriteLocker locker(&m_lock);
+    m_acls.remove(id);
+    m_owners.remove(id);
+}
+
+void AclSnapshot::invalidate()
+{
+    QWriteLocker locker(&m_lock);
+    m_acls.clear();
+    m_owners.clear();
+    m_isValid = false;
+}
+
+bool AclSnapshot::lookup(quint32 id, QStringList *acl,
+                         QStringList *owners) const
+{
+    QReadLocker locker(&m_lock);
+    if (!m_isValid) return false;
+
+    if (acl != 0) *acl = m_acls.value(id);
+    if (owners != 0) *owners = m_owners.value(id);
+    return true;
+}
+
+} // namespace SignonDaemonNS
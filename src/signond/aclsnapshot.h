@@ -0,0 +1,91 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+
+/*!
+  @file aclsnapshot.h
+  Definition of the AclSnapshot object.
+  @ingroup Accounts_and_SSO_Framework
+ */
+
+#ifndef SIGNON_ACL_SNAPSHOT_H
+#define SIGNON_ACL_SNAPSHOT_H
+
+#include <QHash>
+#include <QReadWriteLock>
+#include <QStringList>
+
+namespace SignonDaemonNS {
+
+/*!
+ * @class AclSnapshot
+ * A copy of the access control lists and owners of all the stored
+ * identities. It is kept up to date by the CredentialsDB, in the storage
+ * thread, and can be read from any thread: the access control checks made
+ * while dispatching the D-Bus calls don't wait for the storage queue.
+ */
+class AclSnapshot
+{
+public:
+    AclSnapshot();
+    ~AclSnapshot();
+
+    /*!
+     * Replaces the whole contents, and makes the snapshot valid.
+     */
+    void reset(const QHash<quint32, QStringList> &acls,
+               const QHash<quint32, QStringList> &owners);
+
+    /*!
+     * Sets the access control list and owners of an identity.
+     */
+    void update(quint32 id, const QStringList &acl,
+                const QStringList &owners);
+
+    /*!
+     * Drops an identity.
+     */
+    void remove(quint32 id);
+
+    /*!
+     * Empties the snapshot: the lookups fail until reset() is called.
+     */
+    void invalidate();
+
+    /*!
+     * Reads the access control list and owners of an identity; these are
+     * empty for the identities which are not stored.
+     * @returns false if the database is not available.
+     */
+    bool lookup(quint32 id, QStringList *acl, QStringList *owners) const;
+
+private:
+    mutable QReadWriteLock m_lock;
+    bool m_isValid;
+    QHash<quint32, QStringList> m_acls;
+    QHash<quint32, QStringList> m_owners;
+};
+
+} // namespace SignonDaemonNS
+
+#endif // SIGNON_ACL_SNAPSHOT_H
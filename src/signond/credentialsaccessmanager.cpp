@@ -127,9 +127,11 @@ CredentialsAccessManager::CredentialsAccessManager(
     QObject(parent),
     m_isInitialized(false),
     m_systemOpened(false),
+    m_secretsDBOpen(false),
     m_error(NoError),
     keyManagers(),
     m_pCredentialsDB(NULL),
+    m_storageQueue(NULL),
     m_cryptoManager(NULL),
     m_keyHandler(NULL),
     m_keyAuthorizer(NULL),
@@ -145,6 +147,7 @@ CredentialsAccessManager::CredentialsAccessManager(
     }
 
     m_keyHandler = new SignOn::KeyHandler(this);
+    m_storageQueue = new StorageQueue(this);
 }
 
 CredentialsAccessManager::~CredentialsAccessManager()
@@ -398,21 +401,26 @@ bool CredentialsAccessManager::openSecretsDB()
 
     TRACE() << "Database name: [" << dbPath << "]";
 
-    if (!m_pCredentialsDB->openSecretsDB(dbPath))
+    bool opened = m_storageQueue->run([dbPath](CredentialsDB *db) {
+        return db != 0 && db->openSecretsDB(dbPath);
+    });
+    if (!opened)
         return false;
 
+    /* The secrets DB is only opened and closed from here: the state is
+     * tracked in the main thread, not to wait for the storage queue */
+    m_secretsDBOpen = true;
     m_error = NoError;
     return true;
 }
 
-bool CredentialsAccessManager::isSecretsDBOpen()
-{
-    return m_pCredentialsDB->isSecretsDBOpen();
-}
-
 bool CredentialsAccessManager::closeSecretsDB()
 {
-    m_pCredentialsDB->closeSecretsDB();
+    m_secretsDBOpen = false;
+    m_storageQueue->run([](CredentialsDB *db) -> bool {
+        if (db != 0) db->closeSecretsDB();
+        return true;
+    });
 
     if (!m_cryptoManager->unmountFileSystem()) {
         m_error = CredentialsDbUnmountFailed;
@@ -444,9 +452,23 @@ bool CredentialsAccessManager::openMetaDataDB()
 {
     QString dbPath = m_CAMConfiguration.metadataDBPath();
 
-    m_pCredentialsDB = new CredentialsDB(dbPath, m_secretsStorage);
-
-    if (!m_pCredentialsDB->init()) {
+    bool ok = false;
+    int groupCommitWindow = m_CAMConfiguration.m_databaseOptions.
+        value(QLatin1String("GroupCommitWindow")).toInt(&ok);
+    if (ok && groupCommitWindow >= 0)
+        m_storageQueue->setGroupCommitWindow(groupCommitWindow);
+
+    /* The DB connections belong to the thread which creates them */
+    m_storageQueue->start();
+    ok = m_storageQueue->run([this, dbPath](CredentialsDB *) -> bool {
+        m_pCredentialsDB = new CredentialsDB(dbPath, m_secretsStorage);
+        m_pCredentialsDB->setDatabaseOptions(
+            m_CAMConfiguration.m_databaseOptions);
+        m_pCredentialsDB->setAclSnapshot(&m_aclSnapshot);
+        m_storageQueue->setCredentialsDB(m_pCredentialsDB);
+        return m_pCredentialsDB->init();
+    });
+    if (!ok) {
         m_error = CredentialsDbConnectionError;
         return false;
     }
@@ -456,10 +478,14 @@ bool CredentialsAccessManager::openMetaDataDB()
 
 void CredentialsAccessManager::closeMetaDataDB()
 {
-    if (m_pCredentialsDB) {
-        delete m_pCredentialsDB;
+    /* Without the CredentialsDB, the secrets DB is not reachable */
+    m_secretsDBOpen = false;
+    m_storageQueue->run([this](CredentialsDB *db) -> bool {
+        m_storageQueue->setCredentialsDB(0);
+        delete db;
         m_pCredentialsDB = NULL;
-    }
+        return true;
+    });
 }
 
 bool CredentialsAccessManager::openCredentialsSystem()
@@ -527,6 +553,16 @@ CredentialsDB *CredentialsAccessManager::credentialsDB() const
     return m_pCredentialsDB;
 }
 
+StorageQueue *CredentialsAccessManager::storageQueue() const
+{
+    return m_storageQueue;
+}
+
+const AclSnapshot *CredentialsAccessManager::aclSnapshot() const
+{
+    return &m_aclSnapshot;
+}
+
 bool CredentialsAccessManager::isCredentialsSystemReady() const
 {
     return (m_keyHandler != 0) ? m_keyHandler->isReady() : true;
@@ -592,7 +628,7 @@ void CredentialsAccessManager::replyToSecureStorageEventNotifiers()
     TRACE();
     //Notify secure storage notifiers if any.
     int eventType = SIGNON_SECURE_STORAGE_NOT_AVAILABLE;
-    if ((m_pCredentialsDB != 0) && m_pCredentialsDB->isSecretsDBOpen())
+    if (isSecretsDBOpen())
         eventType = SIGNON_SECURE_STORAGE_AVAILABLE;
 
     // Signal objects that posted secure storage not available events
@@ -635,7 +671,7 @@ void CredentialsAccessManager::customEvent(QEvent *event)
     }
 
     //Double check if the secrets DB is indeed unavailable
-    if (m_pCredentialsDB->isSecretsDBOpen()) {
+    if (isSecretsDBOpen()) {
         replyToSecureStorageEventNotifiers();
         QObject::customEvent(event);
         return;
@@ -670,6 +706,10 @@ void CredentialsAccessManager::onEncryptedFSUnmounting()
     if (!credentialsSystemOpened()) return;
 
     if (isSecretsDBOpen()) {
-        m_pCredentialsDB->closeSecretsDB();
+        m_secretsDBOpen = false;
+        m_storageQueue->run([](CredentialsDB *db) -> bool {
+            db->closeSecretsDB();
+            return true;
+        });
     }
 }
@@ -32,8 +32,10 @@
 #define CREDENTIALS_ACCESS_MANAGER_H
 
 #include "accesscontrolmanagerhelper.h"
+#include "aclsnapshot.h"
 #include "credentialsdb.h"
 #include "signonui_interface.h"
+#include "storagequeue.h"
 
 #include <QObject>
 #include <QPointer>
@@ -148,6 +150,8 @@ struct CAMConfiguration
     QString m_secretsDbName;    /*!< The credentials database file name. */
     QByteArray m_encryptionPassphrase; /*!< Passphrase used for opening
                                          encrypted FS. */
+    QVariantMap m_databaseOptions; /*!< SQLite tuning options for the
+                                     databases. */
 
     QVariantMap m_settings;
 };
@@ -336,10 +340,27 @@ public:
     bool isCredentialsSystemReady() const;
 
     /*!
-     * @returns the credentials database object.
+     * @returns the credentials database object. The object lives in the
+     * storage thread: outside of it, use the storageQueue() to access it.
      */
     CredentialsDB *credentialsDB() const;
 
+    /*!
+     * @returns the queue running the operations on the credentials database.
+     */
+    StorageQueue *storageQueue() const;
+
+    /*!
+     * @returns the access control lists and owners of the identities; unlike
+     * the credentialsDB(), this can be read from the main thread.
+     */
+    const AclSnapshot *aclSnapshot() const;
+
+    /*!
+     * @returns whether the secrets DB is open.
+     */
+    bool isSecretsDBOpen() const { return m_secretsDBOpen; }
+
     /*!
      * @returns the CAM in use configuration.
      */
@@ -377,7 +398,6 @@ protected:
 private:
     bool createStorageDir();
     bool openSecretsDB();
-    bool isSecretsDBOpen();
     bool closeSecretsDB();
     bool openMetaDataDB();
     void closeMetaDataDB();
@@ -388,6 +408,7 @@ private:
 
     bool m_isInitialized;
     bool m_systemOpened;
+    bool m_secretsDBOpen;
     /* Flag indicating whether the system is ready or not.
      * Currently the system is ready when all of the key managers have
      * successfully reported all of the inserted keys.
@@ -396,6 +417,8 @@ private:
     QList<SignOn::AbstractKeyManager *> keyManagers;
 
     CredentialsDB *m_pCredentialsDB;
+    StorageQueue *m_storageQueue;
+    AclSnapshot m_aclSnapshot;
     SignOn::AbstractCryptoManager *m_cryptoManager;
     SignOn::KeyHandler *m_keyHandler;
     SignOn::AbstractKeyAuthorizer *m_keyAuthorizer;
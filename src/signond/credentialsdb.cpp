@@ -22,8 +22,10 @@
  * 02110-1301 USA
  */
 
+#include "aclsnapshot.h"
 #include "credentialsdb.h"
 #include "credentialsdb_p.h"
+#include "default-secrets-storage.h"
 #include "signond-common.h"
 #include "signonidentityinfo.h"
 #include "signonsessioncoretools.h"
@@ -41,23 +43,181 @@ namespace SignonDaemonNS {
 
 static const QString driver = QLatin1String("QSQLITE");
 
+/* The clock of the cache entries expiry, immune to changes of the system
+ * time. */
+static qint64 monotonicTime()
+{
+    static QElapsedTimer timer;
+    if (!timer.isValid()) timer.start();
+    return timer.elapsed();
+}
+
+static int stringCost(const QString &string)
+{
+    return int(sizeof(QString)) + int(sizeof(QChar)) * string.capacity();
+}
+
+/* The memory held by a value, including the containers it might hold */
+static int variantCost(const QVariant &value)
+{
+    int cost = int(sizeof(QVariant));
+    switch (value.type()) {
+    case QVariant::String:
+        cost += stringCost(value.toString());
+        break;
+    case QVariant::ByteArray:
+        cost += value.toByteArray().capacity();
+        break;
+    case QVariant::StringList:
+        foreach (const QString &string, value.toStringList())
+            cost += stringCost(string);
+        break;
+    case QVariant::List:
+        foreach (const QVariant &item, value.toList())
+            cost += variantCost(item);
+        break;
+    case QVariant::Map:
+        {
+            QVariantMap map = value.toMap();
+            QVariantMap::const_iterator i;
+            for (i = map.constBegin(); i != map.constEnd(); i++)
+                cost += stringCost(i.key()) + variantCost(i.value());
+        }
+        break;
+    default:
+        break;
+    }
+    return cost;
+}
+
+SecretsCache::SecretsCache():
+    m_maxSize(SSO_DEFAULT_SECRETS_CACHE_SIZE),
+    m_size(0),
+    m_timeToLive(0),
+    m_useCounter(0),
+    m_hits(0),
+    m_misses(0),
+    m_evictions(0),
+    m_expirations(0)
+{
+}
+
+void SecretsCache::setMaxSize(int bytes)
+{
+    m_maxSize = bytes;
+    evict();
+}
+
+SecretsCache::AuthCache *SecretsCache::entry(quint32 id)
+{
+    QHash<quint32, AuthCache>::iterator i = m_cache.find(id);
+    if (i == m_cache.end()) {
+        m_misses++;
+        return 0;
+    }
+
+    if (isExpired(*i)) {
+        m_expirations++;
+        m_size -= i->m_cost;
+        m_cache.erase(i);
+        m_misses++;
+        return 0;
+    }
+
+    m_hits++;
+    i->m_lastUse = ++m_useCounter;
+    return &i.value();
+}
+
+SecretsCache::AuthCache *SecretsCache::insertEntry(quint32 id)
+{
+    AuthCache &entry = m_cache[id];
+    if (isExpired(entry)) {
+        /* Don't let the new data revive the expired one */
+        m_expirations++;
+        m_size -= entry.m_cost;
+        entry = AuthCache();
+    }
+    entry.m_lastUse = ++m_useCounter;
+    return &entry;
+}
+
+void SecretsCache::entryUpdated(AuthCache &entry)
+{
+    if (m_timeToLive > 0)
+        entry.m_expiry = monotonicTime() + m_timeToLive;
+
+    int cost = int(sizeof(quint32) + sizeof(AuthCache)) +
+        stringCost(entry.m_username) + stringCost(entry.m_password);
+    QHash<quint32, QVariantMap>::const_iterator i;
+    for (i = entry.m_blobData.constBegin();
+         i != entry.m_blobData.constEnd();
+         i++) {
+        cost += int(sizeof(quint32)) + variantCost(i.value());
+    }
+    m_size += cost - entry.m_cost;
+    entry.m_cost = cost;
+
+    if (m_size > m_maxSize) {
+        removeExpired();
+        evict();
+    }
+}
+
+bool SecretsCache::isExpired(const AuthCache &entry) const
+{
+    return entry.m_expiry != 0 && entry.m_expiry <= monotonicTime();
+}
+
+void SecretsCache::removeExpired()
+{
+    QHash<quint32, AuthCache>::iterator i = m_cache.begin();
+    while (i != m_cache.end()) {
+        if (isExpired(*i)) {
+            m_expirations++;
+            m_size -= i->m_cost;
+            i = m_cache.erase(i);
+        } else {
+            i++;
+        }
+    }
+}
+
+void SecretsCache::evict()
+{
+    /* Evictions are rare enough not to need a recency list */
+    while (m_size > m_maxSize && !m_cache.isEmpty()) {
+        QHash<quint32, AuthCache>::iterator oldest = m_cache.begin();
+        QHash<quint32, AuthCache>::iterator i;
+        for (i = m_cache.begin(); i != m_cache.end(); i++) {
+            if (i->m_lastUse < oldest->m_lastUse)
+                oldest = i;
+        }
+        BLAME() << "Dropping the cached secrets of identity" << oldest.key();
+        m_evictions++;
+        m_size -= oldest->m_cost;
+        m_cache.erase(oldest);
+    }
+}
+
 bool SecretsCache::lookupCredentials(quint32 id,
                                      QString &username,
-                                     QString &password) const
+                                     QString &password)
 {
-    QHash<quint32, AuthCache>::const_iterator i;
-
-    i = m_cache.find(id);
-    if (i == m_cache.end()) return false;
+    AuthCache *credentials = entry(id);
+    if (credentials == 0) return false;
 
-    username = i->m_username;
-    password = i->m_password;
+    username = credentials->m_username;
+    password = credentials->m_password;
     return true;
 }
 
-QVariantMap SecretsCache::lookupData(quint32 id, quint32 method) const
+QVariantMap SecretsCache::lookupData(quint32 id, quint32 method)
 {
-    return m_cache.value(id).m_blobData.value(method);
+    AuthCache *credentials = entry(id);
+    if (credentials == 0) return QVariantMap();
+
+    return credentials->m_blobData.value(method);
 }
 
 void SecretsCache::updateCredentials(quint32 id,
@@ -67,10 +227,11 @@ void SecretsCache::updateCredentials(quint32 id,
 {
     if (id == 0) return;
 
-    AuthCache &credentials = m_cache[id];
-    credentials.m_username = username;
-    credentials.m_password = password;
-    credentials.m_storePassword = storePassword;
+    AuthCache *credentials = insertEntry(id);
+    credentials->m_username = username;
+    credentials->m_password = password;
+    credentials->m_storePassword = storePassword;
+    entryUpdated(*credentials);
 }
 
 void SecretsCache::updateData(quint32 id, quint32 method,
@@ -78,17 +239,21 @@ void SecretsCache::updateData(quint32 id, quint32 method,
 {
     if (id == 0) return;
 
-    AuthCache &credentials = m_cache[id];
-    credentials.m_blobData[method] = data;
+    AuthCache *credentials = insertEntry(id);
+    credentials->m_blobData[method] = data;
+    entryUpdated(*credentials);
 }
 
-void
-SecretsCache::storeToDB(SignOn::AbstractSecretsStorage *secretsStorage) const
+void SecretsCache::storeToDB(SignOn::AbstractSecretsStorage *secretsStorage)
 {
+    removeExpired();
     if (m_cache.isEmpty()) return;
 
     TRACE() << "Storing cached credentials into permanent storage";
 
+    /* All the cached secrets are written in one transaction */
+    bool batched = secretsStorage->beginBatch();
+
     QHash<quint32, AuthCache>::const_iterator i;
     for (i = m_cache.constBegin();
          i != m_cache.constEnd();
@@ -114,9 +279,77 @@ SecretsCache::storeToDB(SignOn::AbstractSecretsStorage *secretsStorage) const
             secretsStorage->storeData(id, method, j.value());
         }
     }
+
+    if (batched && !secretsStorage->commitBatch())
+        BLAME() << "Could not store the cached credentials";
 }
 
 void SecretsCache::clear()
+{
+    m_cache.clear();
+    m_size = 0;
+}
+
+/* A rough estimate of the memory held by a cached identity, in bytes */
+static int identityCost(const SignonIdentityInfo &info)
+{
+    int chars = info.caption().size() + info.userName().size();
+    foreach (const QString &string,
+             info.realms() + info.accessControlList() + info.ownerList()) {
+        chars += string.size();
+    }
+
+    MethodMap methods = info.methods();
+    MethodMap::const_iterator i;
+    for (i = methods.constBegin(); i != methods.constEnd(); i++) {
+        chars += i.key().size();
+        foreach (const QString &mechanism, i.value()) {
+            chars += mechanism.size();
+        }
+    }
+
+    return int(sizeof(SignonIdentityInfo)) + 64 * info.count() +
+        int(sizeof(QChar)) * chars;
+}
+
+IdentityCache::IdentityCache():
+    m_cache(SSO_DEFAULT_IDENTITY_CACHE_SIZE),
+    m_hits(0),
+    m_misses(0)
+{
+}
+
+void IdentityCache::setMaxSize(int bytes)
+{
+    m_cache.setMaxCost(bytes);
+}
+
+bool IdentityCache::lookup(quint32 id, SignonIdentityInfo &info)
+{
+    SignonIdentityInfo *cached = m_cache.object(id);
+    if (cached == 0) {
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+    info = *cached;
+    return true;
+}
+
+void IdentityCache::insert(const SignonIdentityInfo &info)
+{
+    /* Entries bigger than the whole cache are deleted by QCache itself */
+    m_cache.insert(info.id(), new SignonIdentityInfo(info),
+                   identityCost(info));
+}
+
+void IdentityCache::remove(quint32 id)
+{
+    m_cache.remove(id);
+}
+
+void IdentityCache::clear()
 {
     m_cache.clear();
 }
@@ -125,6 +358,11 @@ SqlDatabase::SqlDatabase(const QString &databaseName,
                          const QString &connectionName,
                          int version):
     m_lastError(SignOn::CredentialsDBError()),
+    m_execCount(0),
+    m_lazyTransaction(false),
+    m_walMode(false),
+    m_transactionDepth(0),
+    m_host(0),
     m_version(version),
     m_database(QSqlDatabase::addDatabase(driver, connectionName))
 
@@ -135,9 +373,33 @@ SqlDatabase::SqlDatabase(const QString &databaseName,
     m_database.setDatabaseName(databaseName);
 }
 
+SqlDatabase::SqlDatabase(SqlDatabase *host, const QString &schema,
+                         const QString &databaseName, int version):
+    m_lastError(SignOn::CredentialsDBError()),
+    m_execCount(0),
+    m_lazyTransaction(false),
+    m_walMode(false),
+    m_transactionDepth(0),
+    m_host(host),
+    m_schema(schema),
+    m_schemaPrefix(schema + QLatin1Char('.')),
+    m_attachedName(databaseName),
+    m_version(version),
+    m_database(host->m_database)
+{
+    TRACE() << "DATABASE NAME [" << databaseName << "] attached as" << schema;
+}
+
 SqlDatabase::~SqlDatabase()
 {
+    if (m_host != 0) {
+        clearStatements();
+        detach();
+        return;
+    }
+
     m_database.commit();
+    clearStatements();
     m_database.close();
 }
 
@@ -149,6 +411,9 @@ bool SqlDatabase::init()
     TRACE() <<  "Database connection succeeded.";
 
     if (!hasTables()) {
+        /* This only takes effect before the first table is created */
+        exec(pragma("auto_vacuum = INCREMENTAL"));
+
         TRACE() << "Creating SQL table structure...";
         if (!createTables())
             return false;
@@ -159,73 +424,424 @@ bool SqlDatabase::init()
     } else {
         TRACE() << "SQL table structure already created...";
         // check the DB version
-        QSqlQuery q = exec(S("PRAGMA user_version"));
+        QSqlQuery q = exec(pragma("user_version"));
         int oldVersion = q.first() ? q.value(0).toInt() : 0;
         if (oldVersion < m_version)
             updateDB(oldVersion);
+        q.finish();
     }
 
+    /* The schema statements won't be run again: don't keep them cached */
+    clearStatements();
+
     return true;
 }
 
+void SqlDatabase::enableIncrementalVacuum()
+{
+    if (pragmaValue("auto_vacuum") == 2)
+        return;
+
+    /* This cannot happen with statements pending */
+    TRACE() << "Rebuilding" << connectionName() << "for incremental vacuum";
+    QElapsedTimer timer;
+    timer.start();
+    clearStatements();
+    exec(pragma("auto_vacuum = INCREMENTAL"));
+    exec(isAttached() ? S("VACUUM ") + m_schema : S("VACUUM"));
+    if (errorOccurred()) {
+        BLAME() << "Could not enable incremental vacuum:" <<
+            m_lastError.text() << "after" << timer.elapsed() << "ms";
+        m_lastError.clear();
+    } else {
+        TRACE() << "Rebuilt" << connectionName() << "in" <<
+            timer.elapsed() << "ms";
+    }
+}
+
 bool SqlDatabase::updateDB(int version)
 {
     TRACE() << "Update DB from version " << version << " to " << m_version;
-    exec(QString::fromLatin1("PRAGMA user_version = %1").arg(m_version));
+    exec(pragma("user_version = ") + QString::number(m_version));
     return true;
 }
 
+bool SqlDatabase::hasTables() const
+{
+    if (m_host == 0)
+        return m_database.tables().count() > 0;
+
+    QSqlQuery q(m_database);
+    q.exec(QString::fromLatin1("SELECT count(*) FROM %1sqlite_master "
+                               "WHERE type = 'table'").arg(m_schemaPrefix));
+    return q.first() && q.value(0).toInt() > 0;
+}
+
+QString SqlDatabase::pragma(const char *name) const
+{
+    return S("PRAGMA ") + m_schemaPrefix + QLatin1String(name);
+}
+
+bool SqlDatabase::attach()
+{
+    if (!m_database.isOpen()) {
+        TRACE() << "The host database is not open";
+        m_lastError = SignOn::CredentialsDBError(
+            S("Host database not open"),
+            SignOn::CredentialsDBError::NotOpen);
+        return false;
+    }
+
+    QSqlQuery q(m_database);
+    q.prepare(S("ATTACH DATABASE :name AS ") + m_schema);
+    q.bindValue(S(":name"), m_attachedName);
+    exec(q);
+    return !errorOccurred();
+}
+
+void SqlDatabase::detach()
+{
+    if (m_database.isOpen())
+        exec(S("DETACH DATABASE ") + m_schema);
+}
+
+bool SqlDatabase::hostResult(bool ok)
+{
+    if (!ok)
+        m_lastError = m_host->m_lastError;
+    return ok;
+}
+
 bool SqlDatabase::connect()
 {
-    if (!m_database.open()) {
+    if (m_host != 0) {
+        if (!attach()) {
+            TRACE() << "Could not attach database" << m_attachedName;
+            return false;
+        }
+    } else if (!m_database.open()) {
         TRACE() << "Could not open database connection.\n";
         setLastError(m_database.lastError());
         return false;
     }
+    applyOptions();
     return true;
 }
 
+void SqlDatabase::setOptions(const QVariantMap &options)
+{
+    m_options = options;
+}
+
+/* Only values from these lists are ever written into the PRAGMA statements,
+ * which cannot take bound parameters. */
+static QString pragmaKeyword(const QVariant &value,
+                             const QStringList &keywords)
+{
+    QString keyword = value.toString().toUpper();
+    if (keywords.contains(keyword))
+        return keyword;
+
+    if (value.isValid())
+        BLAME() << "Ignoring invalid database option:" << value;
+    return QString();
+}
+
+static qint64 pragmaNumber(const QVariant &value)
+{
+    bool ok = false;
+    qint64 number = value.toLongLong(&ok);
+    if (ok && number >= 0)
+        return number;
+
+    if (value.isValid())
+        BLAME() << "Ignoring invalid database option:" << value;
+    return -1;
+}
+
+void SqlDatabase::applyOptions()
+{
+    static const QStringList journalModes = QStringList() <<
+        S("DELETE") << S("TRUNCATE") << S("PERSIST") << S("MEMORY") <<
+        S("WAL");
+    static const QStringList syncLevels = QStringList() <<
+        S("OFF") << S("NORMAL") << S("FULL") << S("EXTRA");
+
+    m_walMode = false;
+    QString journalMode =
+        pragmaKeyword(m_options.value(S("JournalMode")), journalModes);
+    if (!journalMode.isEmpty()) {
+        QStringList mode = queryList(pragma("journal_mode = ") +
+                                     journalMode);
+        m_walMode = mode.value(0).toUpper() == S("WAL");
+        if (mode.value(0).toUpper() != journalMode)
+            BLAME() << "Could not set journal mode" << journalMode <<
+                "on" << connectionName();
+    }
+
+    m_synchronous =
+        pragmaKeyword(m_options.value(S("Synchronous")), syncLevels);
+    m_lazySynchronous =
+        pragmaKeyword(m_options.value(S("TokenSynchronous")), syncLevels);
+    if (!m_synchronous.isEmpty()) {
+        setSynchronous(m_synchronous);
+    } else if (!m_lazySynchronous.isEmpty()) {
+        /* Remember the built-in level, to restore it after lazy writes */
+        m_synchronous = queryList(pragma("synchronous")).value(0);
+    }
+
+    qint64 busyTimeout = pragmaNumber(m_options.value(S("BusyTimeout")));
+    if (busyTimeout >= 0)
+        exec(QString::fromLatin1("PRAGMA busy_timeout = %1").
+             arg(busyTimeout));
+
+    qint64 mmapSize = pragmaNumber(m_options.value(S("MmapSize")));
+    if (mmapSize >= 0)
+        exec(pragma("mmap_size = ") + QString::number(mmapSize));
+}
+
+void SqlDatabase::setSynchronous(const QString &level)
+{
+    exec(pragma("synchronous = ") + level);
+}
+
+void SqlDatabase::restoreDurability()
+{
+    if (m_lazyTransaction) {
+        /* Don't hide the error which made the transaction fail */
+        SignOn::CredentialsDBError error = m_lastError;
+        setSynchronous(m_synchronous);
+        m_lastError = error;
+        m_lazyTransaction = false;
+    }
+}
+
+bool SqlDatabase::checkpoint()
+{
+    if (!m_walMode || !connected())
+        return true;
+
+    /* PASSIVE never waits for readers or writers: whatever cannot be copied
+     * now will be by the next checkpoint. */
+    QSqlQuery q = exec(pragma("wal_checkpoint(PASSIVE)"));
+    if (errorOccurred() || !q.first()) {
+        TRACE() << "Checkpoint failed on" << connectionName();
+        return false;
+    }
+
+    bool busy = q.value(0).toInt() != 0;
+    TRACE() << connectionName() << "checkpointed" << q.value(2).toInt() <<
+        "of" << q.value(1).toInt() << "frames";
+    q.finish();
+    return !busy;
+}
+
+qint64 SqlDatabase::pragmaValue(const char *name)
+{
+    QSqlQuery q = exec(pragma(name));
+    if (errorOccurred() || !q.first())
+        return -1;
+    qint64 value = q.value(0).toLongLong();
+    q.finish();
+    return value;
+}
+
+qint64 SqlDatabase::incrementalVacuum(int maxPages)
+{
+    if (pragmaValue("auto_vacuum") != 2)
+        return 0;
+
+    qint64 freePages = pragmaValue("freelist_count");
+    if (freePages <= 0 || maxPages <= 0)
+        return freePages;
+
+    /* Depending on the driver, each execution may release a single page:
+     * repeat it until the slice is done. Losing the result of a crash is
+     * harmless, so don't pay for a durable commit. */
+    qint64 target = qMax(freePages - maxPages, qint64(0));
+    if (!startTransaction(Lazy))
+        return -1;
+    while (freePages > target) {
+        exec(pragma("incremental_vacuum(") +
+             QString::number(freePages - target) + QLatin1Char(')'));
+        qint64 left = pragmaValue("freelist_count");
+        if (left < 0 || left >= freePages) {
+            freePages = left;
+            break;
+        }
+        freePages = left;
+    }
+    if (freePages < 0 || !commit()) {
+        rollback();
+        return -1;
+    }
+
+    TRACE() << connectionName() << "has" << freePages << "free pages left";
+    return freePages;
+}
+
+qint64 SqlDatabase::fileSize()
+{
+    qint64 pages = pragmaValue("page_count");
+    return pages < 0 ? -1 : pages * pragmaValue("page_size");
+}
+
+qint64 SqlDatabase::freeSize()
+{
+    qint64 pages = pragmaValue("freelist_count");
+    return pages < 0 ? -1 : pages * pragmaValue("page_size");
+}
+
 void SqlDatabase::disconnect()
 {
+    m_transactionDepth = 0;
+    clearStatements();
+    if (m_host != 0) {
+        detach();
+        return;
+    }
     m_database.close();
 }
 
-bool SqlDatabase::startTransaction()
+bool SqlDatabase::startTransaction(Durability durability)
 {
-    return m_database.transaction();
+    /* The synchronous level cannot change within a transaction: switch it
+     * before starting, and back when the transaction ends. */
+    if (!inTransaction() && durability == Lazy &&
+        !m_lazySynchronous.isEmpty() && m_lazySynchronous != m_synchronous) {
+        setSynchronous(m_lazySynchronous);
+        m_lazyTransaction = true;
+    }
+
+    if (m_host != 0) {
+        if (m_host->startTransaction(durability))
+            return true;
+        restoreDurability();
+        return hostResult(false);
+    }
+
+    if (m_transactionDepth > 0) {
+        QSqlQuery q = exec(S("SAVEPOINT nested"));
+        if (errorOccurred())
+            return false;
+        m_transactionDepth++;
+        return true;
+    }
+
+    if (!m_database.transaction()) {
+        restoreDurability();
+        return false;
+    }
+    m_transactionDepth = 1;
+    return true;
 }
 
 bool SqlDatabase::commit()
 {
-    return m_database.commit();
+    if (m_host != 0) {
+        finishStatements();
+        bool ok = hostResult(m_host->commit());
+        if (!inTransaction())
+            restoreDurability();
+        return ok;
+    }
+
+    if (m_transactionDepth > 1) {
+        SignOn::CredentialsDBError error = m_lastError;
+        exec(S("RELEASE nested"));
+        /* The savepoint is still open: the rollback() which follows must
+         * only undo it, not the enclosing transaction */
+        if (errorOccurred())
+            return false;
+        m_transactionDepth--;
+        m_lastError = error;
+        return true;
+    }
+
+    finishStatements();
+    bool ok = m_database.commit();
+    m_transactionDepth = 0;
+    restoreDurability();
+    return ok;
 }
 
 void SqlDatabase::rollback()
 {
+    SignOn::CredentialsDBError error = m_lastError;
+    if (m_host != 0) {
+        finishStatements();
+        m_host->rollback();
+        if (!inTransaction())
+            restoreDurability();
+        rolledBack();
+        m_lastError = error;
+        return;
+    }
+
+    if (m_transactionDepth > 1) {
+        m_transactionDepth--;
+        exec(S("ROLLBACK TO nested"));
+        exec(S("RELEASE nested"));
+        rolledBack();
+        m_lastError = error;
+        return;
+    }
+
+    finishStatements();
     if (!m_database.rollback())
         TRACE() << "Rollback failed, db data integrity could be compromised.";
+    m_transactionDepth = 0;
+
+    restoreDurability();
+    rolledBack();
+    m_lastError = error;
 }
 
-QSqlQuery SqlDatabase::exec(const QString &queryStr)
+QSqlQuery SqlDatabase::preparedQuery(const QString &queryStr)
 {
-    QSqlQuery query(QString(), m_database);
+    QHash<QString, QSqlQuery>::iterator i = m_statements.find(queryStr);
+    if (i != m_statements.end()) {
+        /* Reset the statement, in case a previous user left it active */
+        i->finish();
+        return i.value();
+    }
 
-    if (!query.prepare(queryStr))
+    QSqlQuery query(m_database);
+    query.setForwardOnly(true);
+    if (!query.prepare(queryStr)) {
         TRACE() << "Query prepare warning: " << query.lastQuery();
+        return query;
+    }
 
-    if (!query.exec()) {
-        TRACE() << "Query exec error: " << query.lastQuery();
-        setLastError(query.lastError());
-        TRACE() << errorInfo(query.lastError());
-    } else
-        m_lastError.clear();
-
+    /* Statements with inlined values would fill the cache with single-use
+     * entries; stop caching once the limit is reached. */
+    if (m_statements.count() < SSO_MAX_CACHED_STATEMENTS)
+        m_statements.insert(queryStr, query);
     return query;
 }
 
-QSqlQuery SqlDatabase::exec(QSqlQuery &query)
+void SqlDatabase::finishStatements()
+{
+    QHash<QString, QSqlQuery>::iterator i;
+    for (i = m_statements.begin(); i != m_statements.end(); i++) {
+        i->finish();
+    }
+}
+
+void SqlDatabase::clearStatements()
+{
+    m_statements.clear();
+}
+
+QSqlQuery SqlDatabase::exec(const QString &queryStr)
 {
+    QSqlQuery query = preparedQuery(queryStr);
+    return exec(query);
+}
 
+QSqlQuery SqlDatabase::exec(QSqlQuery &query)
+{
+    m_execCount++;
     if (!query.exec()) {
         TRACE() << "Query exec error: " << query.lastQuery();
         setLastError(query.lastError());
@@ -238,6 +854,12 @@ QSqlQuery SqlDatabase::exec(QSqlQuery &query)
 
 
 bool SqlDatabase::transactionalExec(const QStringList &queryList)
+{
+    return transactionalExec(queryList, QVariantMap());
+}
+
+bool SqlDatabase::transactionalExec(const QStringList &queryList,
+                                    const QVariantMap &bindings)
 {
     if (!startTransaction()) {
         setLastError(m_database.lastError());
@@ -248,7 +870,13 @@ bool SqlDatabase::transactionalExec(const QStringList &queryList)
     bool allOk = true;
     foreach (QString queryStr, queryList) {
         TRACE() << QString::fromLatin1("TRANSACT Query [%1]").arg(queryStr);
-        QSqlQuery query = exec(queryStr);
+        QSqlQuery query = preparedQuery(queryStr);
+        QVariantMap::const_iterator i;
+        for (i = bindings.constBegin(); i != bindings.constEnd(); i++) {
+            if (queryStr.contains(i.key()))
+                query.bindValue(i.key(), i.value());
+        }
+        exec(query);
 
         if (errorOccurred()) {
             allOk = false;
@@ -316,9 +944,7 @@ QString SqlDatabase::errorInfo(const QSqlError &error)
 
 QStringList SqlDatabase::queryList(const QString &query_str)
 {
-    QSqlQuery query(QString(), m_database);
-    if (!query.prepare(query_str))
-        TRACE() << "Query prepare warning: " << query.lastQuery();
+    QSqlQuery query = preparedQuery(query_str);
     return queryList(query);
 }
 
@@ -330,7 +956,7 @@ QStringList SqlDatabase::queryList(QSqlQuery &q)
     while (query.next()) {
         list.append(query.value(0).toString());
     }
-    query.clear();
+    query.finish();
     return list;
 }
 
@@ -373,6 +999,55 @@ QStringList MetaDataDB::tableUpdates2()
     return tableUpdates;
 }
 
+QStringList MetaDataDB::tableUpdates3()
+{
+    /* The primary keys of REALMS and REFS already start with identity_id,
+     * so only ACL and OWNER need indexes. They also hold the token id, for
+     * the token lists to be read from the index alone. */
+    QStringList tableUpdates = QStringList()
+        << QString::fromLatin1(
+            "CREATE INDEX idx_ACL_identity_id_token_id "
+            "ON ACL (identity_id, token_id)")
+        << QString::fromLatin1(
+            "CREATE INDEX idx_ACL_method_id_identity_id "
+            "ON ACL (method_id, identity_id)")
+        << QString::fromLatin1(
+            "CREATE INDEX idx_OWNER_identity_id_token_id "
+            "ON OWNER (identity_id, token_id)");
+
+    return tableUpdates;
+}
+
+QStringList MetaDataDB::tableUpdates4()
+{
+    /* One row per identity, holding its last change: the seq primary key
+     * is the rowid, which makes the changes readable in order without any
+     * extra index. Rows of removed identities are tombstones. */
+    QStringList tableUpdates = QStringList()
+        << QString::fromLatin1(
+            "CREATE TABLE CHANGES"
+            "(seq INTEGER PRIMARY KEY,"
+            "identity_id INTEGER NOT NULL UNIQUE,"
+            "removed INTEGER NOT NULL DEFAULT 0)");
+
+    return tableUpdates;
+}
+
+QStringList MetaDataDB::tableUpdates6()
+{
+    /* The identity filters test these columns for equality or with a GLOB
+     * prefix; both can be answered from an index. */
+    QStringList tableUpdates = QStringList()
+        << QString::fromLatin1(
+            "CREATE INDEX idx_CREDENTIALS_caption ON CREDENTIALS (caption)")
+        << QString::fromLatin1(
+            "CREATE INDEX idx_CREDENTIALS_username ON CREDENTIALS (username)")
+        << QString::fromLatin1(
+            "CREATE INDEX idx_REALMS_realm ON REALMS (realm)");
+
+    return tableUpdates;
+}
+
 bool MetaDataDB::createTables()
 {
     /* !!! Foreign keys support seems to be disabled, for the moment... */
@@ -608,6 +1283,9 @@ end of generated code
 */
     //insert table updates
     createTableQuery << tableUpdates2();
+    createTableQuery << tableUpdates3();
+    createTableQuery << tableUpdates4();
+    createTableQuery << tableUpdates6();
 
     foreach (QString createTable, createTableQuery) {
         QSqlQuery query = exec(createTable);
@@ -632,7 +1310,7 @@ bool MetaDataDB::updateDB(int version)
         TRACE() << "Upgrading from version < 1 not supported. Clearing DB";
         QString fileName = m_database.databaseName();
         QString connectionName = m_database.connectionName();
-        m_database.close();
+        disconnect();
         QFile::remove(fileName);
         m_database = QSqlDatabase(QSqlDatabase::addDatabase(driver,
                                                             connectionName));
@@ -642,6 +1320,8 @@ bool MetaDataDB::updateDB(int version)
 
         if (!createTables())
             return false;
+
+        return SqlDatabase::updateDB(version);
     }
 
     //convert from 1 to 2
@@ -666,113 +1346,234 @@ bool MetaDataDB::updateDB(int version)
             BLAME() << "Table copy failed.";
             rollback();
         }
+        version = 2;
+    }
 
-    } else {
-        return false;
+    //convert from 2 to 3
+    if (version == 2) {
+        QStringList createIndexQuery = tableUpdates3();
+        foreach (QString createIndex, createIndexQuery) {
+            QSqlQuery query = exec(createIndex);
+            if (lastError().isValid()) {
+                TRACE() << "Error occurred while creating indexes.";
+                return false;
+            }
+            query.clear();
+            commit();
+        }
+
+        /* Existing databases can be large: let the query planner know
+         * how selective the new indexes are. */
+        exec(S("ANALYZE"));
+        TRACE() << "Index creation successful";
+        version = 3;
+    }
+
+    //convert from 3 to 4
+    if (version == 3) {
+        QStringList updates = tableUpdates4();
+        /* The existing identities count as changed, in id order */
+        updates << QString::fromLatin1(
+            "INSERT INTO CHANGES (seq, identity_id, removed) "
+            "SELECT id, id, 0 FROM CREDENTIALS");
+        if (!transactionalExec(updates)) {
+            TRACE() << "Error occurred while creating the change log.";
+            return false;
+        }
+        version = 4;
+    }
+
+    //convert from 4 to 5
+    if (version == 4) {
+        /* Tried once: if the rebuild fails, the version is bumped anyway,
+         * rather than rebuilding the whole file again at every start */
+        enableIncrementalVacuum();
+        version = 5;
     }
 
+    //convert from 5 to 6
+    if (version == 5) {
+        if (!transactionalExec(tableUpdates6())) {
+            TRACE() << "Error occurred while creating the filter indexes.";
+            return false;
+        }
+        exec(S("ANALYZE"));
+        version = 6;
+    }
+
+    if (version != m_version)
+        return false;
+
     return SqlDatabase::updateDB(version);
 }
 
-QStringList MetaDataDB::methods(const quint32 id, const QString &securityToken)
+bool MetaDataDB::init()
 {
-    QStringList list;
-    if (securityToken.isEmpty()) {
-        list = queryList(
-                 QString::fromLatin1("SELECT DISTINCT METHODS.method FROM "
-                        "( ACL JOIN METHODS ON ACL.method_id = METHODS.id ) "
-                        "WHERE ACL.identity_id = '%1'").arg(id)
-                 );
-        return list;
-    }
-    QSqlQuery q = newQuery();
-    q.prepare(S("SELECT DISTINCT METHODS.method FROM "
-                "( ACL JOIN METHODS ON ACL.method_id = METHODS.id) "
-                "WHERE ACL.identity_id = :id AND ACL.token_id = "
-                "(SELECT id FROM TOKENS where token = :token)"));
+    if (!SqlDatabase::init())
+        return false;
+
+    return loadNames() && loadChangeSequence();
+}
+
+void MetaDataDB::rolledBack()
+{
+    /* The names and changes inserted by the transaction are gone from the
+     * DB: the numbers it used will be given again */
+    if (!loadNames())
+        BLAME() << "Could not reload the method names";
+    if (!loadChangeSequence())
+        BLAME() << "Could not reload the change sequence";
+}
+
+/* METHODS and MECHANISMS only ever grow through insertName(), so they are
+ * read once and then kept in memory: resolving names and ids does not need
+ * any SQL. */
+bool MetaDataDB::loadNames()
+{
+    m_methods.clear();
+    m_mechanisms.clear();
+
+    QSqlQuery q = exec(S("SELECT id, method FROM METHODS"));
+    if (errorOccurred()) return false;
+    while (q.next())
+        m_methods.insert(q.value(0).toUInt(), q.value(1).toString());
+    q.finish();
+
+    q = exec(S("SELECT id, mechanism FROM MECHANISMS"));
+    if (errorOccurred()) return false;
+    while (q.next())
+        m_mechanisms.insert(q.value(0).toUInt(), q.value(1).toString());
+    q.finish();
+
+    TRACE() << "Loaded" << m_methods.count() << "methods and" <<
+        m_mechanisms.count() << "mechanisms";
+    return true;
+}
+
+bool MetaDataDB::loadChangeSequence()
+{
+    QSqlQuery q = exec(S("SELECT MAX(seq) FROM CHANGES"));
+    if (errorOccurred()) return false;
+    m_changeSequence = q.first() ? q.value(0).toULongLong() : 0;
+    q.finish();
+    return true;
+}
+
+bool MetaDataDB::recordChange(quint32 id, bool removed)
+{
+    QSqlQuery q = preparedQuery(
+        S("INSERT OR REPLACE INTO CHANGES (seq, identity_id, removed) "
+          "VALUES (:seq, :id, :removed)"));
+    q.bindValue(S(":seq"), qint64(m_changeSequence + 1));
     q.bindValue(S(":id"), id);
-    q.bindValue(S(":token"), securityToken);
-    list = queryList(q);
+    q.bindValue(S(":removed"), removed ? 1 : 0);
+    exec(q);
+    if (errorOccurred()) return false;
 
-    return list;
+    m_changeSequence++;
+    return true;
 }
 
-quint32 MetaDataDB::methodId(const QString &method)
+qint64 MetaDataDB::totalChanges()
 {
-    TRACE() << "method:" << method;
+    QSqlQuery q = preparedQuery(S("SELECT total_changes()"));
+    exec(q);
+    qint64 count = q.first() ? q.value(0).toLongLong() : -1;
+    q.finish();
+    return count;
+}
 
-    QSqlQuery q = newQuery();
-    q.prepare(S("SELECT id FROM METHODS WHERE method = :method"));
-    q.bindValue(S(":method"), method);
+bool MetaDataDB::changes(quint64 since, QList<quint32> &changed,
+                         QList<quint32> &removed, quint64 &sequence)
+{
+    /* Only the changes written to the DB count: a sequence given out must
+     * not be reused after a restart */
+    if (!loadChangeSequence()) return false;
+    sequence = m_changeSequence;
+
+    QSqlQuery q = preparedQuery(S("SELECT identity_id, removed FROM CHANGES "
+                                  "WHERE seq > :since ORDER BY seq"));
+    q.bindValue(S(":since"), qint64(since));
     exec(q);
-    if (!q.first()) {
-        TRACE() << "No result or invalid method query.";
-        return 0;
+    if (errorOccurred()) return false;
+
+    while (q.next()) {
+        if (q.value(1).toInt() != 0) {
+            removed.append(q.value(0).toUInt());
+        } else {
+            changed.append(q.value(0).toUInt());
+        }
     }
+    q.finish();
+    return true;
+}
+
+quint32 MetaDataDB::insertName(NameIdMap &names, const QString &insertStr,
+                               const QString &name)
+{
+    QSqlQuery q = preparedQuery(insertStr);
+    q.bindValue(S(":name"), name);
+    exec(q);
+    if (errorOccurred())
+        return 0;
 
-    return q.value(0).toUInt();
+    quint32 id = q.lastInsertId().toUInt();
+    if (id != 0)
+        names.insert(id, name);
+    return id;
 }
 
-SignonIdentityInfo MetaDataDB::identity(const quint32 id)
+/* An unknown id (0) is stored as NULL, as the name subselects used to do */
+static QVariant nameIdValue(quint32 id)
 {
-    QString query_str;
+    return id != 0 ? QVariant(id) : QVariant(QVariant::UInt);
+}
 
-    query_str = QString::fromLatin1(
-            "SELECT caption, username, flags, type "
-            "FROM credentials WHERE id = %1").arg(id);
-    QSqlQuery query = exec(query_str);
+QStringList MetaDataDB::methods(const quint32 id, const QString &securityToken)
+{
+    QSqlQuery q = newQuery();
+    if (securityToken.isEmpty()) {
+        q = preparedQuery(
+            S("SELECT DISTINCT method_id FROM ACL WHERE identity_id = :id"));
+    } else {
+        q = preparedQuery(
+            S("SELECT DISTINCT method_id FROM ACL "
+              "WHERE identity_id = :id AND token_id = "
+              "(SELECT id FROM TOKENS where token = :token)"));
+        q.bindValue(S(":token"), securityToken);
+    }
+    q.bindValue(S(":id"), id);
 
-    if (!query.first()) {
-        TRACE() << "No result or invalid credentials query.";
-        return SignonIdentityInfo();
+    QStringList list;
+    foreach (const QString &methodId, queryList(q)) {
+        QString method = m_methods.name(methodId.toUInt());
+        if (!method.isEmpty())
+            list.append(method);
     }
+    return list;
+}
 
-    QString caption = query.value(0).toString();
-    QString username = query.value(1).toString();
-    int flags = query.value(2).toInt();
+quint32 MetaDataDB::methodId(const QString &method)
+{
+    TRACE() << "method:" << method;
+
+    quint32 id = m_methods.id(method);
+    if (id == 0)
+        TRACE() << "Unknown method.";
+    return id;
+}
+
+/* Builds the identity from a row whose first columns are
+ * caption, username, flags and type (in this order). */
+static SignonIdentityInfo identityFromRecord(quint32 id, const QSqlQuery &q)
+{
+    QString caption = q.value(0).toString();
+    QString username = q.value(1).toString();
+    int flags = q.value(2).toInt();
     bool savePassword = flags & RememberPassword;
     bool validated =  flags & Validated;
     bool isUserNameSecret = flags & UserNameIsSecret;
-    if (isUserNameSecret) username = QString();
-    int type = query.value(3).toInt();
-
-    query.clear();
-    QStringList realms = queryList(
-            QString::fromLatin1("SELECT realm FROM REALMS "
-                    "WHERE identity_id = %1").arg(id));
-
-    QStringList ownerTokens = queryList(
-            QString::fromLatin1("SELECT token FROM TOKENS "
-                                "WHERE id IN "
-                                "(SELECT token_id FROM OWNER WHERE identity_id = '%1' )")
-                                .arg(id));
-
-    query_str = QString::fromLatin1("SELECT token FROM TOKENS "
-            "WHERE id IN "
-            "(SELECT token_id FROM ACL WHERE identity_id = '%1' )")
-            .arg(id);
-    query = exec(query_str);
-    QStringList securityTokens;
-    while (query.next()) {
-        securityTokens.append(query.value(0).toString());
-    }
-    query.clear();
-    MethodMap methods;
-    query_str = QString::fromLatin1(
-            "SELECT DISTINCT ACL.method_id, METHODS.method FROM "
-            "( ACL JOIN METHODS ON ACL.method_id = METHODS.id ) "
-            "WHERE ACL.identity_id = '%1'").arg(id);
-    query = exec(query_str);
-    while (query.next()) {
-        QStringList mechanisms = queryList(
-                QString::fromLatin1("SELECT DISTINCT MECHANISMS.mechanism FROM "
-                        "( MECHANISMS JOIN ACL "
-                        "ON ACL.mechanism_id = MECHANISMS.id ) "
-                        "WHERE ACL.method_id = '%1' AND ACL.identity_id = '%2' ")
-                        .arg(query.value(0).toInt()).arg(id));
-            methods.insert(query.value(1).toString(), mechanisms);
-    }
-    query.clear();
+    int type = q.value(3).toInt();
 
     int refCount = 0;
     //TODO query for refcount
@@ -783,10 +1584,6 @@ SignonIdentityInfo MetaDataDB::identity(const quint32 id)
         info.setUserName(username);
     info.setStorePassword(savePassword);
     info.setCaption(caption);
-    info.setMethods(methods);
-    info.setRealms(realms);
-    info.setAccessControlList(securityTokens);
-    info.setOwnerList(ownerTokens);
     info.setType(type);
     info.setRefCount(refCount);
     info.setValidated(validated);
@@ -794,36 +1591,395 @@ SignonIdentityInfo MetaDataDB::identity(const quint32 id)
     return info;
 }
 
+/* ACL rows without a mechanism have a NULL mechanism_id, which leaves the
+ * method with an empty mechanism list; rows without a method are skipped. */
+void MetaDataDB::addMethodRow(MethodMap &methods, const QVariant &methodId,
+                              const QVariant &mechanismId) const
+{
+    QString method = m_methods.name(methodId.toUInt());
+    if (method.isEmpty())
+        return;
+
+    MechanismsList &mechanisms = methods[method];
+    QString mechanism = m_mechanisms.name(mechanismId.toUInt());
+    if (!mechanism.isEmpty())
+        mechanisms.append(mechanism);
+}
+
+/* Identity filters map each criterion to a regular expression which must
+ * match the whole field (for realms and methods, any one of them). When the
+ * head of a pattern is a plain literal the candidates are narrowed in SQL:
+ * a pure literal becomes an equality test and "literal.*" a GLOB prefix
+ * test, both of which can be answered from an index. Only the remaining
+ * patterns are evaluated as regular expressions, and only on the rows which
+ * passed the SQL tests. */
+struct FilterPattern
+{
+    enum MatchType {
+        Exact = 0,
+        Prefix,
+        RegExp
+    };
+
+    FilterPattern(): matchType(Exact) {}
+
+    bool matches(const QString &value) const
+    {
+        switch (matchType) {
+        case Exact: return value == literal;
+        case Prefix: return value.startsWith(literal);
+        default: return regExp.match(value).hasMatch();
+        }
+    }
+
+    bool matchesAny(const QStringList &values) const
+    {
+        foreach (const QString &value, values) {
+            if (matches(value)) return true;
+        }
+        return false;
+    }
+
+    MatchType matchType;
+    QString literal;
+    QRegularExpression regExp;
+};
+
+static FilterPattern parseFilterPattern(const QString &pattern)
+{
+    static const QString specialChars = S("\\^$.|?*+()[]{}");
+    FilterPattern filterPattern;
+
+    /* With an alternation no literal head is shared by all the matches */
+    int i = 0;
+    if (!pattern.contains(QLatin1Char('|'))) {
+        while (i < pattern.length()) {
+            QChar c = pattern.at(i);
+            if (c == QLatin1Char('\\') && i + 1 < pattern.length() &&
+                specialChars.contains(pattern.at(i + 1))) {
+                c = pattern.at(++i);
+            } else if (specialChars.contains(c)) {
+                break;
+            }
+            filterPattern.literal.append(c);
+            i++;
+        }
+    }
+
+    QString rest = pattern.mid(i);
+    if (rest.isEmpty()) {
+        filterPattern.matchType = FilterPattern::Exact;
+    } else if (rest == S(".*")) {
+        filterPattern.matchType = FilterPattern::Prefix;
+    } else {
+        /* A quantifier makes the last literal character optional */
+        if (rest.startsWith(QLatin1Char('?')) ||
+            rest.startsWith(QLatin1Char('*')) ||
+            rest.startsWith(QLatin1Char('{')))
+            filterPattern.literal.chop(1);
+        filterPattern.matchType = FilterPattern::RegExp;
+        filterPattern.regExp =
+            QRegularExpression(S("\\A(?:") + pattern + S(")\\z"));
+    }
+    return filterPattern;
+}
+
+/* Returns the SQL test narrowing column to the values which can match the
+ * pattern, or an empty string if the pattern has no literal head. */
+static QString filterCondition(const QString &column,
+                               const QString &param,
+                               const FilterPattern &pattern,
+                               QVariantMap &bindings)
+{
+    if (pattern.matchType == FilterPattern::Exact) {
+        bindings.insert(param, pattern.literal);
+        return column + S(" = ") + param;
+    }
+
+    if (pattern.literal.isEmpty()) return QString();
+
+    QString glob = pattern.literal;
+    glob.replace(QLatin1Char('['), S("[[]"));
+    glob.replace(QLatin1Char('*'), S("[*]"));
+    glob.replace(QLatin1Char('?'), S("[?]"));
+    bindings.insert(param, glob + QLatin1Char('*'));
+    return column + S(" GLOB ") + param;
+}
+
+static bool identityMatches(const SignonIdentityInfo &info,
+                            const QMap<QString, FilterPattern> &patterns)
+{
+    QMapIterator<QString, FilterPattern> it(patterns);
+    while (it.hasNext()) {
+        it.next();
+        const FilterPattern &pattern = it.value();
+        bool ok;
+        if (it.key() == SIGNOND_IDENTITY_FILTER_CAPTION) {
+            ok = pattern.matches(info.caption());
+        } else if (it.key() == SIGNOND_IDENTITY_FILTER_USERNAME) {
+            ok = pattern.matches(info.userName());
+        } else if (it.key() == SIGNOND_IDENTITY_FILTER_TYPE) {
+            ok = pattern.matches(QString::number(info.type()));
+        } else if (it.key() == SIGNOND_IDENTITY_FILTER_REALM) {
+            ok = pattern.matchesAny(info.realms());
+        } else {
+            ok = pattern.matchesAny(info.methods().keys());
+        }
+        if (!ok) return false;
+    }
+    return true;
+}
+
+static void bindValues(QSqlQuery &q, const QVariantMap &bindings)
+{
+    QMapIterator<QString, QVariant> it(bindings);
+    while (it.hasNext()) {
+        it.next();
+        q.bindValue(it.key(), it.value());
+    }
+}
+
+SignonIdentityInfo MetaDataDB::identity(const quint32 id,
+                                        IdentityFields fields)
+{
+    /* The whole identity is loaded with a fixed number of statements, no
+     * matter how many methods and mechanisms it has; each part which is not
+     * requested saves one. */
+    QSqlQuery q = preparedQuery(S("SELECT caption, username, flags, type "
+                                  "FROM CREDENTIALS WHERE id = :id"));
+    q.bindValue(S(":id"), id);
+    exec(q);
+
+    if (!q.first()) {
+        TRACE() << "No result or invalid credentials query.";
+        return SignonIdentityInfo();
+    }
+
+    SignonIdentityInfo info = identityFromRecord(id, q);
+    q.finish();
+
+    if (fields & RealmsField) {
+        q = preparedQuery(
+            S("SELECT realm FROM REALMS WHERE identity_id = :id"));
+        q.bindValue(S(":id"), id);
+        info.setRealms(queryList(q));
+    }
+
+    if (fields & OwnerListField) {
+        q = preparedQuery(
+            S("SELECT token FROM TOKENS "
+              "WHERE id IN "
+              "(SELECT token_id FROM OWNER WHERE identity_id = :id )"));
+        q.bindValue(S(":id"), id);
+        info.setOwnerList(queryList(q));
+    }
+
+    if (fields & AccessControlListField) {
+        q = preparedQuery(
+            S("SELECT token FROM TOKENS "
+              "WHERE id IN "
+              "(SELECT token_id FROM ACL WHERE identity_id = :id )"));
+        q.bindValue(S(":id"), id);
+        info.setAccessControlList(queryList(q));
+    }
+
+    if (!(fields & MethodsField))
+        return info;
+
+    MethodMap methods;
+    q = preparedQuery(
+        S("SELECT DISTINCT method_id, mechanism_id FROM ACL "
+          "WHERE identity_id = :id"));
+    q.bindValue(S(":id"), id);
+    exec(q);
+    while (q.next()) {
+        addMethodRow(methods, q.value(0), q.value(1));
+    }
+    q.finish();
+    info.setMethods(methods);
+
+    return info;
+}
+
 QList<SignonIdentityInfo> MetaDataDB::identities(const QMap<QString,
-                                                 QString> &filter)
+                                                 QString> &filter,
+                                                 quint32 afterId,
+                                                 int pageSize,
+                                                 quint32 *nextId)
 {
     TRACE();
-    Q_UNUSED(filter)
     QList<SignonIdentityInfo> result;
+    if (nextId != 0) *nextId = 0;
+
+    QStringList conditions;
+    QVariantMap bindings;
+    QMap<QString, FilterPattern> patterns;
+    QMapIterator<QString, QString> it(filter);
+    while (it.hasNext()) {
+        it.next();
+        FilterPattern pattern = parseFilterPattern(it.value());
+        QString param = S(":filter") + QString::number(patterns.count());
+        QString condition;
+        if (it.key() == SIGNOND_IDENTITY_FILTER_CAPTION) {
+            condition = filterCondition(S("caption"), param,
+                                        pattern, bindings);
+        } else if (it.key() == SIGNOND_IDENTITY_FILTER_USERNAME) {
+            condition = filterCondition(S("username"), param,
+                                        pattern, bindings);
+        } else if (it.key() == SIGNOND_IDENTITY_FILTER_TYPE) {
+            condition = filterCondition(S("type"), param, pattern, bindings);
+        } else if (it.key() == SIGNOND_IDENTITY_FILTER_REALM) {
+            condition = filterCondition(S("realm"), param, pattern, bindings);
+            if (!condition.isEmpty())
+                condition = S("id IN (SELECT identity_id FROM REALMS "
+                              "WHERE ") + condition + S(")");
+        } else if (it.key() == SIGNOND_IDENTITY_FILTER_AUTHMETHOD) {
+            condition = filterCondition(S("METHODS.method"), param,
+                                        pattern, bindings);
+            if (!condition.isEmpty())
+                condition = S("id IN (SELECT ACL.identity_id FROM "
+                              "ACL JOIN METHODS ON ACL.method_id = METHODS.id "
+                              "WHERE ") + condition + S(")");
+        } else {
+            TRACE() << "Ignoring unknown filter criteria:" << it.key();
+            continue;
+        }
+
+        if (!condition.isEmpty())
+            conditions.append(condition);
+        patterns.insert(it.key(), pattern);
+    }
+
+    /* Pages are delimited by id, rather than by offset: identities added or
+     * removed meanwhile don't shift the following pages. */
+    QString order = S(" ORDER BY id");
+    if (pageSize > 0) {
+        conditions.append(S("id > :afterId"));
+        bindings.insert(S(":afterId"), afterId);
+        bindings.insert(S(":pageSize"), pageSize);
+        order += S(" LIMIT :pageSize");
+    }
+
+    /* The related tables are only read for the identities which passed the
+     * SQL tests of the filter. */
+    QString candidates;
+    if (!conditions.isEmpty()) {
+        candidates = S(" IN (SELECT id FROM CREDENTIALS WHERE ") +
+            conditions.join(S(" AND ")) +
+            (pageSize > 0 ? order : QString()) + S(")");
+    }
+
+    /* Each table is read exactly once, and the identities are then
+     * assembled in memory: the cost grows with the number of rows, not with
+     * the number of identities. */
+    QHash<quint32, QStringList> realms;
+    QHash<quint32, QStringList> ownerTokens;
+    QHash<quint32, QStringList> securityTokens;
+    QHash<quint32, MethodMap> methods;
 
-    QString queryStr(QString::fromLatin1("SELECT id FROM credentials"));
+    bool allOk = true;
+    QSqlQuery q = preparedQuery(
+        S("SELECT identity_id, realm FROM REALMS") +
+        (candidates.isEmpty() ? QString() :
+         S(" WHERE identity_id") + candidates));
+    bindValues(q, bindings);
+    exec(q);
+    if (errorOccurred()) allOk = false;
+    while (q.next()) {
+        realms[q.value(0).toUInt()].append(q.value(1).toString());
+    }
+    q.finish();
+
+    q = preparedQuery(
+        S("SELECT DISTINCT OWNER.identity_id, TOKENS.token FROM "
+          "OWNER JOIN TOKENS ON OWNER.token_id = TOKENS.id") +
+        (candidates.isEmpty() ? QString() :
+         S(" WHERE OWNER.identity_id") + candidates));
+    bindValues(q, bindings);
+    exec(q);
+    if (errorOccurred()) allOk = false;
+    while (q.next()) {
+        ownerTokens[q.value(0).toUInt()].append(q.value(1).toString());
+    }
+    q.finish();
+
+    q = preparedQuery(
+        S("SELECT DISTINCT ACL.identity_id, TOKENS.token FROM "
+          "ACL JOIN TOKENS ON ACL.token_id = TOKENS.id") +
+        (candidates.isEmpty() ? QString() :
+         S(" WHERE ACL.identity_id") + candidates));
+    bindValues(q, bindings);
+    exec(q);
+    if (errorOccurred()) allOk = false;
+    while (q.next()) {
+        securityTokens[q.value(0).toUInt()].append(q.value(1).toString());
+    }
+    q.finish();
+
+    q = preparedQuery(
+        S("SELECT DISTINCT identity_id, method_id, mechanism_id FROM ACL") +
+        (candidates.isEmpty() ? QString() :
+         S(" WHERE identity_id") + candidates));
+    bindValues(q, bindings);
+    exec(q);
+    if (errorOccurred()) allOk = false;
+    while (q.next()) {
+        addMethodRow(methods[q.value(0).toUInt()], q.value(1), q.value(2));
+    }
+    q.finish();
 
-    // TODO - process filtering step here !!!
+    if (!allOk) {
+        TRACE() << "Error occurred while fetching credentials from database.";
+        return result;
+    }
 
-    queryStr += QString::fromLatin1(" ORDER BY id");
+    QString queryStr(QString::fromLatin1(
+        "SELECT caption, username, flags, type, id FROM CREDENTIALS"));
+    if (!conditions.isEmpty())
+        queryStr += S(" WHERE ") + conditions.join(S(" AND "));
+    queryStr += order;
 
-    QSqlQuery query = exec(queryStr);
+    q = preparedQuery(queryStr);
+    bindValues(q, bindings);
+    exec(q);
     if (errorOccurred()) {
         TRACE() << "Error occurred while fetching credentials from database.";
         return result;
     }
 
-    while (query.next()) {
-        SignonIdentityInfo info = identity(query.value(0).toUInt());
-        if (errorOccurred())
-            break;
-        result << info;
+    int examined = 0;
+    quint32 lastId = 0;
+    while (q.next()) {
+        quint32 id = q.value(4).toUInt();
+        SignonIdentityInfo info = identityFromRecord(id, q);
+        info.setRealms(realms.value(id));
+        info.setOwnerList(ownerTokens.value(id));
+        info.setAccessControlList(securityTokens.value(id));
+        info.setMethods(methods.value(id));
+        if (identityMatches(info, patterns))
+            result << info;
+        examined++;
+        lastId = id;
     }
 
-    query.clear();
+    /* A full page means that there might be more */
+    if (pageSize > 0 && examined == pageSize && nextId != 0)
+        *nextId = lastId;
+
+    q.finish();
     return result;
 }
 
+/* A row of the ACL table: method id, mechanism id and token; the ids are 0
+ * and the token is null where the column is NULL. */
+typedef QPair<QPair<quint32, quint32>, QString> AclEntry;
+
+static AclEntry aclEntry(quint32 methodId, quint32 mechanismId,
+                         const QString &token)
+{
+    return AclEntry(qMakePair(methodId, mechanismId), token);
+}
+
 quint32 MetaDataDB::updateIdentity(const SignonIdentityInfo &info)
 {
     if (!startTransaction()) {
@@ -831,14 +1987,26 @@ quint32 MetaDataDB::updateIdentity(const SignonIdentityInfo &info)
         return 0;
     }
 
-    quint32 id = updateCredentials(info);
-    if (id == 0) {
+    /* Only the rows which differ from the stored ones are written; the
+     * identity counts as changed if any was. */
+    qint64 changesBefore = totalChanges();
+    quint32 id;
+    if (!info.isNew() && !credentialsChanged(info)) {
+        id = info.id();
+    } else {
+        id = updateCredentials(info);
+    }
+    if (id == 0 || errorOccurred()) {
         rollback();
         return 0;
     }
 
     /* Methods inserts */
-    insertMethods(info.methods());
+    if (!insertMethods(info.methods())) {
+        TRACE() << "Error in inserting methods";
+        rollback();
+        return 0;
+    }
 
     if (!updateRealms(id, info.realms(), info.isNew())) {
         TRACE() << "Error in updating realms";
@@ -846,128 +2014,160 @@ quint32 MetaDataDB::updateIdentity(const SignonIdentityInfo &info)
         return 0;
     }
 
-    /* Security tokens insert */
-    foreach (QString token, info.accessControlList()) {
-        QSqlQuery tokenInsert = newQuery();
-        tokenInsert.prepare(S("INSERT OR IGNORE INTO TOKENS (token) "
-                              "VALUES ( :token )"));
-        tokenInsert.bindValue(S(":token"), token);
-        exec(tokenInsert);
-    }
-
-    foreach (QString token, info.ownerList()) {
-        if (!token.isEmpty()) {
-            QSqlQuery tokenInsert = newQuery();
-            tokenInsert.prepare(S("INSERT OR IGNORE INTO TOKENS (token) "
-                                  "VALUES ( :token )"));
-            tokenInsert.bindValue(S(":token"), token);
-            exec(tokenInsert);
-        }
-    }
-
-    if (!info.isNew()) {
-        //remove acl
-        QString queryStr = QString::fromLatin1(
-                    "DELETE FROM ACL WHERE "
-                    "identity_id = '%1'")
-                    .arg(info.id());
-        QSqlQuery insertQuery = exec(queryStr);
-        insertQuery.clear();
-        //remove owner
-        queryStr = QString::fromLatin1(
-                    "DELETE FROM OWNER WHERE "
-                    "identity_id = '%1'")
-                    .arg(info.id());
-        insertQuery = exec(queryStr);
-        insertQuery.clear();
-    }
-
-    /* ACL insert, this will do basically identity level ACL */
+    /* The ACL, this will do basically identity level ACL; the rows are
+     * written in the order of the lists given by the client, the sets only
+     * tell which are already there. */
+    QList<AclEntry> acl;
+    QSet<AclEntry> aclSet;
     QMapIterator<QString, QStringList> it(info.methods());
     while (it.hasNext()) {
         it.next();
-        if (!info.accessControlList().isEmpty()) {
-            foreach (QString token, info.accessControlList()) {
-                foreach (QString mech, it.value()) {
-                    QSqlQuery aclInsert = newQuery();
-                    aclInsert.prepare(S("INSERT OR REPLACE INTO ACL "
-                                        "(identity_id, method_id, mechanism_id, token_id) "
-                                        "VALUES ( :id, "
-                                        "( SELECT id FROM METHODS WHERE method = :method ),"
-                                        "( SELECT id FROM MECHANISMS WHERE mechanism= :mech ), "
-                                        "( SELECT id FROM TOKENS WHERE token = :token ))"));
-                    aclInsert.bindValue(S(":id"), id);
-                    aclInsert.bindValue(S(":method"), it.key());
-                    aclInsert.bindValue(S(":mech"), mech);
-                    aclInsert.bindValue(S(":token"), token);
-                    exec(aclInsert);
-                }
-                //insert entires for empty mechs list
-                if (it.value().isEmpty()) {
-                    QSqlQuery aclInsert = newQuery();
-                    aclInsert.prepare(S("INSERT OR REPLACE INTO ACL (identity_id, method_id, token_id) "
-                                        "VALUES ( :id, "
-                                        "( SELECT id FROM METHODS WHERE method = :method ),"
-                                        "( SELECT id FROM TOKENS WHERE token = :token ))"));
-                    aclInsert.bindValue(S(":id"), id);
-                    aclInsert.bindValue(S(":method"), it.key());
-                    aclInsert.bindValue(S(":token"), token);
-                    exec(aclInsert);
-                }
-            }
-        } else {
-            foreach (QString mech, it.value()) {
-                QSqlQuery aclInsert = newQuery();
-                aclInsert.prepare(S("INSERT OR REPLACE INTO ACL "
-                                    "(identity_id, method_id, mechanism_id) "
-                                    "VALUES ( :id, "
-                                    "( SELECT id FROM METHODS WHERE method = :method ),"
-                                    "( SELECT id FROM MECHANISMS WHERE mechanism= :mech )"
-                                    ")"));
-                aclInsert.bindValue(S(":id"), id);
-                aclInsert.bindValue(S(":method"), it.key());
-                aclInsert.bindValue(S(":mech"), mech);
-                exec(aclInsert);
-            }
-            //insert entires for empty mechs list
-            if (it.value().isEmpty()) {
-                QSqlQuery aclInsert = newQuery();
-                aclInsert.prepare(S("INSERT OR REPLACE INTO ACL (identity_id, method_id) "
-                                    "VALUES ( :id, "
-                                    "( SELECT id FROM METHODS WHERE method = :method )"
-                                    ")"));
-                aclInsert.bindValue(S(":id"), id);
-                aclInsert.bindValue(S(":method"), it.key());
-                exec(aclInsert);
+        quint32 methodId = m_methods.id(it.key());
+        QStringList tokens = info.accessControlList();
+        /* A null token stands for the missing ACL */
+        if (tokens.isEmpty())
+            tokens.append(QString());
+        foreach (const QString &token, tokens) {
+            QList<AclEntry> entries;
+            foreach (const QString &mech, it.value())
+                entries.append(aclEntry(methodId, m_mechanisms.id(mech),
+                                        token));
+            //entries for empty mechs list
+            if (it.value().isEmpty())
+                entries.append(aclEntry(methodId, 0, token));
+
+            foreach (const AclEntry &entry, entries) {
+                if (aclSet.contains(entry)) continue;
+                aclSet.insert(entry);
+                acl.append(entry);
             }
         }
     }
-    //insert acl in case where methods are missing
+    //acl in case where methods are missing
     if (info.methods().isEmpty()) {
-        foreach (QString token, info.accessControlList()) {
-            QSqlQuery aclInsert = newQuery();
-            aclInsert.prepare(S("INSERT OR REPLACE INTO ACL "
-                                "(identity_id, token_id) "
-                                "VALUES ( :id, "
-                                "( SELECT id FROM TOKENS WHERE token = :token ))"));
-            aclInsert.bindValue(S(":id"), id);
-            aclInsert.bindValue(S(":token"), token);
-            exec(aclInsert);
+        foreach (const QString &token, info.accessControlList()) {
+            AclEntry entry = aclEntry(0, 0, token);
+            if (aclSet.contains(entry)) continue;
+            aclSet.insert(entry);
+            acl.append(entry);
         }
     }
 
-    //insert owner list
-    foreach (QString token, info.ownerList()) {
-        if (!token.isEmpty()) {
-            QSqlQuery ownerInsert = newQuery();
-            ownerInsert.prepare(S("INSERT OR REPLACE INTO OWNER "
-                            "(identity_id, token_id) "
-                            "VALUES ( :id, "
-                            "( SELECT id FROM TOKENS WHERE token = :token ))"));
-            ownerInsert.bindValue(S(":id"), id);
-            ownerInsert.bindValue(S(":token"), token);
-            exec(ownerInsert);
+    QStringList owners;
+    QSet<QString> ownerSet;
+    foreach (const QString &token, info.ownerList()) {
+        if (token.isEmpty() || ownerSet.contains(token)) continue;
+        ownerSet.insert(token);
+        owners.append(token);
+    }
+
+    /* Drop the stored rows which are not wanted anymore (including any
+     * duplicates), and remove the others from the rows to be inserted */
+    QSet<QString> knownTokens;
+    if (!info.isNew()) {
+        QList<qint64> staleRows;
+        QSet<AclEntry> storedAcl;
+        QSqlQuery q = preparedQuery(
+            S("SELECT ACL.rowid, method_id, mechanism_id, token "
+              "FROM ACL LEFT JOIN TOKENS ON ACL.token_id = TOKENS.id "
+              "WHERE identity_id = :id"));
+        q.bindValue(S(":id"), id);
+        exec(q);
+        while (q.next()) {
+            AclEntry entry = aclEntry(q.value(1).toUInt(),
+                                      q.value(2).toUInt(),
+                                      q.value(3).toString());
+            if (!aclSet.contains(entry) || storedAcl.contains(entry)) {
+                staleRows.append(q.value(0).toLongLong());
+            } else {
+                storedAcl.insert(entry);
+                knownTokens.insert(entry.second);
+            }
+        }
+        q.finish();
+        for (int i = acl.count() - 1; i >= 0; i--) {
+            if (storedAcl.contains(acl[i]))
+                acl.removeAt(i);
+        }
+
+        foreach (qint64 rowId, staleRows) {
+            QSqlQuery deleteQuery =
+                preparedQuery(S("DELETE FROM ACL WHERE rowid = :rowid"));
+            deleteQuery.bindValue(S(":rowid"), rowId);
+            exec(deleteQuery);
         }
+
+        staleRows.clear();
+        QSet<QString> storedOwners;
+        q = preparedQuery(
+            S("SELECT OWNER.rowid, token "
+              "FROM OWNER LEFT JOIN TOKENS ON OWNER.token_id = TOKENS.id "
+              "WHERE identity_id = :id"));
+        q.bindValue(S(":id"), id);
+        exec(q);
+        while (q.next()) {
+            QString token = q.value(1).toString();
+            if (!ownerSet.contains(token) || storedOwners.contains(token)) {
+                staleRows.append(q.value(0).toLongLong());
+            } else {
+                storedOwners.insert(token);
+                knownTokens.insert(token);
+            }
+        }
+        q.finish();
+        for (int i = owners.count() - 1; i >= 0; i--) {
+            if (storedOwners.contains(owners[i]))
+                owners.removeAt(i);
+        }
+
+        foreach (qint64 rowId, staleRows) {
+            QSqlQuery deleteQuery =
+                preparedQuery(S("DELETE FROM OWNER WHERE rowid = :rowid"));
+            deleteQuery.bindValue(S(":rowid"), rowId);
+            exec(deleteQuery);
+        }
+    }
+
+    /* Security tokens insert */
+    foreach (const AclEntry &entry, acl) {
+        if (!entry.second.isNull())
+            insertToken(entry.second, knownTokens);
+    }
+    foreach (const QString &token, owners) {
+        insertToken(token, knownTokens);
+    }
+
+    /* ACL insert */
+    foreach (const AclEntry &entry, acl) {
+        QSqlQuery aclInsert = preparedQuery(
+            S("INSERT INTO ACL "
+              "(identity_id, method_id, mechanism_id, token_id) "
+              "VALUES ( :id, :method_id, :mech_id, "
+              "( SELECT id FROM TOKENS WHERE token = :token ))"));
+        aclInsert.bindValue(S(":id"), id);
+        aclInsert.bindValue(S(":method_id"), nameIdValue(entry.first.first));
+        aclInsert.bindValue(S(":mech_id"), nameIdValue(entry.first.second));
+        aclInsert.bindValue(S(":token"), entry.second.isNull() ?
+                            QVariant(QVariant::String) :
+                            QVariant(entry.second));
+        exec(aclInsert);
+    }
+
+    //insert owner list
+    foreach (const QString &token, owners) {
+        QSqlQuery ownerInsert = preparedQuery(
+            S("INSERT INTO OWNER "
+              "(identity_id, token_id) "
+              "VALUES ( :id, "
+              "( SELECT id FROM TOKENS WHERE token = :token ))"));
+        ownerInsert.bindValue(S(":id"), id);
+        ownerInsert.bindValue(S(":token"), token);
+        exec(ownerInsert);
+    }
+
+    if (totalChanges() != changesBefore && !recordChange(id, false)) {
+        rollback();
+        return 0;
     }
 
     if (commit()) {
@@ -979,28 +2179,52 @@ quint32 MetaDataDB::updateIdentity(const SignonIdentityInfo &info)
     }
 }
 
+void MetaDataDB::insertToken(const QString &token, QSet<QString> &knownTokens)
+{
+    if (knownTokens.contains(token)) return;
+
+    QSqlQuery tokenInsert = preparedQuery(
+        S("INSERT OR IGNORE INTO TOKENS (token) "
+          "VALUES ( :token )"));
+    tokenInsert.bindValue(S(":token"), token);
+    exec(tokenInsert);
+    knownTokens.insert(token);
+}
+
 bool MetaDataDB::removeIdentity(const quint32 id)
 {
     TRACE();
 
+    /* The tombstone is only written if the identity exists */
     QStringList queries = QStringList()
-        << QString::fromLatin1(
-            "DELETE FROM CREDENTIALS WHERE id = %1").arg(id)
-        << QString::fromLatin1(
-            "DELETE FROM ACL WHERE identity_id = %1").arg(id)
-        << QString::fromLatin1(
-            "DELETE FROM REALMS WHERE identity_id = %1").arg(id)
-        << QString::fromLatin1(
-            "DELETE FROM owner WHERE identity_id = %1").arg(id);
+        << QLatin1String("INSERT OR REPLACE INTO CHANGES "
+                         "(seq, identity_id, removed) "
+                         "SELECT :seq, id, 1 FROM CREDENTIALS WHERE id = :id")
+        << QLatin1String("DELETE FROM CREDENTIALS WHERE id = :id")
+        << QLatin1String("DELETE FROM ACL WHERE identity_id = :id")
+        << QLatin1String("DELETE FROM REALMS WHERE identity_id = :id")
+        << QLatin1String("DELETE FROM owner WHERE identity_id = :id");
+
+    QVariantMap bindings;
+    bindings.insert(S(":id"), id);
+    bindings.insert(S(":seq"), qint64(m_changeSequence + 1));
+    if (!transactionalExec(queries, bindings))
+        return false;
 
-    return transactionalExec(queries);
+    /* No tombstone is written for a missing identity */
+    return loadChangeSequence();
 }
 
 bool MetaDataDB::clear()
 {
     TRACE();
 
+    /* Each identity gets its own tombstone, numbered after the last
+     * change */
     QStringList clearCommands = QStringList()
+        << QLatin1String("INSERT OR REPLACE INTO CHANGES "
+                         "(seq, identity_id, removed) "
+                         "SELECT :seq + id, id, 1 FROM CREDENTIALS")
         << QLatin1String("DELETE FROM CREDENTIALS")
         << QLatin1String("DELETE FROM METHODS")
         << QLatin1String("DELETE FROM MECHANISMS")
@@ -1009,23 +2233,53 @@ bool MetaDataDB::clear()
         << QLatin1String("DELETE FROM TOKENS")
         << QLatin1String("DELETE FROM OWNER");
 
-    return transactionalExec(clearCommands);
+    QVariantMap bindings;
+    bindings.insert(S(":seq"), qint64(m_changeSequence));
+    if (!transactionalExec(clearCommands, bindings))
+        return false;
+
+    m_methods.clear();
+    m_mechanisms.clear();
+    return loadChangeSequence();
 }
 
 QStringList MetaDataDB::accessControlList(const quint32 identityId)
 {
-    return queryList(QString::fromLatin1("SELECT token FROM TOKENS "
-            "WHERE id IN "
-            "(SELECT token_id FROM ACL WHERE identity_id = '%1' )")
-            .arg(identityId));
+    QSqlQuery q = preparedQuery(S("SELECT token FROM TOKENS "
+                                  "WHERE id IN "
+                                  "(SELECT token_id FROM ACL "
+                                  "WHERE identity_id = :id )"));
+    q.bindValue(S(":id"), identityId);
+    return queryList(q);
 }
 
 QStringList MetaDataDB::ownerList(const quint32 identityId)
 {
-    return queryList(QString::fromLatin1("SELECT token FROM TOKENS "
-            "WHERE id IN "
-            "(SELECT token_id FROM OWNER WHERE identity_id = '%1' )")
-            .arg(identityId));
+    QSqlQuery q = preparedQuery(S("SELECT token FROM TOKENS "
+                                  "WHERE id IN "
+                                  "(SELECT token_id FROM OWNER "
+                                  "WHERE identity_id = :id )"));
+    q.bindValue(S(":id"), identityId);
+    return queryList(q);
+}
+
+bool MetaDataDB::allAccessTokens(QHash<quint32, QStringList> &acls,
+                                 QHash<quint32, QStringList> &owners)
+{
+    QSqlQuery q = exec(S("SELECT DISTINCT ACL.identity_id, TOKENS.token "
+                         "FROM ACL JOIN TOKENS ON TOKENS.id = ACL.token_id"));
+    if (errorOccurred()) return false;
+    while (q.next())
+        acls[q.value(0).toUInt()].append(q.value(1).toString());
+    q.finish();
+
+    q = exec(S("SELECT DISTINCT OWNER.identity_id, TOKENS.token "
+               "FROM OWNER JOIN TOKENS ON TOKENS.id = OWNER.token_id"));
+    if (errorOccurred()) return false;
+    while (q.next())
+        owners[q.value(0).toUInt()].append(q.value(1).toString());
+    q.finish();
+    return true;
 }
 
 bool MetaDataDB::addReference(const quint32 id,
@@ -1042,22 +2296,22 @@ bool MetaDataDB::addReference(const quint32 id,
     bool allOk = true;
 
     /* Security token insert */
-    QSqlQuery tokenInsert = newQuery();
-    tokenInsert.prepare(S("INSERT OR IGNORE INTO TOKENS (token) "
-                          "VALUES ( :token )"));
+    QSqlQuery tokenInsert = preparedQuery(
+        S("INSERT OR IGNORE INTO TOKENS (token) "
+          "VALUES ( :token )"));
     tokenInsert.bindValue(S(":token"), token);
     exec(tokenInsert);
     if (errorOccurred()) {
                 allOk = false;
     }
 
-    QSqlQuery refsInsert = newQuery();
-    refsInsert.prepare(S("INSERT OR REPLACE INTO REFS "
-                         "(identity_id, token_id, ref) "
-                         "VALUES ( :id, "
-                         "( SELECT id FROM TOKENS WHERE token = :token ),"
-                         ":reference"
-                         ")"));
+    QSqlQuery refsInsert = preparedQuery(
+        S("INSERT OR REPLACE INTO REFS "
+          "(identity_id, token_id, ref) "
+          "VALUES ( :id, "
+          "( SELECT id FROM TOKENS WHERE token = :token ),"
+          ":reference"
+          ")"));
     refsInsert.bindValue(S(":id"), id);
     refsInsert.bindValue(S(":token"), token);
     refsInsert.bindValue(S(":reference"), reference);
@@ -1066,7 +2320,7 @@ bool MetaDataDB::addReference(const quint32 id,
                 allOk = false;
     }
 
-    if (allOk && commit()) {
+    if (allOk && recordChange(id, false) && commit()) {
         TRACE() << "Data insertion ok.";
         return true;
     }
@@ -1096,16 +2350,18 @@ bool MetaDataDB::removeReference(const quint32 id,
     QSqlQuery refsDelete = newQuery();
 
     if (reference.isEmpty()) {
-        refsDelete.prepare(S("DELETE FROM REFS "
-                             "WHERE identity_id = :id AND "
-                             "token_id = ( SELECT id FROM TOKENS WHERE token = :token )"));
+        refsDelete = preparedQuery(
+            S("DELETE FROM REFS "
+              "WHERE identity_id = :id AND "
+              "token_id = ( SELECT id FROM TOKENS WHERE token = :token )"));
         refsDelete.bindValue(S(":id"), id);
         refsDelete.bindValue(S(":token"), token);
     } else {
-        refsDelete.prepare(S("DELETE FROM REFS "
-                             "WHERE identity_id = :id AND "
-                             "token_id = ( SELECT id FROM TOKENS WHERE token = :token ) "
-                             "AND ref = :ref"));
+        refsDelete = preparedQuery(
+            S("DELETE FROM REFS "
+              "WHERE identity_id = :id AND "
+              "token_id = ( SELECT id FROM TOKENS WHERE token = :token ) "
+              "AND ref = :ref"));
         refsDelete.bindValue(S(":id"), id);
         refsDelete.bindValue(S(":token"), token);
         refsDelete.bindValue(S(":ref"), reference);
@@ -1116,7 +2372,7 @@ bool MetaDataDB::removeReference(const quint32 id,
                 allOk = false;
     }
 
-    if (allOk && commit()) {
+    if (allOk && recordChange(id, false) && commit()) {
         TRACE() << "Data delete ok.";
         return true;
     }
@@ -1127,14 +2383,16 @@ bool MetaDataDB::removeReference(const quint32 id,
 
 QStringList MetaDataDB::references(const quint32 id, const QString &token)
 {
-    if (token.isEmpty())
-        return queryList(QString::fromLatin1("SELECT ref FROM REFS "
-            "WHERE identity_id = '%1'")
-            .arg(id));
-    QSqlQuery q = newQuery();
-    q.prepare(S("SELECT ref FROM REFS "
-                "WHERE identity_id = :id AND "
-                "token_id = (SELECT id FROM TOKENS WHERE token = :token )"));
+    if (token.isEmpty()) {
+        QSqlQuery q =
+            preparedQuery(S("SELECT ref FROM REFS WHERE identity_id = :id"));
+        q.bindValue(S(":id"), id);
+        return queryList(q);
+    }
+    QSqlQuery q = preparedQuery(
+        S("SELECT ref FROM REFS "
+          "WHERE identity_id = :id AND "
+          "token_id = (SELECT id FROM TOKENS WHERE token = :token )"));
     q.bindValue(S(":id"), id);
     q.bindValue(S(":token"), token);
     return queryList(q);
@@ -1144,25 +2402,23 @@ bool MetaDataDB::insertMethods(QMap<QString, QStringList> methods)
 {
     bool allOk = true;
 
-    if (methods.isEmpty()) return false;
-    //insert (unique) method names
+    //insert (unique) method names, unless they are known already
     QMapIterator<QString, QStringList> it(methods);
     while (it.hasNext()) {
         it.next();
-        QSqlQuery methodInsert = newQuery();
-        methodInsert.prepare(S("INSERT OR IGNORE INTO METHODS (method) "
-                               "VALUES( :method )"));
-        methodInsert.bindValue(S(":method"), it.key());
-        exec(methodInsert);
-        if (errorOccurred()) allOk = false;
+        if (m_methods.id(it.key()) == 0 &&
+            insertName(m_methods,
+                       S("INSERT INTO METHODS (method) VALUES( :name )"),
+                       it.key()) == 0)
+            allOk = false;
         //insert (unique) mechanism names
         foreach (QString mech, it.value()) {
-            QSqlQuery mechInsert = newQuery();
-            mechInsert.prepare(S("INSERT OR IGNORE INTO MECHANISMS (mechanism) "
-                                 "VALUES( :mech )"));
-            mechInsert.bindValue(S(":mech"), mech);
-            exec(mechInsert);
-            if (errorOccurred()) allOk = false;
+            if (m_mechanisms.id(mech) == 0 &&
+                insertName(m_mechanisms,
+                           S("INSERT INTO MECHANISMS (mechanism) "
+                             "VALUES( :name )"),
+                           mech) == 0)
+                allOk = false;
         }
     }
     return allOk;
@@ -1170,16 +2426,37 @@ bool MetaDataDB::insertMethods(QMap<QString, QStringList> methods)
 
 quint32 MetaDataDB::insertMethod(const QString &method, bool *ok)
 {
-    QSqlQuery q = newQuery();
-    q.prepare(S("INSERT INTO METHODS (method) VALUES(:method)"));
-    q.bindValue(S(":method"), method);
+    quint32 id = insertName(m_methods,
+                            S("INSERT INTO METHODS (method) VALUES( :name )"),
+                            method);
+    if (ok != 0) *ok = (id != 0);
+    return id;
+}
+
+static int identityFlags(const SignonIdentityInfo &info)
+{
+    int flags = 0;
+    if (info.validated()) flags |= Validated;
+    if (info.storePassword()) flags |= RememberPassword;
+    if (info.isUserNameSecret()) flags |= UserNameIsSecret;
+    return flags;
+}
+
+bool MetaDataDB::credentialsChanged(const SignonIdentityInfo &info)
+{
+    QSqlQuery q = preparedQuery(S("SELECT caption, username, flags, type "
+                                  "FROM CREDENTIALS WHERE id = :id"));
+    q.bindValue(S(":id"), info.id());
     exec(q);
+    if (!q.first()) return true;
 
-    if (errorOccurred()) {
-        if (ok != 0) *ok = false;
-        return 0;
-    }
-    return q.lastInsertId().toUInt(ok);
+    QString userName = info.isUserNameSecret() ? QString() : info.userName();
+    bool changed = q.value(0).toString() != info.caption() ||
+        q.value(1).toString() != userName ||
+        q.value(2).toInt() != identityFlags(info) ||
+        q.value(3).toInt() != info.type();
+    q.finish();
+    return changed;
 }
 
 quint32 MetaDataDB::updateCredentials(const SignonIdentityInfo &info)
@@ -1187,23 +2464,20 @@ quint32 MetaDataDB::updateCredentials(const SignonIdentityInfo &info)
     quint32 id;
     QSqlQuery q = newQuery();
 
-    int flags = 0;
-    if (info.validated()) flags |= Validated;
-    if (info.storePassword()) flags |= RememberPassword;
-    if (info.isUserNameSecret()) flags |= UserNameIsSecret;
+    int flags = identityFlags(info);
 
     if (!info.isNew()) {
         TRACE() << "UPDATE:" << info.id() ;
-        q.prepare(S("UPDATE CREDENTIALS SET caption = :caption, "
-                    "username = :username, "
-                    "flags = :flags, "
-                    "type = :type WHERE id = :id"));
+        q = preparedQuery(S("UPDATE CREDENTIALS SET caption = :caption, "
+                            "username = :username, "
+                            "flags = :flags, "
+                            "type = :type WHERE id = :id"));
         q.bindValue(S(":id"), info.id());
     } else {
         TRACE() << "INSERT:" << info.id();
-        q.prepare(S("INSERT INTO CREDENTIALS "
-                    "(caption, username, flags, type) "
-                    "VALUES(:caption, :username, :flags, :type)"));
+        q = preparedQuery(S("INSERT INTO CREDENTIALS "
+                            "(caption, username, flags, type) "
+                            "VALUES(:caption, :username, :flags, :type)"));
     }
     q.bindValue(S(":username"),
                 info.isUserNameSecret() ? QString() : info.userName());
@@ -1233,25 +2507,40 @@ quint32 MetaDataDB::updateCredentials(const SignonIdentityInfo &info)
 
 bool MetaDataDB::updateRealms(quint32 id, const QStringList &realms, bool isNew)
 {
-    QString queryStr;
-
+    QSet<QString> storedRealms;
     if (!isNew) {
-        //remove realms list
-        queryStr = QString::fromLatin1(
-            "DELETE FROM REALMS WHERE identity_id = '%1'")
-            .arg(id);
-        exec(queryStr);
+        //remove the realms which are not in the list, skip the others
+        QSet<QString> wantedRealms = realms.toSet();
+        QSqlQuery q =
+            preparedQuery(S("SELECT realm FROM REALMS WHERE identity_id = :id"));
+        q.bindValue(S(":id"), id);
+        foreach (const QString &realm, queryList(q)) {
+            if (wantedRealms.contains(realm)) {
+                storedRealms.insert(realm);
+                continue;
+            }
+
+            QSqlQuery deleteQuery = preparedQuery(
+                S("DELETE FROM REALMS "
+                  "WHERE identity_id = :id AND realm = :realm"));
+            deleteQuery.bindValue(S(":id"), id);
+            deleteQuery.bindValue(S(":realm"), realm);
+            exec(deleteQuery);
+            if (errorOccurred()) return false;
+        }
     }
 
-    /* Realms insert */
-    QSqlQuery q = newQuery();
-    q.prepare(S("INSERT OR IGNORE INTO REALMS (identity_id, realm) "
-                "VALUES (:id, :realm)"));
-    foreach (QString realm, realms) {
+    /* Realms insert, in the order given by the client */
+    QSqlQuery q = preparedQuery(
+        S("INSERT OR IGNORE INTO REALMS (identity_id, realm) "
+          "VALUES (:id, :realm)"));
+    foreach (const QString &realm, realms) {
+        if (storedRealms.contains(realm)) continue;
         q.bindValue(S(":id"), id);
         q.bindValue(S(":realm"), realm);
         exec(q);
         if (errorOccurred()) return false;
+        storedRealms.insert(realm);
     }
     return true;
 }
@@ -1290,6 +2579,8 @@ CredentialsDB::CredentialsDB(const QString &metaDataDbName,
                              SignOn::AbstractSecretsStorage *secretsStorage):
     secretsStorage(secretsStorage),
     m_secretsCache(new SecretsCache),
+    m_identityCache(new IdentityCache),
+    m_aclSnapshot(0),
     metaDataDB(new MetaDataDB(metaDataDbName))
 {
     noSecretsDB = SignOn::CredentialsDBError(
@@ -1302,6 +2593,17 @@ CredentialsDB::~CredentialsDB()
     TRACE();
 
     delete m_secretsCache;
+    delete m_identityCache;
+    if (m_aclSnapshot != 0)
+        m_aclSnapshot->invalidate();
+
+    /* An attached secrets DB cannot outlive the metadata connection */
+    DefaultSecretsStorage *defaultStorage =
+        qobject_cast<DefaultSecretsStorage *>(secretsStorage);
+    if (defaultStorage != 0 && defaultStorage->hostDatabase() == metaDataDB) {
+        defaultStorage->close();
+        defaultStorage->setHostDatabase(0);
+    }
 
     if (metaDataDB) {
         QString connectionName = metaDataDB->connectionName();
@@ -1310,21 +2612,87 @@ CredentialsDB::~CredentialsDB()
     }
 }
 
+void CredentialsDB::setDatabaseOptions(const QVariantMap &options)
+{
+    m_databaseOptions = options;
+    metaDataDB->setOptions(options);
+
+    bool ok = false;
+    int cacheSize =
+        options.value(QLatin1String("IdentityCacheSize")).toInt(&ok);
+    if (ok && cacheSize >= 0)
+        m_identityCache->setMaxSize(cacheSize);
+
+    cacheSize =
+        options.value(QLatin1String("SecretsCacheSize")).toInt(&ok);
+    if (ok && cacheSize >= 0)
+        m_secretsCache->setMaxSize(cacheSize);
+
+    int timeToLive =
+        options.value(QLatin1String("SecretsCacheTimeout")).toInt(&ok);
+    if (ok && timeToLive >= 0)
+        m_secretsCache->setTimeToLive(qint64(timeToLive) * 1000);
+}
+
 bool CredentialsDB::init()
 {
-    return metaDataDB->init();
+    return metaDataDB->init() && loadAclSnapshot();
+}
+
+bool CredentialsDB::loadAclSnapshot()
+{
+    if (m_aclSnapshot == 0) return true;
+
+    QHash<quint32, QStringList> acls;
+    QHash<quint32, QStringList> owners;
+    if (!metaDataDB->allAccessTokens(acls, owners)) {
+        m_aclSnapshot->invalidate();
+        return false;
+    }
+    m_aclSnapshot->reset(acls, owners);
+    return true;
+}
+
+/* Called once the changes to an identity are written: if they are rolled
+ * back later, the whole snapshot is reloaded. */
+void CredentialsDB::updateAclSnapshot(const quint32 id)
+{
+    if (m_aclSnapshot == 0) return;
+
+    QStringList acl = metaDataDB->accessControlList(id);
+    QStringList owners = metaDataDB->ownerList(id);
+    if (metaDataDB->errorOccurred()) {
+        loadAclSnapshot();
+        return;
+    }
+    m_aclSnapshot->update(id, acl, owners);
 }
 
 bool CredentialsDB::openSecretsDB(const QString &secretsDbName)
 {
-    QVariantMap configuration;
+    QVariantMap configuration = m_databaseOptions;
     configuration.insert(QLatin1String("name"), secretsDbName);
+
+    /* The default storage shares the metadata connection, so that the
+     * changes made to both databases by one operation are committed at
+     * once; other storages keep their own connections. */
+    DefaultSecretsStorage *defaultStorage =
+        qobject_cast<DefaultSecretsStorage *>(secretsStorage);
+    if (defaultStorage != 0)
+        defaultStorage->setHostDatabase(metaDataDB);
+
     if (!secretsStorage->initialize(configuration)) {
         TRACE() << "SecretsStorage initialization failed: " <<
             secretsStorage->lastError().text();
         return false;
     }
 
+    TRACE() << "Secrets cache:" << m_secretsCache->count() << "entries," <<
+        m_secretsCache->size() << "bytes," <<
+        m_secretsCache->hits() << "hits," <<
+        m_secretsCache->misses() << "misses," <<
+        m_secretsCache->evictions() << "evictions," <<
+        m_secretsCache->expirations() << "expirations";
     m_secretsCache->storeToDB(secretsStorage);
     m_secretsCache->clear();
     return true;
@@ -1335,6 +2703,13 @@ bool CredentialsDB::isSecretsDBOpen()
     return secretsStorage != 0 && secretsStorage->isOpen();
 }
 
+SignOn::SecretsStorageMaintenanceInterface *CredentialsDB::secretsMaintenance()
+{
+    if (!isSecretsDBOpen()) return 0;
+    return qobject_cast<SignOn::SecretsStorageMaintenanceInterface *>(
+        secretsStorage);
+}
+
 void CredentialsDB::closeSecretsDB()
 {
     if (secretsStorage != 0) secretsStorage->close();
@@ -1345,6 +2720,32 @@ SignOn::CredentialsDBError CredentialsDB::lastError() const
     return _lastError;
 }
 
+quint64 CredentialsDB::identityCacheHits() const
+{
+    return m_identityCache->hits();
+}
+
+quint64 CredentialsDB::identityCacheMisses() const
+{
+    return m_identityCache->misses();
+}
+
+SignonIdentityInfo CredentialsDB::identity(const quint32 id,
+                                           IdentityFields fields)
+{
+    SignonIdentityInfo info;
+    if (m_identityCache->lookup(id, info))
+        return info;
+
+    /* Only complete identities are cached */
+    fields &= MetaDataFields;
+    info = metaDataDB->identity(id, fields);
+    if (fields == MetaDataFields &&
+        !info.isNew() && !metaDataDB->errorOccurred())
+        m_identityCache->insert(info);
+    return info;
+}
+
 QStringList CredentialsDB::methods(const quint32 id,
                                    const QString &securityToken)
 {
@@ -1358,7 +2759,7 @@ bool CredentialsDB::checkPassword(const quint32 id,
 {
     INIT_ERROR();
     RETURN_IF_NO_SECRETS_DB(false);
-    SignonIdentityInfo info = metaDataDB->identity(id);
+    SignonIdentityInfo info = identity(id, BasicFields);
     if (info.isUserNameSecret()) {
         return secretsStorage->checkPassword(id, username, password);
     } else {
@@ -1370,10 +2771,16 @@ bool CredentialsDB::checkPassword(const quint32 id,
 SignonIdentityInfo CredentialsDB::credentials(const quint32 id,
                                               bool queryPassword)
 {
-    TRACE() << "id:" << id << "queryPassword:" << queryPassword;
+    return credentialFields(id, queryPassword ? AllFields : MetaDataFields);
+}
+
+SignonIdentityInfo CredentialsDB::credentialFields(const quint32 id,
+                                                   IdentityFields fields)
+{
+    TRACE() << "id:" << id << "fields:" << int(fields);
     INIT_ERROR();
-    SignonIdentityInfo info = metaDataDB->identity(id);
-    if (queryPassword && !info.isNew()) {
+    SignonIdentityInfo info = identity(id, fields);
+    if ((fields & SecretsField) && !info.isNew()) {
         QString username, password;
         if (info.storePassword() && isSecretsDBOpen()) {
             TRACE() << "Loading credentials from DB.";
@@ -1402,6 +2809,14 @@ CredentialsDB::credentials(const QMap<QString, QString> &filter)
     return metaDataDB->identities(filter);
 }
 
+QList<SignonIdentityInfo>
+CredentialsDB::credentials(const QMap<QString, QString> &filter,
+                           quint32 afterId, int pageSize, quint32 &nextId)
+{
+    INIT_ERROR();
+    return metaDataDB->identities(filter, afterId, pageSize, &nextId);
+}
+
 quint32 CredentialsDB::insertCredentials(const SignonIdentityInfo &info)
 {
     SignonIdentityInfo newInfo = info;
@@ -1413,8 +2828,20 @@ quint32 CredentialsDB::insertCredentials(const SignonIdentityInfo &info)
 quint32 CredentialsDB::updateCredentials(const SignonIdentityInfo &info)
 {
     INIT_ERROR();
+
+    /* The identity and its secrets are committed together */
+    if (!beginWrites())
+        return 0;
+
     quint32 id = metaDataDB->updateIdentity(info);
-    if (id == 0) return id;
+    if (id == 0) {
+        rollbackWrites();
+        return id;
+    }
+
+    /* The stored identity can differ from the given one (duplicates are
+     * dropped, for instance): let the next read load it from the DB. */
+    m_identityCache->remove(id);
 
     if (info.hasSecrets()) {
         QString password = info.password();
@@ -1423,7 +2850,10 @@ quint32 CredentialsDB::updateCredentials(const SignonIdentityInfo &info)
             userName = info.userName();
 
         if (info.storePassword() && isSecretsDBOpen()) {
-            secretsStorage->updateCredentials(id, userName, password);
+            if (!secretsStorage->updateCredentials(id, userName, password)) {
+                rollbackWrites();
+                return 0;
+            }
         } else {
             /* Cache username and password in memory */
             m_secretsCache->updateCredentials(id, userName, password,
@@ -1431,6 +2861,10 @@ quint32 CredentialsDB::updateCredentials(const SignonIdentityInfo &info)
         }
     }
 
+    if (!commitWrites())
+        return 0;
+
+    updateAclSnapshot(id);
     Q_EMIT credentialsUpdated(id);
 
     return id;
@@ -1444,8 +2878,21 @@ bool CredentialsDB::removeCredentials(const quint32 id)
      * available */
     RETURN_IF_NO_SECRETS_DB(false);
 
-    return secretsStorage->removeCredentials(id) &&
-        metaDataDB->removeIdentity(id);
+    m_identityCache->remove(id);
+    if (!beginWrites())
+        return false;
+
+    if (!secretsStorage->removeCredentials(id) ||
+        !metaDataDB->removeIdentity(id)) {
+        rollbackWrites();
+        return false;
+    }
+    if (!commitWrites())
+        return false;
+
+    if (m_aclSnapshot != 0)
+        m_aclSnapshot->remove(id);
+    return true;
 }
 
 bool CredentialsDB::clear()
@@ -1457,10 +2904,25 @@ bool CredentialsDB::clear()
     /* We don't allow clearing the DB if the secrets DB is not available */
     RETURN_IF_NO_SECRETS_DB(false);
 
-    return secretsStorage->clear() && metaDataDB->clear();
+    m_identityCache->clear();
+    if (!beginWrites())
+        return false;
+
+    if (!secretsStorage->clear() || !metaDataDB->clear()) {
+        rollbackWrites();
+        return false;
+    }
+    if (!commitWrites())
+        return false;
+
+    if (m_aclSnapshot != 0)
+        m_aclSnapshot->reset(QHash<quint32, QStringList>(),
+                             QHash<quint32, QStringList>());
+    return true;
 }
 
-QVariantMap CredentialsDB::loadData(const quint32 id, const QString &method)
+QVariantMap CredentialsDB::loadData(const quint32 id, const QString &method,
+                                    const QStringList &skippedKeys)
 {
     TRACE() << "Loading:" << id << "," << method;
 
@@ -1470,12 +2932,23 @@ QVariantMap CredentialsDB::loadData(const quint32 id, const QString &method)
     quint32 methodId = metaDataDB->methodId(method);
     if (methodId == 0) return QVariantMap();
 
+    QVariantMap data;
     if (isSecretsDBOpen()) {
-        return secretsStorage->loadData(id, methodId);
+        /* Other secrets storages can only load all the values */
+        SignOn::SecretsStorageMaintenanceInterface *maintenance =
+            secretsMaintenance();
+        if (!skippedKeys.isEmpty() && maintenance != 0)
+            return maintenance->loadPartialData(id, methodId, skippedKeys);
+        data = secretsStorage->loadData(id, methodId);
     } else {
         TRACE() << "Looking up data from cache";
-        return m_secretsCache->lookupData(id, methodId);
+        data = m_secretsCache->lookupData(id, methodId);
+    }
+
+    foreach (const QString &key, skippedKeys) {
+        data.remove(key);
     }
+    return data;
 }
 
 bool CredentialsDB::storeData(const quint32 id, const QString &method,
@@ -1525,13 +2998,21 @@ bool CredentialsDB::removeData(const quint32 id, const QString &method)
 QStringList CredentialsDB::accessControlList(const quint32 identityId)
 {
     INIT_ERROR();
-    return metaDataDB->accessControlList(identityId);
+    if (!m_identityCache->isEnabled())
+        return metaDataDB->accessControlList(identityId);
+
+    /* The whole identity is loaded: it's usually needed right after the
+     * access control checks. */
+    return identity(identityId).accessControlList();
 }
 
 QStringList CredentialsDB::ownerList(const quint32 identityId)
 {
     INIT_ERROR();
-    return metaDataDB->ownerList(identityId);
+    if (!m_identityCache->isEnabled())
+        return metaDataDB->ownerList(identityId);
+
+    return identity(identityId).ownerList();
 }
 
 QString CredentialsDB::credentialsOwnerSecurityToken(const quint32 identityId)
@@ -1546,6 +3027,7 @@ bool CredentialsDB::addReference(const quint32 id,
                                  const QString &reference)
 {
     INIT_ERROR();
+    m_identityCache->remove(id);
     return metaDataDB->addReference(id, token, reference);
 }
 
@@ -1554,6 +3036,7 @@ bool CredentialsDB::removeReference(const quint32 id,
                                     const QString &reference)
 {
     INIT_ERROR();
+    m_identityCache->remove(id);
     return metaDataDB->removeReference(id, token, reference);
 }
 
@@ -1563,4 +3046,118 @@ QStringList CredentialsDB::references(const quint32 id, const QString &token)
     return metaDataDB->references(id, token);
 }
 
+bool CredentialsDB::changes(quint64 since, QList<quint32> &changed,
+                            QList<quint32> &removed, quint64 &sequence)
+{
+    INIT_ERROR();
+    return metaDataDB->changes(since, changed, removed, sequence);
+}
+
+void CredentialsDB::checkpoint()
+{
+    TRACE();
+    metaDataDB->checkpoint();
+
+    SignOn::SecretsStorageMaintenanceInterface *maintenance =
+        secretsMaintenance();
+    if (maintenance != 0)
+        maintenance->checkpoint();
+}
+
+qint64 CredentialsDB::vacuum(int maxPages)
+{
+    INIT_ERROR();
+    qint64 freePages = metaDataDB->incrementalVacuum(maxPages);
+    if (freePages < 0)
+        return -1;
+
+    /* Other secrets storages manage their space by themselves */
+    SignOn::SecretsStorageMaintenanceInterface *maintenance =
+        secretsMaintenance();
+    qint64 secretsFreePages = maintenance != 0 ?
+        maintenance->incrementalVacuum(maxPages) : 0;
+    if (secretsFreePages < 0)
+        return -1;
+
+    return freePages + secretsFreePages;
+}
+
+qint64 CredentialsDB::databaseSize()
+{
+    qint64 size = metaDataDB->fileSize();
+    SignOn::SecretsStorageMaintenanceInterface *maintenance =
+        secretsMaintenance();
+    qint64 secretsSize = maintenance != 0 ? maintenance->fileSize() : 0;
+    return (size < 0 || secretsSize < 0) ? -1 : size + secretsSize;
+}
+
+qint64 CredentialsDB::freeSpace()
+{
+    qint64 size = metaDataDB->freeSize();
+    SignOn::SecretsStorageMaintenanceInterface *maintenance =
+        secretsMaintenance();
+    qint64 secretsSize = maintenance != 0 ? maintenance->freeSize() : 0;
+    return (size < 0 || secretsSize < 0) ? -1 : size + secretsSize;
+}
+
+bool CredentialsDB::beginWrites()
+{
+    INIT_ERROR();
+    if (!metaDataDB->startTransaction())
+        return false;
+
+    /* Nested units of work follow the choice of the outermost one, so that
+     * the secrets storage sees balanced calls. */
+    bool secretsBatched = m_secretsBatches.isEmpty() ?
+        isSecretsDBOpen() : m_secretsBatches.last();
+    if (secretsBatched && !secretsStorage->beginBatch()) {
+        BLAME() << "Could not start a batch on the secrets storage";
+        secretsBatched = false;
+    }
+    m_secretsBatches.append(secretsBatched);
+    return true;
+}
+
+bool CredentialsDB::commitWrites()
+{
+    INIT_ERROR();
+    if (m_secretsBatches.isEmpty())
+        return false;
+
+    /* The secrets are committed first: if that fails, the metadata referring
+     * to them is rolled back. */
+    if (m_secretsBatches.last() && !secretsStorage->commitBatch()) {
+        BLAME() << "Could not commit the secrets";
+        m_secretsBatches.removeLast();
+        metaDataDB->rollback();
+        m_identityCache->clear();
+        loadAclSnapshot();
+        return false;
+    }
+    m_secretsBatches.removeLast();
+
+    if (!metaDataDB->commit()) {
+        metaDataDB->rollback();
+        m_identityCache->clear();
+        loadAclSnapshot();
+        return false;
+    }
+    return true;
+}
+
+void CredentialsDB::rollbackWrites()
+{
+    if (m_secretsBatches.isEmpty())
+        return;
+
+    if (m_secretsBatches.takeLast())
+        secretsStorage->rollbackBatch();
+    metaDataDB->rollback();
+
+    /* Identities read within the transaction might have been cached, and
+     * the identities written by it might be in the ACL snapshot */
+    m_identityCache->clear();
+    loadAclSnapshot();
+}
+
 } //namespace SignonDaemonNS
@@ -52,6 +52,26 @@ enum IdentityFlags {
     UserNameIsSecret = 0x0004,
 };
 
+/*!
+ * @enum IdentityField
+ * The parts of an identity which can be loaded on their own. The caption,
+ * the user name, the type and the flags are stored in the same row, and are
+ * always loaded.
+ */
+enum IdentityField {
+    BasicFields = 0,
+    RealmsField = 0x0001,
+    OwnerListField = 0x0002,
+    AccessControlListField = 0x0004,
+    MethodsField = 0x0008,
+    SecretsField = 0x0010,      /*!< The password, and the secret user name */
+    MetaDataFields = 0x000f,
+    AllFields = 0x001f,
+};
+Q_DECLARE_FLAGS(IdentityFields, IdentityField)
+
+class AclSnapshot;
+class IdentityCache;
 class MetaDataDB;
 class SecretsCache;
 class SignonIdentityInfo;
@@ -88,6 +108,21 @@ public:
                   SignOn::AbstractSecretsStorage *secretsStorage);
     ~CredentialsDB();
 
+    /*!
+     * Sets the SQLite tuning options of the metadata DB and, if the default
+     * secrets storage is used, of the secrets DB. The options also carry
+     * the bounds of the in-memory caches: "IdentityCacheSize" and
+     * "SecretsCacheSize" (in bytes) and "SecretsCacheTimeout" (in seconds).
+     * @see SqlDatabase::setOptions()
+     */
+    void setDatabaseOptions(const QVariantMap &options);
+
+    /*!
+     * Sets the snapshot of the access control lists to keep up to date; it
+     * is filled by init(), and invalidated when this object is destroyed.
+     */
+    void setAclSnapshot(AclSnapshot *snapshot) { m_aclSnapshot = snapshot; }
+
     bool init();
     /*!
      * This method will open the DB file containing the user secrets.
@@ -101,12 +136,32 @@ public:
     SignOn::CredentialsDBError lastError() const;
     bool errorOccurred() const { return lastError().isValid(); };
 
+    /*!
+     * @returns the number of identity reads served from memory, and the
+     * number of those which had to go to the DB.
+     */
+    quint64 identityCacheHits() const;
+    quint64 identityCacheMisses() const;
+
     QStringList methods(const quint32 id,
                         const QString &securityToken = QString());
     bool checkPassword(const quint32 id,
                        const QString &username, const QString &password);
     SignonIdentityInfo credentials(const quint32 id, bool queryPassword = true);
+    /*!
+     * Like credentials(), but only the given parts of the identity are
+     * loaded from the DB; the others may be left empty.
+     */
+    SignonIdentityInfo credentialFields(const quint32 id,
+                                        IdentityFields fields);
     QList<SignonIdentityInfo> credentials(const QMap<QString, QString> &filter);
+    /*!
+     * Returns a page of the identities matching the filter; see
+     * MetaDataDB::identities().
+     */
+    QList<SignonIdentityInfo> credentials(const QMap<QString, QString> &filter,
+                                          quint32 afterId, int pageSize,
+                                          quint32 &nextId);
 
     quint32 insertCredentials(const SignonIdentityInfo &info);
     quint32 updateCredentials(const SignonIdentityInfo &info);
@@ -118,7 +173,13 @@ public:
     QStringList ownerList(const quint32 identityId);
     QString credentialsOwnerSecurityToken(const quint32 identityId);
 
-    QVariantMap loadData(const quint32 id, const QString &method);
+    /*!
+     * Loads the data stored for the given identity and method.
+     * @param skippedKeys Keys whose values are not needed: when possible,
+     * they are not even decoded.
+     */
+    QVariantMap loadData(const quint32 id, const QString &method,
+                         const QStringList &skippedKeys = QStringList());
     bool storeData(const quint32 id,
                    const QString &method,
                    const QVariantMap &data);
@@ -133,17 +194,77 @@ public:
     QStringList references(const quint32 id,
                            const QString &token = QString());
 
+    /*!
+     * Lists the identities changed or removed after the given change.
+     * @param since 0, or the @a sequence returned by a previous call.
+     * @param sequence Set to the number of the last change, to be passed as
+     * @a since in order to get the following changes.
+     * @sa MetaDataDB::changes().
+     */
+    bool changes(quint64 since, QList<quint32> &changed,
+                 QList<quint32> &removed, quint64 &sequence);
+
+    /*!
+     * Runs a WAL checkpoint on the databases; meant to be called when the
+     * daemon is idle.
+     */
+    void checkpoint();
+
+    /*!
+     * Returns up to @a maxPages unused pages of each database to the
+     * filesystem; meant to be called in slices when the daemon is idle.
+     * @returns the number of unused pages which are left, or -1 on error.
+     */
+    qint64 vacuum(int maxPages);
+
+    /*!
+     * @returns the size of the database files, and how much of it is taken
+     * by unused pages, in bytes; -1 on error.
+     */
+    qint64 databaseSize();
+    qint64 freeSpace();
+
+    /*!
+     * Starts a unit of work: the changes made until commitWrites() is called
+     * are committed with a single transaction on each database, rather than
+     * one transaction per operation. Operations failing in the meantime are
+     * still rolled back on their own. Units of work can be nested.
+     * @returns false if the transaction could not be started.
+     */
+    bool beginWrites();
+    /*!
+     * Commits the changes made since beginWrites().
+     */
+    bool commitWrites();
+    /*!
+     * Discards the changes made since beginWrites().
+     */
+    void rollbackWrites();
+
 Q_SIGNALS:
     void credentialsUpdated(quint32 id);
 
+private:
+    SignonIdentityInfo identity(const quint32 id,
+                                IdentityFields fields = MetaDataFields);
+    bool loadAclSnapshot();
+    void updateAclSnapshot(const quint32 id);
+    SignOn::SecretsStorageMaintenanceInterface *secretsMaintenance();
+
 private:
     SignOn::AbstractSecretsStorage *secretsStorage;
     SecretsCache *m_secretsCache;
+    IdentityCache *m_identityCache;
+    AclSnapshot *m_aclSnapshot;
     MetaDataDB *metaDataDB;
     SignOn::CredentialsDBError _lastError;
     SignOn::CredentialsDBError noSecretsDB;
+    QVariantMap m_databaseOptions;
+    QList<bool> m_secretsBatches;
 };
 
 } // namespace SignonDaemonNS
 
+Q_DECLARE_OPERATORS_FOR_FLAGS(SignonDaemonNS::IdentityFields)
+
 #endif // CREDENTIALSDB_H
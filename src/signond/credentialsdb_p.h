@@ -29,10 +29,15 @@
 #include <QtSql>
 
 #include "SignOn/abstract-secrets-storage.h"
+#include "credentialsdb.h"
 #include "signonidentityinfo.h"
 
-#define SSO_METADATADB_VERSION 2
-#define SSO_SECRETSDB_VERSION 1
+#define SSO_METADATADB_VERSION 6
+#define SSO_SECRETSDB_VERSION 3
+
+#define SSO_MAX_CACHED_STATEMENTS 64
+#define SSO_DEFAULT_IDENTITY_CACHE_SIZE (256*1024) // bytes
+#define SSO_DEFAULT_SECRETS_CACHE_SIZE (256*1024) // bytes
 
 class TestDatabase;
 
@@ -40,7 +45,10 @@ namespace SignonDaemonNS {
 
 /*!
  * @class SecretsCache
- * Caches credentials or BLOB authentication data.
+ * Caches credentials or BLOB authentication data, while the secrets DB is
+ * not available. The memory used by the cache is bounded: when it is
+ * exceeded, the least recently used identities are dropped. Entries can
+ * also be given a time to live, after which they are dropped.
  */
 class SecretsCache
 {
@@ -50,20 +58,38 @@ public:
     {
         friend class SecretsCache;
 
+    public:
+        AuthCache(): m_storePassword(false), m_cost(0), m_lastUse(0),
+            m_expiry(0) {}
+
     private:
         QString m_username;
         QString m_password;
         bool m_storePassword;
         QHash<quint32,QVariantMap> m_blobData;
+        int m_cost;
+        quint64 m_lastUse;
+        qint64 m_expiry;
     };
 
-    SecretsCache() {};
+    SecretsCache();
     ~SecretsCache() {};
 
+    /*!
+     * Sets the memory bound of the cache, in bytes; 0 disables the cache.
+     */
+    void setMaxSize(int bytes);
+    int maxSize() const { return m_maxSize; }
+    /*!
+     * Sets the time after its last update when an entry is dropped, in
+     * milliseconds; 0 (the default) keeps the entries until evicted.
+     */
+    void setTimeToLive(qint64 msecs) { m_timeToLive = msecs; }
+
     bool lookupCredentials(quint32 id,
                            QString &username,
-                           QString &password) const;
-    QVariantMap lookupData(quint32 id, quint32 method) const;
+                           QString &password);
+    QVariantMap lookupData(quint32 id, quint32 method);
 
     void updateCredentials(quint32 id,
                            const QString &username,
@@ -71,11 +97,73 @@ public:
                            bool storePassword);
     void updateData(quint32 id, quint32 method, const QVariantMap &data);
 
-    void storeToDB(SignOn::AbstractSecretsStorage *secretsStorage) const;
+    /*!
+     * Writes all the entries which have not been evicted nor have expired
+     * into the secrets storage.
+     */
+    void storeToDB(SignOn::AbstractSecretsStorage *secretsStorage);
     void clear();
 
+    int size() const { return m_size; }
+    int count() const { return m_cache.count(); }
+    quint64 hits() const { return m_hits; }
+    quint64 misses() const { return m_misses; }
+    quint64 evictions() const { return m_evictions; }
+    quint64 expirations() const { return m_expirations; }
+
+private:
+    AuthCache *entry(quint32 id);
+    AuthCache *insertEntry(quint32 id);
+    void entryUpdated(AuthCache &entry);
+    bool isExpired(const AuthCache &entry) const;
+    void removeExpired();
+    void evict();
+
 private:
     QHash<quint32, AuthCache> m_cache;
+    int m_maxSize;
+    int m_size;
+    qint64 m_timeToLive;
+    quint64 m_useCounter;
+    quint64 m_hits;
+    quint64 m_misses;
+    quint64 m_evictions;
+    quint64 m_expirations;
+};
+
+/*!
+ * @class IdentityCache
+ * Keeps the metadata of the most recently used identities in memory. The
+ * daemon is the only writer of the metadata DB, so the entries stay valid
+ * until the daemon itself changes the identity.
+ */
+class IdentityCache
+{
+    friend class ::TestDatabase;
+public:
+    IdentityCache();
+    ~IdentityCache() {};
+
+    /*!
+     * Sets the memory bound of the cache; least recently used entries are
+     * dropped when it is exceeded. 0 disables the cache.
+     * @param bytes, the approximate maximum memory usage.
+     */
+    void setMaxSize(int bytes);
+    bool isEnabled() const { return m_cache.maxCost() > 0; }
+
+    bool lookup(quint32 id, SignonIdentityInfo &info);
+    void insert(const SignonIdentityInfo &info);
+    void remove(quint32 id);
+    void clear();
+
+    quint64 hits() const { return m_hits; }
+    quint64 misses() const { return m_misses; }
+
+private:
+    QCache<quint32, SignonIdentityInfo> m_cache;
+    quint64 m_hits;
+    quint64 m_misses;
 };
 
 /*!
@@ -94,6 +182,24 @@ public:
     SqlDatabase(const QString &hostname, const QString &connectionName,
                 int version);
 
+    /*!
+     * Constructs a SqlDatabase object for the given database file, which
+     * will be attached to the connection of another SqlDatabase, rather than
+     * opened on a connection of its own. The tables of the attached database
+     * must then be referred to with the schema name (see qualify()), and its
+     * transactions are those of the host: a change made to both databases is
+     * committed with a single transaction.
+     * Note that the commit is atomic across the two files only if the host
+     * database is not in WAL journal mode.
+     * @param host The database whose connection is shared; it must outlive
+     * this object.
+     * @param schema The name under which the database is attached.
+     * @param databaseName The file name of the database.
+     * @param version The schema version.
+     */
+    SqlDatabase(SqlDatabase *host, const QString &schema,
+                const QString &databaseName, int version);
+
     /*!
      * Destroys the SqlDatabase object, closing the database connection.
      */
@@ -118,10 +224,71 @@ public:
      */
     void disconnect();
 
-    bool startTransaction();
+    /*!
+     * Sets the SQLite tuning options applied whenever the connection is
+     * opened. The recognized keys are "JournalMode", "Synchronous",
+     * "TokenSynchronous", "BusyTimeout" (in milliseconds) and "MmapSize" (in
+     * bytes); unknown keys and invalid values are ignored.
+     * @param options, the options.
+     */
+    void setOptions(const QVariantMap &options);
+
+    /*!
+     * @enum Durability
+     * How carefully the writes of a transaction must be synced to disk.
+     */
+    enum Durability {
+        Durable = 0,    /*!< Synced as per the "Synchronous" option. */
+        Lazy            /*!< Synced as per the "TokenSynchronous" option. */
+    };
+
+    /*!
+     * Starts a transaction. If a transaction is already open, a savepoint
+     * is started instead: it is released by commit() and rolled back by
+     * rollback(), but the changes are only durable once the outermost
+     * transaction commits; the durability of the outermost transaction
+     * applies.
+     */
+    bool startTransaction(Durability durability = Durable);
     bool commit();
     void rollback();
 
+    /*!
+     * @returns true if a transaction is open.
+     */
+    bool inTransaction() const {
+        return (m_host != 0 ? m_host->m_transactionDepth :
+                m_transactionDepth) > 0;
+    }
+
+    /*!
+     * @returns true if the database is attached to the connection of
+     * another SqlDatabase.
+     */
+    bool isAttached() const { return m_host != 0; }
+
+    /*!
+     * Copies the content of the write-ahead log into the database, if the
+     * connection is in WAL mode; does nothing otherwise.
+     * @returns false if the checkpoint could not complete.
+     */
+    bool checkpoint();
+
+    /*!
+     * Returns up to @a maxPages unused pages of the database file to the
+     * filesystem; the file only shrinks if the database is in incremental
+     * auto-vacuum mode, which init() sets up.
+     * @returns the number of unused pages left, or -1 on error.
+     */
+    qint64 incrementalVacuum(int maxPages);
+
+    /*!
+     * @returns the size of the database file, and the part of it taken by
+     * unused pages, in bytes; -1 on error.
+     */
+    qint64 fileSize();
+    qint64 freeSize();
+
     /*!
      * @returns true if database connection is opened, false otherwise.
      */
@@ -154,7 +321,9 @@ public:
     /*!
      * @returns the database name.
      */
-    QString databaseName() const { return m_database.databaseName(); }
+    QString databaseName() const {
+        return m_host != 0 ? m_attachedName : m_database.databaseName();
+    }
 
     /*!
      * @returns the username for the database connection.
@@ -168,6 +337,16 @@ public:
 
     QSqlQuery newQuery() const { return QSqlQuery(m_database); }
 
+    /*!
+     * Returns a prepared statement for the given SQL text. The statement is
+     * compiled on first use and then reused by all callers passing the same
+     * text, until the connection is closed; values must therefore be passed
+     * as bound parameters, not inlined in the text.
+     * @param queryStr, the query string.
+     * @returns the prepared query, ready for binding values and executing.
+     */
+    QSqlQuery preparedQuery(const QString &queryStr);
+
     /*!
      * Executes a specific database query.
      * If an error occurres the lastError() method can be used for handling
@@ -199,12 +378,20 @@ public:
      */
     bool transactionalExec(const QStringList &queryList);
 
+    /*!
+     * Same as above, but binds the given values into the queries: each
+     * query gets the values whose placeholder (e.g. ":id") it contains.
+     * @param queryList, the query list to be executed.
+     * @param bindings, placeholder names and their values.
+     * @returns true if the transaction commits successfully, false otherwise.
+     */
+    bool transactionalExec(const QStringList &queryList,
+                           const QVariantMap &bindings);
+
     /*!
      * @returns true, if the database has any tables created, false otherwise.
      */
-    bool hasTables() const {
-        return m_database.tables().count() > 0 ? true : false;
-    }
+    bool hasTables() const;
 
     /*!
      * @returns a list of the supported drivers on the specific OS.
@@ -228,13 +415,65 @@ public:
 
     QString connectionName() const { return m_database.connectionName(); }
 
+    /*!
+     * @returns the number of statements executed on this connection so far.
+     */
+    quint64 execCount() const { return m_execCount; }
+
 protected:
     QStringList queryList(const QString &query_str);
     QStringList queryList(QSqlQuery &query);
     void setLastError(const QSqlError &sqlError);
 
+    /*!
+     * Prefixes the names of the tables in the given query with the schema
+     * name of the database, if it is attached to another connection: the
+     * table names must be preceded by "%1", as in "SELECT * FROM %1DATA".
+     */
+    QString qualify(const char *query) const {
+        return QString::fromLatin1(query).arg(m_schemaPrefix);
+    }
+
+    /*!
+     * Rebuilds a database created before the incremental auto-vacuum mode
+     * was set, so that its free pages can be released; this is a schema
+     * migration step, run once. Failing is not fatal: the database just
+     * won't shrink.
+     */
+    void enableIncrementalVacuum();
+
+    /*!
+     * Called after a transaction has been rolled back; the last error is
+     * preserved across the call.
+     */
+    virtual void rolledBack() {}
+
+private:
+    void finishStatements();
+    void clearStatements();
+    void applyOptions();
+    void setSynchronous(const QString &level);
+    void restoreDurability();
+    QString pragma(const char *name) const;
+    qint64 pragmaValue(const char *name);
+    bool attach();
+    void detach();
+    bool hostResult(bool ok);
+
 private:
     SignOn::CredentialsDBError m_lastError;
+    quint64 m_execCount;
+    QHash<QString, QSqlQuery> m_statements;
+    QVariantMap m_options;
+    QString m_synchronous;
+    QString m_lazySynchronous;
+    bool m_lazyTransaction;
+    bool m_walMode;
+    int m_transactionDepth;
+    SqlDatabase *m_host;
+    QString m_schema;
+    QString m_schemaPrefix;
+    QString m_attachedName;
 
 protected:
     int m_version;
@@ -243,13 +482,41 @@ protected:
     friend class CredentialsDB;
 };
 
+/*!
+ * @class NameIdMap
+ * Bidirectional map between the names and the ids of a table of unique
+ * names; both directions share the same name strings.
+ */
+class NameIdMap
+{
+public:
+    void insert(quint32 id, const QString &name) {
+        m_ids.insert(name, id);
+        m_names.insert(id, name);
+    }
+    quint32 id(const QString &name) const { return m_ids.value(name, 0); }
+    QString name(quint32 id) const { return m_names.value(id); }
+    int count() const { return m_ids.count(); }
+    void clear() { m_ids.clear(); m_names.clear(); }
+
+private:
+    QHash<QString, quint32> m_ids;
+    QHash<quint32, QString> m_names;
+};
+
 class MetaDataDB: public SqlDatabase
 {
     friend class ::TestDatabase;
 public:
     MetaDataDB(const QString &name):
         SqlDatabase(name, QLatin1String("SSO-metadata"),
-                    SSO_METADATADB_VERSION) {}
+                    SSO_METADATADB_VERSION),
+        m_changeSequence(0) {}
+
+    /*!
+     * Connects to the DB, and loads the method and mechanism names.
+     */
+    bool init();
 
     bool createTables();
     bool updateDB(int version);
@@ -258,8 +525,20 @@ public:
                         const QString &securityToken = QString());
     quint32 insertMethod(const QString &method, bool *ok = 0);
     quint32 methodId(const QString &method);
-    SignonIdentityInfo identity(const quint32 id);
-    QList<SignonIdentityInfo> identities(const QMap<QString, QString> &filter);
+    SignonIdentityInfo identity(const quint32 id,
+                                IdentityFields fields = MetaDataFields);
+    /*!
+     * Returns the identities matching the filter, ordered by id.
+     * With a positive @a pageSize, only the identities whose id is greater
+     * than @a afterId are examined, and at most @a pageSize of them: the page
+     * can hold fewer identities, if some did not match the filter.
+     * @param nextId Set to the @a afterId of the next page, or to 0 if there
+     * are no more identities to examine.
+     */
+    QList<SignonIdentityInfo> identities(const QMap<QString, QString> &filter,
+                                         quint32 afterId = 0,
+                                         int pageSize = 0,
+                                         quint32 *nextId = 0);
 
     quint32 updateIdentity(const SignonIdentityInfo &info);
     bool removeIdentity(const quint32 id);
@@ -269,6 +548,12 @@ public:
     QStringList accessControlList(const quint32 identityId);
     QStringList ownerList(const quint32 identityId);
 
+    /*!
+     * Reads the access control lists and owners of all the identities.
+     */
+    bool allAccessTokens(QHash<quint32, QStringList> &acls,
+                         QHash<quint32, QStringList> &owners);
+
     bool addReference(const quint32 id,
                       const QString &token,
                       const QString &reference);
@@ -277,11 +562,53 @@ public:
                          const QString &reference = QString());
     QStringList references(const quint32 id, const QString &token = QString());
 
+    /*!
+     * @returns the number of the last change made to the identities. Every
+     * change to an identity (including its removal, and the changes to its
+     * references) is given a higher number than the previous ones.
+     */
+    quint64 changeSequence() const { return m_changeSequence; }
+
+    /*!
+     * Lists the identities changed after the given change; an identity
+     * changed several times is listed once.
+     * @param since A value returned by changeSequence(), or 0 to list all
+     * the identities.
+     * @param changed Filled with the ids of the stored identities.
+     * @param removed Filled with the ids of the removed identities.
+     * @param sequence Set to the number of the last change stored in the
+     * DB.
+     * @returns false if the changes could not be read.
+     */
+    bool changes(quint64 since, QList<quint32> &changed,
+                 QList<quint32> &removed, quint64 &sequence);
+
+protected:
+    void rolledBack();
+
 private:
+    bool loadNames();
+    bool loadChangeSequence();
+    bool recordChange(quint32 id, bool removed);
+    qint64 totalChanges();
+    quint32 insertName(NameIdMap &names, const QString &insertStr,
+                       const QString &name);
+    void addMethodRow(MethodMap &methods, const QVariant &methodId,
+                      const QVariant &mechanismId) const;
     bool insertMethods(QMap<QString, QStringList> methods);
+    bool credentialsChanged(const SignonIdentityInfo &info);
     quint32 updateCredentials(const SignonIdentityInfo &info);
     bool updateRealms(quint32 id, const QStringList &realms, bool isNew);
+    void insertToken(const QString &token, QSet<QString> &knownTokens);
     QStringList tableUpdates2();
+    QStringList tableUpdates3();
+    QStringList tableUpdates4();
+    QStringList tableUpdates6();
+
+private:
+    NameIdMap m_methods;
+    NameIdMap m_mechanisms;
+    quint64 m_changeSequence;
 };
 
 } // namespace SignonDaemonNS
@@ -36,31 +36,136 @@
 
 using namespace SignonDaemonNS;
 
+/* Layout of the records of the DATA table:
+ *   quint8 version, quint8 flags, body
+ * where the body (compressed with qCompress() if the SSO_DATA_COMPRESSED
+ * flag is set) is a QDataStream holding the number of keys and, for each
+ * key, the key and the offset and size of its value, followed by the
+ * values, each serialized as a QVariant. */
+#define SSO_DATA_RECORD_VERSION 1
+#define SSO_DATA_COMPRESSED 0x01
+#define SSO_DATA_COMPRESSION_THRESHOLD 256
+
+StoredData::StoredData(const QByteArray &record):
+    m_isValid(false)
+{
+    if (record.size() < 2) return;
+
+    if (quint8(record.at(0)) != SSO_DATA_RECORD_VERSION) {
+        BLAME() << "Unsupported data record version" << int(record.at(0));
+        return;
+    }
+
+    QByteArray body = record.mid(2);
+    if (quint8(record.at(1)) & SSO_DATA_COMPRESSED) {
+        body = qUncompress(body);
+        if (body.isEmpty()) {
+            BLAME() << "Corrupted data record";
+            return;
+        }
+    }
+
+    QDataStream stream(body);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        QString key;
+        quint32 offset, size;
+        stream >> key >> offset >> size;
+        m_index.insert(key, qMakePair(offset, size));
+    }
+    if (stream.status() != QDataStream::Ok) {
+        BLAME() << "Corrupted data record index";
+        m_index.clear();
+        return;
+    }
+
+    m_values = body.mid(stream.device()->pos());
+    QHash<QString, QPair<quint32, quint32> >::const_iterator i;
+    for (i = m_index.constBegin(); i != m_index.constEnd(); i++) {
+        if (quint64(i->first) + i->second > quint64(m_values.size())) {
+            BLAME() << "Corrupted data record values";
+            m_index.clear();
+            m_values.clear();
+            return;
+        }
+    }
+    m_isValid = true;
+}
+
+QByteArray StoredData::encode(const QVariantMap &data)
+{
+    QByteArray values;
+    QDataStream valueStream(&values, QIODevice::WriteOnly);
+    valueStream.setVersion(QDataStream::Qt_5_0);
+
+    QByteArray body;
+    QDataStream stream(&body, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << quint32(data.count());
+    QMapIterator<QString, QVariant> it(data);
+    while (it.hasNext()) {
+        it.next();
+        quint32 offset = values.size();
+        valueStream << it.value();
+        stream << it.key() << offset << quint32(values.size() - offset);
+    }
+    body.append(values);
+
+    quint8 flags = 0;
+    if (body.size() >= SSO_DATA_COMPRESSION_THRESHOLD) {
+        QByteArray compressed = qCompress(body);
+        if (compressed.size() < body.size()) {
+            body = compressed;
+            flags |= SSO_DATA_COMPRESSED;
+        }
+    }
+
+    QByteArray record;
+    record.reserve(body.size() + 2);
+    record.append(char(SSO_DATA_RECORD_VERSION));
+    record.append(char(flags));
+    record.append(body);
+    return record;
+}
+
+QVariant StoredData::value(const QString &key) const
+{
+    QHash<QString, QPair<quint32, quint32> >::const_iterator i =
+        m_index.find(key);
+    if (i == m_index.constEnd())
+        return QVariant();
+
+    QByteArray array = QByteArray::fromRawData(m_values.constData() + i->first,
+                                               i->second);
+    QDataStream stream(array);
+    stream.setVersion(QDataStream::Qt_5_0);
+    QVariant value;
+    stream >> value;
+    return value;
+}
+
+QVariantMap StoredData::toMap(const QStringList &skippedKeys) const
+{
+    QVariantMap result;
+    foreach (const QString &key, m_index.keys()) {
+        if (skippedKeys.contains(key)) continue;
+        result.insert(key, value(key));
+    }
+    return result;
+}
+
 bool SecretsDB::createTables()
 {
     QStringList createTableQuery = QStringList()
-        <<  QString::fromLatin1(
-            "CREATE TABLE CREDENTIALS"
+        <<  qualify(
+            "CREATE TABLE %1CREDENTIALS"
             "(id INTEGER NOT NULL UNIQUE,"
             "username TEXT,"
             "password TEXT,"
             "PRIMARY KEY (id))")
-        <<  QString::fromLatin1(
-            "CREATE TABLE STORE"
-            "(identity_id INTEGER,"
-            "method_id INTEGER,"
-            "key TEXT,"
-            "value BLOB,"
-            "PRIMARY KEY (identity_id, method_id, key))")
-
-        << QString::fromLatin1(
-            // Cascading Delete
-            "CREATE TRIGGER tg_delete_credentials "
-            "BEFORE DELETE ON CREDENTIALS "
-            "FOR EACH ROW BEGIN "
-            "    DELETE FROM STORE WHERE STORE.identity_id = OLD.id; "
-            "END; "
-        );
+        << tableUpdates2();
 
    foreach (QString createTable, createTableQuery) {
         QSqlQuery query = exec(createTable);
@@ -74,13 +179,111 @@ bool SecretsDB::createTables()
     return true;
 }
 
+QStringList SecretsDB::tableUpdates2()
+{
+    QStringList tableUpdates = QStringList()
+        <<  qualify(
+            "CREATE TABLE %1DATA"
+            "(identity_id INTEGER,"
+            "method_id INTEGER,"
+            "data BLOB,"
+            "PRIMARY KEY (identity_id, method_id))")
+        << qualify(
+            "DROP TRIGGER IF EXISTS %1tg_delete_credentials")
+        << qualify(
+            // Cascading Delete; the trigger body can only refer to the
+            // tables of its own schema, without qualifying them
+            "CREATE TRIGGER %1tg_delete_credentials "
+            "BEFORE DELETE ON CREDENTIALS "
+            "FOR EACH ROW BEGIN "
+            "    DELETE FROM DATA WHERE DATA.identity_id = OLD.id; "
+            "END; "
+        );
+    return tableUpdates;
+}
+
+bool SecretsDB::updateDB(int version)
+{
+    if (version == m_version)
+        return true;
+
+    //convert from 1 to 2
+    if (version <= 1) {
+        /* The STORE table had one row per key: merge the rows of each
+         * identity and method into a single record */
+        if (!startTransaction()) {
+            TRACE() << "Could not start transaction. Error converting data.";
+            return false;
+        }
+
+        bool allOk = true;
+        foreach (QString update, tableUpdates2()) {
+            exec(update);
+            if (errorOccurred()) {
+                allOk = false;
+                break;
+            }
+        }
+
+        QSqlQuery q = newQuery();
+        if (allOk) {
+            q = exec(qualify("SELECT identity_id, method_id, key, value "
+                             "FROM %1STORE ORDER BY identity_id, method_id"));
+            if (errorOccurred()) allOk = false;
+        }
+
+        QMap<QPair<quint32, quint32>, QVariantMap> records;
+        while (allOk && q.next()) {
+            QByteArray array = q.value(3).toByteArray();
+            QDataStream stream(array);
+            QVariant data;
+            stream >> data;
+            records[qMakePair(q.value(0).toUInt(), q.value(1).toUInt())].
+                insert(q.value(2).toString(), data);
+        }
+        q.finish();
+
+        QMap<QPair<quint32, quint32>, QVariantMap>::const_iterator i;
+        for (i = records.constBegin();
+             allOk && i != records.constEnd(); i++) {
+            allOk = insertRecord(i.key().first, i.key().second,
+                                 StoredData::encode(i.value()));
+        }
+
+        if (allOk) {
+            exec(qualify("DROP TABLE %1STORE"));
+            if (errorOccurred()) allOk = false;
+        }
+
+        if (!allOk || !commit()) {
+            BLAME() << "Data conversion failed.";
+            rollback();
+            return false;
+        }
+        TRACE() << "Converted" << records.count() << "data records";
+        version = 2;
+    }
+
+    //convert from 2 to 3
+    if (version == 2) {
+        /* Tried once, like for the metadata DB */
+        enableIncrementalVacuum();
+        version = 3;
+    }
+
+    if (version != m_version)
+        return false;
+
+    return SqlDatabase::updateDB(version);
+}
+
 bool SecretsDB::clear()
 {
     TRACE();
 
     QStringList clearCommands = QStringList()
-        << QLatin1String("DELETE FROM CREDENTIALS")
-        << QLatin1String("DELETE FROM STORE");
+        << qualify("DELETE FROM %1CREDENTIALS")
+        << qualify("DELETE FROM %1DATA");
 
     return transactionalExec(clearCommands);
 }
@@ -93,12 +296,11 @@ bool SecretsDB::updateCredentials(const quint32 id,
         TRACE() << "Could not start transaction. Error inserting credentials.";
         return false;
     }
-    QSqlQuery query = newQuery();
-
     TRACE() << "INSERT:" << id;
-    query.prepare(S("INSERT OR REPLACE INTO CREDENTIALS "
-                    "(id, username, password) "
-                    "VALUES(:id, :username, :password)"));
+    QSqlQuery query =
+        preparedQuery(qualify("INSERT OR REPLACE INTO %1CREDENTIALS "
+                              "(id, username, password) "
+                              "VALUES(:id, :username, :password)"));
 
     query.bindValue(S(":id"), id);
     query.bindValue(S(":username"), username);
@@ -119,12 +321,12 @@ bool SecretsDB::removeCredentials(const quint32 id)
     TRACE();
 
     QStringList queries = QStringList()
-        << QString::fromLatin1(
-            "DELETE FROM CREDENTIALS WHERE id = %1").arg(id)
-        << QString::fromLatin1(
-            "DELETE FROM STORE WHERE identity_id = %1").arg(id);
+        << qualify("DELETE FROM %1CREDENTIALS WHERE id = :id")
+        << qualify("DELETE FROM %1DATA WHERE identity_id = :id");
 
-    return transactionalExec(queries);
+    QVariantMap bindings;
+    bindings.insert(S(":id"), id);
+    return transactionalExec(queries, bindings);
 }
 
 bool SecretsDB::loadCredentials(const quint32 id,
@@ -133,10 +335,11 @@ bool SecretsDB::loadCredentials(const quint32 id,
 {
     TRACE();
 
-    QString queryStr =
-        QString::fromLatin1("SELECT username, password FROM credentials "
-                            "WHERE id = %1").arg(id);
-    QSqlQuery query = exec(queryStr);
+    QSqlQuery query = preparedQuery(qualify("SELECT username, password "
+                                            "FROM %1CREDENTIALS "
+                                            "WHERE id = :id"));
+    query.bindValue(S(":id"), id);
+    exec(query);
     if (!query.first()) {
         TRACE() << "No result or invalid credentials query.";
         return false;
@@ -147,89 +350,98 @@ bool SecretsDB::loadCredentials(const quint32 id,
     return true;
 }
 
-QVariantMap SecretsDB::loadData(quint32 id, quint32 method)
+QByteArray SecretsDB::loadRecord(quint32 id, quint32 method)
 {
-    TRACE();
+    QSqlQuery q = preparedQuery(
+        qualify("SELECT data FROM %1DATA "
+                "WHERE identity_id = :id AND method_id = :method"));
+    q.bindValue(S(":id"), id);
+    q.bindValue(S(":method"), method);
+    exec(q);
 
-    QSqlQuery q = newQuery();
-    q.prepare(S("SELECT key, value "
-                "FROM STORE WHERE identity_id = :id AND method_id = :method"));
+    QByteArray record;
+    if (q.first())
+        record = q.value(0).toByteArray();
+    q.finish();
+    return record;
+}
+
+bool SecretsDB::insertRecord(quint32 id, quint32 method,
+                             const QByteArray &record)
+{
+    QSqlQuery q = preparedQuery(
+        qualify("INSERT OR REPLACE INTO %1DATA "
+                "(identity_id, method_id, data) "
+                "VALUES(:id, :method, :data)"));
     q.bindValue(S(":id"), id);
     q.bindValue(S(":method"), method);
+    q.bindValue(S(":data"), record);
     exec(q);
-    if (errorOccurred())
+    return !errorOccurred();
+}
+
+QVariantMap SecretsDB::loadData(quint32 id, quint32 method,
+                                const QStringList &skippedKeys)
+{
+    TRACE() << skippedKeys;
+
+    QByteArray record = loadRecord(id, method);
+    if (record.isEmpty())
         return QVariantMap();
 
-    QVariantMap result;
-    while (q.next()) {
-        QByteArray array;
-        array = q.value(1).toByteArray();
-        QDataStream stream(array);
-        QVariant data;
-        stream >> data;
-        result.insert(q.value(0).toString(), data);
-    }
-    return result;
+    /* The skipped values don't get decoded */
+    return StoredData(record).toMap(skippedKeys);
 }
 
 bool SecretsDB::storeData(quint32 id, quint32 method, const QVariantMap &data)
 {
     TRACE();
 
-    if (!startTransaction()) {
-        TRACE() << "Could not start transaction. Error inserting data.";
-        return false;
+    QVariantMap validData;
+    qint32 dataCounter = 0;
+    QMapIterator<QString, QVariant> it(data);
+    while (it.hasNext()) {
+        it.next();
+
+        QByteArray array;
+        QDataStream stream(&array, QIODevice::WriteOnly);
+        stream << it.value();
+
+        dataCounter += it.key().size() +array.size();
+        if (dataCounter >= m_maxDataSize) {
+            BLAME() << "storing data max size exceeded";
+            return false;
+        }
+        /* Key/value insert/replace/delete */
+        if (!it.value().isValid() || it.value().isNull()) {
+            continue;
+        }
+        validData.insert(it.key(), it.value());
     }
 
-    /* first, remove existing data */
-    QSqlQuery q = newQuery();
-    q.prepare(S("DELETE FROM STORE WHERE identity_id = :id "
-                "AND method_id = :method"));
-    q.bindValue(S(":id"), id);
-    q.bindValue(S(":method"), method);
-    exec(q);
-    if (errorOccurred()) {
-        rollback();
-        TRACE() << "Data removal failed.";
+    /* The plugin data (mostly tokens) can be obtained again from the
+     * server, so it doesn't need the same durability as the credentials. */
+    if (!startTransaction(Lazy)) {
+        TRACE() << "Could not start transaction. Error inserting data.";
         return false;
     }
 
     bool allOk = true;
-    qint32 dataCounter = 0;
-    if (!(data.keys().empty())) {
-        QMapIterator<QString, QVariant> it(data);
-        while (it.hasNext()) {
-            it.next();
-
-            QByteArray array;
-            QDataStream stream(&array, QIODevice::WriteOnly);
-            stream << it.value();
-
-            dataCounter += it.key().size() +array.size();
-            if (dataCounter >= SSO_MAX_TOKEN_STORAGE) {
-                BLAME() << "storing data max size exceeded";
-                allOk = false;
-                break;
-            }
-            /* Key/value insert/replace/delete */
-            QSqlQuery query = newQuery();
-            if (!it.value().isValid() || it.value().isNull()) {
-                continue;
-            }
+    if (validData.isEmpty()) {
+        QSqlQuery q = preparedQuery(
+            qualify("DELETE FROM %1DATA "
+                    "WHERE identity_id = :id AND method_id = :method"));
+        q.bindValue(S(":id"), id);
+        q.bindValue(S(":method"), method);
+        exec(q);
+        if (errorOccurred()) allOk = false;
+    } else {
+        /* Token refreshes often store the same data again: don't rewrite
+         * the record if it didn't change */
+        QByteArray record = StoredData::encode(validData);
+        if (record != loadRecord(id, method)) {
             TRACE() << "insert";
-            query.prepare(S(
-                "INSERT OR REPLACE INTO STORE "
-                "(identity_id, method_id, key, value) "
-                "VALUES(:id, :method, :key, :value)"));
-            query.bindValue(S(":value"), array);
-            query.bindValue(S(":id"), id);
-            query.bindValue(S(":method"), method);
-            query.bindValue(S(":key"), it.key());
-            exec(query);
-            if (errorOccurred()) {
-                allOk = false;
-                break;
-            }
+            allOk = insertRecord(id, method, record);
         }
     }
 
@@ -246,17 +458,18 @@ bool SecretsDB::removeData(quint32 id, quint32 method)
 {
     TRACE();
 
-    if (!startTransaction()) {
+    if (!startTransaction(Lazy)) {
         TRACE() << "Could not start transaction. Error removing data.";
         return false;
     }
 
     QSqlQuery q = newQuery();
     if (method == 0) {
-        q.prepare(S("DELETE FROM STORE WHERE identity_id = :id"));
+        q = preparedQuery(qualify("DELETE FROM %1DATA "
+                                  "WHERE identity_id = :id"));
     } else {
-        q.prepare(S("DELETE FROM STORE WHERE identity_id = :id "
-                    "AND method_id = :method"));
+        q = preparedQuery(qualify("DELETE FROM %1DATA WHERE identity_id = :id "
+                                  "AND method_id = :method"));
         q.bindValue(S(":method"), method);
     }
     q.bindValue(S(":id"), id);
@@ -273,7 +486,8 @@ bool SecretsDB::removeData(quint32 id, quint32 method)
 
 DefaultSecretsStorage::DefaultSecretsStorage(QObject *parent):
     AbstractSecretsStorage(parent),
-    m_secretsDB(0)
+    m_secretsDB(0),
+    m_hostDatabase(0)
 {
 }
 
@@ -292,7 +506,9 @@ bool DefaultSecretsStorage::initialize(const QVariantMap &configuration)
     QString name; // force deep copy / detach
     name.append(configuration.value(QLatin1String("name")).toString());
 
-    m_secretsDB = new SecretsDB(name);
+    m_secretsDB = m_hostDatabase != 0 ?
+        new SecretsDB(m_hostDatabase, name) : new SecretsDB(name);
+    m_secretsDB->setOptions(configuration);
     if (!m_secretsDB->init()) {
         setLastError(m_secretsDB->lastError());
         delete m_secretsDB;
@@ -300,17 +516,25 @@ bool DefaultSecretsStorage::initialize(const QVariantMap &configuration)
         return false;
     }
 
+    /* An attached DB has no connection of its own */
     m_secretsDBConnectionName.clear();
-    m_secretsDBConnectionName.append(m_secretsDB->connectionName());
+    if (!m_secretsDB->isAttached())
+        m_secretsDBConnectionName.append(m_secretsDB->connectionName());
     setIsOpen(true);
     return true;
 }
 
+void DefaultSecretsStorage::setHostDatabase(SqlDatabase *database)
+{
+    m_hostDatabase = database;
+}
+
 bool DefaultSecretsStorage::close()
 {
     if (m_secretsDB != 0) {
         delete m_secretsDB;
-        QSqlDatabase::removeDatabase(m_secretsDBConnectionName);
+        if (!m_secretsDBConnectionName.isEmpty())
+            QSqlDatabase::removeDatabase(m_secretsDBConnectionName);
         m_secretsDB = 0;
     }
     return AbstractSecretsStorage::close();
@@ -355,6 +579,14 @@ QVariantMap DefaultSecretsStorage::loadData(quint32 id, quint32 method)
     return m_secretsDB->loadData(id, method);
 }
 
+QVariantMap DefaultSecretsStorage::loadPartialData(quint32 id, quint32 method,
+                                                   const QStringList &skippedKeys)
+{
+    RETURN_IF_NOT_OPEN(QVariantMap());
+
+    return m_secretsDB->loadData(id, method, skippedKeys);
+}
+
 bool DefaultSecretsStorage::storeData(quint32 id, quint32 method,
                                       const QVariantMap &data)
 {
@@ -369,3 +601,55 @@ bool DefaultSecretsStorage::removeData(quint32 id, quint32 method)
 
     return m_secretsDB->removeData(id, method);
 }
+
+bool DefaultSecretsStorage::checkpoint()
+{
+    RETURN_IF_NOT_OPEN(false);
+
+    return m_secretsDB->checkpoint();
+}
+
+qint64 DefaultSecretsStorage::incrementalVacuum(int maxPages)
+{
+    RETURN_IF_NOT_OPEN(-1);
+
+    return m_secretsDB->incrementalVacuum(maxPages);
+}
+
+qint64 DefaultSecretsStorage::fileSize()
+{
+    RETURN_IF_NOT_OPEN(-1);
+
+    return m_secretsDB->fileSize();
+}
+
+qint64 DefaultSecretsStorage::freeSize()
+{
+    RETURN_IF_NOT_OPEN(-1);
+
+    return m_secretsDB->freeSize();
+}
+
+bool DefaultSecretsStorage::beginTransaction()
+{
+    RETURN_IF_NOT_OPEN(false);
+
+    return m_secretsDB->startTransaction();
+}
+
+bool DefaultSecretsStorage::commitTransaction()
+{
+    RETURN_IF_NOT_OPEN(false);
+
+    if (!m_secretsDB->commit()) {
+        m_secretsDB->rollback();
+        return false;
+    }
+    return true;
+}
+
+void DefaultSecretsStorage::rollbackTransaction()
+{
+    if (isOpen())
+        m_secretsDB->rollback();
+}
@@ -38,14 +38,51 @@
 
 namespace SignonDaemonNS {
 
+/*!
+ * @class StoredData
+ * The data stored by a plugin for an identity and method, serialized into
+ * a single versioned record. The record starts with an index of the keys,
+ * so that each value is decoded only when it is requested.
+ */
+class StoredData
+{
+public:
+    explicit StoredData(const QByteArray &record = QByteArray());
+
+    /*!
+     * Serializes the data into a record; large records are compressed.
+     */
+    static QByteArray encode(const QVariantMap &data);
+
+    bool isValid() const { return m_isValid; }
+    QStringList keys() const { return m_index.keys(); }
+    bool contains(const QString &key) const { return m_index.contains(key); }
+    QVariant value(const QString &key) const;
+    /*!
+     * Decodes all the values, except those of the given keys.
+     */
+    QVariantMap toMap(const QStringList &skippedKeys = QStringList()) const;
+
+private:
+    QByteArray m_values;
+    QHash<QString, QPair<quint32, quint32> > m_index;
+    bool m_isValid;
+};
+
 class SecretsDB: public SqlDatabase
 {
     friend class ::TestDatabase;
 public:
     SecretsDB(const QString &name):
-        SqlDatabase(name, QLatin1String("SSO-secrets"), SSO_SECRETSDB_VERSION) {}
+        SqlDatabase(name, QLatin1String("SSO-secrets"), SSO_SECRETSDB_VERSION),
+        m_maxDataSize(SSO_MAX_TOKEN_STORAGE) {}
+    SecretsDB(SqlDatabase *host, const QString &name):
+        SqlDatabase(host, QLatin1String("secrets"), name,
+                    SSO_SECRETSDB_VERSION),
+        m_maxDataSize(SSO_MAX_TOKEN_STORAGE) {}
 
     bool createTables();
+    bool updateDB(int version);
     bool clear();
 
     bool updateCredentials(const quint32 id,
@@ -56,9 +93,18 @@ public:
                          QString &username,
                          QString &password);
 
-    QVariantMap loadData(quint32 id, quint32 method);
+    QVariantMap loadData(quint32 id, quint32 method,
+                         const QStringList &skippedKeys = QStringList());
     bool storeData(quint32 id, quint32 method, const QVariantMap &data);
     bool removeData(quint32 id, quint32 method);
+
+private:
+    QByteArray loadRecord(quint32 id, quint32 method);
+    bool insertRecord(quint32 id, quint32 method, const QByteArray &record);
+    QStringList tableUpdates2();
+
+private:
+    int m_maxDataSize;
 };
 
 
@@ -70,9 +116,13 @@ public:
  * filesystem.
  * @ingroup Accounts_and_SSO_Framework
  */
-class DefaultSecretsStorage: public SignOn::AbstractSecretsStorage
+class DefaultSecretsStorage: public SignOn::AbstractSecretsStorage,
+                             public SignOn::SecretsStorageBatchInterface,
+                             public SignOn::SecretsStorageMaintenanceInterface
 {
     Q_OBJECT
+    Q_INTERFACES(SignOn::SecretsStorageBatchInterface
+                 SignOn::SecretsStorageMaintenanceInterface)
 
 public:
     explicit DefaultSecretsStorage(QObject *parent = 0);
@@ -93,9 +143,34 @@ public:
     bool storeData(quint32 id, quint32 method, const QVariantMap &data);
     bool removeData(quint32 id, quint32 method);
 
+    /* reimplemented from SecretsStorageBatchInterface */
+    bool beginTransaction();
+    bool commitTransaction();
+    void rollbackTransaction();
+
+    /* reimplemented from SecretsStorageMaintenanceInterface */
+    QVariantMap loadPartialData(quint32 id, quint32 method,
+                                const QStringList &skippedKeys);
+    bool checkpoint();
+    qint64 incrementalVacuum(int maxPages);
+    qint64 fileSize();
+    qint64 freeSize();
+
+    /*!
+     * Makes the next initialize() attach the secrets DB to the connection of
+     * the given database, instead of opening a connection for it: the writes
+     * made on both databases within one transaction are then committed
+     * together. Pass 0 to go back to a separate connection.
+     * @param database The database whose connection is shared; it must stay
+     * open until the secrets DB is closed.
+     */
+    void setHostDatabase(SqlDatabase *database);
+    SqlDatabase *hostDatabase() const { return m_hostDatabase; }
+
 private:
     SecretsDB *m_secretsDB;
     QString m_secretsDBConnectionName;
+    SqlDatabase *m_hostDatabase;
 };
 
 } //namespace
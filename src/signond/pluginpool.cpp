@@ -0,0 +1,272 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "pluginpool.h"
+#include "pluginproxy.h"
+#include "signond-common.h"
+
+namespace SignonDaemonNS {
+
+static const int defaultMinSize = 1;
+static const int defaultMaxSize = 2;
+static const int defaultIdleTimeout = 30;
+
+PluginPool *PluginPool::m_pInstance = 0;
+
+PluginPool::PluginPool(QObject *parent):
+    QObject(parent),
+    m_minSize(defaultMinSize),
+    m_maxSize(defaultMaxSize),
+    m_idleTimeout(defaultIdleTimeout)
+{
+    if (m_pInstance == 0)
+        m_pInstance = this;
+
+    m_clock.start();
+
+    m_refillTimer.setSingleShot(true);
+    m_refillTimer.setInterval(0);
+    connect(&m_refillTimer, SIGNAL(timeout()), this, SLOT(refill()));
+
+    m_reapTimer.setSingleShot(true);
+    connect(&m_reapTimer, SIGNAL(timeout()), this, SLOT(reap()));
+}
+
+PluginPool::~PluginPool()
+{
+    foreach (const QList<IdleProxy> &proxies, m_idleProxies) {
+        foreach (const IdleProxy &idle, proxies)
+            delete idle.proxy;
+    }
+    m_idleProxies.clear();
+
+    if (m_pInstance == this)
+        m_pInstance = 0;
+}
+
+PluginPool *PluginPool::instance()
+{
+    return m_pInstance;
+}
+
+void PluginPool::setLimits(int minSize, int maxSize, int idleTimeout)
+{
+    m_maxSize = qMax(maxSize, 0);
+    m_minSize = qBound(0, minSize, m_maxSize);
+    m_idleTimeout = qMax(idleTimeout, 0);
+    TRACE() << "Plugin pool size:" << m_minSize << "-" << m_maxSize <<
+        ", idle timeout:" << m_idleTimeout;
+
+    reap();
+}
+
+PluginProxy *PluginPool::acquire(const QString &type, quint32 identity)
+{
+    QList<IdleProxy> &proxies = m_idleProxies[type];
+    PluginProxy *proxy = 0;
+    while (proxy == 0) {
+        /* Take the most recently used process which served the same
+         * identity, or an unused one: the others may be reaped */
+        int index = -1;
+        for (int i = proxies.count() - 1; i >= 0; i--) {
+            const IdleProxy &idle = proxies[i];
+            if (!idle.unused && identity != 0 && idle.identity == identity) {
+                index = i;
+                break;
+            }
+            if (idle.unused && index < 0)
+                index = i;
+        }
+        if (index < 0) break;
+
+        proxy = proxies.takeAt(index).proxy;
+        proxy->disconnect();
+        if (proxy->state() == PluginProxy::NotRunning) {
+            TRACE() << "Pooled" << type << "process is gone";
+            delete proxy;
+            proxy = 0;
+        }
+    }
+
+    if (proxy == 0) {
+        TRACE() << "No idle" << type << "process, starting one";
+        proxy = PluginProxy::startPluginProxy(type);
+    }
+
+    m_types.insert(type);
+    if (m_minSize > 0)
+        m_refillTimer.start();
+    return proxy;
+}
+
+void PluginPool::release(PluginProxy *proxy)
+{
+    keep(proxy, 0, true);
+}
+
+void PluginPool::release(PluginProxy *proxy, quint32 identity)
+{
+    if (proxy != 0 && identity == SIGNOND_NEW_IDENTITY) {
+        /* Nothing tells the clients of such sessions apart */
+        TRACE() << "Stopping" << proxy->type() <<
+            "process used without identity";
+        delete proxy;
+        return;
+    }
+    keep(proxy, identity, false);
+}
+
+void PluginPool::keep(PluginProxy *proxy, quint32 identity, bool unused)
+{
+    if (proxy == 0) return;
+
+    /* The proxy might have been used by a session which is gone: don't let
+     * its signals reach anybody else. */
+    proxy->disconnect();
+
+    /* A process which is still starting has no state to be reset */
+    const QList<IdleProxy> &proxies = m_idleProxies[proxy->type()];
+    if (proxies.count() >= m_maxSize || proxy->isProcessing() ||
+        (proxy->state() != PluginProxy::Starting && !proxy->reset())) {
+        delete proxy;
+        return;
+    }
+
+    addIdle(proxy, identity, unused);
+
+    if (!m_reapTimer.isActive())
+        m_reapTimer.start(m_idleTimeout * 1000);
+}
+
+int PluginPool::idleCount(const QString &type) const
+{
+    return m_idleProxies.value(type).count();
+}
+
+int PluginPool::unusedCount(const QString &type) const
+{
+    int count = 0;
+    foreach (const IdleProxy &idle, m_idleProxies.value(type)) {
+        if (idle.unused)
+            count++;
+    }
+    return count;
+}
+
+void PluginPool::refill()
+{
+    /* Start one process at a time, letting the event loop run in between */
+    foreach (const QString &type, m_types) {
+        if (unusedCount(type) >= m_minSize ||
+            idleCount(type) >= m_maxSize) continue;
+
+        /* The process is loading the plugin in the background; the next one
+         * is started once this one is ready. */
+        PluginProxy *proxy = PluginProxy::startPluginProxy(type);
+        addIdle(proxy, 0, true);
+        connect(proxy, SIGNAL(ready()), &m_refillTimer, SLOT(start()));
+        if (!m_reapTimer.isActive())
+            m_reapTimer.start(m_idleTimeout * 1000);
+        return;
+    }
+}
+
+void PluginPool::addIdle(PluginProxy *proxy, quint32 identity, bool unused)
+{
+    connect(proxy, SIGNAL(startFailed()), this, SLOT(onStartFailed()));
+
+    IdleProxy idle;
+    idle.proxy = proxy;
+    idle.since = m_clock.elapsed();
+    idle.identity = identity;
+    idle.unused = unused;
+    m_idleProxies[proxy->type()].append(idle);
+}
+
+void PluginPool::onStartFailed()
+{
+    PluginProxy *proxy = qobject_cast<PluginProxy*>(sender());
+    if (proxy == 0) return;
+
+    BLAME() << "Cannot start a process for" << proxy->type();
+    /* Don't try again until the method is used */
+    m_types.remove(proxy->type());
+
+    QList<IdleProxy> &proxies = m_idleProxies[proxy->type()];
+    for (int i = 0; i < proxies.count(); i++) {
+        if (proxies[i].proxy == proxy) {
+            proxies.removeAt(i);
+            break;
+        }
+    }
+    proxy->disconnect(this);
+    proxy->deleteLater();
+}
+
+void PluginPool::reap()
+{
+    qint64 now = m_clock.elapsed();
+    qint64 timeout = qint64(m_idleTimeout) * 1000;
+    qint64 nextExpiry = -1;
+
+    QMutableHashIterator<QString, QList<IdleProxy> > it(m_idleProxies);
+    while (it.hasNext()) {
+        it.next();
+        /* The oldest processes come first */
+        QList<IdleProxy> &proxies = it.value();
+        int unused = unusedCount(it.key());
+        int i = 0;
+        while (i < proxies.count()) {
+            const IdleProxy &idle = proxies[i];
+            /* The minimum number of unused processes is kept running */
+            if (idle.unused && unused <= m_minSize) {
+                i++;
+                continue;
+            }
+
+            qint64 expiry = idle.since + timeout;
+            if (expiry > now && proxies.count() <= m_maxSize) {
+                if (nextExpiry < 0 || expiry < nextExpiry)
+                    nextExpiry = expiry;
+                i++;
+                continue;
+            }
+            TRACE() << "Stopping idle" << it.key() << "process";
+            if (idle.unused)
+                unused--;
+            delete proxies.takeAt(i).proxy;
+        }
+
+        if (proxies.isEmpty())
+            it.remove();
+    }
+
+    if (nextExpiry >= 0)
+        m_reapTimer.start(int(nextExpiry - now));
+
+    /* The processes served identities, or the minimum size has grown */
+    if (m_minSize > 0 && !m_types.isEmpty())
+        m_refillTimer.start();
+}
+
+} // namespace SignonDaemonNS
@@ -0,0 +1,143 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*!
+  @file pluginpool.h
+  Definition of the PluginPool object.
+  @ingroup Accounts_and_SSO_Framework
+ */
+
+#ifndef SIGNON_PLUGIN_POOL_H
+#define SIGNON_PLUGIN_POOL_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+
+namespace SignonDaemonNS {
+
+class PluginProxy;
+
+/*!
+ * @class PluginPool
+ * Keeps plugin processes running while no session uses them, so that new
+ * sessions don't have to wait for a process to start and load its plugin.
+ *
+ * The processes given back to the pool are reset, so that no state of the
+ * previous session is carried over to the next one, and are kept up to the
+ * maximum size of the pool. Still, a plugin might keep state the reset
+ * doesn't reach: a process which has served a stored identity is only
+ * handed out again for the same identity, and one which has served a
+ * session without a stored identity is not kept at all.
+ *
+ * Once a method has been used, the pool also starts processes for it in
+ * advance, up to the minimum size; this happens from the event loop, rather
+ * than when a session needs them. These unused processes keep running for
+ * as long as the daemon does, while the ones above the minimum size and the
+ * ones which served an identity are stopped after a while. The first
+ * session using a method still waits for its process to start.
+ */
+class PluginPool: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PluginPool(QObject *parent = 0);
+    ~PluginPool();
+
+    static PluginPool *instance();
+
+    /*!
+     * Sets the size of the pool.
+     * @param minSize The number of unused processes kept running for each
+     * method which has been used.
+     * @param maxSize The maximum number of idle processes kept for each
+     * method; 0 disables the pool.
+     * @param idleTimeout The number of seconds after which the idle
+     * processes beyond the minimum size are stopped.
+     */
+    void setLimits(int minSize, int maxSize, int idleTimeout);
+
+    /*!
+     * Returns a proxy for a plugin of the given type: an idle one from the
+     * pool, if any, or a newly started one. The proxy might still be
+     * starting: see PluginProxy::state().
+     * @param identity The stored identity the proxy is going to serve: the
+     * processes which served it before are preferred to the unused ones.
+     */
+    PluginProxy *acquire(const QString &type, quint32 identity = 0);
+
+    /*!
+     * Gives back a proxy returned by acquire(), which has not processed
+     * any request: it is kept in the pool if possible, deleted otherwise.
+     */
+    void release(PluginProxy *proxy);
+
+    /*!
+     * Gives back a proxy returned by acquire(), after serving the given
+     * identity: it is reset and kept in the pool for this identity only,
+     * if possible, deleted otherwise.
+     */
+    void release(PluginProxy *proxy, quint32 identity);
+
+    /*!
+     * @returns the number of idle processes kept for the given method.
+     */
+    int idleCount(const QString &type) const;
+
+private Q_SLOTS:
+    void refill();
+    void reap();
+    void onStartFailed();
+
+private:
+    void keep(PluginProxy *proxy, quint32 identity, bool unused);
+    void addIdle(PluginProxy *proxy, quint32 identity, bool unused);
+    int unusedCount(const QString &type) const;
+
+    struct IdleProxy {
+        PluginProxy *proxy;
+        qint64 since;
+        /* The identity served by the process, if not unused */
+        quint32 identity;
+        bool unused;
+    };
+
+    static PluginPool *m_pInstance;
+    int m_minSize;
+    int m_maxSize;
+    int m_idleTimeout;
+    QElapsedTimer m_clock;
+    QHash<QString, QList<IdleProxy> > m_idleProxies;
+    QSet<QString> m_types;
+    QTimer m_refillTimer;
+    QTimer m_reapTimer;
+};
+
+} // namespace SignonDaemonNS
+
+#endif // SIGNON_PLUGIN_POOL_H
@@ -31,6 +31,7 @@
 #include <QThreadStorage>
 #include <QThread>
 #include <QDataStream>
+#include <QElapsedTimer>
 
 #include "signond-common.h"
 #include "SignOn/uisessiondata_priv.h"
@@ -60,14 +61,56 @@ namespace SignonDaemonNS {
 /* ---------------------- PluginProcess ---------------------- */
 
 PluginProcess::PluginProcess(QObject *parent):
-    QProcess(parent)
+    QProcess(parent),
+    m_terminated(false)
 {
+    m_stopTimer.setSingleShot(true);
+    m_stopTimer.setInterval(PLUGINPROCESS_STOP_TIMEOUT);
+    connect(&m_stopTimer, SIGNAL(timeout()), this, SLOT(onStopTimeout()));
 }
 
 PluginProcess::~PluginProcess()
 {
 }
 
+void PluginProcess::shutdown()
+{
+    /* Detach from the proxy being destroyed; the application object only
+     * takes care of the processes still around when the daemon exits. */
+    disconnect();
+    setParent(QCoreApplication::instance());
+
+    if (state() == QProcess::NotRunning) {
+        deleteLater();
+        return;
+    }
+
+    connect(this, SIGNAL(finished(int, QProcess::ExitStatus)),
+            this, SLOT(deleteLater()));
+
+    /* Closing the write channel ensures that the plugin process
+     * will not get stuck on the next read.
+     */
+    closeWriteChannel();
+    m_stopTimer.start();
+}
+
+void PluginProcess::onStopTimeout()
+{
+    if (state() == QProcess::NotRunning) return;
+
+    if (!m_terminated) {
+        qCritical() << "The signon plugin does not react on demand to "
+            "stop: terminating it";
+        m_terminated = true;
+        terminate();
+        m_stopTimer.start();
+    } else {
+        qCritical() << "The signon plugin ignores SIGTERM: killing it";
+        kill();
+    }
+}
+
 /* ---------------------- PluginProxy ---------------------- */
 
 PluginProxy::PluginProxy(QString type, QObject *parent):
@@ -76,9 +119,11 @@ PluginProxy::PluginProxy(QString type, QObject *parent):
     TRACE();
 
     m_type = type;
-    m_isProcessing = false;
-    m_isResultObtained = false;
+    m_state = NotRunning;
+    m_reentrant = false;
     m_currentResultOperation = -1;
+    m_currentRequestId = 0;
+    m_startupQuery = 0;
     m_process = new PluginProcess(this);
 
 #ifdef SIGNOND_TRACE
@@ -101,167 +146,337 @@ PluginProxy::PluginProxy(QString type, QObject *parent):
             this, SLOT(onExit(int, QProcess::ExitStatus)));
     connect(m_process, SIGNAL(error(QProcess::ProcessError)),
             this, SLOT(onError(QProcess::ProcessError)));
+
+    m_blobIOHandler = new BlobIOHandler(m_process, m_process, this);
+
+    connect(m_blobIOHandler,
+            SIGNAL(dataReceived(const QVariantMap &)),
+            this,
+            SLOT(sessionDataReceived(const QVariantMap &)));
+
+    QSocketNotifier *readNotifier =
+        new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
+
+    readNotifier->setEnabled(false);
+    m_blobIOHandler->setReadChannelSocketNotifier(readNotifier);
+
+    m_startTimer.setSingleShot(true);
+    m_startTimer.setInterval(PLUGINPROCESS_START_TIMEOUT);
+    connect(&m_startTimer, SIGNAL(timeout()), this, SLOT(onStartTimeout()));
 }
 
 PluginProxy::~PluginProxy()
 {
-    if (m_process != NULL &&
-        m_process->state() != QProcess::NotRunning)
-    {
-        if (m_isProcessing)
-            cancel();
+    if (m_state == Ready) {
+        foreach (quint32 requestId, m_activeRequests.keys())
+            cancel(requestId);
 
         stop();
-
-        /* Closing the write channel ensures that the plugin process
-         * will not get stuck on the next read.
-         */
-        m_process->closeWriteChannel();
-
-        if (!m_process->waitForFinished(PLUGINPROCESS_STOP_TIMEOUT)) {
-            qCritical() << "The signon plugin does not react on demand to "
-                "stop: need to kill it!!!";
-            m_process->kill();
-
-            if (!m_process->waitForFinished(PLUGINPROCESS_STOP_TIMEOUT))
-            {
-                if (m_process->pid()) {
-                    qCritical() << "The signon plugin seems to ignore kill(), "
-                        "killing it from command line";
-                    QString killProcessCommand(QString::fromLatin1("kill -9 %1").arg(m_process->pid()));
-                    QProcess::execute(killProcessCommand);
-                }
-            }
-        }
     }
+
+    /* Don't wait for the process to exit: it is terminated in the
+     * background, and killed if it doesn't comply. */
+    m_process->shutdown();
+    m_process = NULL;
 }
 
 PluginProxy* PluginProxy::createNewPluginProxy(const QString &type)
 {
-    PluginProxy *pp = new PluginProxy(type);
+    PluginProxy *pp = startPluginProxy(type);
 
-    QStringList args = QStringList() << pp->m_type;
-    pp->m_process->start(REMOTEPLUGIN_BIN_PATH, args);
-
-    QByteArray tmp;
-
-    if (!pp->waitForStarted(PLUGINPROCESS_START_TIMEOUT)) {
-        TRACE() << "The process cannot be started";
+    if (!pp->waitForReady(PLUGINPROCESS_START_TIMEOUT)) {
+        TRACE() << "The process cannot load plugin";
         delete pp;
         return NULL;
     }
 
-    if (!pp->readOnReady(tmp, PLUGINPROCESS_START_TIMEOUT)) {
-        TRACE() << "The process cannot load plugin";
-        delete pp;
-        return NULL;
+    return pp;
+}
+
+PluginProxy *PluginProxy::startPluginProxy(const QString &type)
+{
+    PluginProxy *pp = new PluginProxy(type);
+    pp->start();
+    return pp;
+}
+
+void PluginProxy::start()
+{
+    TRACE() << "Starting plugin process for" << m_type;
+
+    m_state = Starting;
+    m_readBuffer.clear();
+    m_startupQuery = 0;
+
+    disconnect(m_process, SIGNAL(readyRead()), this, 0);
+    connect(m_process, SIGNAL(readyRead()), this, SLOT(onStartupOutput()));
+
+    m_startTimer.start();
+    m_process->start(REMOTEPLUGIN_BIN_PATH, QStringList(m_type));
+}
+
+void PluginProxy::sendQuery(quint32 operation)
+{
+    m_startupQuery = operation;
+    QDataStream ds(m_process);
+    ds << operation;
+}
+
+void PluginProxy::onStartupOutput()
+{
+    m_readBuffer += m_process->readAllStandardOutput();
+
+    /* The plugin process announces itself once it has loaded the plugin;
+     * then it is queried for its type and mechanisms, one request at a time.
+     */
+    if (m_startupQuery == 0) {
+        static const QByteArray started("process started");
+        if (m_readBuffer.size() < started.size()) return;
+        if (!m_readBuffer.startsWith(started)) {
+            abortStart("unexpected output");
+            return;
+        }
+        m_readBuffer.remove(0, started.size());
+        sendQuery(debugEnabled() ? PLUGIN_OP_TYPE : PLUGIN_OP_MECHANISMS);
+        return;
     }
 
-    if (debugEnabled()) {
-        QString pluginType = pp->queryType();
-        if (pluginType != pp->m_type) {
+    QDataStream out(m_readBuffer);
+    if (m_startupQuery == PLUGIN_OP_TYPE) {
+        QString pluginType;
+        out >> pluginType;
+        if (out.status() != QDataStream::Ok) return;
+
+        if (pluginType != m_type) {
             BLAME() << QString::fromLatin1("Plugin returned type '%1', "
                                            "expected '%2'").
-                arg(pluginType).arg(pp->m_type);
+                arg(pluginType).arg(m_type);
         }
+        m_readBuffer.clear();
+        sendQuery(PLUGIN_OP_MECHANISMS);
+        return;
+    }
+
+    if (m_startupQuery == PLUGIN_OP_MECHANISMS) {
+        QVariant mechanismsVar;
+        out >> mechanismsVar;
+        if (out.status() != QDataStream::Ok) return;
+
+        QVariantList varList = mechanismsVar.toList();
+        m_mechanisms.clear();
+        for (int i = 0; i < varList.count(); i++)
+            m_mechanisms << varList.at(i).toString();
+        TRACE() << m_mechanisms;
+
+        m_readBuffer.clear();
+        sendQuery(PLUGIN_OP_REENTRANT);
+        return;
     }
-    pp->m_mechanisms = pp->queryMechanisms();
 
-    connect(pp->m_process, SIGNAL(readyRead()),
-            pp, SLOT(onReadStandardOutput()));
+    out >> m_reentrant;
+    if (out.status() != QDataStream::Ok) return;
+    TRACE() << "Plugin is reentrant:" << m_reentrant;
+
+    m_startTimer.stop();
+    m_readBuffer.clear();
+    m_startupQuery = 0;
+    m_state = Ready;
+
+    disconnect(m_process, SIGNAL(readyRead()),
+               this, SLOT(onStartupOutput()));
+    connect(m_process, SIGNAL(readyRead()),
+            this, SLOT(onReadStandardOutput()));
 
     TRACE() << "The process is started";
-    return pp;
+    QList<Request> pendingRequests = m_pendingRequests;
+    m_pendingRequests.clear();
+    foreach (const Request &request, pendingRequests)
+        sendRequest(request);
+    emit ready();
+}
+
+void PluginProxy::onStartTimeout()
+{
+    if (m_state == Starting)
+        abortStart("timeout");
+}
+
+void PluginProxy::abortStart(const char *reason)
+{
+    BLAME() << "The plugin process for" << m_type << "cannot be started:" <<
+        reason;
+
+    m_startTimer.stop();
+    m_state = NotRunning;
+    m_pendingRequests.clear();
+
+    disconnect(m_process, SIGNAL(readyRead()),
+               this, SLOT(onStartupOutput()));
+    if (m_process->state() != QProcess::NotRunning)
+        m_process->kill();
+
+    failActiveRequests(Error::InternalServer,
+                       QLatin1String("plugin process cannot be started"));
+    emit startFailed();
+}
+
+bool PluginProxy::waitForReady(int timeout)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    /* The QProcess waitFor*() methods emit the signals, so this drives the
+     * same state machine as the event loop would. */
+    while (m_state == Starting) {
+        qint64 remaining = timeout - timer.elapsed();
+        if (remaining <= 0 ||
+            !m_process->waitForReadyRead(int(remaining)))
+            break;
+    }
+
+    return m_state == Ready;
+}
+
+void PluginProxy::sendRequest(const Request &request)
+{
+    if (m_state != Ready) {
+        m_pendingRequests.append(request);
+        return;
+    }
+
+    QDataStream in(m_process);
+    in << request.operation;
+    in << request.requestId;
+    if (request.operation == PLUGIN_OP_PROCESS)
+        in << request.mechanism;
+
+    m_blobIOHandler->sendData(request.data);
+}
+
+void PluginProxy::failActiveRequests(int error, const QString &message)
+{
+    QList<quint32> requestIds = m_activeRequests.keys();
+    m_activeRequests.clear();
+    foreach (quint32 requestId, requestIds)
+        emit processError(requestId, error, message);
 }
 
-bool PluginProxy::process(const QVariantMap &inData,
+bool PluginProxy::process(quint32 requestId,
+                          const QVariantMap &inData,
                           const QString &mechanism)
 {
     if (!restartIfRequired())
         return false;
 
-    m_isResultObtained = false;
     QVariant value = inData.value(SSOUI_KEY_UIPOLICY);
-    m_uiPolicy = value.toInt();
+    m_activeRequests.insert(requestId, value.toInt());
 
-    QDataStream in(m_process);
-    in << (quint32)PLUGIN_OP_PROCESS;
-    in << mechanism;
-
-    m_blobIOHandler->sendData(inData);
+    Request request;
+    request.operation = PLUGIN_OP_PROCESS;
+    request.requestId = requestId;
+    request.mechanism = mechanism;
+    request.data = inData;
+    sendRequest(request);
 
-    m_isProcessing = true;
     return true;
 }
 
-bool PluginProxy::processUi(const QVariantMap &inData)
+bool PluginProxy::processUi(quint32 requestId, const QVariantMap &inData)
 {
     TRACE();
 
     if (!restartIfRequired())
         return false;
 
-    QDataStream in(m_process);
-
-    in << (quint32)PLUGIN_OP_PROCESS_UI;
+    if (!m_activeRequests.contains(requestId))
+        m_activeRequests.insert(requestId, 0);
 
-    m_blobIOHandler->sendData(inData);
-
-    m_isProcessing = true;
+    Request request;
+    request.operation = PLUGIN_OP_PROCESS_UI;
+    request.requestId = requestId;
+    request.data = inData;
+    sendRequest(request);
 
     return true;
 }
 
-bool PluginProxy::processRefresh(const QVariantMap &inData)
+bool PluginProxy::processRefresh(quint32 requestId, const QVariantMap &inData)
 {
     TRACE();
 
     if (!restartIfRequired())
         return false;
 
-    QDataStream in(m_process);
-
-    in << (quint32)PLUGIN_OP_REFRESH;
+    if (!m_activeRequests.contains(requestId))
+        m_activeRequests.insert(requestId, 0);
 
-    m_blobIOHandler->sendData(inData);
-
-    m_isProcessing = true;
+    Request request;
+    request.operation = PLUGIN_OP_REFRESH;
+    request.requestId = requestId;
+    request.data = inData;
+    sendRequest(request);
 
     return true;
 }
 
-void PluginProxy::cancel()
+void PluginProxy::cancel(quint32 requestId)
 {
-    TRACE();
+    TRACE() << requestId;
+
+    if (m_state != Ready) {
+        /* The request has not reached the plugin yet: drop it, and report
+         * the cancellation as the plugin would. */
+        for (int i = 0; i < m_pendingRequests.count(); i++) {
+            if (m_pendingRequests[i].requestId != requestId) continue;
+
+            m_pendingRequests.removeAt(i);
+            m_activeRequests.remove(requestId);
+            QTimer::singleShot(0, this, [=]() {
+                emit processError(requestId, Error::SessionCanceled,
+                                  QLatin1String("The operation is canceled"));
+            });
+            break;
+        }
+        return;
+    }
+
     QDataStream in(m_process);
     in << (quint32)PLUGIN_OP_CANCEL;
+    in << requestId;
 }
 
 void PluginProxy::stop()
 {
     TRACE();
+    if (m_state != Ready) return;
+
     QDataStream in(m_process);
     in << (quint32)PLUGIN_OP_STOP;
 }
 
-bool PluginProxy::readOnReady(QByteArray &buffer, int timeout)
+bool PluginProxy::isProcessing()
 {
-    bool ready = m_process->waitForReadyRead(timeout);
-
-    if (ready) {
-        if (!m_process->bytesAvailable())
-            return false;
-
-        while (m_process->bytesAvailable())
-            buffer += m_process->readAllStandardOutput();
-    }
+    return !m_activeRequests.isEmpty();
+}
 
-    return ready;
+bool PluginProxy::isRunning() const
+{
+    return m_process->state() == QProcess::Running;
 }
 
-bool PluginProxy::isProcessing()
+bool PluginProxy::reset()
 {
-    return m_isProcessing;
+    TRACE();
+    if (m_state != Ready)
+        return false;
+
+    QDataStream in(m_process);
+    in << (quint32)PLUGIN_OP_RESET;
+
+    m_activeRequests.clear();
+    m_currentResultOperation = -1;
+    m_currentRequestId = 0;
+    return true;
 }
 
 void PluginProxy::blobIOError()
@@ -271,7 +486,9 @@ void PluginProxy::blobIOError()
     stop();
 
     connect(m_process, SIGNAL(readyRead()), this, SLOT(onReadStandardOutput()));
+    m_activeRequests.remove(m_currentRequestId);
     emit processError(
+        m_currentRequestId,
         (int)Error::InternalServer,
         QLatin1String("Failed to I/O session data to/from the authentication "
                       "plugin."));
@@ -296,8 +513,7 @@ void PluginProxy::onReadStandardOutput()
 
     if (!m_process->bytesAvailable()) {
         qCritical() << "No information available on process";
-        m_isProcessing = false;
-        emit processError(Error::InternalServer, QString());
+        failActiveRequests(Error::InternalServer, QString());
         return;
     }
 
@@ -317,6 +533,8 @@ void PluginProxy::onReadStandardOutput()
         return;
     }
 
+    reader >> m_currentRequestId;
+
     if (m_currentResultOperation != PLUGIN_RESPONSE_SIGNAL &&
         m_currentResultOperation != PLUGIN_RESPONSE_ERROR) {
 
@@ -341,37 +559,41 @@ void PluginProxy::sessionDataReceived(const QVariantMap &map)
 void PluginProxy::handlePluginResponse(const quint32 resultOperation,
                                        const QVariantMap &sessionDataMap)
 {
-    TRACE() << resultOperation;
+    TRACE() << resultOperation << m_currentRequestId;
+
+    quint32 requestId = m_currentRequestId;
+    /* Responses to requests which have been replied already, or which
+     * belong to a previous session, are not forwarded */
+    bool isActive = m_activeRequests.contains(requestId);
 
     if (resultOperation == PLUGIN_RESPONSE_RESULT) {
         TRACE() << "PLUGIN_RESPONSE_RESULT";
 
-        m_isProcessing = false;
-
-        if (!m_isResultObtained)
-            emit processResultReply(sessionDataMap);
-        else
+        if (isActive) {
+            m_activeRequests.remove(requestId);
+            emit processResultReply(requestId, sessionDataMap);
+        } else {
             BLAME() << "Unexpected plugin response: ";
-
-        m_isResultObtained = true;
+        }
     } else if (resultOperation == PLUGIN_RESPONSE_STORE) {
         TRACE() << "PLUGIN_RESPONSE_STORE";
 
-        if (!m_isResultObtained)
-            emit processStore(sessionDataMap);
+        if (isActive)
+            emit processStore(requestId, sessionDataMap);
         else
             BLAME() << "Unexpected plugin store: ";
 
     } else if (resultOperation == PLUGIN_RESPONSE_UI) {
         TRACE() << "PLUGIN_RESPONSE_UI";
 
-        if (!m_isResultObtained) {
+        if (isActive) {
             bool allowed = true;
+            int uiPolicy = m_activeRequests.value(requestId);
 
-            if (m_uiPolicy == NoUserInteractionPolicy)
+            if (uiPolicy == NoUserInteractionPolicy)
                 allowed = false;
 
-            if (m_uiPolicy == ValidationPolicy) {
+            if (uiPolicy == ValidationPolicy) {
                 bool credentialsQueried =
                     (sessionDataMap.contains(SSOUI_KEY_QUERYUSERNAME)
                     || sessionDataMap.contains(SSOUI_KEY_QUERYPASSWORD));
@@ -390,10 +612,10 @@ void PluginProxy::handlePluginResponse(const quint32 resultOperation,
 
                 QVariantMap nonConstMap = sessionDataMap;
                 nonConstMap.insert(SSOUI_KEY_ERROR, QUERY_ERROR_FORBIDDEN);
-                processUi(nonConstMap);
+                processUi(requestId, nonConstMap);
             } else {
                 TRACE() << "open ui";
-                emit processUiRequest(sessionDataMap);
+                emit processUiRequest(requestId, sessionDataMap);
             }
         } else {
             BLAME() << "Unexpected plugin ui response: ";
@@ -401,8 +623,8 @@ void PluginProxy::handlePluginResponse(const quint32 resultOperation,
     } else if (resultOperation == PLUGIN_RESPONSE_REFRESHED) {
         TRACE() << "PLUGIN_RESPONSE_REFRESHED";
 
-        if (!m_isResultObtained)
-            emit processRefreshRequest(sessionDataMap);
+        if (isActive)
+            emit processRefreshRequest(requestId, sessionDataMap);
         else
             BLAME() << "Unexpected plugin ui response: ";
     } else if (resultOperation == PLUGIN_RESPONSE_ERROR) {
@@ -413,14 +635,13 @@ void PluginProxy::handlePluginResponse(const quint32 resultOperation,
         QDataStream stream(m_process);
         stream >> err;
         stream >> errorMessage;
-        m_isProcessing = false;
 
-        if (!m_isResultObtained)
-            emit processError((int)err, errorMessage);
-        else
+        if (isActive) {
+            m_activeRequests.remove(requestId);
+            emit processError(requestId, (int)err, errorMessage);
+        } else {
             BLAME() << "Unexpected plugin error: " << errorMessage;
-
-        m_isResultObtained = true;
+        }
     } else if (resultOperation == PLUGIN_RESPONSE_SIGNAL) {
         TRACE() << "PLUGIN_RESPONSE_SIGNAL";
         quint32 state;
@@ -430,8 +651,8 @@ void PluginProxy::handlePluginResponse(const quint32 resultOperation,
         stream >> state;
         stream >> message;
 
-        if (!m_isResultObtained)
-            emit stateChanged((int)state, message);
+        if (isActive)
+            emit stateChanged(requestId, (int)state, message);
         else
             BLAME() << "Unexpected plugin signal: " << state << message;
     }
@@ -453,114 +674,50 @@ void PluginProxy::onExit(int exitCode, QProcess::ExitStatus exitStatus)
     TRACE() << "Plugin process exit with code " << exitCode <<
         " : " << exitStatus;
 
-    if (m_isProcessing || exitStatus == QProcess::CrashExit) {
-        qCritical() << "Challenge produces CRASH!";
-        emit processError(Error::InternalServer,
-                          QLatin1String("plugin processed crashed"));
-    }
     if (exitCode == 2) {
         TRACE() << "plugin process terminated because cannot change user";
     }
 
-    m_isProcessing = false;
-}
-
-void PluginProxy::onError(QProcess::ProcessError err)
-{
-    TRACE() << "Error: " << err;
-}
-
-QString PluginProxy::queryType()
-{
-    TRACE();
-
-    if (!restartIfRequired())
-        return QString();
-
-    QDataStream ds(m_process);
-    ds << (quint32)PLUGIN_OP_TYPE;
-
-    QByteArray buffer;
-    bool result;
-
-    if (!(result = readOnReady(buffer, PLUGINPROCESS_START_TIMEOUT)))
-        qCritical("PluginProxy returned NULL result");
-
-    QString type;
-    QDataStream out(buffer);
-    out >> type;
-    return type;
-}
-
-QStringList PluginProxy::queryMechanisms()
-{
-    TRACE();
-
-    if (!restartIfRequired())
-        return QStringList();
-
-    QDataStream in(m_process);
-    in << (quint32)PLUGIN_OP_MECHANISMS;
-
-    QByteArray buffer;
-    QStringList strList;
-    bool result;
-
-    if ((result = readOnReady(buffer, PLUGINPROCESS_START_TIMEOUT))) {
-
-        QVariant mechanismsVar;
-        QDataStream out(buffer);
-
-        out >> mechanismsVar;
-        QVariantList varList = mechanismsVar.toList();
-
-        for (int i = 0; i < varList.count(); i++)
-                strList << varList.at(i).toString();
+    if (m_state == Starting) {
+        abortStart("the process exited");
+        return;
+    }
 
-        TRACE() << strList;
-    } else
-        qCritical("PluginProxy returned NULL result");
+    if (m_state == NotRunning) {
+        /* The start was aborted, and the failure reported already */
+        return;
+    }
 
-    return strList;
+    m_state = NotRunning;
+    if (!m_activeRequests.isEmpty() || exitStatus == QProcess::CrashExit) {
+        qCritical() << "Challenge produces CRASH!";
+        failActiveRequests(Error::InternalServer,
+                           QLatin1String("plugin processed crashed"));
+    }
 }
 
-bool PluginProxy::waitForStarted(int timeout)
+void PluginProxy::onError(QProcess::ProcessError err)
 {
-    if (!m_process->waitForStarted(timeout))
-        return false;
-
-    m_blobIOHandler = new BlobIOHandler(m_process, m_process, this);
-
-    connect(m_blobIOHandler,
-            SIGNAL(dataReceived(const QVariantMap &)),
-            this,
-            SLOT(sessionDataReceived(const QVariantMap &)));
-
-    QSocketNotifier *readNotifier =
-        new QSocketNotifier(STDIN_FILENO, QSocketNotifier::Read, this);
-
-    readNotifier->setEnabled(false);
-    m_blobIOHandler->setReadChannelSocketNotifier(readNotifier);
-
-    return true;
-}
+    TRACE() << "Error: " << err;
 
-bool PluginProxy::waitForFinished(int timeout)
-{
-    return m_process->waitForFinished(timeout);
+    /* No finished() signal follows a failure to start */
+    if (err == QProcess::FailedToStart && m_state == Starting)
+        abortStart("the process failed to start");
 }
 
 bool PluginProxy::restartIfRequired()
 {
-    if (m_process->state() == QProcess::NotRunning) {
-        TRACE() << "RESTART REQUIRED";
-        m_process->start(REMOTEPLUGIN_BIN_PATH, QStringList(m_type));
+    if (m_state != NotRunning)
+        return true;
 
-        QByteArray tmp;
-        if (!waitForStarted(PLUGINPROCESS_START_TIMEOUT) ||
-            !readOnReady(tmp, PLUGINPROCESS_START_TIMEOUT))
-            return false;
+    if (m_process->state() != QProcess::NotRunning) {
+        /* The previous process is still being killed */
+        BLAME() << "Cannot restart the plugin process yet";
+        return false;
     }
+
+    TRACE() << "RESTART REQUIRED";
+    start();
     return true;
 }
 
@@ -47,6 +47,20 @@ class PluginProcess: public QProcess
 
     PluginProcess(QObject* parent = NULL);
     ~PluginProcess();
+
+    /*
+     * Lets the process terminate on its own, escalating to SIGTERM and then
+     * to SIGKILL if it doesn't; the object deletes itself once the process
+     * has exited.
+     */
+    void shutdown();
+
+private Q_SLOTS:
+    void onStopTimeout();
+
+private:
+    QTimer m_stopTimer;
+    bool m_terminated;
 };
 
 /*!
@@ -62,40 +76,86 @@ class PluginProxy: public QObject
     friend class TestAuthSession;
 
 public:
+    enum State {
+        NotRunning = 0, /* the process is not running */
+        Starting,       /* the plugin is being loaded and queried */
+        Ready,          /* the plugin can process requests */
+    };
+
+    /*!
+     * Starts a plugin process and waits until it is ready: this blocks the
+     * event loop, so it should only be used where this doesn't matter.
+     * @returns NULL if the plugin cannot be started.
+     */
     static PluginProxy *createNewPluginProxy(const QString &type);
+
+    /*!
+     * Starts a plugin process, and returns immediately; the ready() or the
+     * startFailed() signal is emitted once the plugin has been loaded and
+     * queried. The requests issued before that are sent once the plugin is
+     * ready.
+     */
+    static PluginProxy *startPluginProxy(const QString &type);
     virtual ~PluginProxy();
 
     bool restartIfRequired();
     bool isProcessing();
+    bool isRunning() const;
+    State state() const { return m_state; }
+
+    /*!
+     * @returns true if the plugin can work on several requests at once;
+     * this is known once the plugin is ready.
+     */
+    bool isReentrant() const { return m_reentrant; }
+
+    /*!
+     * Makes the plugin process drop any state left by the previous session,
+     * before giving the proxy to another one.
+     * @returns false if the process is not running.
+     */
+    bool reset();
 
 public Q_SLOTS:
     QString type() const { return m_type; }
     QStringList mechanisms() const { return m_mechanisms; }
-    bool process(const QVariantMap &inData,
+    bool process(quint32 requestId,
+                 const QVariantMap &inData,
                  const QString &mechanism);
-    bool processUi(const QVariantMap &inData);
-    bool processRefresh(const QVariantMap &inData);
-    void cancel();
+    bool processUi(quint32 requestId, const QVariantMap &inData);
+    bool processRefresh(quint32 requestId, const QVariantMap &inData);
+    void cancel(quint32 requestId = 0);
     void stop();
 
 Q_SIGNALS:
-    void processResultReply(const QVariantMap &data);
-    void processStore(const QVariantMap &data);
-    void processUiRequest(const QVariantMap &data);
-    void processRefreshRequest(const QVariantMap &data);
-    void processError(int error,
+    void processResultReply(quint32 requestId, const QVariantMap &data);
+    void processStore(quint32 requestId, const QVariantMap &data);
+    void processUiRequest(quint32 requestId, const QVariantMap &data);
+    void processRefreshRequest(quint32 requestId, const QVariantMap &data);
+    void processError(quint32 requestId,
+                      int error,
                       const QString &message);
-    void stateChanged(int state,
+    void stateChanged(quint32 requestId,
+                      int state,
                       const QString &message);
+    void ready();
+    void startFailed();
 
 private:
-    QString queryType();
-    QStringList queryMechanisms();
+    struct Request {
+        quint32 operation;
+        quint32 requestId;
+        QString mechanism;
+        QVariantMap data;
+    };
 
-    bool waitForStarted(int timeout);
-    bool waitForFinished(int timeout);
+    void start();
+    void abortStart(const char *reason);
+    void sendQuery(quint32 operation);
+    bool waitForReady(int timeout);
 
-    bool readOnReady(QByteArray &buffer, int timeout);
+    void sendRequest(const Request &request);
+    void failActiveRequests(int error, const QString &message);
 
     void handlePluginResponse(const quint32 resultOperation,
                               const QVariantMap &sessionDataMap = QVariantMap());
@@ -103,6 +163,8 @@ private:
     bool isResultOperationCodeValid(const int opCode) const;
 
 private Q_SLOTS:
+    void onStartupOutput();
+    void onStartTimeout();
     void onReadStandardOutput();
     void onReadStandardError();
     void onExit(int exitCode, QProcess::ExitStatus exitStatus);
@@ -113,15 +175,25 @@ private Q_SLOTS:
 private:
     PluginProxy(QString type, QObject *parent = NULL);
 
-    bool m_isProcessing;
-    bool m_isResultObtained;
+    State m_state;
+    bool m_reentrant;
     QString m_type;
     QStringList m_mechanisms;
-    int m_uiPolicy;
     int m_currentResultOperation;
+    quint32 m_currentRequestId;
+
+    /* The requests which have not been replied yet, with their UI policy */
+    QHash<quint32, int> m_activeRequests;
 
     PluginProcess *m_process;
     SignOn::BlobIOHandler *m_blobIOHandler;
+
+    QTimer m_startTimer;
+    QByteArray m_readBuffer;
+    quint32 m_startupQuery;
+
+    /* The requests issued while the plugin was starting */
+    QList<Request> m_pendingRequests;
 };
 
 } //namespace SignonDaemonNS
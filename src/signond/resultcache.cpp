@@ -0,0 +1,219 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "resultcache.h"
+#include "signond-common.h"
+
+namespace SignonDaemonNS {
+
+ResultCache *ResultCache::m_pInstance = 0;
+
+ResultCache::ResultCache(int maxSize):
+    m_maxSize(qMax(maxSize, 0)),
+    m_count(0),
+    m_generation(0),
+    m_clearGeneration(0)
+{
+    if (m_pInstance == 0)
+        m_pInstance = this;
+
+    m_clock.start();
+}
+
+ResultCache::~ResultCache()
+{
+    if (m_pInstance == this)
+        m_pInstance = 0;
+}
+
+ResultCache *ResultCache::instance()
+{
+    return m_pInstance;
+}
+
+void ResultCache::setMaxSize(int maxSize)
+{
+    m_maxSize = qMax(maxSize, 0);
+    TRACE() << "Result cache size:" << m_maxSize;
+    makeRoom();
+}
+
+quint64 ResultCache::generation(quint32 id) const
+{
+    return qMax(m_clearGeneration, m_identityGenerations.value(id, 0));
+}
+
+bool ResultCache::contains(quint32 id, const QString &method) const
+{
+    QHash<quint32, QList<Entry> >::const_iterator it = m_entries.find(id);
+    if (it == m_entries.constEnd()) return false;
+
+    foreach (const Entry &entry, it.value()) {
+        if (entry.method == method) return true;
+    }
+    return false;
+}
+
+bool ResultCache::lookup(quint32 id, const QString &method,
+                         const QString &mechanism, const QVariantMap &params,
+                         const QStringList &accessTokens, QVariantMap &result)
+{
+    QHash<quint32, QList<Entry> >::iterator it = m_entries.find(id);
+    if (it == m_entries.end()) return false;
+
+    qint64 now = m_clock.elapsed();
+    QList<Entry> &entries = it.value();
+    for (int i = 0; i < entries.count(); i++) {
+        const Entry &entry = entries[i];
+        if (entry.method != method || entry.mechanism != mechanism ||
+            entry.params != params || entry.accessTokens != accessTokens)
+            continue;
+
+        if (entry.expiry <= now) {
+            TRACE() << "Cached result expired";
+            entries.removeAt(i);
+            m_count--;
+            if (entries.isEmpty())
+                m_entries.erase(it);
+            return false;
+        }
+
+        result = entry.result;
+        return true;
+    }
+    return false;
+}
+
+void ResultCache::insert(quint32 id, const QString &method,
+                         const QString &mechanism, const QVariantMap &params,
+                         const QStringList &accessTokens,
+                         const QVariantMap &result, int expiresIn,
+                         quint64 generation)
+{
+    if (m_maxSize == 0 || expiresIn <= 0) return;
+
+    if (generation != this->generation(id)) {
+        TRACE() << "Identity changed while the result was computed";
+        return;
+    }
+
+    Entry entry;
+    entry.method = method;
+    entry.mechanism = mechanism;
+    entry.params = params;
+    entry.accessTokens = accessTokens;
+    entry.result = result;
+    entry.expiry = m_clock.elapsed() + qint64(expiresIn) * 1000;
+
+    /* Replace the result of the same request, if any */
+    QList<Entry> &entries = m_entries[id];
+    for (int i = 0; i < entries.count(); i++) {
+        const Entry &other = entries[i];
+        if (other.method == method && other.mechanism == mechanism &&
+            other.params == params && other.accessTokens == accessTokens) {
+            entries[i] = entry;
+            return;
+        }
+    }
+
+    entries.append(entry);
+    m_count++;
+    makeRoom();
+}
+
+void ResultCache::invalidate(quint32 id)
+{
+    m_identityGenerations.insert(id, ++m_generation);
+    m_count -= m_entries.take(id).count();
+}
+
+void ResultCache::invalidateMethod(quint32 id, const QString &method)
+{
+    QHash<quint32, QList<Entry> >::iterator it = m_entries.find(id);
+    if (it == m_entries.end()) return;
+
+    QList<Entry> &entries = it.value();
+    for (int i = 0; i < entries.count(); ) {
+        if (entries[i].method == method) {
+            entries.removeAt(i);
+            m_count--;
+        } else {
+            i++;
+        }
+    }
+    if (entries.isEmpty())
+        m_entries.erase(it);
+}
+
+void ResultCache::clear()
+{
+    m_clearGeneration = ++m_generation;
+    m_identityGenerations.clear();
+    m_entries.clear();
+    m_count = 0;
+}
+
+void ResultCache::makeRoom()
+{
+    if (m_count <= m_maxSize) return;
+
+    /* Drop the expired results first, then those expiring first */
+    qint64 now = m_clock.elapsed();
+    QMutableHashIterator<quint32, QList<Entry> > it(m_entries);
+    while (it.hasNext()) {
+        it.next();
+        QList<Entry> &entries = it.value();
+        for (int i = 0; i < entries.count(); ) {
+            if (entries[i].expiry <= now) {
+                entries.removeAt(i);
+                m_count--;
+            } else {
+                i++;
+            }
+        }
+        if (entries.isEmpty())
+            it.remove();
+    }
+
+    while (m_count > m_maxSize) {
+        QHash<quint32, QList<Entry> >::iterator oldest = m_entries.end();
+        int oldestIndex = -1;
+        for (QHash<quint32, QList<Entry> >::iterator i = m_entries.begin();
+             i != m_entries.end(); ++i) {
+            for (int j = 0; j < i.value().count(); j++) {
+                if (oldestIndex < 0 ||
+                    i.value()[j].expiry < oldest.value()[oldestIndex].expiry) {
+                    oldest = i;
+                    oldestIndex = j;
+                }
+            }
+        }
+
+        oldest.value().removeAt(oldestIndex);
+        m_count--;
+        if (oldest.value().isEmpty())
+            m_entries.erase(oldest);
+    }
+}
+
+} // namespace SignonDaemonNS
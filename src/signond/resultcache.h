@@ -0,0 +1,146 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*!
+  @file resultcache.h
+  Definition of the ResultCache object.
+  @ingroup Accounts_and_SSO_Framework
+ */
+
+#ifndef SIGNON_RESULT_CACHE_H
+#define SIGNON_RESULT_CACHE_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+namespace SignonDaemonNS {
+
+/*!
+ * @class ResultCache
+ * Keeps the results of the authentications which the plugins declared
+ * valid for some time (see SSO_PLUGIN_RESULT_EXPIRES_IN), so that the
+ * identical requests made meanwhile are answered without involving the
+ * plugin process.
+ *
+ * A result is given back only for the same identity, method, mechanism and
+ * session parameters, and to clients matching the same entries of the
+ * identity ACL. The results of an identity are dropped when it is changed,
+ * removed or signed out; the results of a method are dropped when the
+ * plugin stores new data for it.
+ */
+class ResultCache
+{
+public:
+    explicit ResultCache(int maxSize);
+    ~ResultCache();
+
+    static ResultCache *instance();
+
+    /*!
+     * Sets the maximum number of results kept; 0 disables the cache.
+     */
+    void setMaxSize(int maxSize);
+    int maxSize() const { return m_maxSize; }
+
+    /*!
+     * @returns the number of results kept, including the expired ones not
+     * dropped yet.
+     */
+    int count() const { return m_count; }
+
+    /*!
+     * @returns a value which changes whenever the given identity is
+     * invalidated: results computed from older data must not be inserted.
+     */
+    quint64 generation(quint32 id) const;
+
+    /*!
+     * @returns true if some result is kept for the given identity and
+     * method.
+     */
+    bool contains(quint32 id, const QString &method) const;
+
+    /*!
+     * Looks up a valid result.
+     * @returns true if @a result has been set.
+     */
+    bool lookup(quint32 id, const QString &method, const QString &mechanism,
+                const QVariantMap &params, const QStringList &accessTokens,
+                QVariantMap &result);
+
+    /*!
+     * Keeps a result for @a expiresIn seconds, unless the identity has been
+     * invalidated since @a generation was read.
+     */
+    void insert(quint32 id, const QString &method, const QString &mechanism,
+                const QVariantMap &params, const QStringList &accessTokens,
+                const QVariantMap &result, int expiresIn,
+                quint64 generation);
+
+    /*!
+     * Drops the results of an identity.
+     */
+    void invalidate(quint32 id);
+
+    /*!
+     * Drops the results of an identity for the given method. The results
+     * being computed at this time can still be inserted.
+     */
+    void invalidateMethod(quint32 id, const QString &method);
+
+    /*!
+     * Drops all the results.
+     */
+    void clear();
+
+private:
+    struct Entry {
+        QString method;
+        QString mechanism;
+        QVariantMap params;
+        QStringList accessTokens;
+        QVariantMap result;
+        qint64 expiry;
+    };
+
+    void makeRoom();
+
+    static ResultCache *m_pInstance;
+    int m_maxSize;
+    int m_count;
+    /* Increased at each invalidation; the generation of an identity is the
+     * value of its last invalidation, or of the last clear() if later */
+    quint64 m_generation;
+    quint64 m_clearGeneration;
+    QHash<quint32, quint64> m_identityGenerations;
+    QElapsedTimer m_clock;
+    QHash<quint32, QList<Entry> > m_entries;
+};
+
+} // namespace SignonDaemonNS
+
+#endif // SIGNON_RESULT_CACHE_H
@@ -75,34 +75,8 @@ QVariantMap SignonAuthSessionAdaptor::process(const QVariantMap &sessionDataVa,
 {
     TRACE() << mechanism;
 
-    QString allowedMechanism(mechanism);
-
-    if (parent()->id() != SIGNOND_NEW_IDENTITY) {
-        CredentialsDB *db =
-            CredentialsAccessManager::instance()->credentialsDB();
-        if (db) {
-            SignonIdentityInfo identityInfo = db->credentials(parent()->id(),
-                                                              false);
-            if (!identityInfo.checkMethodAndMechanism(parent()->method(),
-                                                      mechanism,
-                                                      allowedMechanism)) {
-                QString errMsg;
-                QTextStream(&errMsg) << SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_STR
-                                     << " Method:"
-                                     << parent()->method()
-                                     << ", mechanism:"
-                                     << mechanism
-                                     << ", allowed:"
-                                     << allowedMechanism;
-                errorReply(SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_NAME,
-                           errMsg);
-                return QVariantMap();
-            }
-        } else {
-            BLAME() << "Null database handler object.";
-        }
-    }
-
+    /* The method and mechanism are checked against the stored identity by
+     * the session, once it is loaded */
     QDBusContext &dbusContext = *static_cast<QDBusContext *>(parent());
     if (AccessControlManagerHelper::pidOfPeer(dbusContext) !=
         parent()->ownerPid()) {
@@ -116,7 +90,7 @@ QVariantMap SignonAuthSessionAdaptor::process(const QVariantMap &sessionDataVa,
         return QVariantMap();
     }
 
-    return parent()->process(sessionDataVa, allowedMechanism);
+    return parent()->process(sessionDataVa, mechanism);
 }
 
 void SignonAuthSessionAdaptor::cancel()
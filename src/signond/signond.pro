@@ -14,6 +14,7 @@ DBUS_ADAPTORS += \
 
 HEADERS += \
     accesscontrolmanagerhelper.h \
+    aclsnapshot.h \
     credentialsaccessmanager.h \
     credentialsdb.h \
     credentialsdb_p.h \
@@ -29,13 +30,17 @@ HEADERS += \
     signondaemon.h \
     signondisposable.h \
     signontrace.h \
+    pluginpool.h \
     pluginproxy.h \
+    resultcache.h \
     signonidentityinfo.h \
     signonui_interface.h \
     signonidentityadaptor.h \
-    signonsessioncoretools.h
+    signonsessioncoretools.h \
+    storagequeue.h
 SOURCES += \
     accesscontrolmanagerhelper.cpp \
+    aclsnapshot.cpp \
     credentialsaccessmanager.cpp \
     credentialsdb.cpp \
     default-crypto-manager.cpp \
@@ -48,12 +53,15 @@ SOURCES += \
     signondaemonadaptor.cpp \
     signondisposable.cpp \
     signonui_interface.cpp \
+    pluginpool.cpp \
     pluginproxy.cpp \
+    resultcache.cpp \
     main.cpp \
     signondaemon.cpp \
     signonidentityinfo.cpp \
     signonidentityadaptor.cpp \
-    signonsessioncoretools.cpp
+    signonsessioncoretools.cpp \
+    storagequeue.cpp
 INCLUDEPATH += . \
     $${TOP_SRC_DIR}/lib/plugins \
     $${TOP_SRC_DIR}/lib/plugins/signon-plugins-common \
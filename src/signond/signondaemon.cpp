@@ -27,6 +27,8 @@ extern "C" {
     #include <sys/types.h>
 }
 
+#include <climits>
+
 #include <QtDebug>
 #include <QDir>
 #include <QDBusConnection>
@@ -34,8 +36,10 @@ extern "C" {
 #include <QDBusMetaType>
 #include <QPluginLoader>
 #include <QProcessEnvironment>
+#include <QRegularExpression>
 #include <QSocketNotifier>
 #include <QStandardPaths>
+#include <QTimer>
 
 #include "SignOn/misc.h"
 
@@ -47,6 +51,8 @@ extern "C" {
 #include "signonidentity.h"
 #include "signonauthsession.h"
 #include "accesscontrolmanagerhelper.h"
+#include "pluginpool.h"
+#include "resultcache.h"
 
 #define SIGNON_RETURN_IF_CAM_UNAVAILABLE(_ret_arg_) do {                   \
         if (m_pCAMManager && !m_pCAMManager->credentialsSystemOpened()) {  \
@@ -70,7 +76,12 @@ SignonDaemonConfiguration::SignonDaemonConfiguration():
     m_camConfiguration(),
     m_daemonTimeout(0), // 0 = no timeout
     m_identityTimeout(300),//secs
-    m_authSessionTimeout(300)//secs
+    m_authSessionTimeout(300),//secs
+    m_pluginPoolMinSize(1),
+    m_pluginPoolMaxSize(2),
+    m_pluginPoolIdleTimeout(30),//secs
+    m_coalesceAuthRequests(false),
+    m_resultCacheSize(64)
 {}
 
 SignonDaemonConfiguration::~SignonDaemonConfiguration()
@@ -95,6 +106,15 @@ SignonDaemonConfiguration::~SignonDaemonConfiguration()
     [ObjectTimeouts]
     IdentityTimeout=300
     AuthSessionTimeout=300
+
+    [PluginPool]
+    MinSize=1
+    MaxSize=2
+    IdleTimeout=30
+
+    [AuthSessions]
+    CoalesceRequests=false
+    ResultCacheSize=64
  */
 void SignonDaemonConfiguration::load()
 {
@@ -125,6 +145,23 @@ void SignonDaemonConfiguration::load()
                                           QLatin1String("/signond"));
     }
 
+    // Database tuning
+    static const QStringList databaseOptions = QStringList() <<
+        QLatin1String("JournalMode") <<
+        QLatin1String("Synchronous") <<
+        QLatin1String("TokenSynchronous") <<
+        QLatin1String("BusyTimeout") <<
+        QLatin1String("MmapSize") <<
+        QLatin1String("IdentityCacheSize") <<
+        QLatin1String("SecretsCacheSize") <<
+        QLatin1String("SecretsCacheTimeout") <<
+        QLatin1String("GroupCommitWindow");
+    foreach (const QString &key, databaseOptions) {
+        if (settings.contains(key))
+            m_camConfiguration.m_databaseOptions.insert(key,
+                                                        settings.value(key));
+    }
+
     // Secure storage
 
     // Support legacy setting "UseSecureStorage"
@@ -163,6 +200,36 @@ void SignonDaemonConfiguration::load()
 
     settings.endGroup();
 
+    //Plugin process pool
+    settings.beginGroup(QLatin1String("PluginPool"));
+
+    aux = settings.value(QLatin1String("MinSize")).toUInt(&isOk);
+    if (isOk)
+        m_pluginPoolMinSize = aux;
+
+    aux = settings.value(QLatin1String("MaxSize")).toUInt(&isOk);
+    if (isOk)
+        m_pluginPoolMaxSize = aux;
+
+    aux = settings.value(QLatin1String("IdleTimeout")).toUInt(&isOk);
+    if (isOk)
+        m_pluginPoolIdleTimeout = aux;
+
+    settings.endGroup();
+
+    //Authentication sessions
+    settings.beginGroup(QLatin1String("AuthSessions"));
+
+    m_coalesceAuthRequests =
+        settings.value(QLatin1String("CoalesceRequests"),
+                       m_coalesceAuthRequests).toBool();
+
+    aux = settings.value(QLatin1String("ResultCacheSize")).toUInt(&isOk);
+    if (isOk)
+        m_resultCacheSize = aux;
+
+    settings.endGroup();
+
     //Environment variables
 
     int value = 0;
@@ -184,6 +251,12 @@ void SignonDaemonConfiguration::load()
         if (value > 0 && isOk) m_authSessionTimeout = value;
     }
 
+    if (environment.contains(QLatin1String("SSO_COALESCE_REQUESTS"))) {
+        value = environment.value(
+            QLatin1String("SSO_COALESCE_REQUESTS")).toInt(&isOk);
+        if (isOk) m_coalesceAuthRequests = (value > 0);
+    }
+
     if (environment.contains(QLatin1String("SSO_LOGGING_LEVEL"))) {
         value = environment.value(
             QLatin1String("SSO_LOGGING_LEVEL")).toInt(&isOk);
@@ -234,12 +307,17 @@ const QString internalServerErrStr = SIGNOND_INTERNAL_SERVER_ERR_STR;
 
 static int sigFd[2];
 
+/* The number of unused pages released by each slice of the idle vacuum */
+static const int vacuumSlicePages = 256;
+
 SignonDaemon *SignonDaemon::m_instance = NULL;
 
 SignonDaemon::SignonDaemon(QObject *parent):
     QObject(parent),
     m_configuration(0),
     m_pCAMManager(0),
+    m_pluginPool(0),
+    m_resultCache(0),
     m_dbusServer(0)
 {
     // Files created by signond must be unreadable by "other"
@@ -260,6 +338,9 @@ SignonDaemon::~SignonDaemon()
     SignonAuthSession::stopAllAuthSessions();
     m_storedIdentities.clear();
 
+    delete m_pluginPool;
+    delete m_resultCache;
+
     if (m_pCAMManager) {
         m_pCAMManager->closeCredentialsSystem();
         delete m_pCAMManager;
@@ -371,6 +452,13 @@ void SignonDaemon::init()
     m_pCAMManager =
         new CredentialsAccessManager(m_configuration->camConfiguration());
 
+    m_pluginPool = new PluginPool;
+    m_pluginPool->setLimits(m_configuration->pluginPoolMinSize(),
+                            m_configuration->pluginPoolMaxSize(),
+                            m_configuration->pluginPoolIdleTimeout());
+
+    m_resultCache = new ResultCache(m_configuration->resultCacheSize());
+
 #ifdef ENABLE_BACKUP
     /* backup dbus interface */
     bool backupMode = app->arguments().contains(QLatin1String("-backup"));
@@ -437,6 +525,10 @@ void SignonDaemon::init()
     if (!initStorage())
         BLAME() << "Signond: Cannot initialize credentials storage.";
 
+    /* Checkpoint the write-ahead logs as soon as the clients go away,
+     * rather than in the middle of their requests. */
+    SignonDisposable::invokeOnIdle(0, this, SLOT(onIdle()));
+
     if (m_configuration->daemonTimeout() > 0) {
         SignonDisposable::invokeOnIdle(m_configuration->daemonTimeout(),
                                        this, SLOT(deleteLater()));
@@ -445,6 +537,41 @@ void SignonDaemon::init()
     TRACE() << "Signond SUCCESSFULLY initialized.";
 }
 
+void SignonDaemon::onIdle()
+{
+    m_pCAMManager->storageQueue()->enqueue([](CredentialsDB *db) {
+        if (!db) return;
+        db->checkpoint();
+
+        qint64 size = db->databaseSize();
+        qint64 freeSpace = db->freeSpace();
+        if (size > 0 && freeSpace >= 0) {
+            TRACE() << "Storage size:" << size << "bytes, free:" <<
+                (freeSpace * 100 / size) << "%";
+        }
+    });
+
+    vacuumStorage(-1);
+}
+
+void SignonDaemon::vacuumStorage(qint64 lastFreePages)
+{
+    /* The vacuum is queued in slices, each one after the requests which
+     * arrived meanwhile; it stops as soon as the clients are back, and
+     * resumes on the next idle time. */
+    StorageQueue *queue = m_pCAMManager->storageQueue();
+    queue->enqueue(this,
+        [](CredentialsDB *db) -> qint64 {
+            return db ? db->vacuum(vacuumSlicePages) : -1;
+        },
+        [=](qint64 freePages) {
+            if (freePages > 0 &&
+                (lastFreePages < 0 || freePages < lastFreePages) &&
+                queue->pendingTasks() == 0)
+                vacuumStorage(freePages);
+        });
+}
+
 void SignonDaemon::onNewConnection(const QDBusConnection &connection)
 {
     TRACE() << "New p2p connection" << connection.name();
@@ -559,12 +686,21 @@ int SignonDaemon::authSessionTimeout() const
                                      m_configuration->authSessionTimeout());
 }
 
-QObject *SignonDaemon::getIdentity(const quint32 id,
-                                   QVariantMap &identityData)
+bool SignonDaemon::coalesceAuthRequests() const
+{
+    return (m_configuration == NULL ?
+                                     false :
+                                     m_configuration->coalesceAuthRequests());
+}
+
+void SignonDaemon::getIdentity(const quint32 id,
+                               const QDBusConnection &conn,
+                               const QDBusMessage &msg,
+                               const IdentityCallback &callback)
 {
     clearLastError();
 
-    SIGNON_RETURN_IF_CAM_UNAVAILABLE(0);
+    SIGNON_RETURN_IF_CAM_UNAVAILABLE();
 
     TRACE() << "Registering identity:" << id;
 
@@ -576,24 +712,29 @@ QObject *SignonDaemon::getIdentity(const quint32 id,
         identity = SignonIdentity::createIdentity(id, this);
     Q_ASSERT(identity != NULL);
 
-    bool ok;
-    SignonIdentityInfo info = identity->queryInfo(ok, false);
-
-    if (info.isNew())
-    {
-        setLastError(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
-                     SIGNOND_IDENTITY_NOT_FOUND_ERR_STR);
-        identity->destroy();
-        return 0;
-    }
+    identity->queryInfo(false, [=](bool ok, const SignonIdentityInfo &info) {
+        if (!ok || info.isNew()) {
+            conn.send(msg.createErrorReply(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
+                                           SIGNOND_IDENTITY_NOT_FOUND_ERR_STR));
+            identity->destroy();
+            return;
+        }
 
-    watchIdentity(identity);
-    identity->keepInUse();
+        /* Another client might have got the identity meanwhile */
+        SignonIdentity *registered = m_storedIdentities.value(id, NULL);
+        if (registered != NULL && registered != identity) {
+            identity->destroy();
+            registered->keepInUse();
+            callback(registered, info.toMap());
+            return;
+        }
 
-    identityData = info.toMap();
+        watchIdentity(identity);
+        identity->keepInUse();
 
-    TRACE() << "DONE REGISTERING IDENTITY";
-    return identity;
+        TRACE() << "DONE REGISTERING IDENTITY";
+        callback(identity, info.toMap());
+    });
 }
 
 QStringList SignonDaemon::queryMethods()
@@ -618,87 +759,250 @@ QStringList SignonDaemon::queryMethods()
     return ret;
 }
 
-QStringList SignonDaemon::queryMechanisms(const QString &method)
+void SignonDaemon::queryMechanisms(const QString &method,
+                                   const QDBusConnection &conn,
+                                   const QDBusMessage &msg)
 {
     clearLastError();
 
     TRACE() << method;
 
-    PluginProxy *plugin = PluginProxy::createNewPluginProxy(method);
+    PluginProxy *plugin = m_pluginPool->acquire(method);
+    if (plugin->state() == PluginProxy::Ready) {
+        conn.send(msg.createReply(QVariantList() << plugin->mechanisms()));
+        m_pluginPool->release(plugin);
+        return;
+    }
 
-    if (!plugin) {
+    /* Reply once the plugin has been loaded. The pool might delete the
+     * proxy: it's given back once its signal emission is over. */
+    connect(plugin, &PluginProxy::ready, this, [=]() {
+        conn.send(msg.createReply(QVariantList() << plugin->mechanisms()));
+        plugin->disconnect(this);
+        QTimer::singleShot(0, this, [=]() {
+            m_pluginPool->release(plugin);
+        });
+    });
+    connect(plugin, &PluginProxy::startFailed, this, [=]() {
         TRACE() << "Could not load plugin of type: " << method;
-        setLastError(SIGNOND_METHOD_NOT_KNOWN_ERR_NAME,
-                     SIGNOND_METHOD_NOT_KNOWN_ERR_STR +
-                     QString::fromLatin1("Method %1 is not known or could "
-                                         "not load specific configuration.").
-                     arg(method));
-        return QStringList();
-    }
+        conn.send(msg.createErrorReply(SIGNOND_METHOD_NOT_KNOWN_ERR_NAME,
+            SIGNOND_METHOD_NOT_KNOWN_ERR_STR +
+            QString::fromLatin1("Method %1 is not known or could "
+                                "not load specific configuration.").
+            arg(method)));
+        plugin->disconnect(this);
+        QTimer::singleShot(0, this, [=]() {
+            m_pluginPool->release(plugin);
+        });
+    });
+}
 
-    QStringList mechs = plugin->mechanisms();
-    delete plugin;
+bool SignonDaemon::parseFilter(const QVariantMap &filter,
+                               QMap<QString, QString> &filterLocal)
+{
+    static const QStringList criteria = QStringList() <<
+        SIGNOND_IDENTITY_FILTER_AUTHMETHOD <<
+        SIGNOND_IDENTITY_FILTER_USERNAME <<
+        SIGNOND_IDENTITY_FILTER_REALM <<
+        SIGNOND_IDENTITY_FILTER_CAPTION <<
+        SIGNOND_IDENTITY_FILTER_TYPE;
 
-    return mechs;
+    QMapIterator<QString, QVariant> it(filter);
+    while (it.hasNext()) {
+        it.next();
+        QString pattern = it.value().toString();
+        if (!criteria.contains(it.key()) ||
+            !QRegularExpression(pattern).isValid()) {
+            setLastError(SIGNOND_INVALID_QUERY_ERR_NAME,
+                         SIGNOND_INVALID_QUERY_ERR_STR +
+                         QString::fromLatin1("Invalid filter %1: %2").
+                         arg(it.key()).arg(pattern));
+            return false;
+        }
+        filterLocal.insert(it.key(), pattern);
+    }
+    return true;
 }
 
-QList<QVariantMap> SignonDaemon::queryIdentities(const QVariantMap &filter)
+void SignonDaemon::queryIdentities(const QVariantMap &filter,
+                                   const QDBusConnection &conn,
+                                   const QDBusMessage &msg)
 {
     clearLastError();
 
-    SIGNON_RETURN_IF_CAM_UNAVAILABLE(QList<QVariantMap>());
+    SIGNON_RETURN_IF_CAM_UNAVAILABLE();
 
     TRACE() << "Querying identities";
 
-    CredentialsDB *db = m_pCAMManager->credentialsDB();
-    if (!db) {
-        qCritical() << Q_FUNC_INFO << m_pCAMManager->lastError();
-        return QList<QVariantMap>();
-    }
+    QMap<QString, QString> filterLocal;
+    if (!parseFilter(filter, filterLocal))
+        return;
+
+    /* The reply is sent once the query has been executed in the storage
+     * thread. */
+    m_pCAMManager->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> QDBusMessage {
+            if (!db) {
+                return msg.createErrorReply(internalServerErrName,
+                    internalServerErrStr +
+                    QLatin1String("Could not access Signon Database."));
+            }
+
+            QList<SignonIdentityInfo> credentials =
+                db->credentials(filterLocal);
+            if (db->errorOccurred()) {
+                return msg.createErrorReply(internalServerErrName,
+                    internalServerErrStr +
+                    QLatin1String("Querying database error occurred."));
+            }
+
+            MapList mapList;
+            foreach (const SignonIdentityInfo &info, credentials) {
+                mapList.append(info.toMap());
+            }
+            return msg.createReply(QVariant::fromValue(mapList));
+        },
+        [=](const QDBusMessage &reply) {
+            conn.send(reply);
+        });
+}
+
+void SignonDaemon::queryIdentitiesPage(const QVariantMap &filter,
+                                       uint pageSize,
+                                       const QString &cursor,
+                                       const QDBusConnection &conn,
+                                       const QDBusMessage &msg)
+{
+    clearLastError();
+
+    SIGNON_RETURN_IF_CAM_UNAVAILABLE();
+
+    TRACE() << "Querying identities after" << cursor;
 
     QMap<QString, QString> filterLocal;
-    QMapIterator<QString, QVariant> it(filter);
-    while (it.hasNext()) {
-        it.next();
-        filterLocal.insert(it.key(), it.value().toString());
+    if (!parseFilter(filter, filterLocal))
+        return;
+
+    /* The cursor is the id of the last identity examined by the previous
+     * page; clients must treat it as opaque. */
+    bool ok = true;
+    quint32 afterId = cursor.isEmpty() ? 0 : cursor.toUInt(&ok);
+    if (!ok || pageSize == 0 || pageSize > uint(INT_MAX)) {
+        setLastError(SIGNOND_INVALID_QUERY_ERR_NAME,
+                     SIGNOND_INVALID_QUERY_ERR_STR +
+                     QString::fromLatin1("Invalid page request %1: %2").
+                     arg(pageSize).arg(cursor));
+        return;
     }
 
-    QList<SignonIdentityInfo> credentials = db->credentials(filterLocal);
+    m_pCAMManager->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> QDBusMessage {
+            if (!db) {
+                return msg.createErrorReply(internalServerErrName,
+                    internalServerErrStr +
+                    QLatin1String("Could not access Signon Database."));
+            }
+
+            quint32 nextId = 0;
+            QList<SignonIdentityInfo> credentials =
+                db->credentials(filterLocal, afterId, int(pageSize), nextId);
+            if (db->errorOccurred()) {
+                return msg.createErrorReply(internalServerErrName,
+                    internalServerErrStr +
+                    QLatin1String("Querying database error occurred."));
+            }
+
+            MapList mapList;
+            foreach (const SignonIdentityInfo &info, credentials) {
+                mapList.append(info.toMap());
+            }
+            QString nextCursor =
+                nextId != 0 ? QString::number(nextId) : QString();
+            return msg.createReply(QVariantList() <<
+                                   QVariant::fromValue(mapList) <<
+                                   nextCursor);
+        },
+        [=](const QDBusMessage &reply) {
+            conn.send(reply);
+        });
+}
 
-    if (db->errorOccurred()) {
-        setLastError(internalServerErrName,
-                     internalServerErrStr +
-                     QLatin1String("Querying database error occurred."));
-        return QList<QVariantMap>();
-    }
+void SignonDaemon::queryChanges(quint64 since,
+                                const QDBusConnection &conn,
+                                const QDBusMessage &msg)
+{
+    clearLastError();
 
-    QList<QVariantMap> mapList;
-    foreach (const SignonIdentityInfo &info, credentials) {
-        mapList.append(info.toMap());
-    }
-    return mapList;
+    SIGNON_RETURN_IF_CAM_UNAVAILABLE();
+
+    TRACE() << "Querying changes after" << since;
+
+    m_pCAMManager->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> QDBusMessage {
+            if (!db) {
+                return msg.createErrorReply(internalServerErrName,
+                    internalServerErrStr +
+                    QLatin1String("Could not access Signon Database."));
+            }
+
+            QList<quint32> changed;
+            QList<quint32> removed;
+            quint64 sequence = 0;
+            MapList mapList;
+            if (db->changes(since, changed, removed, sequence)) {
+                foreach (quint32 id, changed) {
+                    SignonIdentityInfo info = db->credentials(id, false);
+                    if (db->errorOccurred()) break;
+                    mapList.append(info.toMap());
+                }
+            }
+            if (db->errorOccurred()) {
+                return msg.createErrorReply(internalServerErrName,
+                    internalServerErrStr +
+                    QLatin1String("Querying database error occurred."));
+            }
+
+            QList<uint> removedIds;
+            foreach (quint32 id, removed) {
+                removedIds.append(id);
+            }
+            return msg.createReply(QVariantList() <<
+                                   QVariant::fromValue(mapList) <<
+                                   QVariant::fromValue(removedIds) <<
+                                   QVariant::fromValue(qulonglong(sequence)));
+        },
+        [=](const QDBusMessage &reply) {
+            conn.send(reply);
+        });
 }
 
-bool SignonDaemon::clear()
+void SignonDaemon::clear(const QDBusConnection &conn,
+                         const QDBusMessage &msg)
 {
     clearLastError();
 
-    SIGNON_RETURN_IF_CAM_UNAVAILABLE(false);
+    SIGNON_RETURN_IF_CAM_UNAVAILABLE();
 
     TRACE() << "\n\n\n Clearing DB\n\n";
-    CredentialsDB *db = m_pCAMManager->credentialsDB();
-    if (!db) {
-        qCritical() << Q_FUNC_INFO << m_pCAMManager->lastError();
-        return false;
-    }
-
-    if (!db->clear()) {
-        setLastError(SIGNOND_INTERNAL_SERVER_ERR_NAME,
-                     SIGNOND_INTERNAL_SERVER_ERR_STR +
-                     QLatin1String("Database error occurred."));
-        return false;
-    }
-    return true;
+    m_pCAMManager->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> QDBusMessage {
+            if (!db) {
+                return msg.createErrorReply(SIGNOND_INTERNAL_SERVER_ERR_NAME,
+                    SIGNOND_INTERNAL_SERVER_ERR_STR +
+                    QLatin1String("Could not access Signon Database."));
+            }
+
+            if (!db->clear()) {
+                return msg.createErrorReply(SIGNOND_INTERNAL_SERVER_ERR_NAME,
+                    SIGNOND_INTERNAL_SERVER_ERR_STR +
+                    QLatin1String("Database error occurred."));
+            }
+            return msg.createReply(true);
+        },
+        [=](const QDBusMessage &reply) {
+            conn.send(reply);
+        });
+    m_resultCache->clear();
 }
 
 QObject *SignonDaemon::getAuthSession(const quint32 id,
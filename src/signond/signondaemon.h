@@ -35,6 +35,8 @@ extern "C" {
 #include <QtCore>
 #include <QtDBus>
 
+#include <functional>
+
 #include "credentialsaccessmanager.h"
 
 #ifndef SIGNOND_PLUGINS_DIR
@@ -79,6 +81,11 @@ public:
     uint daemonTimeout() const { return m_daemonTimeout; }
     uint identityTimeout() const { return m_identityTimeout; }
     uint authSessionTimeout() const { return m_authSessionTimeout; }
+    int pluginPoolMinSize() const { return m_pluginPoolMinSize; }
+    int pluginPoolMaxSize() const { return m_pluginPoolMaxSize; }
+    int pluginPoolIdleTimeout() const { return m_pluginPoolIdleTimeout; }
+    bool coalesceAuthRequests() const { return m_coalesceAuthRequests; }
+    int resultCacheSize() const { return m_resultCacheSize; }
 
 private:
     QString m_pluginsDir;
@@ -92,8 +99,19 @@ private:
     uint m_daemonTimeout;
     uint m_identityTimeout;
     uint m_authSessionTimeout;
+
+    //plugin process pool
+    int m_pluginPoolMinSize;
+    int m_pluginPoolMaxSize;
+    int m_pluginPoolIdleTimeout;
+
+    //authentication sessions
+    bool m_coalesceAuthRequests;
+    int m_resultCacheSize;
 };
 
+class PluginPool;
+class ResultCache;
 class SignonIdentity;
 
 /*!
@@ -121,16 +139,63 @@ public:
     int identityTimeout() const;
     int authSessionTimeout() const;
 
+    /*!
+     * Returns whether the queued authentication requests identical to one
+     * being processed are answered with its result.
+     */
+    bool coalesceAuthRequests() const;
+
 public:
     QObject *registerNewIdentity();
-    QObject *getIdentity(const quint32 id, QVariantMap &identityData);
+    typedef std::function<void (QObject *identity,
+                                const QVariantMap &identityData)>
+        IdentityCallback;
+    /*!
+     * Gets the identity object, and passes it to @a callback with the
+     * identity data once they have been loaded; if the identity doesn't
+     * exist, the D-Bus message is replied with an error instead.
+     */
+    void getIdentity(const quint32 id,
+                     const QDBusConnection &conn,
+                     const QDBusMessage &msg,
+                     const IdentityCallback &callback);
     QObject *getAuthSession(const quint32 id, const QString type,
                             pid_t ownerPid);
 
     QStringList queryMethods();
-    QStringList queryMechanisms(const QString &method);
-    QList<QVariantMap> queryIdentities(const QVariantMap &filter);
-    bool clear();
+    void queryMechanisms(const QString &method,
+                         const QDBusConnection &conn,
+                         const QDBusMessage &msg);
+    /*!
+     * Queries the identities matching the filter; the reply to the D-Bus
+     * message is sent asynchronously, unless an error is set.
+     */
+    void queryIdentities(const QVariantMap &filter,
+                         const QDBusConnection &conn,
+                         const QDBusMessage &msg);
+    /*!
+     * Queries a page of the identities matching the filter: the reply holds
+     * at most @a pageSize identities, and the cursor to pass to get the next
+     * page (empty, if this was the last one).
+     */
+    void queryIdentitiesPage(const QVariantMap &filter,
+                             uint pageSize,
+                             const QString &cursor,
+                             const QDBusConnection &conn,
+                             const QDBusMessage &msg);
+    /*!
+     * Queries the identities changed or removed after the given change: the
+     * reply holds the changed identities, the ids of the removed ones and the
+     * number of the last change.
+     */
+    void queryChanges(quint64 since,
+                      const QDBusConnection &conn,
+                      const QDBusMessage &msg);
+    /*!
+     * Clears the database; the reply to the D-Bus message is sent
+     * asynchronously, unless an error is set.
+     */
+    void clear(const QDBusConnection &conn, const QDBusMessage &msg);
 
     QString lastErrorName() const { return m_lastErrorName; }
     QString lastErrorMessage() const { return m_lastErrorMessage; }
@@ -141,6 +206,7 @@ private Q_SLOTS:
     void onNewConnection(const QDBusConnection &connection);
     void onIdentityStored(SignonIdentity *identity);
     void onIdentityDestroyed();
+    void onIdle();
 
 private:
     SignonDaemon(QObject *parent);
@@ -150,6 +216,10 @@ private:
 
     void watchIdentity(SignonIdentity *identity);
     void setupSignalHandlers();
+    void vacuumStorage(qint64 lastFreePages);
+
+    bool parseFilter(const QVariantMap &filter,
+                     QMap<QString, QString> &filterLocal);
 
     void setLastError(const QString &name, const QString &msg);
     void clearLastError();
@@ -167,6 +237,9 @@ private:
      * */
     CredentialsAccessManager *m_pCAMManager;
 
+    PluginPool *m_pluginPool;
+    ResultCache *m_resultCache;
+
     int m_identityTimeout;
     int m_authSessionTimeout;
 
@@ -24,6 +24,7 @@
  */
 
 #include "signondaemonadaptor.h"
+#include "signonauthsession.h"
 #include "signondisposable.h"
 #include "accesscontrolmanagerhelper.h"
 
@@ -116,12 +117,31 @@ void SignonDaemonAdaptor::getIdentity(const quint32 id,
         return;
     }
 
-    QObject *identity = m_parent->getIdentity(id, identityData);
-    if (handleLastError(conn, msg)) return;
-
-    objectPath = registerObject(conn, identity);
+    Q_UNUSED(objectPath);
+    Q_UNUSED(identityData);
+    msg.setDelayedReply(true);
+    identityReply(id, conn, msg);
+}
 
-    SignonDisposable::destroyUnused();
+void SignonDaemonAdaptor::identityReply(quint32 id,
+                                        const QDBusConnection &connection,
+                                        const QDBusMessage &message)
+{
+    /* The reply is sent once the identity has been loaded in the storage
+     * thread */
+    m_parent->getIdentity(id, connection, message,
+                          [=](QObject *identity,
+                              const QVariantMap &identityData) {
+        QDBusObjectPath objectPath = registerObject(connection, identity);
+
+        QVariantList args;
+        args << QVariant::fromValue(objectPath);
+        args << identityData;
+        connection.send(message.createReply(args));
+
+        SignonDisposable::destroyUnused();
+    });
+    handleLastError(connection, message);
 }
 
 void SignonDaemonAdaptor::onIdentityAccessReplyFinished()
@@ -141,18 +161,7 @@ void SignonDaemonAdaptor::onIdentityAccessReplyFinished()
         return;
     }
 
-    QVariantMap identityData;
-    QObject *identity = m_parent->getIdentity(id, identityData);
-    if (handleLastError(connection, message)) return;
-
-    QDBusObjectPath objectPath = registerObject(connection, identity);
-
-    QVariantList args;
-    args << QVariant::fromValue(objectPath);
-    args << identityData;
-    connection.send(message.createReply(args));
-
-    SignonDisposable::destroyUnused();
+    identityReply(id, connection, message);
 }
 
 QStringList SignonDaemonAdaptor::queryMethods()
@@ -189,8 +198,39 @@ QString SignonDaemonAdaptor::getAuthSessionObjectPath(const quint32 id,
     QObject *authSession = m_parent->getAuthSession(id, type, ownerPid);
     if (handleLastError(conn, msg)) return QString();
 
-    QDBusObjectPath objectPath = registerObject(conn, authSession);
-    return objectPath.path();
+    msg.setDelayedReply(true);
+    authSessionReply(conn, msg, authSession);
+    return QString();
+}
+
+void SignonDaemonAdaptor::authSessionReply(const QDBusConnection &connection,
+                                           const QDBusMessage &message,
+                                           QObject *object)
+{
+    SignonAuthSession *authSession = qobject_cast<SignonAuthSession*>(object);
+    Q_ASSERT(authSession != 0);
+    SignonSessionCore *core = authSession->parent();
+
+    if (core->isReady()) {
+        QDBusObjectPath objectPath = registerObject(connection, authSession);
+        connection.send(message.createReply(QVariantList() <<
+                                            QVariant::fromValue(objectPath)));
+        return;
+    }
+
+    /* Don't hand out the session until its plugin has been loaded */
+    TRACE() << "Waiting for the plugin of" << authSession->objectName();
+    QObject::connect(core, &SignonSessionCore::ready, authSession, [=]() {
+        QDBusObjectPath objectPath = registerObject(connection, authSession);
+        connection.send(message.createReply(QVariantList() <<
+                                            QVariant::fromValue(objectPath)));
+    });
+    QObject::connect(core, &SignonSessionCore::setupFailed, authSession,
+                     [=]() {
+        connection.send(message.createErrorReply(
+            SIGNOND_METHOD_NOT_KNOWN_ERR_NAME,
+            SIGNOND_METHOD_NOT_KNOWN_ERR_STR));
+    });
 }
 
 void SignonDaemonAdaptor::onAuthSessionAccessReplyFinished()
@@ -215,24 +255,19 @@ void SignonDaemonAdaptor::onAuthSessionAccessReplyFinished()
     pid_t ownerPid = acm->pidOfPeer(connection, message);
     QObject *authSession = m_parent->getAuthSession(id, type, ownerPid);
     if (handleLastError(connection, message)) return;
-    QDBusObjectPath objectPath = registerObject(connection, authSession);
-
-    QVariantList args;
-    args << QVariant::fromValue(objectPath);
-    connection.send(message.createReply(args));
+    authSessionReply(connection, message, authSession);
 
     SignonDisposable::destroyUnused();
 }
 
-QStringList SignonDaemonAdaptor::queryMechanisms(const QString &method)
+void SignonDaemonAdaptor::queryMechanisms(const QString &method)
 {
-    QStringList mechanisms = m_parent->queryMechanisms(method);
-    if (handleLastError(parentDBusContext().connection(),
-                        parentDBusContext().message())) {
-        return QStringList();
-    }
+    QDBusMessage msg = parentDBusContext().message();
+    QDBusConnection conn = parentDBusContext().connection();
 
-    return mechanisms;
+    msg.setDelayedReply(true);
+    m_parent->queryMechanisms(method, conn, msg);
+    handleLastError(conn, msg);
 }
 
 void SignonDaemonAdaptor::queryIdentities(const QVariantMap &filter)
@@ -247,11 +282,42 @@ void SignonDaemonAdaptor::queryIdentities(const QVariantMap &filter)
     }
 
     msg.setDelayedReply(true);
-    MapList identities = m_parent->queryIdentities(filter);
-    if (handleLastError(conn, msg)) return;
+    m_parent->queryIdentities(filter, conn, msg);
+    handleLastError(conn, msg);
+}
 
-    QDBusMessage reply = msg.createReply(QVariant::fromValue(identities));
-    conn.send(reply);
+void SignonDaemonAdaptor::queryIdentitiesPage(const QVariantMap &filter,
+                                              uint pageSize,
+                                              const QString &cursor)
+{
+    /* Access Control */
+    QDBusMessage msg = parentDBusContext().message();
+    QDBusConnection conn = parentDBusContext().connection();
+    if (!AccessControlManagerHelper::instance()->isPeerKeychainWidget(conn,
+                                                                      msg)) {
+        securityErrorReply();
+        return;
+    }
+
+    msg.setDelayedReply(true);
+    m_parent->queryIdentitiesPage(filter, pageSize, cursor, conn, msg);
+    handleLastError(conn, msg);
+}
+
+void SignonDaemonAdaptor::queryChanges(qulonglong since)
+{
+    /* Access Control */
+    QDBusMessage msg = parentDBusContext().message();
+    QDBusConnection conn = parentDBusContext().connection();
+    if (!AccessControlManagerHelper::instance()->isPeerKeychainWidget(conn,
+                                                                      msg)) {
+        securityErrorReply();
+        return;
+    }
+
+    msg.setDelayedReply(true);
+    m_parent->queryChanges(since, conn, msg);
+    handleLastError(conn, msg);
 }
 
 bool SignonDaemonAdaptor::clear()
@@ -265,10 +331,10 @@ bool SignonDaemonAdaptor::clear()
         return false;
     }
 
-    bool ok = m_parent->clear();
-    if (handleLastError(conn, msg)) return false;
-
-    return ok;
+    msg.setDelayedReply(true);
+    m_parent->clear(conn, msg);
+    handleLastError(conn, msg);
+    return false;
 }
 
 } //namespace SignonDaemonNS
@@ -55,8 +55,11 @@ public Q_SLOTS:
     QString getAuthSessionObjectPath(const quint32 id, const QString &type);
 
     QStringList queryMethods();
-    QStringList queryMechanisms(const QString &method);
+    void queryMechanisms(const QString &method);
     void queryIdentities(const QVariantMap &filter);
+    void queryIdentitiesPage(const QVariantMap &filter, uint pageSize,
+                             const QString &cursor);
+    void queryChanges(qulonglong since);
     bool clear();
 
 private:
@@ -67,6 +70,12 @@ private:
                          const QDBusMessage &message);
     QDBusObjectPath registerObject(const QDBusConnection &connection,
                                    QObject *object);
+    void identityReply(quint32 id,
+                       const QDBusConnection &connection,
+                       const QDBusMessage &message);
+    void authSessionReply(const QDBusConnection &connection,
+                          const QDBusMessage &message,
+                          QObject *object);
 
 private Q_SLOTS:
     void onIdentityAccessReplyFinished();
@@ -28,7 +28,7 @@
 namespace SignonDaemonNS {
 
 static QList<SignonDisposable *> disposableObjects;
-static QPointer<QTimer> notifyTimer = 0;
+static QList<QPointer<QTimer> > notifyTimers;
 static QPointer<QTimer> disposeTimer = 0;
 
 SignonDisposable::SignonDisposable(int maxInactivity, QObject *parent):
@@ -65,8 +65,8 @@ void SignonDisposable::keepInUse() const
     }
     lastActivity = ts.tv_sec;
 
-    if (notifyTimer != 0) {
-        notifyTimer->stop();
+    foreach (QTimer *notifyTimer, notifyTimers) {
+        if (notifyTimer != 0) notifyTimer->stop();
     }
     if (disposeTimer != 0) {
         disposeTimer->start();
@@ -82,11 +82,16 @@ void SignonDisposable::setAutoDestruct(bool value) const
 void SignonDisposable::invokeOnIdle(int maxInactivity,
                                     QObject *object, const char *member)
 {
-    notifyTimer = new QTimer(object);
+    QTimer *notifyTimer = new QTimer(object);
     notifyTimer->setSingleShot(true);
     notifyTimer->setInterval(maxInactivity * 1000);
     QObject::connect(notifyTimer, SIGNAL(timeout()),
                      object, member);
+    notifyTimers.append(notifyTimer);
+
+    /* The dispose timer is shared by all the idle notifications */
+    if (disposeTimer != 0)
+        return;
 
     /* In addition to the notifyTimer, we create another timer to let
      * destroyUnused() to run when we expect that some SignonDisposable object
@@ -125,9 +130,11 @@ void SignonDisposable::destroyUnused()
         }
     }
 
-    if (disposableObjects.isEmpty() && notifyTimer != 0) {
-        TRACE() << "No disposable objects, starting notification timer";
-        notifyTimer->start();
+    if (disposableObjects.isEmpty()) {
+        TRACE() << "No disposable objects, starting notification timers";
+        foreach (QTimer *notifyTimer, notifyTimers) {
+            if (notifyTimer != 0) notifyTimer->start();
+        }
     }
 }
 
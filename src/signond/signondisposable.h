@@ -77,9 +77,9 @@ public:
      * Invoke the specified method on @object when there are no
      * disposable objects for more than @maxInactivity seconds.
      *
-     * To keep the implementation simpler, this function can be called only
-     * once, and the @member variable must still be accessible when the method
-     * will be invoked (use a static string).
+     * The function can be called several times, to be notified after
+     * different periods of inactivity; the @member variable must still be
+     * accessible when the method will be invoked (use a static string).
      */
     static void invokeOnIdle(int maxInactivity,
                              QObject *object, const char *member);
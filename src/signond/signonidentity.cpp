@@ -35,6 +35,7 @@
 
 #include "accesscontrolmanagerhelper.h"
 #include "signonidentityadaptor.h"
+#include "resultcache.h"
 
 #define SIGNON_RETURN_IF_CAM_UNAVAILABLE(_ret_arg_) do {                          \
         if (!(CredentialsAccessManager::instance()->credentialsSystemOpened())) { \
@@ -84,6 +85,7 @@ private:
 SignonIdentity::SignonIdentity(quint32 id, int timeout,
                                SignonDaemon *parent):
     SignonDisposable(timeout, parent),
+    m_storageId(new quint32(id)),
     m_pInfo(NULL)
 {
     m_id = id;
@@ -131,10 +133,9 @@ void SignonIdentity::destroy()
     deleteLater();
 }
 
-SignonIdentityInfo SignonIdentity::queryInfo(bool &ok, bool queryPassword)
+void SignonIdentity::queryInfo(bool queryPassword,
+                               const InfoCallback &callback)
 {
-    ok = true;
-
     bool needLoadFromDB = true;
     if (m_pInfo) {
         needLoadFromDB = false;
@@ -143,29 +144,41 @@ SignonIdentityInfo SignonIdentity::queryInfo(bool &ok, bool queryPassword)
         }
     }
 
-    if (needLoadFromDB) {
-        if (m_pInfo != 0) {
-            delete m_pInfo;
+    if (!needLoadFromDB) {
+        /* Make sure that we clear the password, if the caller doesn't need
+         * it */
+        SignonIdentityInfo info = *m_pInfo;
+        if (!queryPassword) {
+            info.setPassword(QString());
         }
+        callback(true, info);
+        return;
+    }
 
-        CredentialsDB *db =
-            CredentialsAccessManager::instance()->credentialsDB();
-        m_pInfo = new SignonIdentityInfo(db->credentials(m_id, queryPassword));
-
-        if (db->lastError().isValid()) {
-            ok = false;
+    quint32 id = m_id;
+    setAutoDestruct(false);
+    CredentialsAccessManager::instance()->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> QPair<bool, SignonIdentityInfo> {
+            if (db == 0) return qMakePair(false, SignonIdentityInfo());
+            SignonIdentityInfo info = db->credentials(id, queryPassword);
+            return qMakePair(!db->lastError().isValid(), info);
+        },
+        [=](const QPair<bool, SignonIdentityInfo> &loaded) {
+            setAutoDestruct(true);
             delete m_pInfo;
             m_pInfo = NULL;
-            return SignonIdentityInfo();
-        }
-    }
+            if (!loaded.first) {
+                callback(false, SignonIdentityInfo());
+                return;
+            }
 
-    /* Make sure that we clear the password, if the caller doesn't need it */
-    SignonIdentityInfo info = *m_pInfo;
-    if (!queryPassword) {
-        info.setPassword(QString());
-    }
-    return info;
+            m_pInfo = new SignonIdentityInfo(loaded.second);
+            SignonIdentityInfo info = loaded.second;
+            if (!queryPassword) {
+                info.setPassword(QString());
+            }
+            callback(true, info);
+        });
 }
 
 bool SignonIdentity::addReference(const QString &reference)
@@ -174,18 +187,14 @@ bool SignonIdentity::addReference(const QString &reference)
 
     SIGNON_RETURN_IF_CAM_UNAVAILABLE(false);
 
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    if (db == NULL) {
-        BLAME() << "NULL database handler object.";
-        return false;
-    }
     const QDBusContext &context = static_cast<QDBusContext>(*this);
     QString appId =
         AccessControlManagerHelper::instance()->appIdOfPeer(
                                                    context.connection(),
                                                    context.message());
     keepInUse();
-    return db->addReference(m_id, appId, reference);
+    updateReference(&CredentialsDB::addReference, appId, reference);
+    return true;
 }
 
 bool SignonIdentity::removeReference(const QString &reference)
@@ -194,58 +203,86 @@ bool SignonIdentity::removeReference(const QString &reference)
 
     SIGNON_RETURN_IF_CAM_UNAVAILABLE(false);
 
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    if (db == NULL) {
-        BLAME() << "NULL database handler object.";
-        return false;
-    }
     const QDBusContext &context = static_cast<QDBusContext>(*this);
     QString appId =
         AccessControlManagerHelper::instance()->appIdOfPeer(
                                                    context.connection(),
                                                    context.message());
     keepInUse();
-    return db->removeReference(m_id, appId, reference);
+    updateReference(&CredentialsDB::removeReference, appId, reference);
+    return true;
+}
+
+void SignonIdentity::updateReference(ReferenceUpdate update,
+                                     const QString &appId,
+                                     const QString &reference)
+{
+    QDBusConnection conn = connection();
+    QDBusMessage msg = message();
+    quint32 id = m_id;
+
+    setDelayedReply(true);
+    setAutoDestruct(false);
+    CredentialsAccessManager::instance()->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> bool {
+            if (db == NULL) {
+                BLAME() << "NULL database handler object.";
+                return false;
+            }
+            return (db->*update)(id, appId, reference);
+        },
+        [=](bool ok) {
+            setAutoDestruct(true);
+            if (ok) {
+                conn.send(msg.createReply());
+            } else {
+                conn.send(msg.createErrorReply(
+                                            SIGNOND_OPERATION_FAILED_ERR_NAME,
+                                            SIGNOND_OPERATION_FAILED_ERR_STR));
+            }
+        });
 }
 
 quint32 SignonIdentity::requestCredentialsUpdate(const QString &displayMessage)
 {
     SIGNON_RETURN_IF_CAM_UNAVAILABLE(SIGNOND_NEW_IDENTITY);
 
-    bool ok;
-    SignonIdentityInfo info = queryInfo(ok, false);
-
-    if (!ok) {
-        BLAME() << "Identity not found.";
-        sendErrorReply(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
-                       SIGNOND_IDENTITY_NOT_FOUND_ERR_STR);
-        return SIGNOND_NEW_IDENTITY;
-    }
-    if (!info.storePassword()) {
-        BLAME() << "Password cannot be stored.";
-        sendErrorReply(SIGNOND_STORE_FAILED_ERR_NAME,
-                       SIGNOND_STORE_FAILED_ERR_STR);
-        return SIGNOND_NEW_IDENTITY;
-    }
+    QDBusConnection conn = connection();
+    QDBusMessage msg = message();
 
     //delay dbus reply, ui interaction might take long time to complete
     setDelayedReply(true);
+    queryInfo(false, [=](bool ok, const SignonIdentityInfo &info) {
+        if (!ok) {
+            BLAME() << "Identity not found.";
+            conn.send(msg.createErrorReply(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
+                                           SIGNOND_IDENTITY_NOT_FOUND_ERR_STR));
+            return;
+        }
+        if (!info.storePassword()) {
+            BLAME() << "Password cannot be stored.";
+            conn.send(msg.createErrorReply(SIGNOND_STORE_FAILED_ERR_NAME,
+                                           SIGNOND_STORE_FAILED_ERR_STR));
+            return;
+        }
 
-    //create ui request to ask password
-    QVariantMap uiRequest;
-    uiRequest.insert(SSOUI_KEY_QUERYPASSWORD, true);
-    uiRequest.insert(SSOUI_KEY_USERNAME, info.userName());
-    uiRequest.insert(SSOUI_KEY_MESSAGE, displayMessage);
-    uiRequest.insert(SSOUI_KEY_CAPTION, info.caption());
+        //create ui request to ask password
+        QVariantMap uiRequest;
+        uiRequest.insert(SSOUI_KEY_QUERYPASSWORD, true);
+        uiRequest.insert(SSOUI_KEY_USERNAME, info.userName());
+        uiRequest.insert(SSOUI_KEY_MESSAGE, displayMessage);
+        uiRequest.insert(SSOUI_KEY_CAPTION, info.caption());
 
-    TRACE() << "Waiting for reply from signon-ui";
-    PendingCallWatcherWithContext *watcher =
-        new PendingCallWatcherWithContext(m_signonui->queryDialog(uiRequest),
-                                          this);
-    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
-            this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
+        TRACE() << "Waiting for reply from signon-ui";
+        PendingCallWatcherWithContext *watcher =
+            new PendingCallWatcherWithContext(
+                                        m_signonui->queryDialog(uiRequest),
+                                        conn, msg, this);
+        connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
 
-    setAutoDestruct(false);
+        setAutoDestruct(false);
+    });
     return 0;
 }
 
@@ -255,27 +292,33 @@ QVariantMap SignonIdentity::getInfo()
 
     SIGNON_RETURN_IF_CAM_UNAVAILABLE(QVariantMap());
 
-    bool ok;
-    SignonIdentityInfo info = queryInfo(ok, false);
+    QDBusConnection conn = connection();
+    QDBusMessage msg = message();
 
-    if (!ok) {
-        TRACE();
-        sendErrorReply(SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_NAME,
-                       SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_STR +
-                       QLatin1String("Database querying error occurred."));
-        return QVariantMap();
-    }
+    setDelayedReply(true);
+    queryInfo(false, [=](bool ok, const SignonIdentityInfo &queried) {
+        if (!ok) {
+            TRACE();
+            conn.send(msg.createErrorReply(
+                SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_NAME,
+                SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_STR +
+                QLatin1String("Database querying error occurred.")));
+            return;
+        }
 
-    if (info.isNew()) {
-        TRACE();
-        sendErrorReply(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
-                       SIGNOND_IDENTITY_NOT_FOUND_ERR_STR);
-        return QVariantMap();
-    }
+        if (queried.isNew()) {
+            TRACE();
+            conn.send(msg.createErrorReply(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
+                                           SIGNOND_IDENTITY_NOT_FOUND_ERR_STR));
+            return;
+        }
 
-    keepInUse();
-    info.removeSecrets();
-    return info.toMap();
+        keepInUse();
+        SignonIdentityInfo info = queried;
+        info.removeSecrets();
+        conn.send(msg.createReply(QVariantList() << info.toMap()));
+    });
+    return QVariantMap();
 }
 
 void SignonIdentity::queryUserPassword(const QVariantMap &params,
@@ -296,33 +339,35 @@ bool SignonIdentity::verifyUser(const QVariantMap &params)
 {
     SIGNON_RETURN_IF_CAM_UNAVAILABLE(false);
 
-    bool ok;
-    SignonIdentityInfo info = queryInfo(ok, true);
-
-    if (!ok) {
-        BLAME() << "Identity not found.";
-        sendErrorReply(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
-                       SIGNOND_IDENTITY_NOT_FOUND_ERR_STR);
-        return false;
-    }
-    if (!info.storePassword() || info.password().isEmpty()) {
-        BLAME() << "Password is not stored.";
-        sendErrorReply(SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_NAME,
-                       SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_STR);
-        return false;
-    }
+    QDBusConnection conn = connection();
+    QDBusMessage msg = message();
 
     //delay dbus reply, ui interaction might take long time to complete
     setDelayedReply(true);
+    queryInfo(true, [=](bool ok, const SignonIdentityInfo &info) {
+        if (!ok) {
+            BLAME() << "Identity not found.";
+            conn.send(msg.createErrorReply(SIGNOND_IDENTITY_NOT_FOUND_ERR_NAME,
+                                           SIGNOND_IDENTITY_NOT_FOUND_ERR_STR));
+            return;
+        }
+        if (!info.storePassword() || info.password().isEmpty()) {
+            BLAME() << "Password is not stored.";
+            conn.send(msg.createErrorReply(
+                                    SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_NAME,
+                                    SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_STR));
+            return;
+        }
 
-    //create ui request to ask password
-    QVariantMap uiRequest;
-    uiRequest.unite(params);
-    uiRequest.insert(SSOUI_KEY_QUERYPASSWORD, true);
-    uiRequest.insert(SSOUI_KEY_USERNAME, info.userName());
-    uiRequest.insert(SSOUI_KEY_CAPTION, info.caption());
+        //create ui request to ask password
+        QVariantMap uiRequest;
+        uiRequest.unite(params);
+        uiRequest.insert(SSOUI_KEY_QUERYPASSWORD, true);
+        uiRequest.insert(SSOUI_KEY_USERNAME, info.userName());
+        uiRequest.insert(SSOUI_KEY_CAPTION, info.caption());
 
-    queryUserPassword(uiRequest, connection(), message());
+        queryUserPassword(uiRequest, conn, msg);
+    });
     return false;
 }
 
@@ -330,42 +375,68 @@ bool SignonIdentity::verifySecret(const QString &secret)
 {
     SIGNON_RETURN_IF_CAM_UNAVAILABLE(false);
 
-    bool ok;
-    queryInfo(ok);
-    if (!ok) {
-        TRACE();
-        sendErrorReply(SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_NAME,
-                       SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_STR +
-                       QLatin1String("Database querying error occurred."));
-        return false;
-    }
+    QDBusConnection conn = connection();
+    QDBusMessage msg = message();
 
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    bool ret = db->checkPassword(m_pInfo->id(), m_pInfo->userName(), secret);
+    setDelayedReply(true);
+    queryInfo(true, [=](bool ok, const SignonIdentityInfo &info) {
+        if (!ok) {
+            TRACE();
+            conn.send(msg.createErrorReply(
+                SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_NAME,
+                SIGNOND_CREDENTIALS_NOT_AVAILABLE_ERR_STR +
+                QLatin1String("Database querying error occurred.")));
+            return;
+        }
 
-    keepInUse();
-    return ret;
+        quint32 id = info.id();
+        QString userName = info.userName();
+        setAutoDestruct(false);
+        CredentialsAccessManager::instance()->storageQueue()->enqueue(this,
+            [=](CredentialsDB *db) -> bool {
+                return (db != 0) && db->checkPassword(id, userName, secret);
+            },
+            [=](bool matches) {
+                setAutoDestruct(true);
+                keepInUse();
+                conn.send(msg.createReply(QVariantList() << matches));
+            });
+    });
+    return false;
 }
 
 void SignonIdentity::remove()
 {
     SIGNON_RETURN_IF_CAM_UNAVAILABLE();
 
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    if ((db == 0) || !db->removeCredentials(m_id)) {
-        TRACE() << "Error occurred while inserting/updating credentials.";
-        sendErrorReply(SIGNOND_REMOVE_FAILED_ERR_NAME,
-                       SIGNOND_REMOVE_FAILED_ERR_STR +
-                       QLatin1String("Database error occurred."));
-        return;
-    }
+    QDBusConnection conn = connection();
+    QDBusMessage msg = message();
+    quint32 id = m_id;
+
+    invalidateCachedResults();
+
     setDelayedReply(true);
     setAutoDestruct(false);
-    PendingCallWatcherWithContext *watcher =
-        new PendingCallWatcherWithContext(m_signonui->removeIdentityData(m_id),
-                                          this);
-    connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
-            this, SLOT(removeCompleted(QDBusPendingCallWatcher*)));
+    CredentialsAccessManager::instance()->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> bool {
+            return (db != 0) && db->removeCredentials(id);
+        },
+        [=](bool ok) {
+            if (!ok) {
+                TRACE() << "Error occurred while removing credentials.";
+                setAutoDestruct(true);
+                conn.send(msg.createErrorReply(SIGNOND_REMOVE_FAILED_ERR_NAME,
+                            SIGNOND_REMOVE_FAILED_ERR_STR +
+                            QLatin1String("Database error occurred.")));
+                return;
+            }
+            PendingCallWatcherWithContext *watcher =
+                new PendingCallWatcherWithContext(
+                                        m_signonui->removeIdentityData(id),
+                                        conn, msg, this);
+            connect(watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+                    this, SLOT(removeCompleted(QDBusPendingCallWatcher*)));
+        });
     keepInUse();
 }
 
@@ -401,11 +472,14 @@ bool SignonIdentity::signOut()
      */
     if (id() != SIGNOND_NEW_IDENTITY) {
         //clear stored sessiondata
-        CredentialsDB *db =
-            CredentialsAccessManager::instance()->credentialsDB();
-        if ((db == 0) || !db->removeData(m_id)) {
-            TRACE() << "clear data failed";
-        }
+        quint32 id = m_id;
+        invalidateCachedResults();
+        CredentialsAccessManager::instance()->storageQueue()->enqueue(
+            [=](CredentialsDB *db) {
+                if ((db == 0) || !db->removeData(id)) {
+                    TRACE() << "clear data failed";
+                }
+            });
 
         setDelayedReply(true);
         setAutoDestruct(false);
@@ -485,47 +559,80 @@ quint32 SignonIdentity::store(const QVariantMap &info)
         m_pInfo->update(newInfo);
     }
 
-    m_id = storeCredentials(*m_pInfo);
-
-    if (m_id == SIGNOND_NEW_IDENTITY) {
-        sendErrorReply(SIGNOND_STORE_FAILED_ERR_NAME,
-                       SIGNOND_STORE_FAILED_ERR_STR);
-    }
+    setDelayedReply(true);
+    storeCredentials(*m_pInfo, connection(), message());
+    return 0;
+}
 
-    return m_id;
+void SignonIdentity::invalidateCachedResults()
+{
+    ResultCache *cache = ResultCache::instance();
+    if (cache != 0 && m_id != SIGNOND_NEW_IDENTITY)
+        cache->invalidate(m_id);
 }
 
-quint32 SignonIdentity::storeCredentials(const SignonIdentityInfo &info)
+void SignonIdentity::storeCredentials(const SignonIdentityInfo &info,
+                                      const QDBusConnection &conn,
+                                      const QDBusMessage &msg)
 {
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    if (db == NULL) {
-        BLAME() << "NULL database handler object.";
-        return SIGNOND_NEW_IDENTITY;
-    }
+    /* m_storageId is only accessed from the storage thread: if several store
+     * requests for a new identity are queued, only the first one inserts it
+     * and the following ones update it. */
+    QSharedPointer<quint32> storageId = m_storageId;
 
-    bool newIdentity = info.isNew();
+    /* The results computed with the former credentials are not valid */
+    invalidateCachedResults();
 
-    if (newIdentity)
-        m_id = db->insertCredentials(info);
-    else
-        db->updateCredentials(info);
+    setAutoDestruct(false);
+    CredentialsAccessManager::instance()->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> quint32 {
+            if (db == NULL) {
+                BLAME() << "NULL database handler object.";
+                return SIGNOND_NEW_IDENTITY;
+            }
 
-    if (db->errorOccurred()) {
-        if (newIdentity)
-            m_id = SIGNOND_NEW_IDENTITY;
+            SignonIdentityInfo storedInfo(info);
+            if (storedInfo.isNew())
+                storedInfo.setId(*storageId);
 
-        TRACE() << "Error occurred while inserting/updating credentials.";
-    } else {
-        if (m_pInfo) {
-            delete m_pInfo;
-            m_pInfo = NULL;
-        }
-        Q_EMIT stored(this);
+            quint32 id;
+            if (storedInfo.isNew()) {
+                id = db->insertCredentials(storedInfo);
+            } else {
+                id = storedInfo.id();
+                db->updateCredentials(storedInfo);
+            }
 
-        TRACE() << "FRESH, JUST STORED CREDENTIALS ID:" << m_id;
-        emit infoUpdated((int)SignOn::IdentityDataUpdated);
-    }
-    return m_id;
+            if (db->errorOccurred()) {
+                TRACE() << "Error occurred while inserting/updating "
+                    "credentials.";
+                return SIGNOND_NEW_IDENTITY;
+            }
+            *storageId = id;
+            return id;
+        },
+        [=](quint32 id) {
+            setAutoDestruct(true);
+            if (id == SIGNOND_NEW_IDENTITY) {
+                conn.send(msg.createErrorReply(SIGNOND_STORE_FAILED_ERR_NAME,
+                                               SIGNOND_STORE_FAILED_ERR_STR));
+                return;
+            }
+
+            m_id = id;
+            if (m_pInfo) {
+                delete m_pInfo;
+                m_pInfo = NULL;
+            }
+            Q_EMIT stored(this);
+
+            TRACE() << "FRESH, JUST STORED CREDENTIALS ID:" << m_id;
+            emit infoUpdated((int)SignOn::IdentityDataUpdated);
+
+            QDBusMessage reply = msg.createReply();
+            reply << quint32(id);
+            conn.send(reply);
+        });
 }
 
 void SignonIdentity::queryUiSlot(QDBusPendingCallWatcher *call)
@@ -582,31 +689,39 @@ void SignonIdentity::queryUiSlot(QDBusPendingCallWatcher *call)
     }
 
     if (resultParameters.contains(SSOUI_KEY_PASSWORD)) {
-        CredentialsDB *db =
-            CredentialsAccessManager::instance()->credentialsDB();
-        if (db == NULL) {
-            BLAME() << "NULL database handler object.";
-            errReply = message.createErrorReply(SIGNOND_STORE_FAILED_ERR_NAME,
-                    SIGNOND_STORE_FAILED_ERR_STR);
-            connection.send(errReply);
-            return;
-        }
-
         //store new password
         if (m_pInfo) {
             m_pInfo->setPassword(resultParameters[SSOUI_KEY_PASSWORD].toString());
 
-            quint32 ret = db->updateCredentials(*m_pInfo);
+            SignonIdentityInfo info = *m_pInfo;
             delete m_pInfo;
             m_pInfo = NULL;
-            if (ret != SIGNOND_NEW_IDENTITY) {
-                QDBusMessage dbusreply = message.createReply();
-                dbusreply << quint32(m_id);
-                connection.send(dbusreply);
-                return;
-            } else{
-                BLAME() << "Error during update";
-            }
+
+            QDBusConnection conn = connection;
+            QDBusMessage msg = message;
+            setAutoDestruct(false);
+            CredentialsAccessManager::instance()->storageQueue()->enqueue(this,
+                [=](CredentialsDB *db) -> quint32 {
+                    if (db == NULL) {
+                        BLAME() << "NULL database handler object.";
+                        return SIGNOND_NEW_IDENTITY;
+                    }
+                    return db->updateCredentials(info);
+                },
+                [=](quint32 ret) {
+                    setAutoDestruct(true);
+                    if (ret != SIGNOND_NEW_IDENTITY) {
+                        QDBusMessage dbusreply = msg.createReply();
+                        dbusreply << quint32(m_id);
+                        conn.send(dbusreply);
+                    } else {
+                        BLAME() << "Error during update";
+                        conn.send(msg.createErrorReply(
+                                            SIGNOND_STORE_FAILED_ERR_NAME,
+                                            SIGNOND_STORE_FAILED_ERR_STR));
+                    }
+                });
+            return;
         }
     }
 
@@ -675,16 +790,6 @@ void SignonIdentity::verifyUiSlot(QDBusPendingCallWatcher *call)
     }
 
     if (resultParameters.contains(SSOUI_KEY_PASSWORD)) {
-        CredentialsDB *db =
-            CredentialsAccessManager::instance()->credentialsDB();
-        if (db == NULL) {
-            BLAME() << "NULL database handler object.";
-            errReply = message.createErrorReply(SIGNOND_STORE_FAILED_ERR_NAME,
-                    SIGNOND_STORE_FAILED_ERR_STR);
-            connection.send(errReply);
-            return;
-        }
-
         //compare passwords
         if (m_pInfo) {
             bool ret =
@@ -27,6 +27,8 @@
 #include <QtCore>
 #include <QtDBus>
 
+#include <functional>
+
 #include "pluginproxy.h"
 
 #include "signond-common.h"
@@ -60,8 +62,16 @@ public:
     static SignonIdentity *createIdentity(quint32 id, SignonDaemon *parent);
     quint32 id() const { return m_id; }
 
-    SignonIdentityInfo queryInfo(bool &ok, bool queryPassword = true);
-    quint32 storeCredentials(const SignonIdentityInfo &info);
+    typedef std::function<void (bool ok, const SignonIdentityInfo &info)>
+        InfoCallback;
+    /*!
+     * Passes the identity info to @a callback; if it has not been loaded
+     * yet, this happens once the storage thread has read it.
+     */
+    void queryInfo(bool queryPassword, const InfoCallback &callback);
+    void storeCredentials(const SignonIdentityInfo &info,
+                          const QDBusConnection &conn,
+                          const QDBusMessage &msg);
 
 public Q_SLOTS:
     quint32 requestCredentialsUpdate(const QString &message);
@@ -87,13 +97,22 @@ private Q_SLOTS:
     void onCredentialsUpdated(quint32 id);
 
 private:
+    typedef bool (CredentialsDB::*ReferenceUpdate)(const quint32,
+                                                   const QString &,
+                                                   const QString &);
+
     SignonIdentity(quint32 id, int timeout, SignonDaemon *parent);
+    void updateReference(ReferenceUpdate update,
+                         const QString &appId,
+                         const QString &reference);
     void queryUserPassword(const QVariantMap &params,
                            const QDBusConnection &connection,
                            const QDBusMessage &message);
+    void invalidateCachedResults();
 
 private:
     quint32 m_id;
+    QSharedPointer<quint32> m_storageId;
     SignonUiAdaptor *m_signonui;
     SignonIdentityInfo *m_pInfo;
 }; //class SignonDaemon
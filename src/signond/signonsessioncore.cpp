@@ -29,6 +29,8 @@
 #include "signonidentity.h"
 #include "signonui_interface.h"
 #include "accesscontrolmanagerhelper.h"
+#include "pluginpool.h"
+#include "resultcache.h"
 
 #include "SignOn/uisessiondata_priv.h"
 #include "SignOn/authpluginif.h"
@@ -40,6 +42,12 @@
  * */
 #define IDLE_WATCHDOG_TIMEOUT SIGNOND_MAX_IDLE_TIME * 500
 
+/* The most requests given at once to a reentrant plugin */
+static const int maxConcurrentRequests = 8;
+
+/* The number of requests answered with the result of another one */
+static quint64 coalescedRequests = 0;
+
 #define SSO_KEY_USERNAME QLatin1String("UserName")
 #define SSO_KEY_PASSWORD QLatin1String("Secret")
 #define SSO_KEY_CAPTION QLatin1String("Caption")
@@ -67,6 +75,21 @@ static QVariantMap filterVariantMap(const QVariantMap &other)
     return result;
 }
 
+/* Removes the keys which concern the client, rather than the
+ * authentication: requests differing only in those can be coalesced */
+static QVariantMap withoutClientKeys(const QVariantMap &params)
+{
+    QVariantMap result = filterVariantMap(params);
+    result.remove(SSO_ACCESS_CONTROL_TOKENS);
+    result.remove(SSOUI_KEY_WINDOWID);
+    result.remove(SSOUI_KEY_EMBEDDED);
+    result.remove(SSOUI_KEY_CLIENT_DATA);
+    result.remove(SSOUI_KEY_REQUESTID);
+    result.remove(SSOUI_KEY_PID);
+    result.remove(SSOUI_KEY_APP_ID);
+    return result;
+}
+
 static QString sessionName(const quint32 id, const QString &method)
 {
    return QString::number(id) + QLatin1String("+") + method;
@@ -77,13 +100,13 @@ SignonSessionCore::SignonSessionCore(quint32 id,
                                      int timeout,
                                      QObject *parent):
     SignonDisposable(timeout, parent),
+    m_plugin(0),
+    m_pluginReady(false),
+    m_lastRequestId(0),
+    m_coalesceRequests(false),
     m_signonui(0),
-    m_watcher(0),
-    m_requestIsActive(false),
-    m_canceled(false),
     m_id(id),
-    m_method(method),
-    m_queryCredsUiDisplayed(false)
+    m_method(method)
 {
     m_signonui = new SignonUiAdaptor(SIGNON_UI_SERVICE,
                                      SIGNON_UI_DAEMON_OBJECTPATH,
@@ -97,13 +120,20 @@ SignonSessionCore::SignonSessionCore(quint32 id,
 
 SignonSessionCore::~SignonSessionCore()
 {
-    delete m_plugin;
-    delete m_watcher;
+    flushStoreOperations();
+
+    /* The plugin process can serve another session of this identity */
+    PluginPool *pool = PluginPool::instance();
+    if (pool != 0)
+        pool->release(m_plugin, m_id);
+    else
+        delete m_plugin;
+    foreach (const RequestData &request, m_listOfRequests)
+        delete request.m_watcher;
     delete m_signonui;
 
     m_plugin = NULL;
     m_signonui = NULL;
-    m_watcher = NULL;
 }
 
 SignonSessionCore *SignonSessionCore::sessionCore(const quint32 id,
@@ -121,6 +151,7 @@ SignonSessionCore *SignonSessionCore::sessionCore(const quint32 id,
     SignonSessionCore *ssc = new SignonSessionCore(id, method,
                                                    parent->authSessionTimeout(),
                                                    parent);
+    ssc->m_coalesceRequests = parent->coalesceAuthRequests();
 
     if (ssc->setupPlugin() == false) {
         TRACE() << "The resulted object is corrupted and has to be deleted";
@@ -137,6 +168,11 @@ SignonSessionCore *SignonSessionCore::sessionCore(const quint32 id,
     return ssc;
 }
 
+quint64 SignonSessionCore::coalescedRequestCount()
+{
+    return coalescedRequests;
+}
+
 quint32 SignonSessionCore::id() const
 {
     TRACE();
@@ -153,52 +189,85 @@ QString SignonSessionCore::method() const
 
 bool SignonSessionCore::setupPlugin()
 {
-    m_plugin = PluginProxy::createNewPluginProxy(m_method);
+    PluginPool *pool = PluginPool::instance();
+    m_plugin = pool != 0 ? pool->acquire(m_method, m_id) :
+        PluginProxy::startPluginProxy(m_method);
 
     if (!m_plugin) {
         TRACE() << "Plugin of type " << m_method << " cannot be found";
         return false;
     }
 
+    m_pluginReady = (m_plugin->state() == PluginProxy::Ready);
+    if (!m_pluginReady) {
+        connect(m_plugin, SIGNAL(ready()), this, SLOT(onPluginReady()));
+        connect(m_plugin, SIGNAL(startFailed()),
+                this, SLOT(onPluginStartFailed()));
+    }
+
     connect(m_plugin,
-            SIGNAL(processResultReply(const QVariantMap&)),
+            SIGNAL(processResultReply(quint32, const QVariantMap&)),
             this,
-            SLOT(processResultReply(const QVariantMap&)),
+            SLOT(processResultReply(quint32, const QVariantMap&)),
             Qt::DirectConnection);
 
     connect(m_plugin,
-            SIGNAL(processStore(const QVariantMap&)),
+            SIGNAL(processStore(quint32, const QVariantMap&)),
             this,
-            SLOT(processStore(const QVariantMap&)),
+            SLOT(processStore(quint32, const QVariantMap&)),
             Qt::DirectConnection);
 
     connect(m_plugin,
-            SIGNAL(processUiRequest(const QVariantMap&)),
+            SIGNAL(processUiRequest(quint32, const QVariantMap&)),
             this,
-            SLOT(processUiRequest(const QVariantMap&)),
+            SLOT(processUiRequest(quint32, const QVariantMap&)),
             Qt::DirectConnection);
 
     connect(m_plugin,
-            SIGNAL(processRefreshRequest(const QVariantMap&)),
+            SIGNAL(processRefreshRequest(quint32, const QVariantMap&)),
             this,
-            SLOT(processRefreshRequest(const QVariantMap&)),
+            SLOT(processRefreshRequest(quint32, const QVariantMap&)),
             Qt::DirectConnection);
 
     connect(m_plugin,
-            SIGNAL(processError(int, const QString&)),
+            SIGNAL(processError(quint32, int, const QString&)),
             this,
-            SLOT(processError(int, const QString&)),
+            SLOT(processError(quint32, int, const QString&)),
             Qt::DirectConnection);
 
     connect(m_plugin,
-            SIGNAL(stateChanged(int, const QString&)),
+            SIGNAL(stateChanged(quint32, int, const QString&)),
             this,
-            SLOT(stateChangedSlot(int, const QString&)),
+            SLOT(stateChangedSlot(quint32, int, const QString&)),
             Qt::DirectConnection);
 
     return true;
 }
 
+void SignonSessionCore::onPluginReady()
+{
+    TRACE() << "Plugin of type" << m_method << "is ready";
+    disconnect(m_plugin, SIGNAL(ready()), this, SLOT(onPluginReady()));
+    disconnect(m_plugin, SIGNAL(startFailed()),
+               this, SLOT(onPluginStartFailed()));
+
+    m_pluginReady = true;
+    emit ready();
+}
+
+void SignonSessionCore::onPluginStartFailed()
+{
+    TRACE() << "Plugin of type" << m_method << "cannot be loaded";
+    disconnect(m_plugin, SIGNAL(ready()), this, SLOT(onPluginReady()));
+    disconnect(m_plugin, SIGNAL(startFailed()),
+               this, SLOT(onPluginStartFailed()));
+
+    emit setupFailed();
+
+    /* Nobody got hold of this session yet */
+    destroy();
+}
+
 void SignonSessionCore::stopAllAuthSessions()
 {
     qDeleteAll(sessionsOfStoredCredentials);
@@ -254,15 +323,24 @@ void SignonSessionCore::cancel(const QString &cancelKey)
     if (requestIndex < m_listOfRequests.size()) {
         /* If the request being cancelled is active, we need to keep
          * in the queue until the plugin has replied. */
-        bool isActive = (requestIndex == 0) && m_requestIsActive;
+        RequestData &request = m_listOfRequests[requestIndex];
+        bool isActive = (request.m_requestId != 0);
         if (isActive) {
-            m_canceled = true;
-            m_plugin->cancel();
+            request.m_canceled = true;
+            /* A request still being loaded is dropped once loaded */
+            if (!request.m_loading)
+                m_plugin->cancel(request.m_requestId);
+
+            /* The requests coalesced with this one must run on their own */
+            for (int i = 0; i < m_listOfRequests.size(); i++) {
+                if (m_listOfRequests[i].m_leaderId == request.m_requestId)
+                    m_listOfRequests[i].m_leaderId = 0;
+            }
 
-            if (m_watcher && !m_watcher->isFinished()) {
+            if (request.m_watcher && !request.m_watcher->isFinished()) {
                 m_signonui->cancelUiRequest(cancelKey);
-                delete m_watcher;
-                m_watcher = 0;
+                delete request.m_watcher;
+                request.m_watcher = 0;
             }
         }
 
@@ -273,7 +351,7 @@ void SignonSessionCore::cancel(const QString &cancelKey)
          * resultSlot or via errorSlot.
          * */
         RequestData rd(isActive ?
-                       m_listOfRequests.head() :
+                       m_listOfRequests.at(requestIndex) :
                        m_listOfRequests.takeAt(requestIndex));
 
         QDBusMessage errReply =
@@ -310,58 +388,271 @@ void SignonSessionCore::setId(quint32 id)
     m_id = id;
 }
 
-void SignonSessionCore::startProcess()
+RequestData *SignonSessionCore::findRequest(quint32 requestId)
+{
+    if (requestId == 0) return 0;
+
+    for (int i = 0; i < m_listOfRequests.size(); i++) {
+        if (m_listOfRequests[i].m_requestId == requestId)
+            return &m_listOfRequests[i];
+    }
+    return 0;
+}
+
+RequestData *SignonSessionCore::nextQueuedRequest()
+{
+    for (int i = 0; i < m_listOfRequests.size(); i++) {
+        if (m_listOfRequests[i].m_requestId == 0 &&
+            m_listOfRequests[i].m_leaderId == 0)
+            return &m_listOfRequests[i];
+    }
+    return 0;
+}
+
+int SignonSessionCore::activeRequestCount() const
+{
+    int count = 0;
+    foreach (const RequestData &request, m_listOfRequests) {
+        if (request.m_requestId != 0)
+            count++;
+    }
+    return count;
+}
+
+bool SignonSessionCore::canBeCoalesced(const RequestData &request,
+                                       const RequestData &leader) const
+{
+    if (leader.m_canceled || request.m_mechanism != leader.m_mechanism)
+        return false;
+
+    if (withoutClientKeys(request.m_params) !=
+        withoutClientKeys(leader.m_clientData))
+        return false;
+
+    /* The client must be granted exactly the same access as the one whose
+     * request is being processed, or the plugin might have replied
+     * differently. */
+    AccessControlManagerHelper *acm = AccessControlManagerHelper::instance();
+    foreach (const QString &acl, leader.m_identityAcl) {
+        bool allowed =
+            acm->isPeerAllowedToAccess(request.m_conn, request.m_msg, acl);
+        if (allowed != leader.m_accessTokens.contains(acl))
+            return false;
+    }
+    return true;
+}
+
+void SignonSessionCore::coalesceQueuedRequests()
+{
+    for (int i = 0; i < m_listOfRequests.size(); i++) {
+        RequestData &request = m_listOfRequests[i];
+        if (request.m_requestId != 0 || request.m_leaderId != 0) continue;
+
+        foreach (const RequestData &leader, m_listOfRequests) {
+            /* The ACL tokens of the leader are not known before its
+             * identity is loaded */
+            if (leader.m_requestId == 0 || leader.m_loading) continue;
+            if (!canBeCoalesced(request, leader)) continue;
+
+            request.m_leaderId = leader.m_requestId;
+            coalescedRequests++;
+            TRACE() << "Request coalesced with" << leader.m_requestId <<
+                ", coalesced so far:" << coalescedRequests;
+            break;
+        }
+    }
+}
+
+QList<RequestData> SignonSessionCore::takeFollowers(quint32 requestId)
+{
+    QList<RequestData> followers;
+    for (int i = 0; i < m_listOfRequests.size(); ) {
+        if (m_listOfRequests[i].m_leaderId == requestId)
+            followers.append(m_listOfRequests.takeAt(i));
+        else
+            i++;
+    }
+    return followers;
+}
+
+void SignonSessionCore::startProcess(RequestData &data)
 {
 
     TRACE() << "the number of requests is" << m_listOfRequests.length();
 
-    m_requestIsActive = true;
-    RequestData data = m_listOfRequests.head();
+    if (++m_lastRequestId == 0) m_lastRequestId = 1;
+    data.m_requestId = m_lastRequestId;
     QVariantMap parameters = data.m_params;
 
     /* save the client data; this should not be modified during the processing
      * of this request */
-    m_clientData = parameters;
+    data.m_clientData = parameters;
 
-    if (m_id) {
-        CredentialsDB *db =
-            CredentialsAccessManager::instance()->credentialsDB();
-        Q_ASSERT(db != 0);
+    if (!m_id) {
+        sendToPlugin(data, parameters);
+        return;
+    }
 
-        SignonIdentityInfo info = db->credentials(m_id);
-        if (info.id() != SIGNOND_NEW_IDENTITY) {
-            if (!parameters.contains(SSO_KEY_PASSWORD)) {
-                parameters[SSO_KEY_PASSWORD] = info.password();
-            }
-            //database overrules over sessiondata for validated username,
-            //so that identity cannot be misused
-            if (info.validated() || !parameters.contains(SSO_KEY_USERNAME)) {
-                parameters[SSO_KEY_USERNAME] = info.userName();
+    StorageQueue *storage =
+        CredentialsAccessManager::instance()->storageQueue();
+    quint32 requestId = data.m_requestId;
+    quint32 id = m_id;
+    QString method = m_method;
+
+    /* If a result might be cached, the stored data is loaded only if
+     * it isn't */
+    ResultCache *cache = ResultCache::instance();
+    bool mayBeCached = cache != 0 && cache->contains(id, method) &&
+        parameters.value(SSOUI_KEY_UIPOLICY) != RequestPasswordPolicy;
+    if (cache != 0)
+        data.m_cacheGeneration = cache->generation(id);
+
+    /* The values given by the client overrule the stored ones, which
+     * therefore don't need to be loaded */
+    QStringList clientKeys = parameters.keys();
+    bool hasPassword = parameters.contains(SSO_KEY_PASSWORD);
+    bool hasUserName = parameters.contains(SSO_KEY_USERNAME);
+
+    /* The identity is loaded without blocking the main loop; meanwhile,
+     * the request is active, but unknown to the plugin */
+    data.m_loading = true;
+    storage->enqueue(this,
+        [=](CredentialsDB *db) -> QPair<SignonIdentityInfo, QVariantMap> {
+            QPair<SignonIdentityInfo, QVariantMap> stored;
+            if (db == 0) return stored;
+            /* The secrets are only read if the plugin gets them: the client
+             * may give its own, and the user name is usually not secret */
+            SignonIdentityInfo &info = stored.first;
+            info = db->credentialFields(id, MethodsField |
+                                        AccessControlListField);
+            bool needsUserName = info.isUserNameSecret() &&
+                (info.validated() || !hasUserName);
+            if (!info.isNew() && (!hasPassword || needsUserName)) {
+                SignonIdentityInfo secrets =
+                    db->credentialFields(id, SecretsField);
+                info.setUserName(secrets.userName());
+                info.setPassword(secrets.password());
             }
+            if (!mayBeCached)
+                stored.second = db->loadData(id, method, clientKeys);
+            return stored;
+        },
+        [=](const QPair<SignonIdentityInfo, QVariantMap> &stored) {
+            identityLoaded(requestId, stored.first, stored.second,
+                           !mayBeCached);
+        });
+}
 
-            QStringList paramsTokenList;
-            QStringList identityAclList = info.accessControlList();
+void SignonSessionCore::identityLoaded(quint32 requestId,
+                                       const SignonIdentityInfo &storedInfo,
+                                       const QVariantMap &storedParams,
+                                       bool paramsLoaded)
+{
+    keepInUse();
 
-            foreach(QString acl, identityAclList) {
-                if (AccessControlManagerHelper::instance()->
-                    isPeerAllowedToAccess(data.m_conn, data.m_msg, acl))
-                    paramsTokenList.append(acl);
-            }
+    RequestData *request = findRequest(requestId);
+    if (request == 0)
+        return;
 
-            if (!paramsTokenList.isEmpty()) {
-                parameters[SSO_ACCESS_CONTROL_TOKENS] = paramsTokenList;
-            }
-        } else {
-            BLAME() << "Error occurred while getting data from credentials "
-                "database.";
+    /* The client has already been replied to */
+    if (request->m_canceled) {
+        requestDone(requestId);
+        return;
+    }
+
+    RequestData &data = *request;
+    SignonIdentityInfo info = storedInfo;
+    QVariantMap parameters = data.m_params;
+    if (info.id() != SIGNOND_NEW_IDENTITY) {
+        QString allowedMechanism(data.m_mechanism);
+        if (!info.checkMethodAndMechanism(m_method, data.m_mechanism,
+                                          allowedMechanism)) {
+            QString errMsg;
+            QTextStream(&errMsg) <<
+                SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_STR <<
+                " Method:" << m_method <<
+                ", mechanism:" << data.m_mechanism <<
+                ", allowed:" << allowedMechanism;
+            data.m_conn.send(data.m_msg.createErrorReply(
+                SIGNOND_METHOD_OR_MECHANISM_NOT_ALLOWED_ERR_NAME, errMsg));
+            requestDone(requestId);
+            return;
+        }
+        data.m_mechanism = allowedMechanism;
+
+        if (!parameters.contains(SSO_KEY_PASSWORD)) {
+            parameters[SSO_KEY_PASSWORD] = info.password();
+        }
+        //database overrules over sessiondata for validated username,
+        //so that identity cannot be misused
+        if (info.validated() || !parameters.contains(SSO_KEY_USERNAME)) {
+            parameters[SSO_KEY_USERNAME] = info.userName();
+        }
+
+        QStringList paramsTokenList;
+        QStringList identityAclList = info.accessControlList();
+
+        foreach(QString acl, identityAclList) {
+            if (AccessControlManagerHelper::instance()->
+                isPeerAllowedToAccess(data.m_conn, data.m_msg, acl))
+                paramsTokenList.append(acl);
         }
+        data.m_identityAcl = identityAclList;
+        data.m_accessTokens = paramsTokenList;
 
-        QVariantMap storedParams = db->loadData(m_id, m_method);
+        if (!paramsTokenList.isEmpty()) {
+            parameters[SSO_ACCESS_CONTROL_TOKENS] = paramsTokenList;
+        }
+    } else {
+        BLAME() << "Error occurred while getting data from credentials "
+            "database.";
+    }
 
+    if (paramsLoaded) {
         //parameters will overwrite any common keys on stored params
-        parameters = mergeVariantMaps(storedParams, parameters);
+        sendToPlugin(data, mergeVariantMaps(storedParams, parameters));
+        return;
     }
 
+    QVariantMap result;
+    ResultCache *cache = ResultCache::instance();
+    if (cache != 0 &&
+        cache->lookup(m_id, m_method, data.m_mechanism,
+                      withoutClientKeys(data.m_clientData),
+                      data.m_accessTokens, result)) {
+        TRACE() << "Replying with the cached result";
+        data.m_conn.send(data.m_msg.createReply(QVariantList() << result));
+        requestDone(requestId);
+        return;
+    }
+
+    quint32 id = m_id;
+    QString method = m_method;
+    QStringList clientKeys = data.m_params.keys();
+    CredentialsAccessManager::instance()->storageQueue()->enqueue(this,
+        [=](CredentialsDB *db) -> QVariantMap {
+            return (db != 0) ?
+                db->loadData(id, method, clientKeys) : QVariantMap();
+        },
+        [=](const QVariantMap &stored) {
+            keepInUse();
+            RequestData *request = findRequest(requestId);
+            if (request == 0)
+                return;
+            if (request->m_canceled) {
+                requestDone(requestId);
+                return;
+            }
+            sendToPlugin(*request, mergeVariantMaps(stored, parameters));
+        });
+}
+
+void SignonSessionCore::sendToPlugin(RequestData &data,
+                                     const QVariantMap &params)
+{
+    data.m_loading = false;
+
+    QVariantMap parameters = params;
     if (parameters.contains(SSOUI_KEY_UIPOLICY)
         && parameters[SSOUI_KEY_UIPOLICY] == RequestPasswordPolicy) {
         parameters.remove(SSO_KEY_PASSWORD);
@@ -369,18 +660,27 @@ void SignonSessionCore::startProcess()
 
     /* Temporary caching, if credentials are valid
      * this data will be effectively cached */
-    m_tmpUsername = parameters[SSO_KEY_USERNAME].toString();
-    m_tmpPassword = parameters[SSO_KEY_PASSWORD].toString();
+    data.m_tmpUsername = parameters[SSO_KEY_USERNAME].toString();
+    data.m_tmpPassword = parameters[SSO_KEY_PASSWORD].toString();
 
-    if (!m_plugin->process(parameters, data.m_mechanism)) {
+    quint32 requestId = data.m_requestId;
+    if (!m_plugin->process(requestId, parameters, data.m_mechanism)) {
         QDBusMessage errReply =
             data.m_msg.createErrorReply(SIGNOND_RUNTIME_ERR_NAME,
                                         SIGNOND_RUNTIME_ERR_STR);
         data.m_conn.send(errReply);
-        requestDone();
-    } else
-        stateChangedSlot(SignOn::SessionStarted,
-                         QLatin1String("The request is started successfully"));
+        requestDone(requestId);
+        return;
+    }
+
+    stateChangedSlot(requestId, SignOn::SessionStarted,
+                     QLatin1String("The request is started successfully"));
+
+    /* The requests queued while this one was loaded might be coalesced
+     * with it now */
+    if (m_coalesceRequests && m_id)
+        QMetaObject::invokeMethod(this, "startNewRequest",
+                                  Qt::QueuedConnection);
 }
 
 void SignonSessionCore::replyError(const QDBusConnection &conn,
@@ -500,128 +800,207 @@ void SignonSessionCore::replyError(const QDBusConnection &conn,
 void SignonSessionCore::processStoreOperation(const StoreOperation &operation)
 {
     TRACE() << "Processing store operation.";
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    Q_ASSERT(db != 0);
 
-    if (operation.m_storeType != StoreOperation::Blob) {
-        if (!(db->updateCredentials(operation.m_info))) {
-            BLAME() << "Error occured while updating credentials.";
-        }
-    } else {
-        TRACE() << "Processing --- StoreOperation::Blob";
+    /* The writes produced by a request are committed together when the
+     * request is done. */
+    m_storeOperations.append(operation);
+    if (activeRequestCount() == 0)
+        flushStoreOperations();
+}
 
-        if (!db->storeData(m_id,
-                           operation.m_authMethod,
-                           operation.m_blobData)) {
-            BLAME() << "Error occured while storing data.";
-        }
-    }
+void SignonSessionCore::flushStoreOperations()
+{
+    if (m_storeOperations.isEmpty()) return;
+
+    CredentialsAccessManager *camManager =
+        CredentialsAccessManager::instance();
+    QList<StoreOperation> operations = m_storeOperations;
+    m_storeOperations.clear();
+    quint32 id = m_id;
+    QPointer<QObject> sender(this);
+
+    /* These operations are executed asynchronously in the storage thread, in
+     * the same unit of work as the writes of other requests finishing at
+     * about the same time. The outcome is handled even if this session is
+     * gone by then. */
+    camManager->storageQueue()->enqueueWrite(camManager,
+        [=](CredentialsDB *db) -> QPair<bool, bool> {
+            /* Whether the stored credentials changed, and whether a
+             * validated identity was updated after a signon UI query */
+            QPair<bool, bool> outcome(false, false);
+            if (db == 0) {
+                BLAME() << "NULL database handler object.";
+                return outcome;
+            }
+
+            foreach (const StoreOperation &operation, operations) {
+                if (operation.m_storeType != StoreOperation::Blob) {
+                    const SignonIdentityInfo &valid = operation.m_info;
+                    SignonIdentityInfo info = db->credentials(id);
+
+                    if ((!info.validated() && !valid.userName().isEmpty() &&
+                         valid.userName() != info.userName()) ||
+                        (!valid.password().isEmpty() &&
+                         valid.password() != info.password()))
+                        outcome.first = true;
+                    if (info.validated() && operation.m_queryCredsUiDisplayed)
+                        outcome.second = true;
+
+                    /* update username and password from ui interaction; do
+                     * not allow updating the username if the identity is
+                     * validated */
+                    if (!info.validated() && !valid.userName().isEmpty()) {
+                        info.setUserName(valid.userName());
+                    }
+                    if (!valid.password().isEmpty()) {
+                        info.setPassword(valid.password());
+                    }
+                    info.setValidated(true);
+
+                    if (!(db->updateCredentials(info))) {
+                        BLAME() << "Error occured while updating credentials.";
+                    }
+                } else {
+                    TRACE() << "Processing --- StoreOperation::Blob";
+
+                    if (!db->storeData(id,
+                                       operation.m_authMethod,
+                                       operation.m_blobData)) {
+                        BLAME() << "Error occured while storing data.";
+                    }
+                }
+            }
+            return outcome;
+        },
+        [=](const QPair<bool, bool> &outcome) {
+            /* The results computed with the former credentials are not valid
+             * anymore; this drops the result just obtained too, since it
+             * cannot be told apart from the stale ones */
+            ResultCache *cache = ResultCache::instance();
+            if (cache != 0 && outcome.first)
+                cache->invalidate(id);
+
+            /* If the credentials are validated, the secrets db is not
+             * available and not authorized keys are available, then the
+             * store operation has been performed on the memory cache only;
+             * inform the CAM about the situation. */
+            if (outcome.second && !sender.isNull() &&
+                !camManager->isSecretsDBOpen()) {
+                SecureStorageEvent *event =
+                    new SecureStorageEvent(
+                        (QEvent::Type)SIGNON_SECURE_STORAGE_NOT_AVAILABLE);
+                event->m_sender = sender.data();
+
+                QCoreApplication::postEvent(camManager,
+                                            event,
+                                            Qt::HighEventPriority);
+            }
+        });
 }
 
-void SignonSessionCore::requestDone()
+void SignonSessionCore::requestDone(quint32 requestId)
 {
-    m_listOfRequests.removeFirst();
-    m_requestIsActive = false;
+    flushStoreOperations();
+    for (int i = 0; i < m_listOfRequests.size(); ) {
+        if (m_listOfRequests[i].m_requestId == requestId) {
+            m_listOfRequests.removeAt(i);
+            continue;
+        }
+        /* Requests coalesced with this one and not answered yet must run on
+         * their own */
+        if (m_listOfRequests[i].m_leaderId == requestId)
+            m_listOfRequests[i].m_leaderId = 0;
+        i++;
+    }
     QMetaObject::invokeMethod(this, "startNewRequest", Qt::QueuedConnection);
 }
 
-void SignonSessionCore::processResultReply(const QVariantMap &data)
+void SignonSessionCore::processResultReply(quint32 requestId,
+                                           const QVariantMap &data)
 {
     TRACE();
 
     keepInUse();
 
-    if (m_listOfRequests.isEmpty())
+    RequestData *request = findRequest(requestId);
+    if (request == 0)
         return;
 
-    RequestData rd = m_listOfRequests.head();
+    RequestData &rd = *request;
 
-    if (!m_canceled) {
+    if (!rd.m_canceled) {
         QVariantList arguments;
         QVariantMap filteredData = filterVariantMap(data);
+        int expiresIn =
+            filteredData.take(SSO_PLUGIN_RESULT_EXPIRES_IN).toInt();
 
-        CredentialsAccessManager *camManager =
-            CredentialsAccessManager::instance();
-        CredentialsDB *db = camManager->credentialsDB();
-        Q_ASSERT(db != 0);
+        ResultCache *cache = ResultCache::instance();
 
         //update database entry
         if (m_id != SIGNOND_NEW_IDENTITY) {
-            SignonIdentityInfo info = db->credentials(m_id);
-            bool identityWasValidated = info.validated();
-
-            /* update username and password from ui interaction; do not allow
-             * updating the username if the identity is validated */
-            if (!info.validated() && !m_tmpUsername.isEmpty()) {
-                info.setUserName(m_tmpUsername);
-            }
-            if (!m_tmpPassword.isEmpty()) {
-                info.setPassword(m_tmpPassword);
-            }
-            info.setValidated(true);
-
+            /* The stored credentials are read and updated in the storage
+             * thread, together with the other writes of this request */
             StoreOperation storeOp(StoreOperation::Credentials);
-            storeOp.m_info = info;
+            storeOp.m_info.setUserName(rd.m_tmpUsername);
+            storeOp.m_info.setPassword(rd.m_tmpPassword);
+            /* Send the storage not available event only if the curent
+             * result processing is following a previous signon UI query.
+             * This is to avoid unexpected UI pop-ups. */
+            storeOp.m_queryCredsUiDisplayed = rd.m_queryCredsUiDisplayed;
             processStoreOperation(storeOp);
-
-            /* If the credentials are validated, the secrets db is not
-             * available and not authorized keys are available, then
-             * the store operation has been performed on the memory
-             * cache only; inform the CAM about the situation. */
-            if (identityWasValidated && !db->isSecretsDBOpen()) {
-                /* Send the storage not available event only if the curent
-                 * result processing is following a previous signon UI query.
-                 * This is to avoid unexpected UI pop-ups. */
-
-                if (m_queryCredsUiDisplayed) {
-                    SecureStorageEvent *event =
-                        new SecureStorageEvent(
-                            (QEvent::Type)SIGNON_SECURE_STORAGE_NOT_AVAILABLE);
-
-                    event->m_sender = static_cast<QObject *>(this);
-
-                    QCoreApplication::postEvent(
-                        CredentialsAccessManager::instance(),
-                        event,
-                        Qt::HighEventPriority);
-                }
-            }
         }
 
-        m_tmpUsername.clear();
-        m_tmpPassword.clear();
+        rd.m_tmpUsername.clear();
+        rd.m_tmpPassword.clear();
 
         //remove secret field from output
         if (m_method != QLatin1String("password")
             && filteredData.contains(SSO_KEY_PASSWORD))
             filteredData.remove(SSO_KEY_PASSWORD);
 
+        if (cache != 0 && expiresIn > 0 && m_id != SIGNOND_NEW_IDENTITY) {
+            cache->insert(m_id, m_method, rd.m_mechanism,
+                          withoutClientKeys(rd.m_clientData),
+                          rd.m_accessTokens, filteredData, expiresIn,
+                          rd.m_cacheGeneration);
+        }
+
         arguments << filteredData;
         rd.m_conn.send(rd.m_msg.createReply(arguments));
 
-        if (m_watcher && !m_watcher->isFinished()) {
-            delete m_watcher;
-            m_watcher = 0;
+        foreach (const RequestData &follower, takeFollowers(requestId))
+            follower.m_conn.send(follower.m_msg.createReply(arguments));
+
+        if (rd.m_watcher && !rd.m_watcher->isFinished()) {
+            delete rd.m_watcher;
+            rd.m_watcher = 0;
         }
         /* Inform SignOnUi that we are done */
-        if (m_queryCredsUiDisplayed) {
+        if (rd.m_queryCredsUiDisplayed) {
             m_signonui->cancelUiRequest(rd.m_cancelKey);
-            m_queryCredsUiDisplayed = false;
+            rd.m_queryCredsUiDisplayed = false;
         }
     }
 
-    requestDone();
+    requestDone(requestId);
 }
 
-void SignonSessionCore::processStore(const QVariantMap &data)
+void SignonSessionCore::processStore(quint32 requestId,
+                                     const QVariantMap &data)
 {
     TRACE();
 
     keepInUse();
+    RequestData *request = findRequest(requestId);
     if (m_id == SIGNOND_NEW_IDENTITY) {
         BLAME() << "Cannot store without identity";
         return;
     }
+    /* The cached results might depend on the former data */
+    ResultCache *cache = ResultCache::instance();
+    if (cache != 0)
+        cache->invalidateMethod(m_id, m_method);
+
     QVariantMap filteredData = data;
     //do not store username or password
     filteredData.remove(SSO_KEY_PASSWORD);
@@ -629,8 +1008,8 @@ void SignonSessionCore::processStore(const QVariantMap &data)
     filteredData.remove(SSO_ACCESS_CONTROL_TOKENS);
 
     //store data into db
-    CredentialsDB *db = CredentialsAccessManager::instance()->credentialsDB();
-    Q_ASSERT(db != NULL);
+    CredentialsAccessManager *camManager =
+        CredentialsAccessManager::instance();
 
     StoreOperation storeOp(StoreOperation::Blob);
     storeOp.m_blobData = filteredData;
@@ -638,49 +1017,58 @@ void SignonSessionCore::processStore(const QVariantMap &data)
     processStoreOperation(storeOp);
 
     /* If the credentials are validated, the secrets db is not available and
-     * not authorized keys are available inform the CAM about the situation. */
-    SignonIdentityInfo info = db->credentials(m_id);
-    if (info.validated() && !db->isSecretsDBOpen()) {
-        /* Send the storage not available event only if the curent store
-         * processing is following a previous signon UI query. This is to avoid
-         * unexpected UI pop-ups.
-         */
-        if (m_queryCredsUiDisplayed) {
-            TRACE() << "Secure storage not available.";
-
-            SecureStorageEvent *event =
-                new SecureStorageEvent(
-                    (QEvent::Type)SIGNON_SECURE_STORAGE_NOT_AVAILABLE);
-            event->m_sender = static_cast<QObject *>(this);
-
-            QCoreApplication::postEvent(
-                CredentialsAccessManager::instance(),
-                event,
-                Qt::HighEventPriority);
-        }
+     * not authorized keys are available inform the CAM about the situation.
+     * Send the storage not available event only if the curent store
+     * processing is following a previous signon UI query. This is to avoid
+     * unexpected UI pop-ups. */
+    if (request != 0 && request->m_queryCredsUiDisplayed &&
+        !camManager->isSecretsDBOpen()) {
+        quint32 id = m_id;
+        camManager->storageQueue()->enqueue(this,
+            [=](CredentialsDB *db) -> bool {
+                return db != 0 &&
+                    db->credentialFields(id, BasicFields).validated();
+            },
+            [=](bool validated) {
+                if (!validated) return;
+                TRACE() << "Secure storage not available.";
+
+                SecureStorageEvent *event =
+                    new SecureStorageEvent(
+                        (QEvent::Type)SIGNON_SECURE_STORAGE_NOT_AVAILABLE);
+                event->m_sender = static_cast<QObject *>(this);
+
+                QCoreApplication::postEvent(
+                    CredentialsAccessManager::instance(),
+                    event,
+                    Qt::HighEventPriority);
+            });
     }
 
-    m_queryCredsUiDisplayed = false;
+    if (request != 0)
+        request->m_queryCredsUiDisplayed = false;
 
     return;
 }
 
-void SignonSessionCore::processUiRequest(const QVariantMap &data)
+void SignonSessionCore::processUiRequest(quint32 requestId,
+                                         const QVariantMap &data)
 {
     TRACE();
 
     keepInUse();
 
-    if (!m_canceled && !m_listOfRequests.isEmpty()) {
-        RequestData &request = m_listOfRequests.head();
+    RequestData *rd = findRequest(requestId);
+    if (rd != 0 && !rd->m_canceled) {
+        RequestData &request = *rd;
         QString uiRequestId = request.m_cancelKey;
 
-        if (m_watcher) {
-            if (!m_watcher->isFinished())
+        if (request.m_watcher) {
+            if (!request.m_watcher->isFinished())
                 m_signonui->cancelUiRequest(uiRequestId);
 
-            delete m_watcher;
-            m_watcher = 0;
+            delete request.m_watcher;
+            request.m_watcher = 0;
         }
 
         request.m_params = filterVariantMap(data);
@@ -691,7 +1079,7 @@ void SignonSessionCore::processUiRequest(const QVariantMap &data)
         else
             request.m_params[SSOUI_KEY_STORED_IDENTITY] = true;
         request.m_params[SSOUI_KEY_IDENTITY] = m_id;
-        request.m_params[SSOUI_KEY_CLIENT_DATA] = m_clientData;
+        request.m_params[SSOUI_KEY_CLIENT_DATA] = request.m_clientData;
         request.m_params[SSOUI_KEY_METHOD] = m_method;
         request.m_params[SSOUI_KEY_MECHANISM] = request.m_mechanism;
         /* Pass some data about the requesting client */
@@ -702,105 +1090,135 @@ void SignonSessionCore::processUiRequest(const QVariantMap &data)
         request.m_params[SSOUI_KEY_APP_ID] = acm->appIdOfPeer(request.m_conn,
                                                               request.m_msg);
 
-        CredentialsAccessManager *camManager =
-            CredentialsAccessManager::instance();
-        CredentialsDB *db = camManager->credentialsDB();
-        Q_ASSERT(db != 0);
-
         //check that we have caption
         if (!data.contains(SSO_KEY_CAPTION)) {
             TRACE() << "Caption missing";
             if (m_id != SIGNOND_NEW_IDENTITY) {
-                SignonIdentityInfo info = db->credentials(m_id);
-                request.m_params.insert(SSO_KEY_CAPTION, info.caption());
-                TRACE() << "Got caption: " << info.caption();
+                quint32 id = m_id;
+                CredentialsAccessManager::instance()->storageQueue()->enqueue(
+                    this,
+                    [=](CredentialsDB *db) -> QString {
+                        return (db != 0) ?
+                            db->credentialFields(id, BasicFields).caption() :
+                            QString();
+                    },
+                    [=](const QString &caption) {
+                        RequestData *rd = findRequest(requestId);
+                        /* Another dialog might have been requested
+                         * meanwhile */
+                        if (rd == 0 || rd->m_canceled || rd->m_watcher)
+                            return;
+                        TRACE() << "Got caption: " << caption;
+                        rd->m_params.insert(SSO_KEY_CAPTION, caption);
+                        showQueryDialog(*rd);
+                    });
+                return;
             }
         }
 
-        /*
-         * Check the secure storage status, if any issues are encountered signal
-         * this to the signon ui. */
-        if (!db->isSecretsDBOpen()) {
-            TRACE();
-
-            //If there are no keys available
-            if (!camManager->keysAvailable()) {
-                TRACE() << "Secrets DB not available."
-                        << "CAM has no keys available. Informing signon-ui.";
-                request.m_params[SSOUI_KEY_STORAGE_KEYS_UNAVAILABLE] = true;
-            }
-        }
+        showQueryDialog(request);
+    }
+}
 
-        m_watcher = new QDBusPendingCallWatcher(
-                     m_signonui->queryDialog(request.m_params),
-                     this);
-        m_queryCredsUiDisplayed = true;
-        connect(m_watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
-                this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
+void SignonSessionCore::showQueryDialog(RequestData &request)
+{
+    keepInUse();
+
+    CredentialsAccessManager *camManager =
+        CredentialsAccessManager::instance();
+
+    /*
+     * Check the secure storage status, if any issues are encountered signal
+     * this to the signon ui. */
+    if (!camManager->isSecretsDBOpen()) {
+        TRACE();
+
+        //If there are no keys available
+        if (!camManager->keysAvailable()) {
+            TRACE() << "Secrets DB not available."
+                    << "CAM has no keys available. Informing signon-ui.";
+            request.m_params[SSOUI_KEY_STORAGE_KEYS_UNAVAILABLE] = true;
+        }
     }
+
+    request.m_watcher = new QDBusPendingCallWatcher(
+                 m_signonui->queryDialog(request.m_params),
+                 this);
+    request.m_queryCredsUiDisplayed = true;
+    connect(request.m_watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+            this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
 }
 
-void SignonSessionCore::processRefreshRequest(const QVariantMap &data)
+void SignonSessionCore::processRefreshRequest(quint32 requestId,
+                                              const QVariantMap &data)
 {
     TRACE();
 
     keepInUse();
 
-    if (!m_canceled && !m_listOfRequests.isEmpty()) {
-        QString uiRequestId = m_listOfRequests.head().m_cancelKey;
+    RequestData *request = findRequest(requestId);
+    if (request != 0 && !request->m_canceled) {
+        QString uiRequestId = request->m_cancelKey;
 
-        if (m_watcher) {
-            if (!m_watcher->isFinished())
+        if (request->m_watcher) {
+            if (!request->m_watcher->isFinished())
                 m_signonui->cancelUiRequest(uiRequestId);
 
-            delete m_watcher;
-            m_watcher = 0;
+            delete request->m_watcher;
+            request->m_watcher = 0;
         }
 
-        m_listOfRequests.head().m_params = filterVariantMap(data);
-        m_watcher = new QDBusPendingCallWatcher(
-                     m_signonui->refreshDialog(m_listOfRequests.head().m_params),
+        request->m_params = filterVariantMap(data);
+        request->m_watcher = new QDBusPendingCallWatcher(
+                     m_signonui->refreshDialog(request->m_params),
                      this);
-        m_queryCredsUiDisplayed = true;
-        connect(m_watcher, SIGNAL(finished(QDBusPendingCallWatcher*)),
+        request->m_queryCredsUiDisplayed = true;
+        connect(request->m_watcher,
+                SIGNAL(finished(QDBusPendingCallWatcher*)),
                 this, SLOT(queryUiSlot(QDBusPendingCallWatcher*)));
     }
 }
 
-void SignonSessionCore::processError(int err, const QString &message)
+void SignonSessionCore::processError(quint32 requestId,
+                                     int err, const QString &message)
 {
     TRACE();
     keepInUse();
-    m_tmpUsername.clear();
-    m_tmpPassword.clear();
 
-    if (m_listOfRequests.isEmpty())
+    RequestData *request = findRequest(requestId);
+    if (request == 0)
         return;
 
-    RequestData rd = m_listOfRequests.head();
+    RequestData &rd = *request;
+    rd.m_tmpUsername.clear();
+    rd.m_tmpPassword.clear();
 
-    if (!m_canceled) {
+    if (!rd.m_canceled) {
         replyError(rd.m_conn, rd.m_msg, err, message);
 
-        if (m_watcher && !m_watcher->isFinished()) {
-            delete m_watcher;
-            m_watcher = 0;
+        foreach (const RequestData &follower, takeFollowers(requestId))
+            replyError(follower.m_conn, follower.m_msg, err, message);
+
+        if (rd.m_watcher && !rd.m_watcher->isFinished()) {
+            delete rd.m_watcher;
+            rd.m_watcher = 0;
         }
         /* Inform SignOnUi that we are done */
-        if (m_queryCredsUiDisplayed) {
-            m_queryCredsUiDisplayed = false;
+        if (rd.m_queryCredsUiDisplayed) {
+            rd.m_queryCredsUiDisplayed = false;
             m_signonui->cancelUiRequest(rd.m_cancelKey);
         }
     }
 
-    requestDone();
+    requestDone(requestId);
 }
 
-void SignonSessionCore::stateChangedSlot(int state, const QString &message)
+void SignonSessionCore::stateChangedSlot(quint32 requestId,
+                                         int state, const QString &message)
 {
-    if (!m_canceled && !m_listOfRequests.isEmpty()) {
-        RequestData rd = m_listOfRequests.head();
-        emit stateChanged(rd.m_cancelKey, (int)state, message);
+    RequestData *request = findRequest(requestId);
+    if (request != 0 && !request->m_canceled) {
+        emit stateChanged(request->m_cancelKey, (int)state, message);
     }
 
     keepInUse();
@@ -838,10 +1256,21 @@ void SignonSessionCore::queryUiSlot(QDBusPendingCallWatcher *call)
 
     QDBusPendingReply<QVariantMap> reply = *call;
     bool isRequestToRefresh = false;
-    Q_ASSERT_X(m_listOfRequests.size() != 0, __func__,
-               "queue of requests is empty");
 
-    RequestData &rd = m_listOfRequests.head();
+    RequestData *request = 0;
+    for (int i = 0; i < m_listOfRequests.size(); i++) {
+        if (m_listOfRequests[i].m_watcher == call) {
+            request = &m_listOfRequests[i];
+            break;
+        }
+    }
+    Q_ASSERT_X(request != 0, __func__, "no request for the UI reply");
+    if (request == 0) {
+        call->deleteLater();
+        return;
+    }
+
+    RequestData &rd = *request;
     if (!reply.isError() && reply.count()) {
         QVariantMap resultParameters = reply.argumentAt<0>();
         if (resultParameters.contains(SSOUI_KEY_REFRESH)) {
@@ -856,69 +1285,69 @@ void SignonSessionCore::queryUiSlot(QDBusPendingCallWatcher *call)
         if (resultParameters.contains(SSOUI_KEY_ERROR)
             && (resultParameters[SSOUI_KEY_ERROR] == QUERY_ERROR_CANCELED)) {
 
-            m_queryCredsUiDisplayed = false;
+            rd.m_queryCredsUiDisplayed = false;
         }
     } else {
         rd.m_params.insert(SSOUI_KEY_ERROR,
                            (int)SignOn::QUERY_ERROR_NO_SIGNONUI);
-        m_queryCredsUiDisplayed = false;
+        rd.m_queryCredsUiDisplayed = false;
     }
 
-    if (!m_canceled) {
+    rd.m_watcher = NULL;
+    if (!rd.m_canceled) {
         /* Temporary caching, if credentials are valid
          * this data will be effectively cached */
-        m_tmpUsername = rd.m_params.value(SSO_KEY_USERNAME,
-                                          QVariant()).toString();
-        m_tmpPassword = rd.m_params.value(SSO_KEY_PASSWORD,
-                                          QVariant()).toString();
+        rd.m_tmpUsername = rd.m_params.value(SSO_KEY_USERNAME,
+                                             QVariant()).toString();
+        rd.m_tmpPassword = rd.m_params.value(SSO_KEY_PASSWORD,
+                                             QVariant()).toString();
 
         if (isRequestToRefresh) {
             TRACE() << "REFRESH IS REQUIRED";
 
             rd.m_params.remove(SSOUI_KEY_REFRESH);
-            m_plugin->processRefresh(rd.m_params);
+            m_plugin->processRefresh(rd.m_requestId, rd.m_params);
         } else {
-            m_plugin->processUi(rd.m_params);
+            m_plugin->processUi(rd.m_requestId, rd.m_params);
         }
     }
 
-    delete m_watcher;
-    m_watcher = NULL;
+    delete call;
 }
 
 void SignonSessionCore::startNewRequest()
 {
     keepInUse();
 
-    m_canceled = false;
-
     if (m_listOfRequests.isEmpty()) {
         TRACE() << "No more requests to process";
         setAutoDestruct(true);
         return;
     }
 
-    // there is an active request already
-    if (m_requestIsActive) {
-        TRACE() << "One request is already active";
-        return;
-    }
+    /* Reentrant plugins get the queued requests as soon as they arrive,
+     * the others one at a time */
+    int maxActiveRequests =
+        m_plugin->isReentrant() ? maxConcurrentRequests : 1;
 
-    //there is some UI operation with plugin
-    if (m_watcher && !m_watcher->isFinished()) {
-        TRACE() << "Some UI operation is still pending";
-        return;
-    }
+    forever {
+        if (m_coalesceRequests)
+            coalesceQueuedRequests();
+
+        RequestData *request;
+        if (activeRequestCount() >= maxActiveRequests ||
+            (request = nextQueuedRequest()) == 0)
+            break;
 
-    TRACE() << "Starting the authentication process";
-    setAutoDestruct(false);
-    startProcess();
+        TRACE() << "Starting the authentication process";
+        setAutoDestruct(false);
+        startProcess(*request);
+    }
 }
 
 void SignonSessionCore::destroy()
 {
-    if (m_requestIsActive ||
-        m_watcher != NULL) {
+    if (activeRequestCount() > 0) {
         keepInUse();
         return;
     }
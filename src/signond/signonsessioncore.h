@@ -31,6 +31,7 @@
  * TODO: remove invocation of plugin operations into the main signond process
  */
 
+#include "credentialsdb.h"
 #include "pluginproxy.h"
 #include "signondisposable.h"
 #include "signonsessioncoretools.h"
@@ -60,6 +61,18 @@ public:
     quint32 id() const;
     QString method() const;
     bool setupPlugin();
+
+    /*!
+     * @returns true once the plugin has been loaded; until then, the
+     * session is not handed out to clients.
+     */
+    bool isReady() const { return m_pluginReady; }
+
+    /*!
+     * @returns the number of requests which have been answered with the
+     * result of an identical request, rather than being run on their own.
+     */
+    static quint64 coalescedRequestCount();
     /*
      * just for any case
      * */
@@ -91,16 +104,21 @@ Q_SIGNALS:
     void stateChanged(const QString &requestId,
                       int state,
                       const QString &message);
+    void ready();
+    void setupFailed();
 
 private Q_SLOTS:
     void startNewRequest();
-
-    void processResultReply(const QVariantMap &data);
-    void processStore(const QVariantMap &data);
-    void processUiRequest(const QVariantMap &data);
-    void processRefreshRequest(const QVariantMap &data);
-    void processError(int err, const QString &message);
-    void stateChangedSlot(int state,
+    void onPluginReady();
+    void onPluginStartFailed();
+
+    void processResultReply(quint32 requestId, const QVariantMap &data);
+    void processStore(quint32 requestId, const QVariantMap &data);
+    void processUiRequest(quint32 requestId, const QVariantMap &data);
+    void processRefreshRequest(quint32 requestId, const QVariantMap &data);
+    void processError(quint32 requestId, int err, const QString &message);
+    void stateChangedSlot(quint32 requestId,
+                          int state,
                           const QString &message);
 
     void queryUiSlot(QDBusPendingCallWatcher *call);
@@ -115,39 +133,44 @@ protected:
     void customEvent(QEvent *event);
 
 private:
-    void startProcess();
+    void startProcess(RequestData &data);
+    RequestData *findRequest(quint32 requestId);
+    RequestData *nextQueuedRequest();
+    int activeRequestCount() const;
+    bool canBeCoalesced(const RequestData &request,
+                        const RequestData &leader) const;
+    void coalesceQueuedRequests();
+    QList<RequestData> takeFollowers(quint32 requestId);
     void replyError(const QDBusConnection &conn,
                     const QDBusMessage &msg,
                     int err,
                     const QString &message);
     void processStoreOperation(const StoreOperation &operation);
-    void requestDone();
+    void flushStoreOperations();
+    void identityLoaded(quint32 requestId,
+                        const SignonIdentityInfo &storedInfo,
+                        const QVariantMap &storedParams,
+                        bool paramsLoaded);
+    void sendToPlugin(RequestData &data, const QVariantMap &params);
+    void showQueryDialog(RequestData &request);
+    void requestDone(quint32 requestId);
 
 private:
     PluginProxy *m_plugin;
+    bool m_pluginReady;
+    /* The requests being processed have a non-zero request ID, the others
+     * are queued; plugins which are not reentrant get one at a time. */
     QQueue<RequestData> m_listOfRequests;
+    quint32 m_lastRequestId;
+    /* Whether queued requests identical to one being processed are
+     * answered with its result */
+    bool m_coalesceRequests;
     SignonUiAdaptor *m_signonui;
 
-    QDBusPendingCallWatcher *m_watcher;
-
-    bool m_requestIsActive;
-    bool m_canceled;
-
     uint m_id;
     QString m_method;
-    /* the original request parameters, for the request currently being
-     * processed */
-    QVariantMap m_clientData;
-
-    //Temporary caching
-    QString m_tmpUsername;
-    QString m_tmpPassword;
-
-    /* Flag used for handling post ui querying results' processing.
-     * Secure storage not available events won't be posted if the current
-     * session processing was not preceded by a signon UI query credentials
-     * interaction, when this flag is set to true. */
-    bool m_queryCredsUiDisplayed;
+
+    QList<StoreOperation> m_storeOperations;
 
     Q_DISABLE_COPY(SignonSessionCore)
 }; //class SignonDaemon
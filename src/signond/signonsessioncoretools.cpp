@@ -48,13 +48,15 @@ QVariantMap SignonDaemonNS::mergeVariantMaps(const QVariantMap &map1,
 /* --------------------- StoreOperation ---------------------- */
 
 StoreOperation::StoreOperation(const StoreType type):
-    m_storeType(type)
+    m_storeType(type),
+    m_queryCredsUiDisplayed(false)
 {
 }
 
 StoreOperation::StoreOperation(const StoreOperation &src):
     m_storeType(src.m_storeType),
     m_info(src.m_info),
+    m_queryCredsUiDisplayed(src.m_queryCredsUiDisplayed),
     m_authMethod(src.m_authMethod),
     m_blobData(src.m_blobData)
 {
@@ -75,7 +77,14 @@ RequestData::RequestData(const QDBusConnection &conn,
     m_msg(msg),
     m_params(params),
     m_mechanism(mechanism),
-    m_cancelKey(cancelKey)
+    m_cancelKey(cancelKey),
+    m_requestId(0),
+    m_leaderId(0),
+    m_canceled(false),
+    m_loading(false),
+    m_queryCredsUiDisplayed(false),
+    m_watcher(0),
+    m_cacheGeneration(0)
 {
 }
 
@@ -84,7 +93,19 @@ RequestData::RequestData(const RequestData &other):
     m_msg(other.m_msg),
     m_params(other.m_params),
     m_mechanism(other.m_mechanism),
-    m_cancelKey(other.m_cancelKey)
+    m_cancelKey(other.m_cancelKey),
+    m_requestId(other.m_requestId),
+    m_leaderId(other.m_leaderId),
+    m_canceled(other.m_canceled),
+    m_loading(other.m_loading),
+    m_clientData(other.m_clientData),
+    m_tmpUsername(other.m_tmpUsername),
+    m_tmpPassword(other.m_tmpPassword),
+    m_queryCredsUiDisplayed(other.m_queryCredsUiDisplayed),
+    m_watcher(other.m_watcher),
+    m_identityAcl(other.m_identityAcl),
+    m_accessTokens(other.m_accessTokens),
+    m_cacheGeneration(other.m_cacheGeneration)
 {
 }
 
@@ -27,6 +27,7 @@
 #include <QObject>
 #include <QVariantMap>
 #include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
 
 #include "signonidentityinfo.h"
 
@@ -57,7 +58,11 @@ struct StoreOperation {
 
 public:
     StoreType m_storeType;
+    /* The username and password which proved valid: the stored identity is
+     * marked as validated, and updated with these if set */
     SignonIdentityInfo m_info;
+    /* Whether the credentials were queried through the signon UI */
+    bool m_queryCredsUiDisplayed;
     //Blob store related
     QString m_authMethod;
     QVariantMap m_blobData;
@@ -85,6 +90,39 @@ public:
     QVariantMap m_params;
     QString m_mechanism;
     QString m_cancelKey;
+
+    /* The id the request is known with by the plugin; 0 until the request
+     * is passed to the plugin. */
+    quint32 m_requestId;
+    /* The id of the request being processed this one has been coalesced
+     * with, if any: the request is then answered with its result. */
+    quint32 m_leaderId;
+    bool m_canceled;
+    /* Whether the stored identity is being loaded: the request is active,
+     * but the plugin doesn't know about it yet. */
+    bool m_loading;
+    /* the original request parameters; these should not be modified during
+     * the processing of the request */
+    QVariantMap m_clientData;
+
+    //Temporary caching
+    QString m_tmpUsername;
+    QString m_tmpPassword;
+
+    /* Flag used for handling post ui querying results' processing.
+     * Secure storage not available events won't be posted if the current
+     * request processing was not preceded by a signon UI query credentials
+     * interaction, when this flag is set to true. */
+    bool m_queryCredsUiDisplayed;
+    QDBusPendingCallWatcher *m_watcher;
+
+    /* The ACL of the identity, and the entries the client matched, when
+     * the request was passed to the plugin */
+    QStringList m_identityAcl;
+    QStringList m_accessTokens;
+    /* The ResultCache generation of the identity when the request was
+     * started */
+    quint64 m_cacheGeneration;
 };
 
 } //SignonDaemonNS
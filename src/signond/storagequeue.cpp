@@ -0,0 +1,220 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+#include "storagequeue.h"
+#include "credentialsdb.h"
+#include "signond-common.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QPointer>
+#include <QSemaphore>
+
+namespace SignonDaemonNS {
+
+static const int defaultGroupCommitWindow = 10;
+
+/* Carries a functor to the thread of the object receiving the event */
+class StorageEvent: public QEvent
+{
+public:
+    StorageEvent(const std::function<void ()> &work):
+        QEvent(eventType()),
+        m_work(work)
+    {
+    }
+
+    static QEvent::Type eventType()
+    {
+        static int type = QEvent::registerEventType();
+        return QEvent::Type(type);
+    }
+
+    void run() { m_work(); }
+
+private:
+    std::function<void ()> m_work;
+};
+
+/* Lives in the storage thread, and runs the tasks posted to it */
+class StorageWorker: public QObject
+{
+protected:
+    void customEvent(QEvent *event)
+    {
+        if (event->type() == StorageEvent::eventType())
+            static_cast<StorageEvent *>(event)->run();
+    }
+};
+
+StorageQueue::StorageQueue(QObject *parent):
+    QObject(parent),
+    m_worker(new StorageWorker),
+    m_credentialsDB(0),
+    m_pendingTasks(0)
+{
+    m_thread.setObjectName(QLatin1String("storage"));
+    m_worker->moveToThread(&m_thread);
+
+    m_groupTimer.setSingleShot(true);
+    m_groupTimer.setInterval(defaultGroupCommitWindow);
+    QObject::connect(&m_groupTimer, SIGNAL(timeout()),
+                     this, SLOT(flushWrites()));
+}
+
+StorageQueue::~StorageQueue()
+{
+    stop();
+    delete m_worker;
+}
+
+void StorageQueue::start()
+{
+    if (m_thread.isRunning()) return;
+
+    TRACE() << "Starting the storage thread";
+    m_thread.start();
+}
+
+void StorageQueue::stop()
+{
+    if (!m_thread.isRunning()) return;
+
+    TRACE() << "Stopping the storage thread";
+    /* The quit request is queued after the pending tasks */
+    runBlocking([](CredentialsDB *) {});
+    m_thread.quit();
+    m_thread.wait();
+}
+
+bool StorageQueue::isStorageThread() const
+{
+    return QThread::currentThread() == &m_thread;
+}
+
+void StorageQueue::setCredentialsDB(CredentialsDB *db)
+{
+    Q_ASSERT(isStorageThread() || !m_thread.isRunning());
+    m_credentialsDB = db;
+}
+
+void StorageQueue::setGroupCommitWindow(int msecs)
+{
+    m_groupTimer.setInterval(msecs);
+}
+
+void StorageQueue::addWrite(const std::function<void (CredentialsDB *)> &write,
+                            const std::function<void ()> &completion)
+{
+    Q_ASSERT(!isStorageThread());
+
+    m_pendingWrites.append(write);
+    if (completion)
+        m_pendingCompletions.append(completion);
+    if (!m_thread.isRunning()) {
+        flushWrites();
+    } else if (!m_groupTimer.isActive()) {
+        m_groupTimer.start();
+    }
+}
+
+void StorageQueue::flushWrites()
+{
+    if (m_pendingWrites.isEmpty()) return;
+
+    m_groupTimer.stop();
+    QList<std::function<void (CredentialsDB *)> > writes = m_pendingWrites;
+    QList<std::function<void ()> > completions = m_pendingCompletions;
+    m_pendingWrites.clear();
+    m_pendingCompletions.clear();
+
+    TRACE() << "Committing" << writes.count() << "writes";
+    post(completions.isEmpty() ? 0 : this, [=](CredentialsDB *db) {
+        bool grouped = (db != 0) && db->beginWrites();
+        foreach (const std::function<void (CredentialsDB *)> &write, writes)
+            write(db);
+        if (grouped && !db->commitWrites())
+            BLAME() << "Group commit failed:" << db->lastError().text();
+    }, [=]() {
+        foreach (const std::function<void ()> &completion, completions)
+            completion();
+    });
+}
+
+void StorageQueue::post(QObject *context,
+                        const std::function<void (CredentialsDB *)> &work,
+                        const std::function<void ()> &completion)
+{
+    /* Keep the tasks in the order they were queued */
+    flushWrites();
+
+    QPointer<QObject> guard(context);
+    bool hasCompletion = (context != 0) && completion;
+
+    if (!m_thread.isRunning()) {
+        work(m_credentialsDB);
+        if (hasCompletion && !guard.isNull())
+            completion();
+        return;
+    }
+
+    m_pendingTasks.ref();
+    QCoreApplication::postEvent(m_worker, new StorageEvent([=]() {
+        work(m_credentialsDB);
+        QCoreApplication::postEvent(this, new StorageEvent([=]() {
+            m_pendingTasks.deref();
+            if (hasCompletion && !guard.isNull())
+                completion();
+        }));
+    }));
+}
+
+void StorageQueue::runBlocking(
+                          const std::function<void (CredentialsDB *)> &work)
+{
+    if (isStorageThread()) {
+        work(m_credentialsDB);
+        return;
+    }
+
+    flushWrites();
+    if (!m_thread.isRunning()) {
+        work(m_credentialsDB);
+        return;
+    }
+
+    QSemaphore done;
+    QCoreApplication::postEvent(m_worker, new StorageEvent([&]() {
+        work(m_credentialsDB);
+        done.release();
+    }));
+    done.acquire();
+}
+
+void StorageQueue::customEvent(QEvent *event)
+{
+    if (event->type() == StorageEvent::eventType())
+        static_cast<StorageEvent *>(event)->run();
+}
+
+} // namespace SignonDaemonNS
@@ -0,0 +1,207 @@
+/* -*- Mode: C++; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * This file is part of signon
+ *
+ * Copyright (C) 2016 Canonical Ltd.
+ *
+ * Contact: Alberto Mardegan <alberto.mardegan@canonical.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public License
+ * version 2.1 as published by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301 USA
+ */
+
+/*!
+  @file storagequeue.h
+  Definition of the StorageQueue object.
+  @ingroup Accounts_and_SSO_Framework
+ */
+
+#ifndef SIGNON_STORAGE_QUEUE_H
+#define SIGNON_STORAGE_QUEUE_H
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QList>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QThread>
+#include <QTimer>
+
+#include <functional>
+
+namespace SignonDaemonNS {
+
+class CredentialsDB;
+class StorageWorker;
+
+/*!
+ * @class StorageQueue
+ * Runs the operations on the credentials database in a dedicated thread,
+ * so that the disk latency doesn't delay the D-Bus dispatching happening
+ * in the main thread.
+ *
+ * The CredentialsDB object (and therefore its database connections) is
+ * created, used and destroyed only in the storage thread: all the accesses
+ * to it must be made through the tasks passed to this object. The tasks are
+ * executed in the order in which they were queued, so a task always sees
+ * the effects of the tasks queued before it.
+ *
+ * A task is a functor taking a CredentialsDB pointer (which is 0 if the
+ * database is not open) and returning a value.
+ *
+ * Writes whose outcome nobody waits for can be queued with enqueueWrite():
+ * those queued within the group commit window are executed together, in a
+ * single unit of work (see CredentialsDB::beginWrites()), so that they share
+ * the cost of syncing the databases to disk.
+ */
+class StorageQueue: public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit StorageQueue(QObject *parent = 0);
+    ~StorageQueue();
+
+    /*!
+     * Starts the storage thread. Until this is called, the tasks are executed
+     * synchronously in the calling thread.
+     */
+    void start();
+
+    /*!
+     * Executes the queued tasks and stops the storage thread.
+     */
+    void stop();
+
+    /*!
+     * @returns true if the caller is running in the storage thread.
+     */
+    bool isStorageThread() const;
+
+    /*!
+     * Sets the database passed to the tasks; this must be called from a task
+     * (or before the queue is started).
+     */
+    void setCredentialsDB(CredentialsDB *db);
+
+    /*!
+     * Sets for how long the writes queued with enqueueWrite() are held, in
+     * order to commit them together with the following ones.
+     * @param msecs The window, in milliseconds; with 0, only the writes
+     * queued from the same iteration of the event loop are grouped.
+     */
+    void setGroupCommitWindow(int msecs);
+
+    /*!
+     * @returns the number of queued tasks whose completion has not been
+     * delivered yet.
+     */
+    int pendingTasks() const { return m_pendingTasks.load(); }
+
+    /*!
+     * Queues a task, and returns immediately.
+     * @param context The object the callback refers to: the callback is not
+     * invoked if it has been destroyed by the time the task completes.
+     * @param task The task.
+     * @param callback A functor, invoked in the thread of the StorageQueue
+     * with the value returned by the task.
+     */
+    template <typename Task, typename Callback>
+    void enqueue(QObject *context, Task task, Callback callback)
+    {
+        typedef decltype(task(static_cast<CredentialsDB *>(0))) Result;
+        QSharedPointer<Result> result(new Result());
+        post(context,
+             [=](CredentialsDB *db) { *result = task(db); },
+             [=]() { callback(*result); });
+    }
+
+    /*!
+     * Queues a task whose result is not needed, and returns immediately.
+     */
+    template <typename Task>
+    void enqueue(Task task)
+    {
+        post(0, [=](CredentialsDB *db) { task(db); }, std::function<void ()>());
+    }
+
+    /*!
+     * Queues a write whose result is not needed, to be committed together
+     * with the writes queued within the group commit window. The write is
+     * still executed before any task queued after it.
+     */
+    template <typename Task>
+    void enqueueWrite(Task task)
+    {
+        addWrite([=](CredentialsDB *db) { task(db); },
+                 std::function<void ()>());
+    }
+
+    /*!
+     * Queues a write like the above, and passes the value it returns to the
+     * callback once its group has been committed.
+     * @param context The object the callback refers to: the callback is not
+     * invoked if it has been destroyed by the time the group is committed.
+     */
+    template <typename Task, typename Callback>
+    void enqueueWrite(QObject *context, Task task, Callback callback)
+    {
+        typedef decltype(task(static_cast<CredentialsDB *>(0))) Result;
+        QSharedPointer<Result> result(new Result());
+        QPointer<QObject> guard(context);
+        addWrite([=](CredentialsDB *db) { *result = task(db); },
+                 [=]() { if (!guard.isNull()) callback(*result); });
+    }
+
+    /*!
+     * Queues a task, and waits for its completion. This blocks the calling
+     * thread for as long as the tasks queued before are running: only use it
+     * where the result is needed before proceeding.
+     * @returns the value returned by the task.
+     */
+    template <typename Task>
+    auto run(Task task) -> decltype(task(static_cast<CredentialsDB *>(0)))
+    {
+        decltype(task(static_cast<CredentialsDB *>(0))) result;
+        runBlocking([&](CredentialsDB *db) { result = task(db); });
+        return result;
+    }
+
+protected:
+    void customEvent(QEvent *event);
+
+private Q_SLOTS:
+    void flushWrites();
+
+private:
+    void addWrite(const std::function<void (CredentialsDB *)> &write,
+                  const std::function<void ()> &completion);
+    void post(QObject *context,
+              const std::function<void (CredentialsDB *)> &work,
+              const std::function<void ()> &completion);
+    void runBlocking(const std::function<void (CredentialsDB *)> &work);
+
+private:
+    QThread m_thread;
+    StorageWorker *m_worker;
+    CredentialsDB *m_credentialsDB;
+    QAtomicInt m_pendingTasks;
+    QList<std::function<void (CredentialsDB *)> > m_pendingWrites;
+    QList<std::function<void ()> > m_pendingCompletions;
+    QTimer m_groupTimer;
+};
+
+} // namespace SignonDaemonNS
+
+#endif // SIGNON_STORAGE_QUEUE_H
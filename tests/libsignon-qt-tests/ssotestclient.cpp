@@ -1342,12 +1342,9 @@ void SsoTestClient::queryIdentities()
 
 void SsoTestClient::queryIdentitiesWithFilter()
 {
-    QSKIP("Test requires the implementation of the filtering feature.",
-          SkipSingle);
-
     TEST_START
     m_serviceResult.reset();
-    int filteredIdentitiesCount = 2;
+    int filteredIdentitiesCount = 1;
 
     IdentityInfo info(QLatin1String("CAPTION"),
                       QLatin1String("TEST_FILTER_USERNAME"),
@@ -1369,22 +1366,22 @@ void SsoTestClient::queryIdentitiesWithFilter()
 
     connect(&m_serviceResult, SIGNAL(testCompleted()), &loop, SLOT(quit()));
 
-    QString userPattern = QString::fromLatin1("TEST_FILTER");
-    QString realmPattern = QString::fromLatin1("*realm_filter*");
+    QString userPattern = QString::fromLatin1("TEST_FILTER.*");
+    QString realmPattern = QString::fromLatin1(".*realm-filter\\.com");
     AuthService::IdentityRegExp userRegexp(userPattern);
     AuthService::IdentityRegExp realmRegexp(realmPattern);
 
     QVERIFY(userPattern == userRegexp.pattern());
     QVERIFY(realmPattern == realmRegexp.pattern());
-    QString patternCopy = realmRegexp.pattern();
+    QVERIFY(userRegexp.isValid());
+    QVERIFY(realmRegexp.isValid());
+    QVERIFY(!AuthService::IdentityRegExp(QLatin1String("*realm")).isValid());
 
     AuthService::IdentityFilter filter;
     filter.insert(AuthService::Username, userRegexp);
     filter.insert(AuthService::Realm, realmRegexp);
     service.queryIdentities(filter);
 
-    service.queryIdentities();
-
     QTimer::singleShot(test_timeout, &loop, SLOT(quit()));
     loop.exec();
 
@@ -122,6 +122,105 @@ void TestDatabase::queryListTest()
     QVERIFY(list.count() == 0);
 }
 
+void TestDatabase::statementCacheTest()
+{
+    QString queryStr = QString::fromLatin1(
+            "SELECT realm FROM TESTING WHERE identity_id = :id");
+    QSqlQuery query = m_meta->preparedQuery(queryStr);
+    QVERIFY(m_meta->m_statements.contains(queryStr));
+    int cachedCount = m_meta->m_statements.count();
+
+    query.bindValue(QLatin1String(":id"), 80);
+    QStringList list = m_meta->queryList(query);
+    QCOMPARE(list.count(), 2);
+
+    /* the same statement is reused with different values */
+    query = m_meta->preparedQuery(queryStr);
+    query.bindValue(QLatin1String(":id"), 81);
+    list = m_meta->queryList(query);
+    QCOMPARE(list.count(), 0);
+    QCOMPARE(m_meta->m_statements.count(), cachedCount);
+}
+
+void TestDatabase::indexMigrationTest()
+{
+    QStringList indexes = QStringList() <<
+        QLatin1String("idx_ACL_identity_id_token_id") <<
+        QLatin1String("idx_ACL_method_id_identity_id") <<
+        QLatin1String("idx_OWNER_identity_id_token_id") <<
+        QLatin1String("idx_CREDENTIALS_caption") <<
+        QLatin1String("idx_CREDENTIALS_username") <<
+        QLatin1String("idx_REALMS_realm");
+    QString indexQuery = QLatin1String("SELECT name FROM sqlite_master "
+                                       "WHERE type = 'index' AND "
+                                       "name GLOB 'idx_*'");
+
+    /* new databases get the indexes from createTables() */
+    QCOMPARE(m_meta->queryList(indexQuery).toSet(), indexes.toSet());
+
+    /* turn the database back into a version 2 one, and upgrade it */
+    foreach (const QString &index, indexes) {
+        m_meta->exec(QLatin1String("DROP INDEX ") + index);
+    }
+    m_meta->exec(QLatin1String("DROP TABLE CHANGES"));
+    m_meta->exec(QLatin1String("PRAGMA user_version = 2"));
+    QVERIFY(m_meta->queryList(indexQuery).isEmpty());
+
+    QVERIFY(m_meta->updateDB(2));
+    QCOMPARE(m_meta->queryList(indexQuery).toSet(), indexes.toSet());
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA user_version")),
+             QStringList() << QString::number(SSO_METADATADB_VERSION));
+    QCOMPARE(m_meta->queryList(QLatin1String(
+        "SELECT name FROM sqlite_master WHERE name = 'sqlite_stat1'")).count(),
+        1);
+}
+
+void TestDatabase::databaseOptionsTest()
+{
+    QVariantMap options;
+    options.insert(QLatin1String("JournalMode"), QLatin1String("wal"));
+    options.insert(QLatin1String("Synchronous"), QLatin1String("FULL"));
+    options.insert(QLatin1String("TokenSynchronous"), QLatin1String("OFF"));
+    options.insert(QLatin1String("BusyTimeout"), 1000);
+    options.insert(QLatin1String("MmapSize"), QLatin1String("not a number"));
+    m_meta->setOptions(options);
+    m_meta->disconnect();
+    QVERIFY(m_meta->connect());
+
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA journal_mode")),
+             QStringList() << QLatin1String("wal"));
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA busy_timeout")),
+             QStringList() << QLatin1String("1000"));
+    QStringList fullSync = QStringList() << QLatin1String("2");
+    QStringList noSync = QStringList() << QLatin1String("0");
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA synchronous")),
+             fullSync);
+
+    /* lazy transactions use the TokenSynchronous level */
+    QVERIFY(m_meta->startTransaction(SqlDatabase::Lazy));
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA synchronous")), noSync);
+    QVERIFY(m_meta->commit());
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA synchronous")),
+             fullSync);
+
+    QVERIFY(m_meta->startTransaction());
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA synchronous")),
+             fullSync);
+    m_meta->rollback();
+
+    QVERIFY(m_meta->checkpoint());
+
+    /* back to the default journal for the other tests */
+    options.clear();
+    options.insert(QLatin1String("JournalMode"), QLatin1String("DELETE"));
+    m_meta->setOptions(options);
+    m_meta->disconnect();
+    QVERIFY(m_meta->connect());
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA journal_mode")),
+             QStringList() << QLatin1String("delete"));
+    QVERIFY(m_meta->checkpoint());
+}
+
 void TestDatabase::insertMethodsTest()
 {
     //test empty list
@@ -155,6 +254,45 @@ void TestDatabase::insertMethodsTest()
     QVERIFY(list.count() == 2);
 }
 
+void TestDatabase::methodIdTest()
+{
+    QString method = QLatin1String("InternedMethod");
+    quint32 id = m_meta->insertMethod(method);
+    QVERIFY(id != 0);
+
+    /* ids are resolved from memory */
+    quint64 execCount = m_meta->execCount();
+    QCOMPARE(m_meta->methodId(method), id);
+    QCOMPARE(m_meta->methodId(QLatin1String("UnknownMethod")), quint32(0));
+    QCOMPARE(m_meta->execCount(), execCount);
+
+    /* and agree with the DB, also after reloading it */
+    QCOMPARE(m_meta->queryList(QString::fromLatin1(
+        "SELECT id FROM METHODS WHERE method = 'InternedMethod'")),
+        QStringList() << QString::number(id));
+    QVERIFY(m_meta->loadNames());
+    QCOMPARE(m_meta->methodId(method), id);
+
+    /* names inserted by a rolled back transaction are forgotten */
+    QVERIFY(m_meta->startTransaction());
+    QMap<QString, QStringList> methods;
+    methods.insert(QLatin1String("RolledBack"),
+                   QStringList() << QLatin1String("RolledBackMech"));
+    QVERIFY(m_meta->insertMethods(methods));
+    QVERIFY(m_meta->methodId(QLatin1String("RolledBack")) != 0);
+    m_meta->rollback();
+    QCOMPARE(m_meta->methodId(QLatin1String("RolledBack")), quint32(0));
+    QCOMPARE(m_meta->m_mechanisms.id(QLatin1String("RolledBackMech")),
+             quint32(0));
+    QCOMPARE(m_meta->methodId(method), id);
+
+    /* inserting a known name again must fail */
+    bool ok = true;
+    QCOMPARE(m_meta->insertMethod(method, &ok), quint32(0));
+    QVERIFY(!ok);
+    QCOMPARE(m_meta->methodId(method), id);
+}
+
 void TestDatabase::methodsTest()
 {
     quint32 id;
@@ -210,7 +348,140 @@ void TestDatabase::credentialsTest()
     foreach(SignonIdentityInfo info, creds) {
         qDebug() << info.id() << info.caption();
     }
-    //TODO check filtering when implemented
+
+    /* the bulk loader must return the same data as the single loader */
+    info = SignonIdentityInfo();
+    info.setCaption(QLatin1String("Complete"));
+    info.setUserName(QLatin1String("User"));
+    info.setMethods(testMethods);
+    info.setRealms(testRealms);
+    info.setAccessControlList(testAcl);
+    info.setOwnerList(testAcl);
+    m_db->insertCredentials(info);
+    creds = m_db->credentials(filter);
+    QCOMPARE(creds.count(), 3);
+    foreach(SignonIdentityInfo bulkInfo, creds) {
+        SignonIdentityInfo single = m_meta->identity(bulkInfo.id());
+        QCOMPARE(bulkInfo.caption(), single.caption());
+        QCOMPARE(bulkInfo.userName(), single.userName());
+        QCOMPARE(bulkInfo.realms().toSet(), single.realms().toSet());
+        QCOMPARE(bulkInfo.accessControlList().toSet(),
+                 single.accessControlList().toSet());
+        QCOMPARE(bulkInfo.ownerList().toSet(), single.ownerList().toSet());
+        QCOMPARE(bulkInfo.methods().keys(), single.methods().keys());
+        QMapIterator<QString, QStringList> it(single.methods());
+        while (it.hasNext()) {
+            it.next();
+            QCOMPARE(bulkInfo.methods().value(it.key()).toSet(),
+                     it.value().toSet());
+        }
+    }
+
+    /* exact, prefix and regular expression filters */
+    filter.insert(QLatin1String("Caption"), QLatin1String("Complete"));
+    creds = m_db->credentials(filter);
+    QCOMPARE(creds.count(), 1);
+    QCOMPARE(creds.first().userName(), QLatin1String("User"));
+
+    filter.clear();
+    filter.insert(QLatin1String("Caption"), QLatin1String("Cap.*"));
+    QCOMPARE(m_db->credentials(filter).count(), 2);
+
+    filter.clear();
+    filter.insert(QLatin1String("Caption"), QLatin1String("Cap"));
+    QCOMPARE(m_db->credentials(filter).count(), 0);
+
+    filter.clear();
+    filter.insert(QLatin1String("Caption"), QLatin1String("C[a-z]+n"));
+    QCOMPARE(m_db->credentials(filter).count(), 2);
+
+    filter.clear();
+    filter.insert(QLatin1String("Realm"), QLatin1String("Realm2\\.com"));
+    QCOMPARE(m_db->credentials(filter).count(), 1);
+
+    filter.clear();
+    filter.insert(QLatin1String("Realm"), QLatin1String(".*3\\.com"));
+    QCOMPARE(m_db->credentials(filter).count(), 1);
+
+    filter.clear();
+    filter.insert(QLatin1String("AuthMethod"), QLatin1String("Method.*"));
+    filter.insert(QLatin1String("Username"), QLatin1String("Us?er"));
+    creds = m_db->credentials(filter);
+    QCOMPARE(creds.count(), 1);
+    QCOMPARE(creds.first().methods().keys(), testMethods.keys());
+
+    filter.clear();
+    filter.insert(QLatin1String("AuthMethod"), QLatin1String("Method4"));
+    QCOMPARE(m_db->credentials(filter).count(), 0);
+
+    filter.clear();
+    filter.insert(QLatin1String("Type"), QLatin1String("0|1"));
+    QCOMPARE(m_db->credentials(filter).count(), 3);
+    QVERIFY(!m_db->errorOccurred());
+}
+
+void TestDatabase::credentialsPageTest()
+{
+    m_db->openSecretsDB(secretsDbFile);
+    m_db->clear();
+
+    QList<quint32> ids;
+    for (int i = 0; i < 5; i++) {
+        SignonIdentityInfo info;
+        info.setCaption(i % 2 == 0 ? QLatin1String("Even") :
+                        QLatin1String("Odd"));
+        info.setRealms(testRealms);
+        ids.append(m_db->insertCredentials(info));
+    }
+
+    /* the pages together hold all the identities, in order */
+    QMap<QString, QString> filter;
+    QList<quint32> pagedIds;
+    quint32 afterId = 0, nextId = 0;
+    int pages = 0;
+    do {
+        QList<SignonIdentityInfo> page =
+            m_db->credentials(filter, afterId, 2, nextId);
+        QVERIFY(page.count() <= 2);
+        foreach (const SignonIdentityInfo &info, page) {
+            QCOMPARE(info.realms().toSet(), testRealms.toSet());
+            pagedIds.append(info.id());
+        }
+        afterId = nextId;
+        pages++;
+    } while (nextId != 0);
+    QCOMPARE(pagedIds, ids);
+    QCOMPARE(pages, 3);
+
+    /* pages are not shifted by concurrent changes */
+    QList<SignonIdentityInfo> page =
+        m_db->credentials(filter, 0, 2, nextId);
+    QCOMPARE(page.count(), 2);
+    QVERIFY(m_db->removeCredentials(ids[0]));
+    SignonIdentityInfo info;
+    info.setCaption(QLatin1String("Odd"));
+    quint32 newId = m_db->insertCredentials(info);
+    page = m_db->credentials(filter, nextId, 2, nextId);
+    QCOMPARE(page.count(), 2);
+    QCOMPARE(page[0].id(), ids[2]);
+    QCOMPARE(page[1].id(), ids[3]);
+    page = m_db->credentials(filter, nextId, 2, nextId);
+    QCOMPARE(page.count(), 2);
+    QCOMPARE(page[1].id(), newId);
+
+    /* the filter applies within the pages; this pattern cannot be turned
+     * into SQL, so the identities are examined one by one */
+    filter.insert(QLatin1String("Caption"), QLatin1String("(Odd)"));
+    page = m_db->credentials(filter, 0, 2, nextId);
+    QCOMPARE(page.count(), 1);
+    QCOMPARE(page[0].id(), ids[1]);
+    QVERIFY(nextId != 0);
+    page = m_db->credentials(filter, nextId, 10, nextId);
+    QCOMPARE(page.count(), 2);
+    QCOMPARE(nextId, quint32(0));
+    QVERIFY(!m_db->errorOccurred());
+
+    m_db->clear();
 }
 
 void TestDatabase::insertCredentialsTest()
@@ -365,6 +636,86 @@ void TestDatabase::updateCredentialsTest()
              updateInfo.accessControlList().toSet());
 }
 
+void TestDatabase::updateIdentityDiffTest()
+{
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("DiffUser"));
+    info.setCaption(QLatin1String("Diff"));
+    info.setMethods(testMethods);
+    info.setRealms(testRealms);
+    info.setAccessControlList(testAcl);
+    info.setOwnerList(QStringList() << QLatin1String("AID::12345678"));
+    quint32 id = m_meta->updateIdentity(info);
+    QVERIFY(id != 0);
+    info.setId(id);
+
+    const QString changesQuery = QLatin1String("SELECT total_changes()");
+    QSqlQuery changes = m_meta->exec(changesQuery);
+    QVERIFY(changes.first());
+    int changesBefore = changes.value(0).toInt();
+    changes.finish();
+
+    /* storing the same identity again writes nothing */
+    QCOMPARE(m_meta->updateIdentity(info), id);
+    changes = m_meta->exec(changesQuery);
+    QVERIFY(changes.first());
+    QCOMPARE(changes.value(0).toInt(), changesBefore);
+    changes.finish();
+
+    /* a flags or username update is a single UPDATE */
+    info.setValidated(true);
+    info.setUserName(QLatin1String("DiffUser2"));
+    QCOMPARE(m_meta->updateIdentity(info), id);
+    changes = m_meta->exec(changesQuery);
+    QVERIFY(changes.first());
+    QCOMPARE(changes.value(0).toInt(), changesBefore + 1);
+    changesBefore = changes.value(0).toInt();
+    changes.finish();
+
+    SignonIdentityInfo retInfo = m_meta->identity(id);
+    QVERIFY(retInfo.validated());
+    QCOMPARE(retInfo.userName(), info.userName());
+
+    /* only the changed realms, owners and ACL rows are touched: one realm
+     * removed and one added, one owner replaced (one delete, one insert),
+     * and a new token for the ACL (one token insert and one ACL row for
+     * each method and mechanism: 2 + 2 + 1) */
+    QStringList realms = testRealms;
+    realms.removeFirst();
+    realms << QLatin1String("Realm4.com");
+    info.setRealms(realms);
+    info.setOwnerList(QStringList() << QLatin1String("AID::87654321"));
+    QStringList acl = testAcl;
+    acl << QLatin1String("AID::diff");
+    info.setAccessControlList(acl);
+    QCOMPARE(m_meta->updateIdentity(info), id);
+    changes = m_meta->exec(changesQuery);
+    QVERIFY(changes.first());
+    QCOMPARE(changes.value(0).toInt(), changesBefore + 2 + 2 + 1 + 5);
+    changesBefore = changes.value(0).toInt();
+    changes.finish();
+
+    retInfo = m_meta->identity(id);
+    QCOMPARE(retInfo.realms().toSet(), realms.toSet());
+    QCOMPARE(retInfo.ownerList(), info.ownerList());
+    QCOMPARE(retInfo.accessControlList().toSet(), acl.toSet());
+    QCOMPARE(retInfo.methods().keys().toSet(),
+             testMethods.keys().toSet());
+
+    /* dropping a token removes its rows only */
+    info.setAccessControlList(testAcl);
+    QCOMPARE(m_meta->updateIdentity(info), id);
+    changes = m_meta->exec(changesQuery);
+    QVERIFY(changes.first());
+    QCOMPARE(changes.value(0).toInt(), changesBefore + 5);
+    changes.finish();
+
+    retInfo = m_meta->identity(id);
+    QCOMPARE(retInfo.accessControlList().toSet(), testAcl.toSet());
+
+    QVERIFY(m_meta->removeIdentity(id));
+}
+
 void TestDatabase::removeCredentialsTest()
 {
     SignonIdentityInfo retInfo;
@@ -485,6 +836,11 @@ void TestDatabase::dataTest()
     result = m_db->loadData(id, method);
     QCOMPARE(result, data);
 
+    /* the values given by the client need not be loaded */
+    result = m_db->loadData(id, method,
+                            QStringList() << QLatin1String("token"));
+    QCOMPARE(result.keys(), QStringList() << QLatin1String("token2"));
+
 
     data.insert(QLatin1String("token"), QVariant());
     data.insert(QLatin1String("token2"), QVariant());
@@ -534,6 +890,150 @@ void TestDatabase::dataTest()
 
 }
 
+void TestDatabase::groupCommitTest()
+{
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+
+    QString method = QLatin1String("Method1");
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("GroupUser"));
+    info.setPassword(QLatin1String("GroupPass"));
+    info.setStorePassword(true);
+    info.setMethods(testMethods);
+    info.setAccessControlList(testAcl);
+
+    QVariantMap data;
+    data.insert(QLatin1String("token"), QLatin1String("first"));
+
+    /* the operations are committed together */
+    QVERIFY(m_db->beginWrites());
+    QVERIFY(m_meta->inTransaction());
+    quint32 id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+    QVERIFY(m_db->storeData(id, method, data));
+    QVERIFY(m_meta->inTransaction());
+    QVERIFY(m_db->commitWrites());
+    QVERIFY(!m_meta->inTransaction());
+
+    SignonIdentityInfo stored = m_db->credentials(id, true);
+    QCOMPARE(stored.userName(), info.userName());
+    QCOMPARE(stored.password(), info.password());
+    QCOMPARE(m_db->loadData(id, method), data);
+
+    /* and discarded together */
+    QVariantMap newData;
+    newData.insert(QLatin1String("token"), QLatin1String("second"));
+    QVERIFY(m_db->beginWrites());
+    quint32 discardedId = m_db->insertCredentials(info);
+    QVERIFY(discardedId != 0);
+    QVERIFY(m_db->storeData(id, method, newData));
+    QCOMPARE(m_db->loadData(id, method), newData);
+    m_db->rollbackWrites();
+    QVERIFY(!m_meta->inTransaction());
+    QVERIFY(m_db->credentials(discardedId, false).isNew());
+    QCOMPARE(m_db->loadData(id, method), data);
+
+    /* a failing operation doesn't affect the others */
+    QVERIFY(m_db->beginWrites());
+    QVERIFY(m_db->storeData(id, method, newData));
+    QVERIFY(!m_meta->transactionalExec(QStringList() <<
+        QLatin1String("INSERT INTO NOT_A_TABLE VALUES (1)")));
+    QVERIFY(m_meta->inTransaction());
+    QVERIFY(m_db->commitWrites());
+    QCOMPARE(m_db->loadData(id, method), newData);
+
+    QVERIFY(m_db->removeCredentials(id));
+}
+
+void TestDatabase::secretsBatchTest()
+{
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+    SignOn::AbstractSecretsStorage *storage = m_secretsStorage;
+    QVERIFY(qobject_cast<SignOn::SecretsStorageBatchInterface *>(storage)
+            != 0);
+    QVERIFY(qobject_cast<SignOn::SecretsStorageMaintenanceInterface *>(
+            storage) != 0);
+
+    QString username, password;
+    QVariantMap data;
+    data.insert(QLatin1String("token"), QLatin1String("batched"));
+
+    /* the writes of a batch are discarded together */
+    QVERIFY(storage->beginBatch());
+    QVERIFY(storage->updateCredentials(7, QLatin1String("User"),
+                                       QLatin1String("Pass")));
+    QVERIFY(storage->storeData(7, 1, data));
+    storage->rollbackBatch();
+    QVERIFY(!storage->loadCredentials(7, username, password));
+    QVERIFY(storage->loadData(7, 1).isEmpty());
+
+    /* nested batches are committed with the outermost one */
+    QVERIFY(storage->beginBatch());
+    QVERIFY(storage->updateCredentials(7, QLatin1String("User"),
+                                       QLatin1String("Pass")));
+    QVERIFY(storage->beginBatch());
+    QVERIFY(storage->storeData(7, 1, data));
+    QVERIFY(storage->commitBatch());
+    QVERIFY(storage->commitBatch());
+    QVERIFY(storage->loadCredentials(7, username, password));
+    QCOMPARE(username, QLatin1String("User"));
+    QCOMPARE(storage->loadData(7, 1), data);
+
+    QVERIFY(storage->removeCredentials(7));
+}
+
+void TestDatabase::attachedSecretsTest()
+{
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+
+    /* the secrets DB shares the metadata connection */
+    QVERIFY(m_secretsStorage->hostDatabase() == m_meta);
+    QStringList schemas;
+    QSqlQuery q = m_meta->newQuery();
+    QVERIFY(q.exec(QLatin1String("PRAGMA database_list")));
+    while (q.next())
+        schemas.append(q.value(1).toString());
+    QVERIFY(schemas.contains(QLatin1String("secrets")));
+
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("AttachedUser"));
+    info.setPassword(QLatin1String("AttachedPass"));
+    info.setStorePassword(true);
+    info.setMethods(testMethods);
+    info.setAccessControlList(testAcl);
+
+    /* an identity and its secrets are discarded together */
+    QVERIFY(m_db->beginWrites());
+    quint32 id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+    QStringList secrets = m_meta->queryList(
+        QString::fromLatin1("SELECT username FROM secrets.CREDENTIALS "
+                            "WHERE id = %1").arg(id));
+    QCOMPARE(secrets, QStringList() << info.userName());
+    m_db->rollbackWrites();
+    QVERIFY(!m_meta->inTransaction());
+    QVERIFY(m_db->credentials(id, false).isNew());
+    QVERIFY(m_meta->queryList(
+        QString::fromLatin1("SELECT username FROM secrets.CREDENTIALS "
+                            "WHERE id = %1").arg(id)).isEmpty());
+
+    /* and committed together */
+    id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+    QVERIFY(!m_meta->inTransaction());
+    SignonIdentityInfo stored = m_db->credentials(id, true);
+    QCOMPARE(stored.password(), info.password());
+    QVERIFY(m_db->removeCredentials(id));
+    QVERIFY(m_meta->queryList(
+        QString::fromLatin1("SELECT id FROM secrets.CREDENTIALS "
+                            "WHERE id = %1").arg(id)).isEmpty());
+
+    /* closing the secrets DB detaches it */
+    m_db->closeSecretsDB();
+    QVERIFY(m_meta->queryList(QLatin1String("PRAGMA database_list")).
+            count() == schemas.count() - 1);
+}
+
 
 void TestDatabase::referenceTest()
 {
@@ -585,6 +1085,274 @@ void TestDatabase::referenceTest()
 
 }
 
+void TestDatabase::changesTest()
+{
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+
+    QList<quint32> changed;
+    QList<quint32> removed;
+    quint64 start;
+    QVERIFY(m_db->changes(0, changed, removed, start));
+
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("Changing"));
+    info.setCaption(QLatin1String("Before"));
+    quint32 id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+    quint32 otherId = m_db->insertCredentials(info);
+    QVERIFY(otherId != 0);
+
+    quint64 sequence;
+    changed.clear();
+    QVERIFY(m_db->changes(start, changed, removed, sequence));
+    QCOMPARE(changed, QList<quint32>() << id << otherId);
+    QVERIFY(removed.isEmpty());
+    QCOMPARE(sequence, start + 2);
+
+    /* writing the same data is not a change */
+    info.setId(id);
+    QCOMPARE(m_db->updateCredentials(info), id);
+    quint64 afterUpdate;
+    changed.clear();
+    QVERIFY(m_db->changes(sequence, changed, removed, afterUpdate));
+    QVERIFY(changed.isEmpty());
+    QCOMPARE(afterUpdate, sequence);
+
+    /* an identity changed several times is listed once */
+    info.setCaption(QLatin1String("After"));
+    QCOMPARE(m_db->updateCredentials(info), id);
+    QVERIFY(m_db->addReference(id, QLatin1String("AID::12345678"),
+                               QLatin1String("ref1")));
+    changed.clear();
+    QVERIFY(m_db->changes(sequence, changed, removed, afterUpdate));
+    QCOMPARE(changed, QList<quint32>() << id);
+    QCOMPARE(afterUpdate, sequence + 2);
+
+    /* removals leave a tombstone */
+    QVERIFY(m_db->removeCredentials(otherId));
+    changed.clear();
+    QVERIFY(m_db->changes(afterUpdate, changed, removed, sequence));
+    QVERIFY(changed.isEmpty());
+    QCOMPARE(removed, QList<quint32>() << otherId);
+    QCOMPARE(sequence, afterUpdate + 1);
+
+    /* the changes made before are still listed after older sequences */
+    changed.clear();
+    removed.clear();
+    QVERIFY(m_db->changes(start, changed, removed, sequence));
+    QCOMPARE(changed, QList<quint32>() << id);
+    QCOMPARE(removed, QList<quint32>() << otherId);
+
+    /* removing a missing identity is not a change */
+    QVERIFY(m_db->removeCredentials(otherId));
+    QCOMPARE(m_meta->changeSequence(), sequence);
+
+    QVERIFY(m_db->removeCredentials(id));
+}
+
+void TestDatabase::changeSequenceRollbackTest()
+{
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+
+    QList<quint32> changed;
+    QList<quint32> removed;
+    quint64 start;
+    QVERIFY(m_db->changes(0, changed, removed, start));
+
+    /* the numbers used by a discarded write are not given out */
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("Discarded"));
+    QVERIFY(m_db->beginWrites());
+    QVERIFY(m_db->insertCredentials(info) != 0);
+    m_db->rollbackWrites();
+    quint64 sequence;
+    changed.clear();
+    QVERIFY(m_db->changes(start, changed, removed, sequence));
+    QVERIFY(changed.isEmpty());
+    QCOMPARE(sequence, start);
+
+    /* restart the daemon: the sequence doesn't go backwards, and the
+     * changes made after it are listed */
+    m_db->closeSecretsDB();
+    delete m_db;
+    delete m_secretsStorage;
+    m_secretsStorage = new DefaultSecretsStorage();
+    m_db = new CredentialsDB(dbFile, m_secretsStorage);
+    m_meta = m_db->metaDataDB;
+    QVERIFY(m_db->init());
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+
+    quint64 restarted;
+    changed.clear();
+    QVERIFY(m_db->changes(sequence, changed, removed, restarted));
+    QVERIFY(restarted >= sequence);
+
+    info.setUserName(QLatin1String("Stored"));
+    quint32 id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+    changed.clear();
+    QVERIFY(m_db->changes(sequence, changed, removed, restarted));
+    QCOMPARE(changed, QList<quint32>() << id);
+    QVERIFY(restarted > sequence);
+
+    QVERIFY(m_db->removeCredentials(id));
+}
+
+void TestDatabase::vacuumTest()
+{
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA auto_vacuum")),
+             QStringList() << QLatin1String("2"));
+
+    /* fill some pages, and free them */
+    QList<quint32> ids;
+    SignonIdentityInfo info;
+    info.setCaption(QString(2000, QLatin1Char('c')));
+    for (int i = 0; i < 20; i++) {
+        info.setUserName(QString::fromLatin1("Vacuum %1").arg(i));
+        quint32 id = m_db->insertCredentials(info);
+        QVERIFY(id != 0);
+        ids.append(id);
+    }
+    qint64 size = m_db->databaseSize();
+    foreach (quint32 id, ids) {
+        QVERIFY(m_db->removeCredentials(id));
+    }
+    qint64 freeSpace = m_db->freeSpace();
+    QVERIFY(freeSpace > 0);
+    QCOMPARE(m_db->databaseSize(), size);
+
+    /* each slice releases at most the given number of pages per DB */
+    qint64 pageSize = m_meta->queryList(
+        QLatin1String("PRAGMA page_size")).value(0).toLongLong();
+    qint64 freePages = m_db->vacuum(1);
+    QVERIFY(freePages >= 0);
+    qint64 released = freeSpace - m_db->freeSpace();
+    QVERIFY(released >= pageSize && released <= 2 * pageSize);
+    QCOMPARE(m_db->databaseSize(), size - released);
+
+    QCOMPARE(m_db->vacuum(freePages), qint64(0));
+    QCOMPARE(m_db->freeSpace(), qint64(0));
+    QCOMPARE(m_db->databaseSize(), size - freeSpace);
+
+    /* older databases are rebuilt by the migration to version 5 only */
+    m_meta->exec(QLatin1String("PRAGMA auto_vacuum = NONE"));
+    m_meta->exec(QLatin1String("VACUUM"));
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA auto_vacuum")),
+             QStringList() << QLatin1String("0"));
+    QVERIFY(m_meta->updateDB(5));
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA auto_vacuum")),
+             QStringList() << QLatin1String("0"));
+    QVERIFY(m_meta->updateDB(4));
+    QCOMPARE(m_meta->queryList(QLatin1String("PRAGMA auto_vacuum")),
+             QStringList() << QLatin1String("2"));
+}
+
+void TestDatabase::storedDataTest()
+{
+    QVariantMap data;
+    data.insert(QLatin1String("AccessToken"), QLatin1String("access"));
+    data.insert(QLatin1String("ExpiresIn"), 3600);
+    data.insert(QLatin1String("Scopes"),
+                QStringList() << QLatin1String("read"));
+
+    QByteArray record = StoredData::encode(data);
+    StoredData stored(record);
+    QVERIFY(stored.isValid());
+    QCOMPARE(stored.keys().toSet(), data.keys().toSet());
+    QCOMPARE(stored.value(QLatin1String("ExpiresIn")), QVariant(3600));
+    QVERIFY(!stored.value(QLatin1String("Missing")).isValid());
+    QCOMPARE(stored.toMap(), data);
+    QVariantMap partialData = data;
+    partialData.remove(QLatin1String("ExpiresIn"));
+    QCOMPARE(stored.toMap(QStringList() << QLatin1String("ExpiresIn")),
+             partialData);
+
+    /* large tokens get compressed */
+    QString largeToken = QString(QLatin1String("eyJhbGciOiJSUzI1NiJ9.")).
+        repeated(100);
+    data.insert(QLatin1String("RefreshToken"), largeToken);
+    record = StoredData::encode(data);
+    QVERIFY(record.size() < largeToken.size());
+    QCOMPARE(StoredData(record).value(QLatin1String("RefreshToken")),
+             QVariant(largeToken));
+    QCOMPARE(StoredData(record).toMap(), data);
+
+    /* corrupted records are rejected */
+    QVERIFY(!StoredData(QByteArray()).isValid());
+    QVERIFY(!StoredData(record.left(record.size() / 2)).isValid());
+    record[0] = char(99);
+    QVERIFY(!StoredData(record).isValid());
+}
+
+void TestDatabase::secretsMigrationTest()
+{
+    const QString oldDbFile =
+        QLatin1String("/tmp/signon_test_migration_secrets.db");
+    QFile::remove(oldDbFile);
+
+    /* create a version 1 DB, with one STORE row per key */
+    QVariantMap data;
+    data.insert(QLatin1String("token"), QLatin1String("tokenval"));
+    data.insert(QLatin1String("expiry"), 3600);
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase(QLatin1String("QSQLITE"),
+                                                    QLatin1String("old"));
+        db.setDatabaseName(oldDbFile);
+        QVERIFY(db.open());
+        QSqlQuery q(db);
+        QVERIFY(q.exec(QLatin1String(
+            "CREATE TABLE CREDENTIALS (id INTEGER NOT NULL UNIQUE,"
+            "username TEXT, password TEXT, PRIMARY KEY (id))")));
+        QVERIFY(q.exec(QLatin1String(
+            "CREATE TABLE STORE (identity_id INTEGER, method_id INTEGER,"
+            "key TEXT, value BLOB,"
+            "PRIMARY KEY (identity_id, method_id, key))")));
+        QVERIFY(q.exec(QLatin1String(
+            "CREATE TRIGGER tg_delete_credentials "
+            "BEFORE DELETE ON CREDENTIALS FOR EACH ROW BEGIN "
+            "DELETE FROM STORE WHERE STORE.identity_id = OLD.id; END;")));
+        QVERIFY(q.exec(QLatin1String("PRAGMA user_version = 1")));
+        QVERIFY(q.exec(QLatin1String(
+            "INSERT INTO CREDENTIALS (id, username) VALUES (1, 'User')")));
+        QVERIFY(q.prepare(QLatin1String(
+            "INSERT INTO STORE (identity_id, method_id, key, value) "
+            "VALUES (1, 2, :key, :value)")));
+        QMapIterator<QString, QVariant> it(data);
+        while (it.hasNext()) {
+            it.next();
+            QByteArray array;
+            QDataStream stream(&array, QIODevice::WriteOnly);
+            stream << it.value();
+            q.bindValue(QLatin1String(":key"), it.key());
+            q.bindValue(QLatin1String(":value"), array);
+            QVERIFY(q.exec());
+        }
+        db.close();
+    }
+    QSqlDatabase::removeDatabase(QLatin1String("old"));
+
+    SecretsDB *secretsDB = new SecretsDB(oldDbFile);
+    QVERIFY(secretsDB->init());
+    QCOMPARE(secretsDB->queryList(QLatin1String("PRAGMA user_version")),
+             QStringList() << QString::number(SSO_SECRETSDB_VERSION));
+    QVERIFY(!secretsDB->m_database.tables().contains(QLatin1String("STORE")));
+    QCOMPARE(secretsDB->loadData(1, 2), data);
+    QVariantMap partialData = data;
+    partialData.remove(QLatin1String("token"));
+    QCOMPARE(secretsDB->loadData(1, 2, QStringList() <<
+                                 QLatin1String("token")), partialData);
+
+    /* the cascading delete now works on the new table */
+    QVERIFY(secretsDB->removeCredentials(1));
+    QVERIFY(secretsDB->loadData(1, 2).isEmpty());
+
+    QString connectionName = secretsDB->connectionName();
+    delete secretsDB;
+    QSqlDatabase::removeDatabase(connectionName);
+    QFile::remove(oldDbFile);
+}
+
 void TestDatabase::cacheTest()
 {
     quint32 idWithStore, idWithoutStore;
@@ -629,6 +1397,137 @@ void TestDatabase::cacheTest()
     QVERIFY(!ok);
 }
 
+void TestDatabase::secretsCacheBoundsTest()
+{
+    SecretsCache cache;
+    QString username, password;
+
+    /* the memory used is accounted */
+    cache.updateCredentials(1, QLatin1String("User1"),
+                            QLatin1String("Pass1"), true);
+    int entrySize = cache.size();
+    QVERIFY(entrySize > 0);
+    cache.updateCredentials(1, QLatin1String("User1"),
+                            QLatin1String("Pass1"), true);
+    QCOMPARE(cache.size(), entrySize);
+    QVariantMap data;
+    data.insert(QLatin1String("token"), QString(100, QLatin1Char('x')));
+    cache.updateData(1, 1, data);
+    QVERIFY(cache.size() >= entrySize + 200);
+    cache.updateData(1, 1, QVariantMap());
+    QVERIFY(cache.size() < entrySize + 200);
+    cache.clear();
+    QCOMPARE(cache.size(), 0);
+
+    /* the least recently used entries are evicted */
+    cache.updateCredentials(1, QLatin1String("User1"),
+                            QLatin1String("Pass1"), true);
+    cache.updateCredentials(2, QLatin1String("User2"),
+                            QLatin1String("Pass2"), true);
+    cache.updateCredentials(3, QLatin1String("User3"),
+                            QLatin1String("Pass3"), true);
+    QCOMPARE(cache.count(), 3);
+    cache.setMaxSize(cache.size());
+    QCOMPARE(cache.count(), 3);
+    QVERIFY(cache.lookupCredentials(1, username, password));
+    cache.updateCredentials(4, QLatin1String("User4"),
+                            QLatin1String("Pass4"), true);
+    QCOMPARE(cache.count(), 3);
+    QCOMPARE(cache.evictions(), quint64(1));
+    QVERIFY(!cache.lookupCredentials(2, username, password));
+    QVERIFY(cache.lookupCredentials(1, username, password));
+    QCOMPARE(password, QLatin1String("Pass1"));
+    QVERIFY(cache.size() <= cache.maxSize());
+
+    /* the entries not evicted are written to the DB */
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+    cache.storeToDB(m_secretsStorage);
+    QVERIFY(m_secretsStorage->loadCredentials(4, username, password));
+    QCOMPARE(password, QLatin1String("Pass4"));
+    QVERIFY(!m_secretsStorage->loadCredentials(2, username, password));
+    m_secretsStorage->removeCredentials(1);
+    m_secretsStorage->removeCredentials(3);
+    m_secretsStorage->removeCredentials(4);
+    cache.clear();
+
+    /* expired entries are dropped */
+    cache.setTimeToLive(50);
+    cache.updateCredentials(5, QLatin1String("User5"),
+                            QLatin1String("Pass5"), true);
+    QVERIFY(cache.lookupCredentials(5, username, password));
+    QTest::qSleep(100);
+    QVERIFY(!cache.lookupCredentials(5, username, password));
+    QCOMPARE(cache.expirations(), quint64(1));
+    QCOMPARE(cache.count(), 0);
+    QCOMPARE(cache.size(), 0);
+
+    /* a disabled cache keeps nothing */
+    cache.setTimeToLive(0);
+    cache.setMaxSize(0);
+    cache.updateData(6, 1, data);
+    QCOMPARE(cache.count(), 0);
+    QVERIFY(cache.lookupData(6, 1).isEmpty());
+}
+
+void TestDatabase::identityCacheTest()
+{
+    QVERIFY(m_db->openSecretsDB(secretsDbFile));
+
+    SignonIdentityInfo info;
+    info.setCaption(QLatin1String("Cached"));
+    info.setMethods(testMethods);
+    info.setAccessControlList(testAcl);
+    quint32 id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+
+    /* the first read loads the identity, the next ones don't touch the DB */
+    quint64 hits = m_db->identityCacheHits();
+    quint64 misses = m_db->identityCacheMisses();
+    QCOMPARE(m_db->credentials(id, false).caption(), QLatin1String("Cached"));
+    QCOMPARE(m_db->identityCacheMisses(), misses + 1);
+
+    quint64 execCount = m_meta->execCount();
+    QCOMPARE(m_db->credentials(id, false).caption(), QLatin1String("Cached"));
+    QCOMPARE(m_db->accessControlList(id).toSet(), testAcl.toSet());
+    QCOMPARE(m_db->identityCacheHits(), hits + 2);
+    QCOMPARE(m_meta->execCount(), execCount);
+
+    /* writes invalidate the entry */
+    info = m_db->credentials(id, false);
+    info.setCaption(QLatin1String("Updated"));
+    QCOMPARE(m_db->updateCredentials(info), id);
+    QCOMPARE(m_db->credentials(id, false).caption(),
+             QLatin1String("Updated"));
+
+    misses = m_db->identityCacheMisses();
+    QVERIFY(m_db->addReference(id, QLatin1String("AID::12345678"),
+                               QLatin1String("ref")));
+    m_db->credentials(id, false);
+    QCOMPARE(m_db->identityCacheMisses(), misses + 1);
+
+    QVERIFY(m_db->removeCredentials(id));
+    QVERIFY(m_db->credentials(id, false).isNew());
+
+    /* the memory bound is respected */
+    m_db->m_identityCache->setMaxSize(1024);
+    for (int i = 0; i < 10; i++) {
+        m_db->credentials(m_db->insertCredentials(info), false);
+    }
+    QVERIFY(m_db->m_identityCache->m_cache.totalCost() <= 1024);
+    QVERIFY(m_db->m_identityCache->m_cache.count() < 10);
+
+    /* a disabled cache is never hit */
+    m_db->m_identityCache->setMaxSize(0);
+    hits = m_db->identityCacheHits();
+    id = m_db->insertCredentials(info);
+    m_db->credentials(id, false);
+    m_db->credentials(id, false);
+    QCOMPARE(m_db->identityCacheHits(), hits);
+    QCOMPARE(m_db->accessControlList(id).toSet(), testAcl.toSet());
+
+    m_db->m_identityCache->setMaxSize(SSO_DEFAULT_IDENTITY_CACHE_SIZE);
+}
+
 void TestDatabase::accessControlListTest()
 {
     quint32 id;
@@ -659,6 +1558,279 @@ void TestDatabase::credentialsOwnerSecurityTokenTest()
     QStringList tokens = m_db->ownerList(id);
     QCOMPARE(tokens.toSet(), testAcl.toSet());
 
+    /* The owners are stored in the order given */
+    QStringList owners = QStringList() << QLatin1String("Owner::Zeta") <<
+        QLatin1String("Owner::Beta") << QLatin1String("Owner::Alpha");
+    info.setOwnerList(owners);
+    id = m_db->insertCredentials(info);
+    QCOMPARE(m_db->credentialsOwnerSecurityToken(id), owners.first());
+    QCOMPARE(m_db->ownerList(id), owners);
+}
+
+void TestDatabase::identityLoadBenchmark_data()
+{
+    QTest::addColumn<int>("methodCount");
+
+    QTest::newRow("1 method") << 1;
+    QTest::newRow("10 methods") << 10;
+    QTest::newRow("50 methods") << 50;
+}
+
+void TestDatabase::identityLoadBenchmark()
+{
+    QFETCH(int, methodCount);
+
+    QStringList mechs = QStringList() <<
+        QLatin1String("Mech1") <<
+        QLatin1String("Mech2") <<
+        QLatin1String("Mech3");
+    MethodMap methods;
+    for (int i = 0; i < methodCount; i++) {
+        methods.insert(QString::fromLatin1("BenchMethod%1").arg(i), mechs);
+    }
+
+    SignonIdentityInfo info;
+    info.setUserName(QLatin1String("User"));
+    info.setMethods(methods);
+    info.setRealms(testRealms);
+    info.setAccessControlList(testAcl);
+    info.setOwnerList(testAcl);
+
+    quint32 id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+
+    quint64 execCount = m_meta->execCount();
+    SignonIdentityInfo retInfo = m_meta->identity(id);
+    quint64 queryCount = m_meta->execCount() - execCount;
+    qDebug() << methodCount << "methods:" << queryCount <<
+        "queries per identity";
+
+    /* The number of queries must not depend on the number of methods */
+    QCOMPARE(queryCount, quint64(5));
+    QCOMPARE(retInfo.methods().count(), methodCount);
+    QCOMPARE(retInfo.methods().value(QLatin1String("BenchMethod0")).toSet(),
+             mechs.toSet());
+
+    QBENCHMARK {
+        m_meta->identity(id);
+    }
+}
+
+void TestDatabase::identityFieldsBenchmark_data()
+{
+    QTest::addColumn<int>("fields");
+    QTest::addColumn<int>("expectedQueries");
+
+    QTest::newRow("all") << int(MetaDataFields) << 5;
+    QTest::newRow("caption and flags") << int(BasicFields) << 1;
+    QTest::newRow("methods") << int(MethodsField) << 2;
+    QTest::newRow("ACL and owners") <<
+        int(AccessControlListField | OwnerListField) << 3;
+}
+
+void TestDatabase::identityFieldsBenchmark()
+{
+    QFETCH(int, fields);
+    QFETCH(int, expectedQueries);
+
+    MethodMap methods;
+    methods.insert(QLatin1String("BenchMethod"),
+                   QStringList() << QLatin1String("Mech1"));
+    SignonIdentityInfo info;
+    info.setCaption(QLatin1String("Projected"));
+    info.setUserName(QLatin1String("User"));
+    info.setValidated(true);
+    info.setMethods(methods);
+    info.setRealms(testRealms);
+    info.setAccessControlList(testAcl);
+    info.setOwnerList(testAcl);
+
+    quint32 id = m_db->insertCredentials(info);
+    QVERIFY(id != 0);
+
+    IdentityFields mask(fields);
+    quint64 execCount = m_meta->execCount();
+    SignonIdentityInfo retInfo = m_meta->identity(id, mask);
+    quint64 queryCount = m_meta->execCount() - execCount;
+    qDebug() << queryCount << "queries per identity";
+    QCOMPARE(queryCount, quint64(expectedQueries));
+
+    /* the row fields are always there, the others only if requested */
+    QCOMPARE(retInfo.caption(), info.caption());
+    QCOMPARE(retInfo.userName(), info.userName());
+    QVERIFY(retInfo.validated());
+    QCOMPARE(retInfo.methods().isEmpty(), !(mask & MethodsField));
+    QCOMPARE(retInfo.realms().isEmpty(), !(mask & RealmsField));
+    QCOMPARE(retInfo.accessControlList().isEmpty(),
+             !(mask & AccessControlListField));
+    QCOMPARE(retInfo.ownerList().isEmpty(), !(mask & OwnerListField));
+
+    QBENCHMARK {
+        m_meta->identity(id, mask);
+    }
+}
+
+void TestDatabase::aclLookupBenchmark_data()
+{
+    QTest::addColumn<int>("aclRows");
+
+    QTest::newRow("1k ACL rows") << 1000;
+    QTest::newRow("10k ACL rows") << 10000;
+    QTest::newRow("100k ACL rows") << 100000;
+}
+
+void TestDatabase::aclLookupBenchmark()
+{
+    QFETCH(int, aclRows);
+    const int tokensPerIdentity = 10;
+
+    /* Every identity gets one ACL row per token, all with the same method */
+    QVERIFY(m_meta->clear());
+    QStringList populate = QStringList() <<
+        QLatin1String("INSERT INTO METHODS (method) VALUES ('BenchMethod')") <<
+        QString::fromLatin1("INSERT INTO TOKENS (token) "
+                            "WITH RECURSIVE seq(n) AS "
+                            "(SELECT 1 UNION ALL SELECT n + 1 FROM seq "
+                            "WHERE n < %1) "
+                            "SELECT 'BenchToken' || n FROM seq").
+            arg(tokensPerIdentity) <<
+        QString::fromLatin1("INSERT INTO CREDENTIALS (caption, flags, type) "
+                            "WITH RECURSIVE seq(n) AS "
+                            "(SELECT 1 UNION ALL SELECT n + 1 FROM seq "
+                            "WHERE n < %1) "
+                            "SELECT 'Bench' || n, 0, 0 FROM seq").
+            arg(aclRows / tokensPerIdentity) <<
+        QLatin1String("INSERT INTO ACL (identity_id, method_id, token_id) "
+                      "SELECT CREDENTIALS.id, METHODS.id, TOKENS.id "
+                      "FROM CREDENTIALS, METHODS, TOKENS") <<
+        QLatin1String("INSERT INTO OWNER (identity_id, token_id) "
+                      "SELECT CREDENTIALS.id, TOKENS.id "
+                      "FROM CREDENTIALS, TOKENS "
+                      "WHERE TOKENS.token = 'BenchToken1'") <<
+        QLatin1String("ANALYZE");
+    QVERIFY(m_meta->transactionalExec(populate));
+    /* METHODS was written behind the back of the in-memory names */
+    QVERIFY(m_meta->loadNames());
+
+    QCOMPARE(m_meta->queryList(QLatin1String("SELECT COUNT(*) FROM ACL")),
+             QStringList() << QString::number(aclRows));
+
+    quint32 id = m_meta->queryList(
+        QLatin1String("SELECT MAX(id) FROM CREDENTIALS")).first().toUInt();
+
+    /* The lookups must go through the indexes, not scan the tables */
+    QSqlQuery plan = m_meta->exec(QString::fromLatin1(
+        "EXPLAIN QUERY PLAN SELECT token FROM TOKENS WHERE id IN "
+        "(SELECT token_id FROM ACL WHERE identity_id = %1)").arg(id));
+    QString details;
+    while (plan.next()) {
+        details += plan.value(3).toString() + QLatin1Char('\n');
+    }
+    QVERIFY2(details.contains(QLatin1String("idx_ACL_identity_id_token_id")),
+             qPrintable(details));
+
+    QCOMPARE(m_meta->accessControlList(id).count(), tokensPerIdentity);
+    QCOMPARE(m_meta->ownerList(id), QStringList() <<
+             QLatin1String("BenchToken1"));
+    QCOMPARE(m_meta->methods(id), QStringList() <<
+             QLatin1String("BenchMethod"));
+
+    QBENCHMARK {
+        m_meta->accessControlList(id);
+        m_meta->ownerList(id);
+        m_meta->methods(id);
+    }
+
+    QVERIFY(m_meta->clear());
+}
+
+void TestDatabase::storeDataBenchmark_data()
+{
+    QTest::addColumn<int>("keyCount");
+    QTest::addColumn<int>("changedKeys");
+
+    QTest::newRow("5 keys, 1 changed") << 5 << 1;
+    QTest::newRow("5 keys, all changed") << 5 << 5;
+    QTest::newRow("50 keys, 1 changed") << 50 << 1;
+    QTest::newRow("50 keys, all changed") << 50 << 50;
+    QTest::newRow("500 keys, 1 changed") << 500 << 1;
+    QTest::newRow("500 keys, all changed") << 500 << 500;
+}
+
+void TestDatabase::storeDataBenchmark()
+{
+    QFETCH(int, keyCount);
+    QFETCH(int, changedKeys);
+
+    const QString benchDbFile =
+        QLatin1String("/tmp/signon_test_bench_secrets.db");
+    QFile::remove(benchDbFile);
+    SecretsDB *secretsDB = new SecretsDB(benchDbFile);
+    QVERIFY(secretsDB->init());
+    /* 500 keys don't fit in the per-method limit */
+    secretsDB->m_maxDataSize = 1024 * 1024;
+
+    QVariantMap data;
+    for (int i = 0; i < keyCount; i++) {
+        data.insert(QString::fromLatin1("Key%1").arg(i),
+                    QString::fromLatin1("Value%1").arg(i));
+    }
+    QVERIFY(secretsDB->storeData(1, 1, data));
+
+    /* A refresh rewrites the single record, and only if it changed */
+    int refresh = 0;
+    for (int i = 0; i < changedKeys; i++) {
+        data.insert(QString::fromLatin1("Key%1").arg(i),
+                    QString::fromLatin1("Refresh%1").arg(refresh));
+    }
+    const QString changesQuery = QLatin1String("SELECT total_changes()");
+    QSqlQuery changes = secretsDB->exec(changesQuery);
+    QVERIFY(changes.first());
+    int changesBefore = changes.value(0).toInt();
+    changes.finish();
+    QVERIFY(secretsDB->storeData(1, 1, data));
+    changes = secretsDB->exec(changesQuery);
+    QVERIFY(changes.first());
+    int rowsWritten = changes.value(0).toInt() - changesBefore;
+    changes.finish();
+    qDebug() << keyCount << "keys," << changedKeys << "changed:" <<
+        rowsWritten << "rows written per refresh";
+    QCOMPARE(rowsWritten, 1);
+    QCOMPARE(secretsDB->loadData(1, 1), data);
+
+    /* Keys missing from the new data are removed */
+    QVariantMap shrunk = data;
+    shrunk.remove(QLatin1String("Key0"));
+    shrunk.insert(QString::fromLatin1("Key%1").arg(keyCount - 1), QVariant());
+    QVERIFY(secretsDB->storeData(1, 1, shrunk));
+    shrunk.remove(QString::fromLatin1("Key%1").arg(keyCount - 1));
+    QCOMPARE(secretsDB->loadData(1, 1), shrunk);
+    QVERIFY(secretsDB->storeData(1, 1, data));
+
+    /* Storing the same data again doesn't write anything */
+    changes = secretsDB->exec(changesQuery);
+    QVERIFY(changes.first());
+    changesBefore = changes.value(0).toInt();
+    changes.finish();
+    QVERIFY(secretsDB->storeData(1, 1, data));
+    changes = secretsDB->exec(changesQuery);
+    QVERIFY(changes.first());
+    QCOMPARE(changes.value(0).toInt(), changesBefore);
+    changes.finish();
+
+    QBENCHMARK {
+        refresh++;
+        for (int i = 0; i < changedKeys; i++) {
+            data.insert(QString::fromLatin1("Key%1").arg(i),
+                        QString::fromLatin1("Refresh%1").arg(refresh));
+        }
+        secretsDB->storeData(1, 1, data);
+    }
+
+    QString connectionName = secretsDB->connectionName();
+    delete secretsDB;
+    QSqlDatabase::removeDatabase(connectionName);
+    QFile::remove(benchDbFile);
 }
 
 QTEST_MAIN(TestDatabase)
@@ -47,23 +47,48 @@ private Q_SLOTS:
 
     void createTableStructureTest();
     void queryListTest();
+    void statementCacheTest();
+    void indexMigrationTest();
+    void databaseOptionsTest();
     void insertMethodsTest();
+    void methodIdTest();
 
     void methodsTest();
     void checkPasswordTest();
     void credentialsTest();
+    void credentialsPageTest();
     void insertCredentialsTest();
     void updateCredentialsTest();
+    void updateIdentityDiffTest();
     void removeCredentialsTest();
     void clearTest();
 
     void dataTest();
+    void groupCommitTest();
+    void secretsBatchTest();
+    void attachedSecretsTest();
     void referenceTest();
+    void changesTest();
+    void changeSequenceRollbackTest();
+    void vacuumTest();
+    void storedDataTest();
+    void secretsMigrationTest();
     void cacheTest();
+    void secretsCacheBoundsTest();
+    void identityCacheTest();
 
     void accessControlListTest();
     void credentialsOwnerSecurityTokenTest();
 
+    void identityLoadBenchmark_data();
+    void identityLoadBenchmark();
+    void identityFieldsBenchmark_data();
+    void identityFieldsBenchmark();
+    void aclLookupBenchmark_data();
+    void aclLookupBenchmark();
+    void storeDataBenchmark_data();
+    void storeDataBenchmark();
+
 private:
     CredentialsDB *m_db;
     DefaultSecretsStorage *m_secretsStorage;
@@ -26,6 +26,7 @@
 #ifndef PLUGINPROXY_EXTERNAL_INCLUDED_
 #define PLUGINPROXY_EXTERNAL_INCLUDED_
 
+#include "pluginpool.cpp"
 #include "pluginproxy.cpp"
 #include "blobiohandler.cpp"
 
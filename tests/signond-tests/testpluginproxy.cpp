@@ -104,20 +104,20 @@ void TestPluginProxy::process_for_dummy()
         inDataV[key] = inData.getProperty(key);
 
     QSignalSpy spyResult(m_proxy,
-               SIGNAL(processResultReply(const QVariantMap&)));
+               SIGNAL(processResultReply(quint32, const QVariantMap&)));
     QSignalSpy spyState(m_proxy,
-                    SIGNAL(stateChanged(int, const QString&)));
+                    SIGNAL(stateChanged(quint32, int, const QString&)));
     QEventLoop loop;
 
     QObject::connect(m_proxy,
-                 SIGNAL(processResultReply(const QVariantMap&)),
+                 SIGNAL(processResultReply(quint32, const QVariantMap&)),
                  &loop,
                  SLOT(quit()));
 
     QTimer::singleShot(10*1000, &loop, SLOT(quit()));
 
     QString cancelKey = QUuid::createUuid().toString();
-    bool res = m_proxy->process(inDataV, "mech1");
+    bool res = m_proxy->process(0, inDataV, "mech1");
     QVERIFY(res);
 
     loop.exec();
@@ -125,7 +125,7 @@ void TestPluginProxy::process_for_dummy()
     QCOMPARE(spyResult.count(), 1);
     QCOMPARE(spyState.count(), 10);
 
-    QVariantMap outData = spyResult.at(0).at(0).toMap();
+    QVariantMap outData = spyResult.at(0).at(1).toMap();
 
     qDebug() << outData;
 
@@ -151,33 +151,33 @@ void TestPluginProxy::processUi_for_dummy()
         inDataV[key] = inData.getProperty(key);
 
     QSignalSpy spyResult(m_proxy,
-              SIGNAL(processResultReply(const QVariantMap&)));
+              SIGNAL(processResultReply(quint32, const QVariantMap&)));
     QSignalSpy spyError(m_proxy,
-                   SIGNAL(processError(int, const QString&)));
+                   SIGNAL(processError(quint32, int, const QString&)));
     QSignalSpy spyUi(m_proxy,
-                SIGNAL(processUiRequest(const QVariantMap&)));
+                SIGNAL(processUiRequest(quint32, const QVariantMap&)));
     QEventLoop loop;
 
     QObject::connect(m_proxy,
-                 SIGNAL(processResultReply(const QVariantMap&)),
+                 SIGNAL(processResultReply(quint32, const QVariantMap&)),
                  &loop,
                  SLOT(quit()));
 
     QObject::connect(m_proxy,
-                     SIGNAL(processError(int, const QString&)),
+                     SIGNAL(processError(quint32, int, const QString&)),
                      &loop,
                      SLOT(quit()));
 
 
     QObject::connect(m_proxy,
-                     SIGNAL(processUiRequest(const QVariantMap&)),
+                     SIGNAL(processUiRequest(quint32, const QVariantMap&)),
                      &loop,
                      SLOT(quit()));
 
     QTimer::singleShot(10*1000, &loop, SLOT(quit()));
 
     QString cancelKey = QUuid::createUuid().toString();
-    bool res = m_proxy->process(inDataV, "mech2");
+    bool res = m_proxy->process(0, inDataV, "mech2");
     QVERIFY(res);
 
     loop.exec();
@@ -185,8 +185,8 @@ void TestPluginProxy::processUi_for_dummy()
     QCOMPARE(spyUi.count(), 0);
     QCOMPARE(spyError.count(), 1);
 
-    int err = spyError.at(0).at(0).toInt();
-    QString errMsg = spyError.at(0).at(1).toString();
+    int err = spyError.at(0).at(1).toInt();
+    QString errMsg = spyError.at(0).at(2).toString();
 
     qDebug() << err;
     qDebug() << errMsg;
@@ -194,7 +194,7 @@ void TestPluginProxy::processUi_for_dummy()
     QVERIFY(err == Error::NotAuthorized);
 
     inDataV["UiPolicy"] = 0;
-    res = m_proxy->process(inDataV, "mech2");
+    res = m_proxy->process(0, inDataV, "mech2");
     QVERIFY(res);
 
     loop.exec();
@@ -215,33 +215,35 @@ void TestPluginProxy::process_and_cancel_for_dummy()
     foreach(QString key, inData.propertyNames())
         inDataV[key] = inData.getProperty(key);
 
-    QSignalSpy spyResult(m_proxy, SIGNAL(processResultReply(const QVariantMap&)));
-    QSignalSpy spyError(m_proxy, SIGNAL(processError(int, const QString&)));
+    QSignalSpy spyResult(m_proxy,
+                         SIGNAL(processResultReply(quint32, const QVariantMap&)));
+    QSignalSpy spyError(m_proxy,
+                        SIGNAL(processError(quint32, int, const QString&)));
 
     QEventLoop loop;
 
     QObject::connect(m_proxy,
-                     SIGNAL(processResultReply(const QVariantMap&)),
+                     SIGNAL(processResultReply(quint32, const QVariantMap&)),
                      &loop,
                      SLOT(quit()));
 
     QObject::connect(m_proxy,
-                     SIGNAL(processError(int, const QString&)),
+                     SIGNAL(processError(quint32, int, const QString&)),
                      &loop,
                      SLOT(quit()));
 
     QTimer::singleShot(0.2*1000, m_proxy, SLOT(cancel()));
     QTimer::singleShot(10*1000, &loop, SLOT(quit()));
 
-    bool res = m_proxy->process(inDataV, "mech1");
+    bool res = m_proxy->process(0, inDataV, "mech1");
     QVERIFY(res);
     loop.exec();
 
     QCOMPARE(spyResult.count(), 0);
     QCOMPARE(spyError.count(), 1);
 
-    int err = spyError.at(0).at(0).toInt();
-    QString errMsg = spyError.at(0).at(1).toString();
+    int err = spyError.at(0).at(1).toInt();
+    QString errMsg = spyError.at(0).at(2).toString();
 
     qDebug() << err;
     qDebug() << errMsg;
@@ -262,22 +264,24 @@ void TestPluginProxy::process_wrong_mech_for_dummy()
     foreach(QString key, inData.propertyNames())
         inDataV[key] = inData.getProperty(key);
 
-    QSignalSpy spyResult(m_proxy, SIGNAL(processResultReply(const QVariantMap&)));
-    QSignalSpy spyError(m_proxy, SIGNAL(processError(int, const QString&)));
+    QSignalSpy spyResult(m_proxy,
+                         SIGNAL(processResultReply(quint32, const QVariantMap&)));
+    QSignalSpy spyError(m_proxy,
+                        SIGNAL(processError(quint32, int, const QString&)));
 
     QEventLoop loop;
 
     QObject::connect(m_proxy,
-                     SIGNAL(processResultReply(const QVariantMap&)),
+                     SIGNAL(processResultReply(quint32, const QVariantMap&)),
                      &loop,
                      SLOT(quit()));
 
     QObject::connect(m_proxy,
-                     SIGNAL(processError(int, const QString&)),
+                     SIGNAL(processError(quint32, int, const QString&)),
                      &loop,
                      SLOT(quit()));
 
-    bool res = m_proxy->process(inDataV, "wrong");
+    bool res = m_proxy->process(0, inDataV, "wrong");
     QVERIFY(res);
 
     loop.exec();
@@ -285,8 +289,8 @@ void TestPluginProxy::process_wrong_mech_for_dummy()
     QCOMPARE(spyResult.count(), 0);
     QCOMPARE(spyError.count(), 1);
 
-    int err = spyError.at(0).at(0).toInt();
-    QString errMsg = spyError.at(0).at(1).toString();
+    int err = spyError.at(0).at(1).toInt();
+    QString errMsg = spyError.at(0).at(2).toString();
 
     qDebug() << err << " " << errMsg;
 
@@ -306,6 +310,169 @@ void TestPluginProxy::wrong_user_for_dummy()
 #endif
 }
 
+void TestPluginProxy::pool_for_dummy()
+{
+    PluginPool pool;
+    pool.setLimits(0, 1, 30);
+    QCOMPARE(PluginPool::instance(), &pool);
+
+    PluginProxy *proxy = pool.acquire("ssotest");
+    QVERIFY(proxy != NULL);
+    QCOMPARE(pool.idleCount("ssotest"), 0);
+    if (proxy->state() != PluginProxy::Ready) {
+        QSignalSpy spyReady(proxy, SIGNAL(ready()));
+        QVERIFY(spyReady.wait(10*1000));
+    }
+    QCOMPARE(proxy->state(), PluginProxy::Ready);
+
+    /* the process is kept, and given to the next session */
+    pool.release(proxy);
+    QCOMPARE(pool.idleCount("ssotest"), 1);
+    QVERIFY(proxy->isRunning());
+    QCOMPARE(pool.acquire("ssotest"), proxy);
+    QCOMPARE(pool.idleCount("ssotest"), 0);
+    QCOMPARE(proxy->mechanisms(), m_proxy->mechanisms());
+
+    /* a reset process still works */
+    QVariantMap inData;
+    inData.insert("UserName", "testUsername");
+    QSignalSpy spyResult(proxy,
+                         SIGNAL(processResultReply(quint32, const QVariantMap&)));
+    QEventLoop loop;
+    QObject::connect(proxy, SIGNAL(processResultReply(quint32, const QVariantMap&)),
+                     &loop, SLOT(quit()));
+    QTimer::singleShot(10*1000, &loop, SLOT(quit()));
+    QVERIFY(proxy->process(0, inData, "mech1"));
+    loop.exec();
+    QCOMPARE(spyResult.count(), 1);
+
+    /* a process which served an identity is kept for it only */
+    pool.release(proxy, 5);
+    QCOMPARE(pool.idleCount("ssotest"), 1);
+    PluginProxy *other = pool.acquire("ssotest", 6);
+    QVERIFY(other != NULL);
+    QVERIFY(other != proxy);
+    QCOMPARE(pool.idleCount("ssotest"), 1);
+    QCOMPARE(pool.acquire("ssotest", 5), proxy);
+
+    /* a process which served no stored identity is not kept */
+    pool.release(other, 0);
+    QCOMPARE(pool.idleCount("ssotest"), 0);
+
+    /* beyond the maximum size, processes are stopped */
+    other = pool.acquire("ssotest");
+    QVERIFY(other != NULL);
+    QVERIFY(other != proxy);
+    pool.release(proxy, 5);
+    pool.release(other);
+    QCOMPARE(pool.idleCount("ssotest"), 1);
+
+    /* idle processes are reaped, then the minimum number of unused ones is
+     * started again and kept running */
+    pool.setLimits(1, 1, 0);
+    QCOMPARE(pool.idleCount("ssotest"), 0);
+    QTRY_COMPARE(pool.idleCount("ssotest"), 1);
+    pool.setLimits(1, 1, 0);
+    QCOMPARE(pool.idleCount("ssotest"), 1);
+
+    /* without a minimum size, they are all reaped */
+    pool.setLimits(0, 1, 0);
+    QCOMPARE(pool.idleCount("ssotest"), 0);
+}
+
+void TestPluginProxy::slow_start_for_dummy()
+{
+    const int startDelay = 2000;
+    qputenv("SSOTEST_START_DELAY", QByteArray::number(startDelay));
+
+    QElapsedTimer timer;
+    timer.start();
+    PluginProxy *proxy = PluginProxy::startPluginProxy("ssotest");
+    qunsetenv("SSOTEST_START_DELAY");
+    QVERIFY(proxy != NULL);
+    QVERIFY(timer.elapsed() < startDelay / 4);
+    QCOMPARE(proxy->state(), PluginProxy::Starting);
+
+    /* the event loop keeps running while the plugin is loaded */
+    qint64 lastTick = timer.elapsed();
+    qint64 longestStall = 0;
+    QTimer ticker;
+    ticker.setInterval(20);
+    QObject::connect(&ticker, &QTimer::timeout, [&]() {
+        qint64 now = timer.elapsed();
+        longestStall = qMax(longestStall, now - lastTick);
+        lastTick = now;
+    });
+    ticker.start();
+
+    QSignalSpy spyReady(proxy, SIGNAL(ready()));
+    QSignalSpy spyFailed(proxy, SIGNAL(startFailed()));
+    QVERIFY(spyReady.wait(10*1000));
+    ticker.stop();
+
+    QCOMPARE(spyFailed.count(), 0);
+    QVERIFY(timer.elapsed() >= startDelay);
+    QVERIFY2(longestStall < 500,
+             qPrintable(QString("Event loop stalled for %1 ms").
+                        arg(longestStall)));
+    QCOMPARE(proxy->state(), PluginProxy::Ready);
+    QCOMPARE(proxy->mechanisms(), m_proxy->mechanisms());
+
+    /* the process is stopped in the background */
+    timer.restart();
+    delete proxy;
+    QVERIFY(timer.elapsed() < 500);
+}
+
+void TestPluginProxy::reentrant_for_dummy()
+{
+    qputenv("SSOTEST_REENTRANT", "1");
+    PluginProxy *proxy = PluginProxy::createNewPluginProxy("ssotest");
+    qunsetenv("SSOTEST_REENTRANT");
+    QVERIFY(proxy != NULL);
+    QVERIFY(proxy->isReentrant());
+    QVERIFY(!m_proxy->isReentrant());
+
+    QSignalSpy spyResult(proxy,
+                         SIGNAL(processResultReply(quint32, const QVariantMap&)));
+    QSignalSpy spyError(proxy,
+                        SIGNAL(processError(quint32, int, const QString&)));
+
+    /* each request takes about one second: run them at once */
+    QElapsedTimer timer;
+    timer.start();
+    for (quint32 requestId = 1; requestId <= 3; requestId++) {
+        QVariantMap inData;
+        inData.insert("UserName", QString("user%1").arg(requestId));
+        QVERIFY(proxy->process(requestId, inData, "mech1"));
+    }
+
+    /* the second request is canceled alone */
+    QTimer::singleShot(200, [proxy]() { proxy->cancel(2); });
+
+    while (spyResult.count() + spyError.count() < 3 &&
+           timer.elapsed() < 10*1000)
+        QTest::qWait(50);
+    QVERIFY2(timer.elapsed() < 2000,
+             qPrintable(QString("Requests took %1 ms").arg(timer.elapsed())));
+
+    QCOMPARE(spyError.count(), 1);
+    QCOMPARE(spyError.at(0).at(0).toUInt(), quint32(2));
+    QCOMPARE(spyError.at(0).at(1).toInt(), int(Error::SessionCanceled));
+
+    QCOMPARE(spyResult.count(), 2);
+    for (int i = 0; i < spyResult.count(); i++) {
+        quint32 requestId = spyResult.at(i).at(0).toUInt();
+        QVariantMap outData = spyResult.at(i).at(1).toMap();
+        QVERIFY(requestId == 1 || requestId == 3);
+        QCOMPARE(outData.value("UserName").toString(),
+                 QString("user%1").arg(requestId));
+        QVERIFY(!outData.contains(SSO_PLUGIN_REQUEST_ID));
+    }
+
+    delete proxy;
+}
+
 #if !defined(SSO_CI_TESTMANAGEMENT)
 QTEST_MAIN(TestPluginProxy)
 #endif
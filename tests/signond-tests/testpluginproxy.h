@@ -30,6 +30,7 @@
 #include "signond/signoncommon.h"
 #include "SignOn/sessiondata.h"
 #include "SignOn/authpluginif.h"
+#include "pluginpool.h"
 #include "pluginproxy.h"
 
 using namespace SignonDaemonNS;
@@ -52,6 +53,9 @@ private Q_SLOTS:
     void process_wrong_mech_for_dummy();
     void process_and_cancel_for_dummy();
     void wrong_user_for_dummy();
+    void pool_for_dummy();
+    void slow_start_for_dummy();
+    void reentrant_for_dummy();
 
 private:
     PluginProxy *m_proxy;
@@ -29,8 +29,8 @@
 
 #include <SignOn/AbstractAccessControlManager>
 #include "accesscontrolmanagerhelper.h"
+#include "aclsnapshot.h"
 #include "credentialsaccessmanager.h"
-#include "credentialsdb.h"
 
 using namespace SignOn;
 using namespace SignonDaemonNS;
@@ -89,35 +89,36 @@ private Q_SLOTS:
 
 public:
     static AccessControlManagerHelperTest *instance() { return m_instance; }
-    SignonDaemonNS::CredentialsDB *credentialsDB() { return &m_db; }
+    const SignonDaemonNS::AclSnapshot *aclSnapshot() { return &m_snapshot; }
 
 private:
     void setDbOwners(const QStringList &owners) {
-        if (owners.contains("db-error")) {
-            m_dbOwners = QStringList();
-            m_dbLastError = CredentialsDBError("DB error!",
-                                               CredentialsDBError::ConnectionError);
-        } else {
-            m_dbOwners = owners;
-        }
+        m_dbOwners = owners;
+        updateSnapshot();
     }
 
     void setDbAcl(const QStringList &acl) {
-        if (acl.contains("db-error")) {
-            m_dbAcl = QStringList();
-            m_dbLastError = CredentialsDBError("DB error!",
-                                               CredentialsDBError::ConnectionError);
-        } else {
-            m_dbAcl = acl;
+        m_dbAcl = acl;
+        updateSnapshot();
+    }
+
+    /* The snapshot is not available when the DB is in error */
+    void updateSnapshot() {
+        if (m_dbOwners.contains("db-error") || m_dbAcl.contains("db-error")) {
+            m_snapshot.invalidate();
+            return;
         }
+        QHash<quint32, QStringList> acls;
+        QHash<quint32, QStringList> owners;
+        acls.insert(3, m_dbAcl);
+        owners.insert(3, m_dbOwners);
+        m_snapshot.reset(acls, owners);
     }
 
 private:
-    friend class SignonDaemonNS::CredentialsDB;
     static AccessControlManagerHelperTest *m_instance;
     AcmPlugin m_acmPlugin;
-    SignonDaemonNS::CredentialsDB m_db;
-    SignOn::CredentialsDBError m_dbLastError;
+    SignonDaemonNS::AclSnapshot m_snapshot;
     QStringList m_dbAcl;
     QStringList m_dbOwners;
     QDBusConnection m_conn;
@@ -126,40 +127,9 @@ private:
 AccessControlManagerHelperTest *AccessControlManagerHelperTest::m_instance = 0;
 
 namespace SignonDaemonNS {
-// mock CredentialsDB {
-CredentialsDB::CredentialsDB(const QString &metaDataDbName,
-                             SignOn::AbstractSecretsStorage *secretsStorage):
-    QObject()
-{
-    Q_UNUSED(metaDataDbName);
-    Q_UNUSED(secretsStorage);
-}
-
-CredentialsDB::~CredentialsDB()
-{
-}
-
-SignOn::CredentialsDBError CredentialsDB::lastError() const
-{
-    return AccessControlManagerHelperTest::instance()->m_dbLastError;
-}
-
-QStringList CredentialsDB::accessControlList(const quint32 identityId)
-{
-    Q_UNUSED(identityId);
-    return AccessControlManagerHelperTest::instance()->m_dbAcl;
-}
-
-QStringList CredentialsDB::ownerList(const quint32 identityId)
-{
-    Q_UNUSED(identityId);
-    return AccessControlManagerHelperTest::instance()->m_dbOwners;
-}
-// } mock CredentialsDB
-
 // mock CredentialsAccessManager {
-CredentialsDB *CredentialsAccessManager::credentialsDB() const {
-    return AccessControlManagerHelperTest::instance()->credentialsDB();
+const AclSnapshot *CredentialsAccessManager::aclSnapshot() const {
+    return AccessControlManagerHelperTest::instance()->aclSnapshot();
 }
 CredentialsAccessManager *CredentialsAccessManager::instance() {
     return 0;
@@ -169,7 +139,6 @@ CredentialsAccessManager *CredentialsAccessManager::instance() {
 
 AccessControlManagerHelperTest::AccessControlManagerHelperTest():
     QObject(),
-    m_db(QString(), 0),
     m_conn(QLatin1String("test-connection"))
 {
     m_instance = this;
@@ -179,7 +148,7 @@ void AccessControlManagerHelperTest::init()
 {
     m_dbOwners = QStringList();
     m_dbAcl = QStringList();
-    m_dbLastError = CredentialsDBError();
+    updateSnapshot();
 }
 
 void AccessControlManagerHelperTest::testOwnership_data()
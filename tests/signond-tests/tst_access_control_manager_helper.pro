@@ -4,10 +4,11 @@ include(signond-tests.pri)
 
 SOURCES = \
     $${SIGNOND_SRC}/accesscontrolmanagerhelper.cpp \
+    $${SIGNOND_SRC}/aclsnapshot.cpp \
     tst_access_control_manager_helper.cpp
 
 HEADERS = \
     $${SIGNOND_SRC}/accesscontrolmanagerhelper.h \
-    $${SIGNOND_SRC}/credentialsdb.h
+    $${SIGNOND_SRC}/aclsnapshot.h
 
 check.commands = "./$$TARGET"
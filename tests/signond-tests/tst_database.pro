@@ -4,10 +4,12 @@ include(signond-tests.pri)
 
 HEADERS += \
     databasetest.h \
+    $$TOP_SRC_DIR/src/signond/aclsnapshot.h \
     $$TOP_SRC_DIR/src/signond/credentialsdb.h \
     $$TOP_SRC_DIR/src/signond/default-secrets-storage.h
 
 SOURCES = \
     databasetest.cpp \
+    $$TOP_SRC_DIR/src/signond/aclsnapshot.cpp \
     $$TOP_SRC_DIR/src/signond/credentialsdb.cpp \
     $$TOP_SRC_DIR/src/signond/default-secrets-storage.cpp
@@ -20,6 +20,7 @@
  * 02110-1301 USA
  */
 
+#include <QDBusPendingReply>
 #include <QDebug>
 #include <QDir>
 #include <QProcess>
@@ -71,12 +72,15 @@ private Q_SLOTS:
     void testAuthSessionProcess();
     void testAuthSessionProcessFromOtherProcess();
     void testAuthSessionProcessUi();
+    void testAuthSessionCoalescing();
+    void testAuthSessionResultCache();
     void testAuthSessionCloseUi_data();
     void testAuthSessionCloseUi();
 
 private:
     void setupEnvironment();
     bool signondIsRunning();
+    bool setActivationEnvironment(const QString &name, const QString &value);
     bool killSignond();
     void clearBaseDir();
     const QDBusConnection &connection() { return m_dbus.sessionConnection(); }
@@ -93,6 +97,7 @@ private:
     QtDBusTest::DBusTestRunner m_dbus;
     QtDBusMock::DBusMock m_mock;
     FakeSignOnUi m_signonUi;
+    bool m_restoreEnvironment;
 };
 
 static bool mapIsSuperset(const QVariantMap &superSet, const QVariantMap &set)
@@ -117,9 +122,11 @@ SignondTest::SignondTest():
     QObject(0),
     m_dbus((setupEnvironment(), TEST_DBUS_CONFIG_FILE)),
     m_mock(m_dbus),
-    m_signonUi(&m_mock)
+    m_signonUi(&m_mock),
+    m_restoreEnvironment(false)
 {
     DBusMock::registerMetaTypes();
+    qDBusRegisterMetaType<QMap<QString, QString> >();
 }
 
 void SignondTest::setupEnvironment()
@@ -169,6 +176,20 @@ bool SignondTest::signondIsRunning()
         interface()->isServiceRegistered(SIGNOND_SERVICE).value();
 }
 
+bool SignondTest::setActivationEnvironment(const QString &name,
+                                           const QString &value)
+{
+    /* The daemon gets the environment of the bus it is activated by */
+    QDBusMessage msg =
+        QDBusMessage::createMethodCall("org.freedesktop.DBus",
+                                       "/org/freedesktop/DBus",
+                                       "org.freedesktop.DBus",
+                                       "UpdateActivationEnvironment");
+    QMap<QString, QString> environment { { name, value } };
+    msg << QVariant::fromValue(environment);
+    return replyIsValid(connection().call(msg));
+}
+
 bool SignondTest::killSignond()
 {
     uint pid = connection().interface()->servicePid(SIGNOND_SERVICE).value();
@@ -212,6 +233,13 @@ void SignondTest::initTestCase()
 
 void SignondTest::cleanup()
 {
+    if (m_restoreEnvironment) {
+        m_restoreEnvironment = false;
+        QVERIFY(setActivationEnvironment("SSO_COALESCE_REQUESTS", "0"));
+        QVERIFY(killSignond());
+        QTRY_VERIFY(!signondIsRunning());
+    }
+
     if (QTest::currentTestFailed()) {
         m_baseDir.setAutoRemove(false);
         qDebug() << "Base dir:" << m_baseDir.path();
@@ -566,6 +594,133 @@ void SignondTest::testAuthSessionProcessUi()
     QCOMPARE(response, expectedResponse);
 }
 
+void SignondTest::testAuthSessionCoalescing()
+{
+    /* Only this test runs with a daemon coalescing the requests */
+    QVERIFY(setActivationEnvironment("SSO_COALESCE_REQUESTS", "1"));
+    m_restoreEnvironment = true;
+    QVERIFY(killSignond());
+    QTRY_VERIFY(!signondIsRunning());
+
+    QVariantMap identityData {
+        { SIGNOND_IDENTITY_INFO_USERNAME, "John" },
+        { SIGNOND_IDENTITY_INFO_CAPTION, "John's account" },
+        { SIGNOND_IDENTITY_INFO_ACL, QStringList { "*" } },
+    };
+    uint id = 0;
+    QVERIFY(!createIdentity(identityData, &id).isEmpty());
+
+    QDBusMessage msg = methodCall(SIGNOND_DAEMON_OBJECTPATH,
+                                  SIGNOND_DAEMON_INTERFACE,
+                                  "getAuthSessionObjectPath");
+    msg << id;
+    msg << QString("ssotest");
+    QDBusMessage reply = connection().call(msg);
+    QVERIFY(replyIsValid(reply));
+    QString objectPath = reply.arguments()[0].toString();
+    QVERIFY(objectPath.startsWith('/'));
+
+    /* Each request takes about one second in the test plugin; the first two
+     * are identical, and should be processed only once */
+    QVariantMap sessionData {
+        { "Some key", "its value" },
+        { "height", 123 },
+        { "CountProcessed", true },
+    };
+    QVariantMap otherSessionData {
+        { "Some key", "its value" },
+        { "height", 456 },
+        { "CountProcessed", true },
+    };
+    QList<QVariantMap> requests {
+        sessionData, sessionData, otherSessionData
+    };
+
+    QList<QDBusPendingCall> calls;
+    foreach (const QVariantMap &data, requests) {
+        msg = methodCall(objectPath, SIGNOND_AUTH_SESSION_INTERFACE,
+                         "process");
+        msg << data;
+        msg << QString("mech1");
+        calls.append(connection().asyncCall(msg));
+    }
+
+    QList<QVariantMap> responses;
+    foreach (QDBusPendingCall call, calls) {
+        call.waitForFinished();
+        QVERIFY(replyIsValid(call.reply()));
+        responses.append(QDBusPendingReply<QVariantMap>(call).value());
+    }
+
+    /* The plugin got only two of the requests */
+    QCOMPARE(responses[0], responses[1]);
+    QCOMPARE(responses[0].value("height").toInt(), 123);
+    QCOMPARE(responses[0].value("Realm").toString(),
+             QString("testRealm_after_test"));
+    QCOMPARE(responses[0].value("ProcessedCount").toInt(), 1);
+    QCOMPARE(responses[2].value("height").toInt(), 456);
+    QCOMPARE(responses[2].value("ProcessedCount").toInt(), 2);
+}
+
+void SignondTest::testAuthSessionResultCache()
+{
+    QVariantMap identityData {
+        { SIGNOND_IDENTITY_INFO_USERNAME, "John" },
+        { SIGNOND_IDENTITY_INFO_CAPTION, "John's account" },
+        { SIGNOND_IDENTITY_INFO_ACL, QStringList { "*" } },
+    };
+    uint id = 0;
+    QString identityPath = createIdentity(identityData, &id);
+    QVERIFY(!identityPath.isEmpty());
+
+    QDBusMessage msg = methodCall(SIGNOND_DAEMON_OBJECTPATH,
+                                  SIGNOND_DAEMON_INTERFACE,
+                                  "getAuthSessionObjectPath");
+    msg << id;
+    msg << QString("ssotest");
+    QDBusMessage reply = connection().call(msg);
+    QVERIFY(replyIsValid(reply));
+    QString objectPath = reply.arguments()[0].toString();
+    QVERIFY(objectPath.startsWith('/'));
+
+    /* The test plugin lets the daemon keep the result for the given number
+     * of seconds, and tells how many requests it has computed */
+    QVariantMap sessionData {
+        { "Some key", "its value" },
+        { "CacheFor", 60 },
+        { "CountProcessed", true },
+    };
+    QList<QVariantMap> responses;
+    for (int i = 0; i < 3; i++) {
+        if (i == 2) {
+            /* Signing out drops the cached results */
+            msg = methodCall(identityPath, SIGNOND_IDENTITY_INTERFACE,
+                             "signOut");
+            QVERIFY(replyIsValid(connection().call(msg)));
+        }
+
+        msg = methodCall(objectPath, SIGNOND_AUTH_SESSION_INTERFACE,
+                         "process");
+        msg << sessionData;
+        msg << QString("mech1");
+        reply = connection().call(msg);
+        QVERIFY(replyIsValid(reply));
+        responses.append(QDBusReply<QVariantMap>(reply).value());
+    }
+
+    QVERIFY(!responses[0].contains("PluginResultExpiresIn"));
+    QCOMPARE(responses[0].value("Realm").toString(),
+             QString("testRealm_after_test"));
+    QCOMPARE(responses[0].value("ProcessedCount").toInt(), 1);
+    /* The second reply comes from the cache */
+    QCOMPARE(responses[1], responses[0]);
+    /* The third one is computed again by the plugin */
+    QCOMPARE(responses[2].value("ProcessedCount").toInt(), 2);
+    responses[2].remove("ProcessedCount");
+    responses[0].remove("ProcessedCount");
+    QCOMPARE(responses[2], responses[0]);
+}
+
 void SignondTest::testAuthSessionCloseUi_data()
 {
     QTest::addColumn<QVariantMap>("uiReply");